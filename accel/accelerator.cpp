@@ -0,0 +1,63 @@
+#include "../accelerator.hpp"
+
+using namespace std;
+
+bool parseAcceleratorType(const std::string & name, AcceleratorType & type)
+{
+    if(name == "bvh")
+        type = bvh_accelerator;
+    else if(name == "lazybvh")
+        type = lazy_bvh_accelerator;
+    else if(name == "grid")
+        type = grid_accelerator;
+    else if(name == "kdtree")
+        type = kdtree_accelerator;
+    else
+        return false;
+
+    return true;
+}
+
+const char * getAcceleratorName(AcceleratorType type)
+{
+    switch(type)
+    {
+        case bvh_accelerator:
+            return "bvh";
+        case lazy_bvh_accelerator:
+            return "lazybvh";
+        case grid_accelerator:
+            return "grid";
+        case kdtree_accelerator:
+            return "kdtree";
+        default:
+            return "scene";
+    }
+}
+
+void Accelerator::addTraversal(TraversalCounts & total, const TraversalCounts & counts) const
+{
+    std::lock_guard<std::mutex> lock(this->countMutex);
+
+    total.rays++;
+    total.nodes += counts.nodes;
+    total.leaves += counts.leaves;
+    total.surfaces += counts.surfaces;
+}
+
+void Accelerator::setTraversalCounting(bool enabled)
+{
+    this->countTraversal = enabled;
+    this->closestHitCounts = TraversalCounts();
+    this->occlusionCounts = TraversalCounts();
+}
+
+std::ostream &operator<<(std::ostream &output, const TraversalCounts & counts)
+{
+    double rays = counts.rays > 0 ? counts.rays : 1;
+
+    output << counts.rays << " rays, per ray " << counts.nodes / rays << " nodes, "
+           << counts.leaves / rays << " leaves, " << counts.surfaces / rays << " surface tests";
+
+    return output;
+}
@@ -0,0 +1,1765 @@
+#include "../bvh.hpp"
+#include "../threadpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    // surfaces below this count are binned by a single thread
+    const int parallelBinningThreshold = 1 << 15;
+
+    // children of nodes above this count are built as separate tasks
+    const int parallelTaskThreshold = 1 << 12;
+
+    const int maxSurfacesPerType = 255;
+
+    // bins live on the stack of the builder
+    const int maxBinCount = 64;
+
+    const int traversalStackSize = 256;
+
+    // spatial splits are tried when the children of the best object split
+    // .. overlap by more than this fraction of the root's surface area
+    const float spatialSplitOverlap = 1e-5f;
+
+    // keeps the SBVH well within the traversal stack
+    const int maxSpatialSplitDepth = 64;
+
+    // intersection work of a leaf in units of intersectionCost: wide trees
+    // .. test the triangles of a leaf 4 at a time
+    inline int getIntersectionBlocks(int count, const BVHBuildOptions & options)
+    {
+        int blockSize = options.width > 2 ? 4 : 1;
+
+        return (count + blockSize - 1) / blockSize;
+    }
+
+    typedef struct BuildSurface
+    {
+        BoundingBox bounds;
+        float centroid[3];
+        SurfaceRef ref;
+    } BuildSurface;
+
+    typedef struct Bin
+    {
+        BoundingBox bounds;
+        int count;
+
+        Bin() : count(0) {}
+    } Bin;
+
+    typedef struct Split
+    {
+        float cost;
+        int axis;              // -1: no split found
+        int bin;               // the split is in front of this bin
+        float position;        // spatial splits: the plane
+        int leftCount;
+        int rightCount;
+        BoundingBox leftBounds; // object splits only
+        BoundingBox rightBounds;
+
+        Split() : cost(1e30f), axis(-1), bin(0), position(0.0f), leftCount(0), rightCount(0) {}
+    } Split;
+
+    // bounds of the surfaces and of their centroids
+    typedef struct RangeBounds
+    {
+        BoundingBox bounds;
+        BoundingBox centroidBounds;
+
+        void expand(const RangeBounds & rhs)
+        {
+            bounds.expand(rhs.bounds);
+            centroidBounds.expand(rhs.centroidBounds);
+        }
+    } RangeBounds;
+
+    class BVHBuilder
+    {
+        private:
+            const BVHBuildOptions & options;
+            ThreadPool & pool;
+            const Surfaces & surfaces;
+            vector<BuildSurface> & buildSurfaces;
+            std::atomic<int> duplicateBudget;
+            float rootArea;
+
+            RangeBounds computeBounds(const BuildSurface * surfaces, int count) const
+            {
+                RangeBounds result;
+
+                for(int i = 0; i < count; i++)
+                {
+                    const BuildSurface & surface = surfaces[i];
+
+                    result.bounds.expand(surface.bounds);
+                    result.centroidBounds.expand(Position3(surface.centroid[0], surface.centroid[1], surface.centroid[2]));
+                }
+
+                return result;
+            }
+
+            // data parallel over large ranges: every chunk gets its own result, merged afterwards
+            RangeBounds computeBoundsParallel(const BuildSurface * surfaces, int count) const
+            {
+                if(count < parallelBinningThreshold)
+                    return computeBounds(surfaces, count);
+
+                int grainSize = parallelBinningThreshold / 4;
+                vector<RangeBounds> partial((count + grainSize - 1) / grainSize);
+
+                parallelFor(pool, 0, count, grainSize, [&](int chunkBegin, int chunkEnd) {
+                    partial[chunkBegin / grainSize] = computeBounds(surfaces + chunkBegin, chunkEnd - chunkBegin);
+                });
+
+                RangeBounds result;
+
+                for(size_t i = 0; i < partial.size(); i++)
+                    result.expand(partial[i]);
+
+                return result;
+            }
+
+            int getBinIndex(const BuildSurface & surface, int axis, float origin, float scale) const
+            {
+                int index = (int)((surface.centroid[axis] - origin) * scale);
+
+                return index < 0 ? 0 : (index >= options.binCount ? options.binCount - 1 : index);
+            }
+
+            // bins[axis * binCount + bin], one pass over the surfaces for all axes
+            // .. axes without centroid extent end up in their first bin and are not split
+            void fillBins(const BuildSurface * surfaces, int count, const BoundingBox & centroidBounds, Bin * bins) const
+            {
+                float scale[3];
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+
+                    scale[axis] = extent > 0.0f ? options.binCount / extent : 0.0f;
+                }
+
+                for(int i = 0; i < count; i++)
+                {
+                    const BuildSurface & surface = surfaces[i];
+
+                    for(int axis = 0; axis < 3; axis++)
+                    {
+                        Bin & bin = bins[axis * options.binCount + getBinIndex(surface, axis, centroidBounds.min[axis], scale[axis])];
+
+                        bin.count++;
+                        bin.bounds.expand(surface.bounds);
+                    }
+                }
+            }
+
+            void fillBinsParallel(const BuildSurface * surfaces, int count, const BoundingBox & centroidBounds, Bin * bins) const
+            {
+                if(count < parallelBinningThreshold)
+                {
+                    fillBins(surfaces, count, centroidBounds, bins);
+                    return;
+                }
+
+                int grainSize = parallelBinningThreshold / 4;
+                vector< vector<Bin> > partial((count + grainSize - 1) / grainSize);
+
+                parallelFor(pool, 0, count, grainSize, [&](int chunkBegin, int chunkEnd) {
+                    vector<Bin> & chunkBins = partial[chunkBegin / grainSize];
+
+                    chunkBins.resize(3 * options.binCount);
+                    fillBins(surfaces + chunkBegin, chunkEnd - chunkBegin, centroidBounds, &chunkBins[0]);
+                });
+
+                for(size_t chunk = 0; chunk < partial.size(); chunk++)
+                {
+                    // a single thread runs the whole range as the first chunk
+                    if(partial[chunk].empty())
+                        continue;
+
+                    for(int i = 0; i < 3 * options.binCount; i++)
+                    {
+                        bins[i].count += partial[chunk][i].count;
+                        bins[i].bounds.expand(partial[chunk][i].bounds);
+                    }
+                }
+            }
+
+            void makeLeaf(int begin, int end, BVHNode & node)
+            {
+                // triangles first, then spheres
+                BuildSurface * first = &buildSurfaces[begin];
+                BuildSurface * middle = std::partition(first, &buildSurfaces[0] + end, [](const BuildSurface & surface) {
+                    return surface.ref.type == triangle_surface;
+                });
+
+                node.offset = begin;
+                node.triangleCount = middle - first;
+                node.sphereCount = end - begin - node.triangleCount;
+            }
+
+            BVHNode createNode(const BoundingBox & bounds) const
+            {
+                BVHNode node;
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    node.bounds[0][axis] = bounds.min[axis];
+                    node.bounds[1][axis] = bounds.max[axis];
+                }
+
+                node.offset = 0;
+                node.triangleCount = 0;
+                node.sphereCount = 0;
+                node.axis = 0;
+                node.swapped = 0;
+
+                return node;
+            }
+
+            float getSplitCost(float leftArea, int leftCount, float rightArea, int rightCount, float nodeArea) const
+            {
+                return options.traversalCost +
+                       options.intersectionCost *
+                       (leftArea * getIntersectionBlocks(leftCount, options) +
+                        rightArea * getIntersectionBlocks(rightCount, options)) /
+                       (nodeArea > 0.0f ? nodeArea : 1.0f);
+            }
+
+            // the cheapest bin border over all axes, split.axis < 0 if there is none
+            void findObjectSplit(const BuildSurface * surfaces, int count, const RangeBounds & rangeBounds, Split & split) const
+            {
+                Bin bins[3 * maxBinCount];
+                fillBinsParallel(surfaces, count, rangeBounds.centroidBounds, bins);
+
+                float nodeArea = rangeBounds.bounds.getSurfaceArea();
+
+                float rightArea[maxBinCount];
+                int rightCount[maxBinCount];
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    if(rangeBounds.centroidBounds.max[axis] - rangeBounds.centroidBounds.min[axis] <= 0.0f)
+                        continue;
+
+                    const Bin * axisBins = &bins[axis * options.binCount];
+
+                    // sweep from the right: surfaces in bins [i, binCount)
+                    BoundingBox accumulated;
+                    int accumulatedCount = 0;
+
+                    for(int i = options.binCount - 1; i > 0; i--)
+                    {
+                        accumulated.expand(axisBins[i].bounds);
+                        accumulatedCount += axisBins[i].count;
+                        rightArea[i] = accumulated.getSurfaceArea();
+                        rightCount[i] = accumulatedCount;
+                    }
+
+                    // sweep from the left, split between bin i - 1 and bin i
+                    accumulated = BoundingBox();
+                    accumulatedCount = 0;
+
+                    for(int i = 1; i < options.binCount; i++)
+                    {
+                        accumulated.expand(axisBins[i - 1].bounds);
+                        accumulatedCount += axisBins[i - 1].count;
+
+                        if(accumulatedCount == 0 || rightCount[i] == 0)
+                            continue;
+
+                        float cost = getSplitCost(accumulated.getSurfaceArea(), accumulatedCount,
+                                                  rightArea[i], rightCount[i], nodeArea);
+
+                        if(cost < split.cost)
+                        {
+                            split.cost = cost;
+                            split.axis = axis;
+                            split.bin = i;
+                            split.leftCount = accumulatedCount;
+                            split.rightCount = rightCount[i];
+                        }
+                    }
+                }
+
+                if(split.axis < 0)
+                    return;
+
+                // child bounds, spatial splits are only tried when they overlap
+                const Bin * axisBins = &bins[split.axis * options.binCount];
+
+                for(int i = 0; i < options.binCount; i++)
+                    (i < split.bin ? split.leftBounds : split.rightBounds).expand(axisBins[i].bounds);
+            }
+
+            bool isLeftOfObjectSplit(const BuildSurface & surface, const RangeBounds & rangeBounds, const Split & split) const
+            {
+                float origin = rangeBounds.centroidBounds.min[split.axis];
+                float scale = options.binCount / (rangeBounds.centroidBounds.max[split.axis] - origin);
+
+                return getBinIndex(surface, split.axis, origin, scale) < split.bin;
+            }
+
+            // appends the subtree of [begin, end) to nodes in depth first order
+            // .. interior offsets are relative to the start of nodes
+            void buildNode(int begin, int end, vector<BVHNode> & nodes)
+            {
+                const BuildSurface * surfaces = &buildSurfaces[0] + begin;
+                int count = end - begin;
+
+                RangeBounds rangeBounds = computeBoundsParallel(surfaces, count);
+                BVHNode node = createNode(rangeBounds.bounds);
+
+                if(count <= 1)
+                {
+                    makeLeaf(begin, end, node);
+                    nodes.push_back(node);
+                    return;
+                }
+
+                Split split;
+                findObjectSplit(surfaces, count, rangeBounds, split);
+
+                float leafCost = options.intersectionCost * getIntersectionBlocks(count, options);
+
+                if(count <= options.maxLeafSize && (split.axis < 0 || split.cost >= leafCost))
+                {
+                    makeLeaf(begin, end, node);
+                    nodes.push_back(node);
+                    return;
+                }
+
+                int middle;
+
+                if(split.axis >= 0)
+                {
+                    BuildSurface * middleSurface = std::partition(&buildSurfaces[0] + begin, &buildSurfaces[0] + end,
+                                                                  [&](const BuildSurface & surface) {
+                        return isLeftOfObjectSplit(surface, rangeBounds, split);
+                    });
+
+                    middle = middleSurface - &buildSurfaces[0];
+                    node.axis = split.axis;
+                }
+                else
+                {
+                    // all centroids coincide but there are too many for a leaf: halve the range
+                    middle = (begin + end) / 2;
+                    node.axis = rangeBounds.bounds.getLongestAxis();
+                }
+
+                if(middle == begin || middle == end)
+                    middle = (begin + end) / 2;
+
+                int nodeIndex = nodes.size();
+                nodes.push_back(node);
+
+                if(count >= parallelTaskThreshold && pool.getThreadCount() > 1)
+                {
+                    // task parallel: the first child goes to the pool, the second is built here
+                    vector<BVHNode> firstNodes, secondNodes;
+
+                    TaskGroup group(pool);
+                    group.run([&]() { buildNode(begin, middle, firstNodes); });
+                    buildNode(middle, end, secondNodes);
+                    group.wait();
+
+                    appendSubtree(nodes, firstNodes, 0);
+                    nodes[nodeIndex].offset = nodes.size();
+                    appendSubtree(nodes, secondNodes, 0);
+                }
+                else
+                {
+                    buildNode(begin, middle, nodes);
+                    nodes[nodeIndex].offset = nodes.size();
+                    buildNode(middle, end, nodes);
+                }
+            }
+
+            // the part of a surface between the planes lo and hi on axis, within its
+            // .. current (maybe already clipped) bounds; triangles are clipped exactly,
+            // .. spheres by their box
+            BoundingBox clip(const BuildSurface & surface, int axis, float lo, float hi) const
+            {
+                BoundingBox clipped;
+
+                if(surface.ref.type == triangle_surface)
+                {
+                    const Triangle & triangle = this->surfaces.triangles[surface.ref.index];
+
+                    float vertices[3][3];
+
+                    for(int v = 0; v < 3; v++)
+                    {
+                        Position3 vertex = triangle.getVertex(v);
+
+                        vertices[v][0] = vertex.getX();
+                        vertices[v][1] = vertex.getY();
+                        vertices[v][2] = vertex.getZ();
+                    }
+
+                    // the clipped polygon is spanned by the vertices between the planes
+                    // .. and the points where the edges cross the planes
+                    for(int v = 0; v < 3; v++)
+                    {
+                        const float * a = vertices[v];
+                        const float * b = vertices[(v + 1) % 3];
+
+                        if(a[axis] >= lo && a[axis] <= hi)
+                            clipped.expand(Position3(a[0], a[1], a[2]));
+
+                        const float planes[2] = { lo, hi };
+
+                        for(int p = 0; p < 2; p++)
+                        {
+                            if((a[axis] < planes[p]) == (b[axis] < planes[p]))
+                                continue;
+
+                            float t = (planes[p] - a[axis]) / (b[axis] - a[axis]);
+                            float point[3];
+
+                            for(int i = 0; i < 3; i++)
+                                point[i] = a[i] + t * (b[i] - a[i]);
+
+                            point[axis] = planes[p];
+
+                            clipped.expand(Position3(point[0], point[1], point[2]));
+                        }
+                    }
+                }
+                else
+                {
+                    clipped = surface.bounds;
+                    clipped.min[axis] = lo > clipped.min[axis] ? lo : clipped.min[axis];
+                    clipped.max[axis] = hi < clipped.max[axis] ? hi : clipped.max[axis];
+                }
+
+                for(int i = 0; i < 3; i++)
+                {
+                    clipped.min[i] = surface.bounds.min[i] > clipped.min[i] ? surface.bounds.min[i] : clipped.min[i];
+                    clipped.max[i] = surface.bounds.max[i] < clipped.max[i] ? surface.bounds.max[i] : clipped.max[i];
+                }
+
+                return clipped;
+            }
+
+            int getSpatialBinIndex(float position, float origin, float scale) const
+            {
+                int index = (int)((position - origin) * scale);
+
+                return index < 0 ? 0 : (index >= options.binCount ? options.binCount - 1 : index);
+            }
+
+            // chopped binning: every surface is clipped into each bin it overlaps,
+            // .. entries / exits count where surfaces start and end
+            void findSpatialSplit(const vector<BuildSurface> & work, const BoundingBox & bounds, Split & split) const
+            {
+                float nodeArea = bounds.getSurfaceArea();
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float origin = bounds.min[axis];
+                    float extent = bounds.max[axis] - origin;
+
+                    if(extent <= 0.0f)
+                        continue;
+
+                    float binWidth = extent / options.binCount;
+                    float scale = options.binCount / extent;
+
+                    BoundingBox binBounds[maxBinCount];
+                    int entries[maxBinCount] = { 0 };
+                    int exits[maxBinCount] = { 0 };
+
+                    for(size_t s = 0; s < work.size(); s++)
+                    {
+                        const BuildSurface & surface = work[s];
+
+                        int first = getSpatialBinIndex(surface.bounds.min[axis], origin, scale);
+                        int last = getSpatialBinIndex(surface.bounds.max[axis], origin, scale);
+
+                        if(first == last)
+                            binBounds[first].expand(surface.bounds);
+                        else
+                        {
+                            for(int b = first; b <= last; b++)
+                            {
+                                float lo = b == first ? -1e30f : origin + b * binWidth;
+                                float hi = b == last ? 1e30f : origin + (b + 1) * binWidth;
+
+                                binBounds[b].expand(clip(surface, axis, lo, hi));
+                            }
+                        }
+
+                        entries[first]++;
+                        exits[last]++;
+                    }
+
+                    float rightArea[maxBinCount];
+                    int rightCount[maxBinCount];
+
+                    BoundingBox accumulated;
+                    int accumulatedCount = 0;
+
+                    for(int i = options.binCount - 1; i > 0; i--)
+                    {
+                        accumulated.expand(binBounds[i]);
+                        accumulatedCount += exits[i];
+                        rightArea[i] = accumulated.getSurfaceArea();
+                        rightCount[i] = accumulatedCount;
+                    }
+
+                    accumulated = BoundingBox();
+                    accumulatedCount = 0;
+
+                    for(int i = 1; i < options.binCount; i++)
+                    {
+                        accumulated.expand(binBounds[i - 1]);
+                        accumulatedCount += entries[i - 1];
+
+                        // a split that keeps every surface on one side does not make progress
+                        if(accumulatedCount == 0 || rightCount[i] == 0 ||
+                           accumulatedCount == (int)work.size() || rightCount[i] == (int)work.size())
+                            continue;
+
+                        float cost = getSplitCost(accumulated.getSurfaceArea(), accumulatedCount,
+                                                  rightArea[i], rightCount[i], nodeArea);
+
+                        if(cost < split.cost)
+                        {
+                            split.cost = cost;
+                            split.axis = axis;
+                            split.bin = i;
+                            split.position = origin + i * binWidth;
+                            split.leftCount = accumulatedCount;
+                            split.rightCount = rightCount[i];
+                        }
+                    }
+                }
+            }
+
+            // takes duplicates from the shared budget, false if there are not enough left
+            bool reserveDuplicates(int count)
+            {
+                int remaining = this->duplicateBudget.load();
+
+                while(remaining >= count)
+                {
+                    if(this->duplicateBudget.compare_exchange_weak(remaining, remaining - count))
+                        return true;
+                }
+
+                return false;
+            }
+
+            static void setBounds(BuildSurface & surface, const BoundingBox & bounds)
+            {
+                surface.bounds = bounds;
+
+                for(int axis = 0; axis < 3; axis++)
+                    surface.centroid[axis] = bounds.getCentroid(axis);
+            }
+
+            // SBVH: like buildNode, but a node may also be split by a plane, surfaces
+            // .. crossing it go to both children with clipped bounds; every node owns
+            // .. its surfaces, leaves append their refs to leafRefs
+            void buildSpatialNode(vector<BuildSurface> & work, int depth, vector<BVHNode> & nodes, vector<SurfaceRef> & leafRefs)
+            {
+                int count = work.size();
+
+                RangeBounds rangeBounds = computeBoundsParallel(&work[0], count);
+                BVHNode node = createNode(rangeBounds.bounds);
+
+                Split split;
+
+                if(count > 1)
+                    findObjectSplit(&work[0], count, rangeBounds, split);
+
+                // spatial splits only pay off where the children of the object split overlap
+                bool spatial = false;
+
+                if(count > 1 && depth < maxSpatialSplitDepth)
+                {
+                    BoundingBox overlap;
+                    bool overlapping = split.axis >= 0;
+
+                    for(int axis = 0; axis < 3 && overlapping; axis++)
+                    {
+                        overlap.min[axis] = split.leftBounds.min[axis] > split.rightBounds.min[axis] ? split.leftBounds.min[axis] : split.rightBounds.min[axis];
+                        overlap.max[axis] = split.leftBounds.max[axis] < split.rightBounds.max[axis] ? split.leftBounds.max[axis] : split.rightBounds.max[axis];
+                    }
+
+                    if(split.axis < 0 || overlap.getSurfaceArea() > spatialSplitOverlap * this->rootArea)
+                    {
+                        Split spatialSplit;
+                        findSpatialSplit(work, rangeBounds.bounds, spatialSplit);
+
+                        if(spatialSplit.cost < split.cost &&
+                           reserveDuplicates(spatialSplit.leftCount + spatialSplit.rightCount - count))
+                        {
+                            split = spatialSplit;
+                            spatial = true;
+                        }
+                    }
+                }
+
+                float leafCost = options.intersectionCost * getIntersectionBlocks(count, options);
+
+                if(count <= 1 || (count <= options.maxLeafSize && (split.axis < 0 || split.cost >= leafCost)))
+                {
+                    std::partition(work.begin(), work.end(), [](const BuildSurface & surface) {
+                        return surface.ref.type == triangle_surface;
+                    });
+
+                    node.offset = leafRefs.size();
+
+                    for(int i = 0; i < count; i++)
+                    {
+                        leafRefs.push_back(work[i].ref);
+
+                        if(work[i].ref.type == triangle_surface)
+                            node.triangleCount++;
+                        else
+                            node.sphereCount++;
+                    }
+
+                    nodes.push_back(node);
+                    return;
+                }
+
+                vector<BuildSurface> left, right;
+
+                if(spatial)
+                {
+                    for(int i = 0; i < count; i++)
+                    {
+                        const BuildSurface & surface = work[i];
+
+                        if(surface.bounds.max[split.axis] <= split.position)
+                            left.push_back(surface);
+                        else if(surface.bounds.min[split.axis] >= split.position)
+                            right.push_back(surface);
+                        else
+                        {
+                            BoundingBox leftBounds = clip(surface, split.axis, -1e30f, split.position);
+                            BoundingBox rightBounds = clip(surface, split.axis, split.position, 1e30f);
+
+                            if(!leftBounds.isEmpty())
+                            {
+                                left.push_back(surface);
+                                setBounds(left.back(), leftBounds);
+                            }
+
+                            if(!rightBounds.isEmpty())
+                            {
+                                right.push_back(surface);
+                                setBounds(right.back(), rightBounds);
+                            }
+                        }
+                    }
+
+                    node.axis = split.axis;
+                }
+
+                // the object split, or halving, also when the spatial split did not separate anything
+                if(!spatial || left.empty() || right.empty() || (int)left.size() == count || (int)right.size() == count)
+                {
+                    left.clear();
+                    right.clear();
+
+                    vector<BuildSurface>::iterator middle = work.begin() + count / 2;
+
+                    if(split.axis >= 0 && !spatial)
+                    {
+                        middle = std::partition(work.begin(), work.end(), [&](const BuildSurface & surface) {
+                            return isLeftOfObjectSplit(surface, rangeBounds, split);
+                        });
+
+                        node.axis = split.axis;
+                    }
+                    else
+                        node.axis = rangeBounds.bounds.getLongestAxis();
+
+                    if(middle == work.begin() || middle == work.end())
+                        middle = work.begin() + count / 2;
+
+                    left.assign(work.begin(), middle);
+                    right.assign(middle, work.end());
+                }
+
+                // the children own their surfaces now
+                vector<BuildSurface>().swap(work);
+
+                int nodeIndex = nodes.size();
+                nodes.push_back(node);
+
+                if(count >= parallelTaskThreshold && pool.getThreadCount() > 1)
+                {
+                    vector<BVHNode> firstNodes, secondNodes;
+                    vector<SurfaceRef> firstRefs, secondRefs;
+
+                    TaskGroup group(pool);
+                    group.run([&]() { buildSpatialNode(left, depth + 1, firstNodes, firstRefs); });
+                    buildSpatialNode(right, depth + 1, secondNodes, secondRefs);
+                    group.wait();
+
+                    appendSubtree(nodes, firstNodes, leafRefs.size());
+                    leafRefs.insert(leafRefs.end(), firstRefs.begin(), firstRefs.end());
+                    nodes[nodeIndex].offset = nodes.size();
+                    appendSubtree(nodes, secondNodes, leafRefs.size());
+                    leafRefs.insert(leafRefs.end(), secondRefs.begin(), secondRefs.end());
+                }
+                else
+                {
+                    buildSpatialNode(left, depth + 1, nodes, leafRefs);
+                    nodes[nodeIndex].offset = nodes.size();
+                    buildSpatialNode(right, depth + 1, nodes, leafRefs);
+                }
+            }
+
+            // interior offsets are moved by the nodes in front of the subtree,
+            // .. leaf offsets by refBase
+            static void appendSubtree(vector<BVHNode> & nodes, const vector<BVHNode> & subtree, int refBase)
+            {
+                int base = nodes.size();
+
+                for(size_t i = 0; i < subtree.size(); i++)
+                {
+                    BVHNode node = subtree[i];
+
+                    node.offset += node.isLeaf() ? refBase : base;
+
+                    nodes.push_back(node);
+                }
+            }
+
+        public:
+            BVHBuilder(const BVHBuildOptions & options, ThreadPool & pool, const Surfaces & surfaces,
+                       vector<BuildSurface> & buildSurfaces)
+                : options(options), pool(pool), surfaces(surfaces), buildSurfaces(buildSurfaces),
+                  duplicateBudget(0), rootArea(0.0f) {}
+
+            // refs receives the surfaces in leaf order
+            void build(vector<BVHNode> & nodes, vector<SurfaceRef> & refs)
+            {
+                if(buildSurfaces.empty())
+                    return;
+
+                if(!options.spatialSplits)
+                {
+                    buildNode(0, buildSurfaces.size(), nodes);
+
+                    refs.resize(buildSurfaces.size());
+
+                    for(size_t i = 0; i < buildSurfaces.size(); i++)
+                        refs[i] = buildSurfaces[i].ref;
+
+                    return;
+                }
+
+                this->duplicateBudget = (int)(options.spatialSplitBudget * buildSurfaces.size());
+                this->rootArea = computeBoundsParallel(&buildSurfaces[0], buildSurfaces.size()).bounds.getSurfaceArea();
+
+                buildSpatialNode(buildSurfaces, 0, nodes, refs);
+            }
+    };
+
+    inline float getSurfaceArea(const BVHNode & node)
+    {
+        float dx = node.bounds[1][0] - node.bounds[0][0];
+        float dy = node.bounds[1][1] - node.bounds[0][1];
+        float dz = node.bounds[1][2] - node.bounds[0][2];
+
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // a subtree of the depth-first layout is a contiguous run of nodes starting
+    // .. at its root, and its leaves a contiguous run of refs
+    typedef struct SubtreeRange
+    {
+        int nodeEnd;
+        int refBegin;
+        int refEnd;
+    } SubtreeRange;
+
+    SubtreeRange getSubtreeRange(const vector<BVHNode> & nodes, int root)
+    {
+        SubtreeRange range;
+        range.nodeEnd = root + 1;
+        range.refBegin = 1 << 30;
+        range.refEnd = 0;
+
+        vector<int> stack;
+        stack.push_back(root);
+
+        while(!stack.empty())
+        {
+            int index = stack.back();
+            stack.pop_back();
+
+            const BVHNode & node = nodes[index];
+
+            range.nodeEnd = index + 1 > range.nodeEnd ? index + 1 : range.nodeEnd;
+
+            if(node.isLeaf())
+            {
+                int end = node.offset + node.triangleCount + node.sphereCount;
+
+                range.refBegin = node.offset < range.refBegin ? node.offset : range.refBegin;
+                range.refEnd = end > range.refEnd ? end : range.refEnd;
+
+                continue;
+            }
+
+            stack.push_back(index + 1);
+            stack.push_back(node.offset);
+        }
+
+        return range;
+    }
+
+    // spatial splits reference surfaces more than once
+    vector<SurfaceRef> getUniqueRefs(const SurfaceRef * refs, int count)
+    {
+        vector<SurfaceRef> unique(refs, refs + count);
+
+        std::sort(unique.begin(), unique.end(), [](const SurfaceRef & a, const SurfaceRef & b) {
+            return a.type != b.type ? a.type < b.type : a.index < b.index;
+        });
+
+        unique.erase(std::unique(unique.begin(), unique.end(), [](const SurfaceRef & a, const SurfaceRef & b) {
+            return a.type == b.type && a.index == b.index;
+        }), unique.end());
+
+        return unique;
+    }
+
+    // slab test against the node bounds, the ray sign picks the near and far planes
+    inline bool hitsBox(const BVHNode & node, const float origin[3], const float inverse[3], const int * sign,
+                        float tMin, float tMax)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float tNear = (node.bounds[sign[axis]][axis] - origin[axis]) * inverse[axis];
+            float tFar = (node.bounds[1 - sign[axis]][axis] - origin[axis]) * inverse[axis];
+
+            // slightly enlarged against rounding, comparisons keep tMin / tMax when t is NaN
+            tFar *= 1.0000004f;
+
+            tMin = tNear > tMin ? tNear : tMin;
+            tMax = tFar < tMax ? tFar : tMax;
+        }
+
+        return tMin <= tMax;
+    }
+}
+
+void BVH::build(const Surfaces & surfaces, const BVHBuildOptions & options)
+{
+    this->build(surfaces, NULL, surfaces.size(), options);
+}
+
+void BVH::build(const Surfaces & surfaces, const std::vector<SurfaceRef> & subset, const BVHBuildOptions & options)
+{
+    this->build(surfaces, subset.data(), subset.size(), options);
+}
+
+void BVH::build(const Surfaces & surfaces, const SurfaceRef * subset, int surfaceCount, const BVHBuildOptions & buildOptions)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    this->surfaces = &surfaces;
+    this->nodes.clear();
+    this->refs.clear();
+
+    BVHBuildOptions options = buildOptions;
+
+    if(options.width != 2 && options.width != 4 && options.width != 8)
+        throw std::runtime_error("Error: BVH width must be 2, 4 or 8");
+
+    if(options.compressNodes && options.width == 2)
+        throw std::runtime_error("Error: compressed BVH nodes need a BVH width of 4 or 8");
+
+    options.binCount = options.binCount < 2 ? 2 : options.binCount;
+    options.binCount = options.binCount > maxBinCount ? maxBinCount : options.binCount;
+    options.maxLeafSize = options.maxLeafSize < 1 ? 1 : options.maxLeafSize;
+    options.maxLeafSize = options.maxLeafSize > maxSurfacesPerType ? maxSurfacesPerType : options.maxLeafSize;
+
+    ThreadPool pool(options.threadCount);
+
+    vector<BuildSurface> buildSurfaces(surfaceCount);
+
+    parallelFor(pool, 0, surfaceCount, 1 << 14, [&](int begin, int end) {
+        for(int i = begin; i < end; i++)
+        {
+            SurfaceRef ref;
+            int triangleCount = surfaces.triangles.size();
+
+            if(subset)
+                ref = subset[i];
+            else
+            {
+                ref.type = i < triangleCount ? triangle_surface : sphere_surface;
+                ref.index = i < triangleCount ? i : i - triangleCount;
+            }
+
+            BuildSurface & surface = buildSurfaces[i];
+            surface.ref = ref;
+            surface.bounds = surfaces.getBoundingBox(ref);
+
+            for(int axis = 0; axis < 3; axis++)
+                surface.centroid[axis] = surface.bounds.getCentroid(axis);
+        }
+    });
+
+    BVHBuilder builder(options, pool, surfaces, buildSurfaces);
+    builder.build(this->nodes, this->refs);
+
+    this->statistics = BVHStatistics();
+    this->statistics.threadCount = pool.getThreadCount();
+    this->computeStatistics(options);
+    this->statistics.surfaceCount = surfaceCount;
+
+    if(this->statistics.maxDepth > traversalStackSize)
+        throw std::runtime_error("Error: BVH is too deep for the traversal stack");
+
+    if(options.reorderLayout)
+        this->reorderNodes();
+
+    this->width = options.width;
+    this->options = options;
+    this->buildAreas.clear();
+    this->clearWide();
+
+    if(this->width > 2)
+        this->buildWide(options);
+
+    this->updateArrays();
+
+    this->statistics.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// the builder always puts the child below the split next to its parent; this
+// .. lays the nodes out depth first again with the child of larger surface
+// .. area next to it instead, since a ray that hits the parent most likely
+// .. enters that one, and copies the refs of the leaves in the same order
+void BVH::reorderNodes()
+{
+    vector<BVHNode> orderedNodes;
+    vector<SurfaceRef> orderedRefs;
+
+    orderedNodes.reserve(this->nodes.size());
+    orderedRefs.reserve(this->refs.size());
+
+    vector< pair<int, int> > stack; // node, reordered parent whose offset points to it (-1: none)
+    stack.push_back(make_pair(0, -1));
+
+    while(!stack.empty())
+    {
+        int index = stack.back().first;
+        int parent = stack.back().second;
+        stack.pop_back();
+
+        BVHNode node = this->nodes[index];
+        int orderedIndex = orderedNodes.size();
+
+        if(parent >= 0)
+            orderedNodes[parent].offset = orderedIndex;
+
+        if(node.isLeaf())
+        {
+            int count = node.triangleCount + node.sphereCount;
+
+            orderedRefs.insert(orderedRefs.end(), this->refs.begin() + node.offset, this->refs.begin() + node.offset + count);
+            node.offset = orderedRefs.size() - count;
+            orderedNodes.push_back(node);
+
+            continue;
+        }
+
+        int below = node.swapped ? node.offset : index + 1;
+        int above = node.swapped ? index + 1 : node.offset;
+
+        node.swapped = getSurfaceArea(this->nodes[above]) > getSurfaceArea(this->nodes[below]);
+        orderedNodes.push_back(node);
+
+        stack.push_back(make_pair(node.swapped ? below : above, orderedIndex));
+        stack.push_back(make_pair(node.swapped ? above : below, -1));
+    }
+
+    this->nodes.swap(orderedNodes);
+    this->refs.swap(orderedRefs);
+}
+
+SurfaceOrder BVH::reorderSurfaces(Surfaces & surfaces)
+{
+    if(&surfaces != this->surfaces)
+        throw std::runtime_error("Error: BVH was built over different surfaces");
+
+    // new index of every surface, in the order of its first ref
+    SurfaceOrder order;
+    vector<int> & triangleIndex = order.triangles;
+    vector<int> & sphereIndex = order.spheres;
+
+    triangleIndex.assign(surfaces.triangles.size(), -1);
+    sphereIndex.assign(surfaces.spheres.size(), -1);
+
+    Surfaces ordered;
+    ordered.triangles.reserve(surfaces.triangles.size());
+    ordered.spheres.reserve(surfaces.spheres.size());
+
+    for(size_t i = 0; i < this->refs.size(); i++)
+    {
+        SurfaceRef & ref = this->refs[i];
+
+        if(ref.type == triangle_surface)
+        {
+            if(triangleIndex[ref.index] < 0)
+            {
+                triangleIndex[ref.index] = ordered.triangles.size();
+                ordered.triangles.push_back(surfaces.triangles[ref.index]);
+            }
+
+            ref.index = triangleIndex[ref.index];
+        }
+        else
+        {
+            if(sphereIndex[ref.index] < 0)
+            {
+                sphereIndex[ref.index] = ordered.spheres.size();
+                ordered.spheres.push_back(surfaces.spheres[ref.index]);
+            }
+
+            ref.index = sphereIndex[ref.index];
+        }
+    }
+
+    // packets hold copies of their triangles, only the refs change
+    for(size_t i = 0; i < this->packets.size(); i++)
+    {
+        for(int lane = 0; lane < this->packets[i].count; lane++)
+            this->packets[i].refs[lane].index = triangleIndex[this->packets[i].refs[lane].index];
+    }
+
+    surfaces.triangles.swap(ordered.triangles);
+    surfaces.spheres.swap(ordered.spheres);
+
+    return order;
+}
+
+void BVH::clearWide()
+{
+    this->nodes4.clear();
+    this->nodes8.clear();
+    this->quantizedNodes4.clear();
+    this->quantizedNodes8.clear();
+    this->wideLeaves.clear();
+    this->packets.clear();
+    this->compressed = false;
+}
+
+void BVH::updateArrays()
+{
+    BVHArrays & arrays = this->arrays;
+
+    arrays.width = this->width;
+    arrays.compressed = this->compressed;
+    arrays.nodes = this->nodes.data();
+    arrays.nodeCount = this->nodes.size();
+    arrays.refs = this->refs.data();
+    arrays.refCount = this->refs.size();
+    arrays.wideLeaves = this->wideLeaves.data();
+    arrays.wideLeafCount = this->wideLeaves.size();
+    arrays.packets = this->packets.data();
+    arrays.packetCount = this->packets.size();
+
+    if(this->width == 4 && this->compressed)
+    {
+        arrays.wideNodes = this->quantizedNodes4.data();
+        arrays.wideNodeCount = this->quantizedNodes4.size();
+    }
+    else if(this->width == 8 && this->compressed)
+    {
+        arrays.wideNodes = this->quantizedNodes8.data();
+        arrays.wideNodeCount = this->quantizedNodes8.size();
+    }
+    else if(this->width == 4)
+    {
+        arrays.wideNodes = this->nodes4.data();
+        arrays.wideNodeCount = this->nodes4.size();
+    }
+    else
+    {
+        arrays.wideNodes = this->nodes8.data();
+        arrays.wideNodeCount = this->nodes8.size();
+    }
+}
+
+void BVH::checkBinaryArrays(const Surfaces & surfaces, const BVHArrays & arrays)
+{
+    const long long counts[2] = { (long long) surfaces.triangles.size(), (long long) surfaces.spheres.size() };
+
+    if(arrays.nodeCount < 0 || arrays.refCount < 0)
+        throw std::runtime_error("Error: The BVH has a negative size.");
+
+    for(int i = 0; i < arrays.refCount; i++)
+    {
+        if(arrays.refs[i].index >= counts[arrays.refs[i].type == triangle_surface ? 0 : 1])
+            throw std::runtime_error("Error: A BVH reference is outside of the surfaces.");
+    }
+
+    if(arrays.width != 2)
+        return;
+
+    // the first child is the next node, the second one further on
+    vector<int> depths(arrays.nodeCount, 1);
+    int maxDepth = 0;
+
+    for(int i = 0; i < arrays.nodeCount; i++)
+    {
+        const BVHNode & node = arrays.nodes[i];
+
+        maxDepth = depths[i] > maxDepth ? depths[i] : maxDepth;
+
+        if(node.isLeaf())
+        {
+            if(node.offset < 0 || (long long) node.offset + node.triangleCount + node.sphereCount > arrays.refCount)
+                throw std::runtime_error("Error: A BVH leaf is outside of the references.");
+
+            for(int r = node.offset; r < node.offset + node.triangleCount + node.sphereCount; r++)
+            {
+                if(arrays.refs[r].type != (r < node.offset + node.triangleCount ? triangle_surface : sphere_surface))
+                    throw std::runtime_error("Error: A BVH leaf refers to the wrong kind of surface.");
+            }
+
+            continue;
+        }
+
+        if(node.offset <= i + 1 || node.offset >= arrays.nodeCount)
+            throw std::runtime_error("Error: A BVH node is outside of the nodes.");
+
+        depths[i + 1] = max(depths[i + 1], depths[i] + 1);
+        depths[node.offset] = max(depths[node.offset], depths[i] + 1);
+    }
+
+    if(maxDepth > traversalStackSize)
+        throw std::runtime_error("Error: BVH is too deep for the traversal stack");
+}
+
+void BVH::useArrays(const Surfaces & surfaces, const BVHArrays & arrays)
+{
+    checkBinaryArrays(surfaces, arrays);
+
+    if(arrays.width != 2)
+        checkWideArrays(surfaces, arrays);
+
+    this->surfaces = &surfaces;
+    this->nodes.clear();
+    this->refs.clear();
+    this->clearWide();
+    this->buildAreas.clear();
+
+    this->arrays = arrays;
+    this->width = arrays.width;
+    this->compressed = arrays.compressed;
+
+    size_t wideNodeSize = arrays.width == 4 ? (arrays.compressed ? sizeof(QuantizedWideBVHNode<4>) : sizeof(WideBVHNode<4>))
+                                            : (arrays.compressed ? sizeof(QuantizedWideBVHNode<8>) : sizeof(WideBVHNode<8>));
+
+    // what can be told without walking the tree
+    BVHStatistics & stats = this->statistics;
+    stats = BVHStatistics();
+    stats.mapped = true;
+    stats.width = arrays.width;
+    stats.compressed = arrays.compressed;
+    stats.surfaceCount = surfaces.size();
+    stats.referenceCount = arrays.refCount;
+    stats.nodeCount = arrays.nodeCount;
+    stats.wideNodeCount = arrays.wideNodeCount;
+    stats.packetCount = arrays.packetCount;
+    stats.nodeBytes = arrays.width > 2 ? arrays.wideNodeCount * wideNodeSize : arrays.nodeCount * sizeof(BVHNode);
+    stats.memoryBytes = stats.nodeBytes + arrays.refCount * sizeof(SurfaceRef) + arrays.wideLeafCount * sizeof(WideBVHLeaf) +
+                        arrays.packetCount * sizeof(TrianglePacket);
+}
+
+// leaves read their surfaces in parallel, then the interior nodes are
+// .. refit backwards: children follow their parent in the depth-first
+// .. layout, so both are done before it
+void BVH::refitNodes()
+{
+    const Surfaces & surfaces = *this->surfaces;
+
+    ThreadPool pool(this->options.threadCount);
+
+    parallelFor(pool, 0, this->nodes.size(), 1 << 14, [&](int begin, int end) {
+        for(int i = begin; i < end; i++)
+        {
+            BVHNode & node = this->nodes[i];
+
+            if(!node.isLeaf())
+                continue;
+
+            BoundingBox box;
+            int count = node.triangleCount + node.sphereCount;
+
+            for(int j = node.offset; j < node.offset + count; j++)
+                box.expand(surfaces.getBoundingBox(this->refs[j]));
+
+            for(int axis = 0; axis < 3; axis++)
+            {
+                node.bounds[0][axis] = box.min[axis];
+                node.bounds[1][axis] = box.max[axis];
+            }
+        }
+    });
+
+    for(int i = this->nodes.size() - 1; i >= 0; i--)
+    {
+        BVHNode & node = this->nodes[i];
+
+        if(node.isLeaf())
+            continue;
+
+        const BVHNode & first = this->nodes[i + 1];
+        const BVHNode & second = this->nodes[node.offset];
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            node.bounds[0][axis] = first.bounds[0][axis] < second.bounds[0][axis] ? first.bounds[0][axis] : second.bounds[0][axis];
+            node.bounds[1][axis] = first.bounds[1][axis] > second.bounds[1][axis] ? first.bounds[1][axis] : second.bounds[1][axis];
+        }
+    }
+}
+
+void BVH::refit(const BVHRefitOptions & refitOptions)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    if(this->nodes.empty())
+        return;
+
+    // the bounds are still the ones of the build
+    if(this->buildAreas.empty())
+    {
+        this->buildAreas.resize(this->nodes.size());
+
+        for(size_t i = 0; i < this->nodes.size(); i++)
+            this->buildAreas[i] = getSurfaceArea(this->nodes[i]);
+    }
+
+    this->refitNodes();
+
+    // the topmost interior nodes below the root that grew too much; parents
+    // .. come before their children, and a selected subtree is skipped as a whole
+    vector<int> roots;
+    long long rebuiltRefs = 0;
+
+    if(refitOptions.rebuildThreshold > 0.0f)
+    {
+        // keeps nodes that were built flat from counting as grown
+        float minimumArea = 1e-6f * getSurfaceArea(this->nodes[0]);
+
+        for(int i = 1; i < (int)this->nodes.size(); )
+        {
+            float buildArea = this->buildAreas[i] > minimumArea ? this->buildAreas[i] : minimumArea;
+
+            if(this->nodes[i].isLeaf() || getSurfaceArea(this->nodes[i]) <= refitOptions.rebuildThreshold * buildArea)
+            {
+                i++;
+                continue;
+            }
+
+            SubtreeRange range = getSubtreeRange(this->nodes, i);
+
+            roots.push_back(i);
+            rebuiltRefs += range.refEnd - range.refBegin;
+
+            i = range.nodeEnd;
+        }
+    }
+
+    BVHStatistics previous = this->statistics;
+
+    if(rebuiltRefs > refitOptions.maxRebuildFraction * this->refs.size())
+    {
+        // over the same surfaces, which may be a subset of the scene
+        vector<SurfaceRef> subset = getUniqueRefs(this->refs.data(), this->refs.size());
+
+        this->build(*this->surfaces, subset, this->options);
+
+        this->statistics.rebuiltSubtreeCount = 1;
+        this->statistics.rebuiltReferenceCount = this->refs.size();
+    }
+    else
+    {
+        if(roots.empty())
+        {
+            // same topology, only the cost changed
+            double cost = 0.0;
+            float rootArea = getSurfaceArea(this->nodes[0]);
+
+            for(size_t i = 0; i < this->nodes.size(); i++)
+            {
+                const BVHNode & node = this->nodes[i];
+                float relativeArea = rootArea > 0.0f ? getSurfaceArea(node) / rootArea : 1.0f;
+
+                if(node.isLeaf())
+                    cost += relativeArea * getIntersectionBlocks(node.triangleCount + node.sphereCount, this->options) * this->options.intersectionCost;
+                else
+                    cost += relativeArea * this->options.traversalCost;
+            }
+
+            this->statistics.sahCost = cost;
+        }
+        else
+        {
+            this->rebuildSubtrees(roots);
+
+            this->statistics = BVHStatistics();
+            this->statistics.buildSeconds = previous.buildSeconds;
+            this->statistics.threadCount = previous.threadCount;
+            this->statistics.surfaceCount = previous.surfaceCount;
+            this->computeStatistics(this->options);
+
+            if(this->statistics.maxDepth > traversalStackSize)
+                throw std::runtime_error("Error: BVH is too deep for the traversal stack");
+        }
+
+        // collapsing again is linear in the nodes, like refitting them would be,
+        // .. and also picks up the moved triangles for the packets
+        this->clearWide();
+
+        if(this->width > 2)
+            this->buildWide(this->options);
+
+        this->statistics.rebuiltSubtreeCount = roots.size();
+        this->statistics.rebuiltReferenceCount = rebuiltRefs;
+
+        this->updateArrays();
+    }
+
+    this->statistics.refitCount = previous.refitCount + 1;
+    this->statistics.refitSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// builds a new tree over the surfaces below every root and splices them all
+// .. in with a single pass over the nodes; nodes outside keep their build areas
+void BVH::rebuildSubtrees(const std::vector<int> & unsortedRoots)
+{
+    vector<int> roots = unsortedRoots;
+    std::sort(roots.begin(), roots.end());
+
+    int subtreeCount = roots.size();
+
+    vector<SubtreeRange> ranges(subtreeCount);
+    vector< vector<BVHNode> > subtreeNodes(subtreeCount);
+    vector< vector<SurfaceRef> > subtreeRefs(subtreeCount);
+
+    for(int k = 0; k < subtreeCount; k++)
+    {
+        ranges[k] = getSubtreeRange(this->nodes, roots[k]);
+
+        vector<SurfaceRef> subset = getUniqueRefs(this->refs.data() + ranges[k].refBegin, ranges[k].refEnd - ranges[k].refBegin);
+
+        BVHBuildOptions subtreeOptions = this->options;
+        subtreeOptions.width = 2;
+        subtreeOptions.compressNodes = false;
+        subtreeOptions.threadCount = (int)subset.size() >= parallelBinningThreshold ? this->options.threadCount : 1;
+
+        BVH subtree;
+        subtree.build(*this->surfaces, subset, subtreeOptions);
+
+        subtreeNodes[k].swap(subtree.nodes);
+        subtreeRefs[k].swap(subtree.refs);
+    }
+
+    int nodeCount = this->nodes.size();
+
+    // where every node that is kept, and every root, ends up
+    vector<int> newIndex(nodeCount, -1);
+    int newCount = 0;
+
+    for(int i = 0, k = 0; i < nodeCount; )
+    {
+        newIndex[i] = newCount;
+
+        if(k < subtreeCount && roots[k] == i)
+        {
+            newCount += subtreeNodes[k].size();
+            i = ranges[k].nodeEnd;
+            k++;
+        }
+        else
+        {
+            newCount++;
+            i++;
+        }
+    }
+
+    vector<BVHNode> spliced;
+    vector<SurfaceRef> splicedRefs;
+    vector<float> splicedAreas;
+
+    spliced.reserve(newCount);
+    splicedRefs.reserve(this->refs.size());
+    splicedAreas.reserve(newCount);
+
+    for(int i = 0, k = 0; i < nodeCount; )
+    {
+        if(k < subtreeCount && roots[k] == i)
+        {
+            int base = spliced.size();
+            int refBase = splicedRefs.size();
+
+            for(size_t j = 0; j < subtreeNodes[k].size(); j++)
+            {
+                BVHNode node = subtreeNodes[k][j];
+
+                node.offset += node.isLeaf() ? refBase : base;
+
+                spliced.push_back(node);
+                splicedAreas.push_back(getSurfaceArea(node));
+            }
+
+            splicedRefs.insert(splicedRefs.end(), subtreeRefs[k].begin(), subtreeRefs[k].end());
+
+            i = ranges[k].nodeEnd;
+            k++;
+
+            continue;
+        }
+
+        BVHNode node = this->nodes[i];
+
+        if(node.isLeaf())
+        {
+            int count = node.triangleCount + node.sphereCount;
+
+            splicedRefs.insert(splicedRefs.end(), this->refs.begin() + node.offset, this->refs.begin() + node.offset + count);
+            node.offset = splicedRefs.size() - count;
+        }
+        else
+            node.offset = newIndex[node.offset];
+
+        spliced.push_back(node);
+        splicedAreas.push_back(this->buildAreas[i]);
+        i++;
+    }
+
+    this->nodes.swap(spliced);
+    this->refs.swap(splicedRefs);
+    this->buildAreas.swap(splicedAreas);
+}
+
+void BVH::computeStatistics(const BVHBuildOptions & options)
+{
+    BVHStatistics & stats = this->statistics;
+
+    stats.referenceCount = this->refs.size();
+    stats.nodeCount = this->nodes.size();
+    stats.minLeafSize = stats.nodeCount > 0 ? 1 << 30 : 0;
+
+    if(this->nodes.empty())
+        return;
+
+    BoundingBox rootBox;
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        rootBox.min[axis] = this->nodes[0].bounds[0][axis];
+        rootBox.max[axis] = this->nodes[0].bounds[1][axis];
+    }
+
+    float rootArea = rootBox.getSurfaceArea();
+    double cost = 0.0;
+    long long leafSurfaces = 0;
+
+    vector< pair<int, int> > stack; // node, depth
+    stack.push_back(make_pair(0, 1));
+
+    while(!stack.empty())
+    {
+        int index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        const BVHNode & node = this->nodes[index];
+
+        BoundingBox box;
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            box.min[axis] = node.bounds[0][axis];
+            box.max[axis] = node.bounds[1][axis];
+        }
+
+        float relativeArea = rootArea > 0.0f ? box.getSurfaceArea() / rootArea : 1.0f;
+
+        stats.maxDepth = depth > stats.maxDepth ? depth : stats.maxDepth;
+
+        if(node.isLeaf())
+        {
+            int size = node.triangleCount + node.sphereCount;
+
+            stats.leafCount++;
+            leafSurfaces += size;
+            stats.minLeafSize = size < stats.minLeafSize ? size : stats.minLeafSize;
+            stats.maxLeafSize = size > stats.maxLeafSize ? size : stats.maxLeafSize;
+
+            if((int)stats.leafSizeHistogram.size() <= size)
+                stats.leafSizeHistogram.resize(size + 1, 0);
+
+            stats.leafSizeHistogram[size]++;
+
+            cost += relativeArea * getIntersectionBlocks(size, options) * options.intersectionCost;
+        }
+        else
+        {
+            cost += relativeArea * options.traversalCost;
+
+            stack.push_back(make_pair(index + 1, depth + 1));
+            stack.push_back(make_pair(node.offset, depth + 1));
+        }
+    }
+
+    stats.averageLeafSize = stats.leafCount > 0 ? (float)leafSurfaces / stats.leafCount : 0.0f;
+    stats.sahCost = cost;
+    stats.nodeBytes = this->nodes.size() * sizeof(BVHNode);
+    stats.memoryBytes = stats.nodeBytes + this->refs.size() * sizeof(SurfaceRef);
+}
+
+bool BVH::getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const
+{
+    TraversalCounts counts;
+
+    bool hit = this->findCloserHit(ray, hitRecord, false, epsilon, counts);
+
+    this->recordClosestHit(counts);
+
+    return hit;
+}
+
+bool BVH::isOccluded(const Ray & ray, float tMin, float tMax) const
+{
+    TraversalCounts counts;
+
+    bool occluded = this->isOccluded(ray, tMin, tMax, counts);
+
+    this->recordOcclusion(counts);
+
+    return occluded;
+}
+
+bool BVH::findCloserHit(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const
+{
+    return this->width > 2 ? this->getClosestHitWide(ray, hitRecord, hasHit, epsilon, counts)
+                           : this->getClosestHitBinary(ray, hitRecord, hasHit, epsilon, counts);
+}
+
+bool BVH::isOccluded(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const
+{
+    return this->width > 2 ? this->isOccludedWide(ray, tMin, tMax, counts)
+                           : this->isOccludedBinary(ray, tMin, tMax, counts);
+}
+
+void BVH::printStatistics(std::ostream & output) const
+{
+    output << this->statistics;
+}
+
+bool BVH::getClosestHitBinary(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const
+{
+    if(this->arrays.nodeCount == 0)
+        return hasHit;
+
+    const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+    const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+    const int * sign = ray.getSign();
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    int stack[traversalStackSize];
+    int stackSize = 0;
+    int current = 0;
+    bool hit = hasHit;
+
+    while(true)
+    {
+        const BVHNode & node = this->arrays.nodes[current];
+
+        counts.nodes++;
+
+        if(hitsBox(node, origin, inverse, sign, epsilon, hit ? hitRecord.t : 1e30f))
+        {
+            if(node.isLeaf())
+            {
+                const SurfaceRef * leafRefs = this->arrays.refs + node.offset;
+
+                counts.leaves++;
+                counts.surfaces += node.triangleCount + node.sphereCount;
+
+                int index = Triangle::getClosestHit(ray, triangles, leafRefs, node.triangleCount, hitRecord, hit, epsilon);
+
+                if(index >= 0)
+                {
+                    hit = true;
+                    hitRecord.surface = leafRefs[index];
+                }
+
+                leafRefs += node.triangleCount;
+                index = Sphere::getClosestHit(ray, spheres, leafRefs, node.sphereCount, hitRecord, hit, epsilon);
+
+                if(index >= 0)
+                {
+                    hit = true;
+                    hitRecord.surface = leafRefs[index];
+                }
+            }
+            else
+            {
+                // visit the child on the ray's side of the split first
+                if(sign[node.axis] != node.swapped)
+                {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+
+                continue;
+            }
+        }
+
+        if(stackSize == 0)
+            break;
+
+        current = stack[--stackSize];
+    }
+
+    return hit;
+}
+
+bool BVH::isOccludedBinary(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const
+{
+    if(this->arrays.nodeCount == 0)
+        return false;
+
+    const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+    const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+    const int * sign = ray.getSign();
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    int stack[traversalStackSize];
+    int stackSize = 0;
+    int current = 0;
+
+    while(true)
+    {
+        const BVHNode & node = this->arrays.nodes[current];
+
+        counts.nodes++;
+
+        if(hitsBox(node, origin, inverse, sign, tMin, tMax))
+        {
+            if(node.isLeaf())
+            {
+                const SurfaceRef * leafRefs = this->arrays.refs + node.offset;
+
+                counts.leaves++;
+                counts.surfaces += node.triangleCount + node.sphereCount;
+
+                if(Triangle::isOccluding(ray, triangles, leafRefs, node.triangleCount, tMin, tMax) ||
+                   Sphere::isOccluding(ray, spheres, leafRefs + node.triangleCount, node.sphereCount, tMin, tMax))
+                    return true;
+            }
+            else
+            {
+                stack[stackSize++] = node.offset;
+                current = current + 1;
+
+                continue;
+            }
+        }
+
+        if(stackSize == 0)
+            break;
+
+        current = stack[--stackSize];
+    }
+
+    return false;
+}
+
+std::ostream &operator<<(std::ostream &output, const BVHStatistics & statistics)
+{
+    std::streamsize precision = output.precision();
+
+    output << "BVH: " << statistics.surfaceCount << " surfaces";
+
+    if(statistics.referenceCount != statistics.surfaceCount)
+        output << " (" << statistics.referenceCount << " references)";
+
+    if(statistics.mapped)
+    {
+        output << ", BVH" << statistics.width << (statistics.compressed ? " quantized" : "") << " mapped with "
+               << (statistics.width > 2 ? statistics.wideNodeCount : statistics.nodeCount) << " nodes, traversal memory "
+               << fixed << setprecision(1) << statistics.memoryBytes / (1024.0 * 1024.0) << " MiB" << endl;
+
+        output.unsetf(ios::floatfield);
+        output.precision(precision);
+
+        return output;
+    }
+
+    output << ", built in "
+           << fixed << setprecision(3) << statistics.buildSeconds << " s on "
+           << statistics.threadCount << " thread(s)" << endl;
+    output << "     SAH cost " << setprecision(2) << statistics.sahCost
+           << ", " << statistics.nodeCount << " nodes, " << statistics.leafCount << " leaves, depth "
+           << statistics.maxDepth << endl;
+    output << "     leaf size min " << statistics.minLeafSize << " / avg " << statistics.averageLeafSize
+           << " / max " << statistics.maxLeafSize << ", histogram:";
+
+    for(size_t size = 0; size < statistics.leafSizeHistogram.size(); size++)
+    {
+        if(statistics.leafSizeHistogram[size] > 0)
+            output << " " << size << ":" << statistics.leafSizeHistogram[size];
+    }
+
+    output << endl;
+
+    if(statistics.width > 2)
+    {
+        output << "     collapsed to " << (statistics.compressed ? "quantized " : "") << "BVH" << statistics.width << ": " << statistics.wideNodeCount << " nodes, "
+               << statistics.averageChildCount << " children per node, depth " << statistics.wideMaxDepth
+               << ", " << statistics.packetCount << " triangle packets" << endl;
+    }
+
+    output << "     traversal memory " << setprecision(1) << statistics.memoryBytes / (1024.0 * 1024.0) << " MiB, nodes "
+           << statistics.nodeBytes / (1024.0 * 1024.0) << " MiB" << endl;
+
+    if(statistics.refitCount > 0)
+    {
+        output << "     refit " << statistics.refitCount << " time(s), the last in " << setprecision(3)
+               << statistics.refitSeconds << " s, rebuilding " << statistics.rebuiltSubtreeCount << " subtree(s) with "
+               << statistics.rebuiltReferenceCount << " references" << endl;
+    }
+    output.unsetf(ios::floatfield);
+    output.precision(precision);
+
+    return output;
+}
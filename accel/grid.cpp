@@ -0,0 +1,419 @@
+#include "../grid.hpp"
+#include <chrono>
+#include <cmath>
+#include <climits>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    // resolution per axis, whatever the density asks for
+    const int maxResolution = 1024;
+
+    // walks the cells a ray passes through in order (Amanatides and Woo)
+    typedef struct GridWalk
+    {
+        int cell[3];
+        int step[3];
+        int end[3];       // first cell index outside the grid in step direction
+        float tNext[3];   // where the ray crosses into the next cell on each axis
+        float tDelta[3];  // distance between those crossings
+        float tExit;
+
+        // false if the ray misses the grid between tMin and tMax
+        bool start(const BoundingBox & bounds, const int resolution[3], const float cellSize[3], const float inverseCellSize[3],
+                   const Ray & ray, float tMin, float tMax)
+        {
+            const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+            const float direction[3] = { ray.getDirection().getX(), ray.getDirection().getY(), ray.getDirection().getZ() };
+            const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+            const int * sign = ray.getSign();
+
+            // same slab test as the BVH, comparisons keep tMin / tMax when t is NaN
+            for(int axis = 0; axis < 3; axis++)
+            {
+                const float planes[2] = { bounds.min[axis], bounds.max[axis] };
+
+                float tNear = (planes[sign[axis]] - origin[axis]) * inverse[axis];
+                float tFar = (planes[1 - sign[axis]] - origin[axis]) * inverse[axis] * 1.0000004f;
+
+                tMin = tNear > tMin ? tNear : tMin;
+                tMax = tFar < tMax ? tFar : tMax;
+            }
+
+            if(tMin > tMax)
+                return false;
+
+            this->tExit = tMax;
+
+            for(int axis = 0; axis < 3; axis++)
+            {
+                float position = origin[axis] + direction[axis] * tMin;
+                int index = (int)((position - bounds.min[axis]) * inverseCellSize[axis]);
+
+                index = index < 0 ? 0 : (index >= resolution[axis] ? resolution[axis] - 1 : index);
+                this->cell[axis] = index;
+
+                if(direction[axis] > 0.0f)
+                {
+                    this->step[axis] = 1;
+                    this->end[axis] = resolution[axis];
+                    this->tNext[axis] = (bounds.min[axis] + (index + 1) * cellSize[axis] - origin[axis]) * inverse[axis];
+                    this->tDelta[axis] = cellSize[axis] * inverse[axis];
+                }
+                else if(direction[axis] < 0.0f)
+                {
+                    this->step[axis] = -1;
+                    this->end[axis] = -1;
+                    this->tNext[axis] = (bounds.min[axis] + index * cellSize[axis] - origin[axis]) * inverse[axis];
+                    this->tDelta[axis] = -cellSize[axis] * inverse[axis];
+                }
+                else
+                {
+                    this->step[axis] = 0;
+                    this->end[axis] = -1;
+                    this->tNext[axis] = 1e30f;
+                    this->tDelta[axis] = 0.0f;
+                }
+            }
+
+            return true;
+        }
+
+        // where the ray leaves the current cell
+        float getCellExit() const
+        {
+            float t = this->tNext[0] < this->tNext[1] ? this->tNext[0] : this->tNext[1];
+            t = this->tNext[2] < t ? this->tNext[2] : t;
+
+            return t < this->tExit ? t : this->tExit;
+        }
+
+        // false once the ray leaves the grid
+        bool advance()
+        {
+            int axis = this->tNext[0] < this->tNext[1] ? 0 : 1;
+            axis = this->tNext[2] < this->tNext[axis] ? 2 : axis;
+
+            if(this->tNext[axis] > this->tExit)
+                return false;
+
+            this->cell[axis] += this->step[axis];
+
+            if(this->cell[axis] == this->end[axis])
+                return false;
+
+            this->tNext[axis] += this->tDelta[axis];
+
+            return true;
+        }
+    } GridWalk;
+}
+
+int UniformGrid::getCell(int axis, float position) const
+{
+    int index = (int)((position - this->bounds.min[axis]) * this->inverseCellSize[axis]);
+
+    return index < 0 ? 0 : (index >= this->resolution[axis] ? this->resolution[axis] - 1 : index);
+}
+
+void UniformGrid::build(const Surfaces & surfaces, const GridBuildOptions & options)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    this->surfaces = &surfaces;
+    this->bounds = BoundingBox();
+    this->cellStart.clear();
+    this->cellTriangleCount.clear();
+    this->refs.clear();
+
+    int surfaceCount = surfaces.size();
+    int triangleCount = surfaces.triangles.size();
+
+    vector<BoundingBox> boxes(surfaceCount);
+
+    for(int i = 0; i < surfaceCount; i++)
+    {
+        SurfaceRef ref;
+        ref.type = i < triangleCount ? triangle_surface : sphere_surface;
+        ref.index = i < triangleCount ? i : i - triangleCount;
+
+        boxes[i] = surfaces.getBoundingBox(ref);
+        this->bounds.expand(boxes[i]);
+    }
+
+    if(surfaceCount == 0)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            this->bounds.min[axis] = 0.0f;
+            this->bounds.max[axis] = 0.0f;
+        }
+    }
+
+    // flat scenes still get cells of some thickness
+    float largestExtent = 0.0f;
+
+    for(int axis = 0; axis < 3; axis++)
+        largestExtent = this->bounds.max[axis] - this->bounds.min[axis] > largestExtent ? this->bounds.max[axis] - this->bounds.min[axis] : largestExtent;
+
+    float padding = largestExtent > 0.0f ? largestExtent * 1e-3f : 1e-3f;
+    float extent[3];
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(this->bounds.max[axis] - this->bounds.min[axis] < padding)
+        {
+            this->bounds.min[axis] -= padding;
+            this->bounds.max[axis] += padding;
+        }
+
+        extent[axis] = this->bounds.max[axis] - this->bounds.min[axis];
+    }
+
+    // cubic cells, density * surfaces of them in the whole box
+    float cellsPerUnit = cbrtf(options.density * (surfaceCount > 0 ? surfaceCount : 1) / (extent[0] * extent[1] * extent[2]));
+    float scale = 1.0f;
+
+    while(true)
+    {
+        long long cellCount = 1;
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int resolution = (int)(extent[axis] * cellsPerUnit * scale + 0.5f);
+            resolution = resolution < 1 ? 1 : (resolution > maxResolution ? maxResolution : resolution);
+
+            this->resolution[axis] = resolution;
+            cellCount *= resolution;
+        }
+
+        if(cellCount <= options.maxCellCount || scale < 1e-3f)
+            break;
+
+        scale *= 0.9f;
+    }
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        this->cellSize[axis] = extent[axis] / this->resolution[axis];
+        this->inverseCellSize[axis] = this->resolution[axis] / extent[axis];
+    }
+
+    int cellCount = this->resolution[0] * this->resolution[1] * this->resolution[2];
+
+    // count the refs of every cell, then place them: all triangles before all
+    // .. spheres, so every cell lists its triangles first
+    vector<long long> counts(cellCount + 1, 0);
+    this->cellTriangleCount.assign(cellCount, 0);
+
+    for(int pass = 0; pass < 2; pass++)
+    {
+        vector<int> cursor;
+
+        if(pass == 1)
+            cursor.assign(this->cellStart.begin(), this->cellStart.end() - 1);
+
+        for(int i = 0; i < surfaceCount; i++)
+        {
+            int lo[3], hi[3];
+
+            for(int axis = 0; axis < 3; axis++)
+            {
+                lo[axis] = this->getCell(axis, boxes[i].min[axis]);
+                hi[axis] = this->getCell(axis, boxes[i].max[axis]);
+            }
+
+            for(int z = lo[2]; z <= hi[2]; z++)
+            {
+                for(int y = lo[1]; y <= hi[1]; y++)
+                {
+                    for(int x = lo[0]; x <= hi[0]; x++)
+                    {
+                        int cell = x + this->resolution[0] * (y + this->resolution[1] * z);
+
+                        if(pass == 0)
+                        {
+                            counts[cell]++;
+
+                            if(i < triangleCount)
+                                this->cellTriangleCount[cell]++;
+                        }
+                        else
+                        {
+                            SurfaceRef & ref = this->refs[cursor[cell]++];
+                            ref.type = i < triangleCount ? triangle_surface : sphere_surface;
+                            ref.index = i < triangleCount ? i : i - triangleCount;
+                        }
+                    }
+                }
+            }
+        }
+
+        if(pass == 0)
+        {
+            long long total = 0;
+
+            this->cellStart.resize(cellCount + 1);
+
+            for(int cell = 0; cell <= cellCount; cell++)
+            {
+                long long count = counts[cell];
+                counts[cell] = total;
+                total += count;
+            }
+
+            if(total > INT_MAX)
+                throw std::runtime_error("Error: too many grid references, lower the grid density");
+
+            for(int cell = 0; cell <= cellCount; cell++)
+                this->cellStart[cell] = counts[cell];
+
+            this->refs.resize(total);
+        }
+    }
+
+    GridStatistics & stats = this->statistics;
+    stats = GridStatistics();
+
+    stats.surfaceCount = surfaceCount;
+    stats.cellCount = cellCount;
+    stats.referenceCount = this->refs.size();
+
+    for(int axis = 0; axis < 3; axis++)
+        stats.resolution[axis] = this->resolution[axis];
+
+    for(int cell = 0; cell < cellCount; cell++)
+    {
+        int size = this->cellStart[cell + 1] - this->cellStart[cell];
+
+        stats.emptyCellCount += size == 0;
+        stats.maxCellSize = size > stats.maxCellSize ? size : stats.maxCellSize;
+    }
+
+    stats.memoryBytes = this->cellStart.size() * sizeof(int) + this->cellTriangleCount.size() * sizeof(int) +
+                        this->refs.size() * sizeof(SurfaceRef);
+    stats.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// cells are visited front to back, so the search stops in the first cell
+// .. that holds a hit before the ray leaves it; a surface hit further on is
+// .. listed in a later cell too, where it is found again
+bool UniformGrid::getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const
+{
+    TraversalCounts counts;
+    GridWalk walk;
+    bool hit = false;
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    if(walk.start(this->bounds, this->resolution, this->cellSize, this->inverseCellSize, ray, epsilon, 1e30f))
+    {
+        do
+        {
+            int cell = walk.cell[0] + this->resolution[0] * (walk.cell[1] + this->resolution[1] * walk.cell[2]);
+            int first = this->cellStart[cell];
+            int count = this->cellStart[cell + 1] - first;
+
+            counts.nodes++;
+
+            if(count > 0)
+            {
+                const SurfaceRef * cellRefs = &this->refs[first];
+                int triangleCount = this->cellTriangleCount[cell];
+
+                counts.leaves++;
+                counts.surfaces += count;
+
+                int index = Triangle::getClosestHit(ray, triangles, cellRefs, triangleCount, hitRecord, hit, epsilon);
+
+                if(index >= 0)
+                {
+                    hit = true;
+                    hitRecord.surface = cellRefs[index];
+                }
+
+                cellRefs += triangleCount;
+                index = Sphere::getClosestHit(ray, spheres, cellRefs, count - triangleCount, hitRecord, hit, epsilon);
+
+                if(index >= 0)
+                {
+                    hit = true;
+                    hitRecord.surface = cellRefs[index];
+                }
+            }
+
+            if(hit && hitRecord.t <= walk.getCellExit())
+                break;
+        } while(walk.advance());
+    }
+
+    this->recordClosestHit(counts);
+
+    return hit;
+}
+
+bool UniformGrid::isOccluded(const Ray & ray, float tMin, float tMax) const
+{
+    TraversalCounts counts;
+    GridWalk walk;
+    bool occluded = false;
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    if(walk.start(this->bounds, this->resolution, this->cellSize, this->inverseCellSize, ray, tMin, tMax))
+    {
+        do
+        {
+            int cell = walk.cell[0] + this->resolution[0] * (walk.cell[1] + this->resolution[1] * walk.cell[2]);
+            int first = this->cellStart[cell];
+            int count = this->cellStart[cell + 1] - first;
+
+            counts.nodes++;
+
+            if(count > 0)
+            {
+                const SurfaceRef * cellRefs = &this->refs[first];
+                int triangleCount = this->cellTriangleCount[cell];
+
+                counts.leaves++;
+                counts.surfaces += count;
+
+                if(Triangle::isOccluding(ray, triangles, cellRefs, triangleCount, tMin, tMax) ||
+                   Sphere::isOccluding(ray, spheres, cellRefs + triangleCount, count - triangleCount, tMin, tMax))
+                {
+                    occluded = true;
+                    break;
+                }
+            }
+        } while(walk.advance());
+    }
+
+    this->recordOcclusion(counts);
+
+    return occluded;
+}
+
+void UniformGrid::printStatistics(std::ostream & output) const
+{
+    output << this->statistics;
+}
+
+std::ostream &operator<<(std::ostream &output, const GridStatistics & statistics)
+{
+    std::streamsize precision = output.precision();
+
+    output << "grid: " << statistics.surfaceCount << " surfaces (" << statistics.referenceCount << " references), built in "
+           << fixed << setprecision(3) << statistics.buildSeconds << " s" << endl;
+    output << "     " << statistics.resolution[0] << " x " << statistics.resolution[1] << " x " << statistics.resolution[2]
+           << " cells, " << statistics.emptyCellCount << " empty, largest cell " << statistics.maxCellSize << endl;
+    output << "     traversal memory " << setprecision(1) << statistics.memoryBytes / (1024.0 * 1024.0) << " MiB" << endl;
+    output.unsetf(ios::floatfield);
+    output.precision(precision);
+
+    return output;
+}
@@ -0,0 +1,578 @@
+#include "../kdtree.hpp"
+#include "../threadpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    // children of nodes above this count are built as separate tasks
+    const int parallelTaskThreshold = 1 << 12;
+
+    // bins live on the stack of the builder
+    const int maxBinCount = 64;
+
+    // also bounds maxDepth
+    const int traversalStackSize = 64;
+
+    typedef struct BuildRef
+    {
+        BoundingBox bounds; // clipped to the node as the tree gets deeper
+        SurfaceRef ref;
+    } BuildRef;
+
+    typedef struct KdSplit
+    {
+        float cost;
+        int axis;       // -1: no split beats a leaf
+        float position;
+
+        KdSplit() : cost(1e30f), axis(-1), position(0.0f) {}
+    } KdSplit;
+
+    typedef struct TraversalEntry
+    {
+        int node;
+        float tNear;
+        float tFar;
+    } TraversalEntry;
+
+    class KdTreeBuilder
+    {
+        private:
+            const KdTreeBuildOptions & options;
+            ThreadPool & pool;
+            int maxDepth;
+
+            void makeLeaf(vector<BuildRef> & buildRefs, vector<KdTreeNode> & nodes, vector<SurfaceRef> & refs) const
+            {
+                // triangles first, so that the leaf runs one loop per surface type
+                vector<BuildRef>::iterator middle = std::stable_partition(buildRefs.begin(), buildRefs.end(),
+                                                                          [](const BuildRef & buildRef) {
+                    return buildRef.ref.type == triangle_surface;
+                });
+
+                KdTreeNode node;
+                node.split = 0.0f;
+                node.offset = refs.size();
+                node.triangleCount = middle - buildRefs.begin();
+                node.sphereCount = buildRefs.end() - middle;
+                node.axis = 3;
+
+                for(size_t i = 0; i < buildRefs.size(); i++)
+                    refs.push_back(buildRefs[i].ref);
+
+                nodes.push_back(node);
+            }
+
+            // binned SAH over the planes between bins; a surface counts below a
+            // .. plane if its box starts below it and above if its box ends above it
+            KdSplit findSplit(const vector<BuildRef> & buildRefs, const BoundingBox & box) const
+            {
+                int count = buildRefs.size();
+                int binCount = options.binCount;
+                float nodeArea = box.getSurfaceArea();
+
+                KdSplit best;
+                best.cost = options.intersectionCost * count;
+
+                if(!(nodeArea > 0.0f))
+                    return best;
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float extent = box.max[axis] - box.min[axis];
+
+                    if(!(extent > 0.0f))
+                        continue;
+
+                    int starts[maxBinCount] = { 0 };
+                    int ends[maxBinCount] = { 0 };
+                    float scale = binCount / extent;
+
+                    for(int i = 0; i < count; i++)
+                    {
+                        int first = (int)((buildRefs[i].bounds.min[axis] - box.min[axis]) * scale);
+                        int last = (int)((buildRefs[i].bounds.max[axis] - box.min[axis]) * scale);
+
+                        starts[first < 0 ? 0 : (first >= binCount ? binCount - 1 : first)]++;
+                        ends[last < 0 ? 0 : (last >= binCount ? binCount - 1 : last)]++;
+                    }
+
+                    int belowCount = 0;
+                    int endedCount = 0;
+
+                    for(int plane = 1; plane < binCount; plane++)
+                    {
+                        belowCount += starts[plane - 1];
+                        endedCount += ends[plane - 1];
+
+                        int aboveCount = count - endedCount;
+                        float position = box.min[axis] + extent * plane / binCount;
+
+                        BoundingBox below = box;
+                        BoundingBox above = box;
+                        below.max[axis] = position;
+                        above.min[axis] = position;
+
+                        float bonus = belowCount == 0 || aboveCount == 0 ? 1.0f - options.emptyBonus : 1.0f;
+                        float cost = options.traversalCost +
+                                     options.intersectionCost * bonus *
+                                     (below.getSurfaceArea() * belowCount + above.getSurfaceArea() * aboveCount) / nodeArea;
+
+                        if(cost < best.cost)
+                        {
+                            best.cost = cost;
+                            best.axis = axis;
+                            best.position = position;
+                        }
+                    }
+                }
+
+                return best;
+            }
+
+            static void appendSubtree(vector<KdTreeNode> & nodes, vector<SurfaceRef> & refs,
+                                      const vector<KdTreeNode> & subtreeNodes, const vector<SurfaceRef> & subtreeRefs)
+            {
+                int nodeBase = nodes.size();
+                int refBase = refs.size();
+
+                for(size_t i = 0; i < subtreeNodes.size(); i++)
+                {
+                    KdTreeNode node = subtreeNodes[i];
+
+                    node.offset += node.isLeaf() ? refBase : nodeBase;
+
+                    nodes.push_back(node);
+                }
+
+                refs.insert(refs.end(), subtreeRefs.begin(), subtreeRefs.end());
+            }
+
+        public:
+            KdTreeBuilder(const KdTreeBuildOptions & options, ThreadPool & pool, int maxDepth)
+                : options(options), pool(pool), maxDepth(maxDepth) {}
+
+            // buildRefs is consumed
+            void buildNode(vector<BuildRef> & buildRefs, const BoundingBox & box, int depth,
+                           vector<KdTreeNode> & nodes, vector<SurfaceRef> & refs)
+            {
+                int count = buildRefs.size();
+                KdSplit split;
+
+                if(count > options.maxLeafSize && depth < this->maxDepth)
+                    split = findSplit(buildRefs, box);
+
+                if(split.axis < 0)
+                {
+                    makeLeaf(buildRefs, nodes, refs);
+                    return;
+                }
+
+                int axis = split.axis;
+                float position = split.position;
+
+                // surfaces lying in the plane go below
+                vector<BuildRef> below, above;
+
+                for(int i = 0; i < count; i++)
+                {
+                    const BuildRef & buildRef = buildRefs[i];
+
+                    if(buildRef.bounds.min[axis] < position || buildRef.bounds.max[axis] <= position)
+                    {
+                        below.push_back(buildRef);
+                        below.back().bounds.max[axis] = buildRef.bounds.max[axis] < position ? buildRef.bounds.max[axis] : position;
+                    }
+
+                    if(buildRef.bounds.max[axis] > position)
+                    {
+                        above.push_back(buildRef);
+                        above.back().bounds.min[axis] = buildRef.bounds.min[axis] > position ? buildRef.bounds.min[axis] : position;
+                    }
+                }
+
+                vector<BuildRef>().swap(buildRefs);
+
+                BoundingBox belowBox = box;
+                BoundingBox aboveBox = box;
+                belowBox.max[axis] = position;
+                aboveBox.min[axis] = position;
+
+                KdTreeNode node;
+                node.split = position;
+                node.offset = 0;
+                node.triangleCount = 0;
+                node.sphereCount = 0;
+                node.axis = axis;
+
+                int nodeIndex = nodes.size();
+                nodes.push_back(node);
+
+                if(count >= parallelTaskThreshold && pool.getThreadCount() > 1)
+                {
+                    // task parallel: the child below goes to the pool, the one above is built here
+                    vector<KdTreeNode> belowNodes, aboveNodes;
+                    vector<SurfaceRef> belowRefs, aboveRefs;
+
+                    TaskGroup group(pool);
+                    group.run([&]() { buildNode(below, belowBox, depth + 1, belowNodes, belowRefs); });
+                    buildNode(above, aboveBox, depth + 1, aboveNodes, aboveRefs);
+                    group.wait();
+
+                    appendSubtree(nodes, refs, belowNodes, belowRefs);
+                    nodes[nodeIndex].offset = nodes.size();
+                    appendSubtree(nodes, refs, aboveNodes, aboveRefs);
+                }
+                else
+                {
+                    buildNode(below, belowBox, depth + 1, nodes, refs);
+                    nodes[nodeIndex].offset = nodes.size();
+                    buildNode(above, aboveBox, depth + 1, nodes, refs);
+                }
+            }
+    };
+
+    // entry and exit of the ray through box, false if it misses between tMin and tMax
+    inline bool clipToBox(const BoundingBox & box, const Ray & ray, float & tMin, float & tMax)
+    {
+        const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+        const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+        const int * sign = ray.getSign();
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            const float planes[2] = { box.min[axis], box.max[axis] };
+
+            float tNear = (planes[sign[axis]] - origin[axis]) * inverse[axis];
+            float tFar = (planes[1 - sign[axis]] - origin[axis]) * inverse[axis] * 1.0000004f;
+
+            // comparisons keep tMin / tMax when t is NaN
+            tMin = tNear > tMin ? tNear : tMin;
+            tMax = tFar < tMax ? tFar : tMax;
+        }
+
+        return tMin <= tMax;
+    }
+}
+
+void KdTree::build(const Surfaces & surfaces, const KdTreeBuildOptions & buildOptions)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    this->surfaces = &surfaces;
+    this->bounds = BoundingBox();
+    this->nodes.clear();
+    this->refs.clear();
+
+    KdTreeBuildOptions options = buildOptions;
+
+    options.binCount = options.binCount < 2 ? 2 : options.binCount;
+    options.binCount = options.binCount > maxBinCount ? maxBinCount : options.binCount;
+    options.maxLeafSize = options.maxLeafSize < 1 ? 1 : options.maxLeafSize;
+
+    int surfaceCount = surfaces.size();
+    int triangleCount = surfaces.triangles.size();
+
+    int maxDepth = options.maxDepth > 0 ? options.maxDepth : (int)(8.0f + 1.3f * log2f(surfaceCount > 1 ? surfaceCount : 1));
+    maxDepth = maxDepth > traversalStackSize ? traversalStackSize : maxDepth;
+
+    ThreadPool pool(options.threadCount);
+
+    vector<BuildRef> buildRefs(surfaceCount);
+
+    parallelFor(pool, 0, surfaceCount, 1 << 14, [&](int begin, int end) {
+        for(int i = begin; i < end; i++)
+        {
+            BuildRef & buildRef = buildRefs[i];
+
+            buildRef.ref.type = i < triangleCount ? triangle_surface : sphere_surface;
+            buildRef.ref.index = i < triangleCount ? i : i - triangleCount;
+            buildRef.bounds = surfaces.getBoundingBox(buildRef.ref);
+        }
+    });
+
+    for(int i = 0; i < surfaceCount; i++)
+        this->bounds.expand(buildRefs[i].bounds);
+
+    if(surfaceCount > 0)
+    {
+        KdTreeBuilder builder(options, pool, maxDepth);
+        builder.buildNode(buildRefs, this->bounds, 0, this->nodes, this->refs);
+    }
+
+    this->statistics = KdTreeStatistics();
+    this->statistics.threadCount = pool.getThreadCount();
+    this->computeStatistics();
+    this->statistics.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void KdTree::computeStatistics()
+{
+    KdTreeStatistics & stats = this->statistics;
+
+    stats.surfaceCount = this->surfaces->size();
+    stats.referenceCount = this->refs.size();
+    stats.nodeCount = this->nodes.size();
+
+    int filledLeafCount = 0;
+
+    vector< pair<int, int> > stack; // node, depth
+
+    if(!this->nodes.empty())
+        stack.push_back(make_pair(0, 0));
+
+    while(!stack.empty())
+    {
+        int index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        const KdTreeNode & node = this->nodes[index];
+
+        stats.maxDepth = depth > stats.maxDepth ? depth : stats.maxDepth;
+
+        if(node.isLeaf())
+        {
+            int size = node.triangleCount + node.sphereCount;
+
+            stats.leafCount++;
+            stats.emptyLeafCount += size == 0;
+            filledLeafCount += size > 0;
+            stats.maxLeafSize = size > stats.maxLeafSize ? size : stats.maxLeafSize;
+
+            continue;
+        }
+
+        stack.push_back(make_pair(index + 1, depth + 1));
+        stack.push_back(make_pair(node.offset, depth + 1));
+    }
+
+    stats.averageLeafSize = filledLeafCount > 0 ? (float)stats.referenceCount / filledLeafCount : 0.0f;
+    stats.memoryBytes = this->nodes.size() * sizeof(KdTreeNode) + this->refs.size() * sizeof(SurfaceRef);
+}
+
+// leaves are visited front to back, each with the part of the ray inside it;
+// .. a hit within that part is the closest one, a hit beyond it belongs to a
+// .. later leaf that lists the surface too
+bool KdTree::getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const
+{
+    TraversalCounts counts;
+    bool hit = false;
+
+    float tNear = epsilon;
+    float tFar = 1e30f;
+
+    if(this->nodes.empty() || !clipToBox(this->bounds, ray, tNear, tFar))
+    {
+        this->recordClosestHit(counts);
+        return false;
+    }
+
+    const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+    const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+    const int * sign = ray.getSign();
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    TraversalEntry stack[traversalStackSize];
+    int stackSize = 0;
+    int current = 0;
+
+    while(true)
+    {
+        const KdTreeNode & node = this->nodes[current];
+
+        counts.nodes++;
+
+        if(!node.isLeaf())
+        {
+            float tSplit = (node.split - origin[node.axis]) * inverse[node.axis];
+
+            // the ray passes the side of its sign first, NaN visits both
+            int first = sign[node.axis] ? node.offset : current + 1;
+            int second = sign[node.axis] ? current + 1 : node.offset;
+
+            if(tSplit > tFar)
+                current = first;
+            else if(tSplit < tNear)
+                current = second;
+            else
+            {
+                stack[stackSize].node = second;
+                stack[stackSize].tNear = tSplit;
+                stack[stackSize].tFar = tFar;
+                stackSize++;
+
+                current = first;
+                tFar = tSplit;
+            }
+
+            continue;
+        }
+
+        int count = node.triangleCount + node.sphereCount;
+
+        if(count > 0)
+        {
+            const SurfaceRef * leafRefs = &this->refs[node.offset];
+
+            counts.leaves++;
+            counts.surfaces += count;
+
+            int index = Triangle::getClosestHit(ray, triangles, leafRefs, node.triangleCount, hitRecord, hit, epsilon);
+
+            if(index >= 0)
+            {
+                hit = true;
+                hitRecord.surface = leafRefs[index];
+            }
+
+            leafRefs += node.triangleCount;
+            index = Sphere::getClosestHit(ray, spheres, leafRefs, node.sphereCount, hitRecord, hit, epsilon);
+
+            if(index >= 0)
+            {
+                hit = true;
+                hitRecord.surface = leafRefs[index];
+            }
+        }
+
+        if(hit && hitRecord.t <= tFar)
+            break;
+
+        // leaves behind the hit found so far cannot hold a closer one
+        do
+        {
+            if(stackSize == 0)
+            {
+                this->recordClosestHit(counts);
+                return hit;
+            }
+
+            stackSize--;
+        } while(hit && stack[stackSize].tNear > hitRecord.t);
+
+        current = stack[stackSize].node;
+        tNear = stack[stackSize].tNear;
+        tFar = stack[stackSize].tFar;
+    }
+
+    this->recordClosestHit(counts);
+
+    return hit;
+}
+
+bool KdTree::isOccluded(const Ray & ray, float tMin, float tMax) const
+{
+    TraversalCounts counts;
+
+    float tNear = tMin;
+    float tFar = tMax;
+
+    if(this->nodes.empty() || !clipToBox(this->bounds, ray, tNear, tFar))
+    {
+        this->recordOcclusion(counts);
+        return false;
+    }
+
+    const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+    const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+    const int * sign = ray.getSign();
+
+    const Triangle * triangles = this->surfaces->triangles.data();
+    const Sphere * spheres = this->surfaces->spheres.data();
+
+    TraversalEntry stack[traversalStackSize];
+    int stackSize = 0;
+    int current = 0;
+    bool occluded = false;
+
+    while(true)
+    {
+        const KdTreeNode & node = this->nodes[current];
+
+        counts.nodes++;
+
+        if(!node.isLeaf())
+        {
+            float tSplit = (node.split - origin[node.axis]) * inverse[node.axis];
+
+            int first = sign[node.axis] ? node.offset : current + 1;
+            int second = sign[node.axis] ? current + 1 : node.offset;
+
+            if(tSplit > tFar)
+                current = first;
+            else if(tSplit < tNear)
+                current = second;
+            else
+            {
+                stack[stackSize].node = second;
+                stack[stackSize].tNear = tSplit;
+                stack[stackSize].tFar = tFar;
+                stackSize++;
+
+                current = first;
+                tFar = tSplit;
+            }
+
+            continue;
+        }
+
+        int count = node.triangleCount + node.sphereCount;
+
+        if(count > 0)
+        {
+            const SurfaceRef * leafRefs = &this->refs[node.offset];
+
+            counts.leaves++;
+            counts.surfaces += count;
+
+            if(Triangle::isOccluding(ray, triangles, leafRefs, node.triangleCount, tMin, tMax) ||
+               Sphere::isOccluding(ray, spheres, leafRefs + node.triangleCount, node.sphereCount, tMin, tMax))
+            {
+                occluded = true;
+                break;
+            }
+        }
+
+        if(stackSize == 0)
+            break;
+
+        stackSize--;
+        current = stack[stackSize].node;
+        tNear = stack[stackSize].tNear;
+        tFar = stack[stackSize].tFar;
+    }
+
+    this->recordOcclusion(counts);
+
+    return occluded;
+}
+
+void KdTree::printStatistics(std::ostream & output) const
+{
+    output << this->statistics;
+}
+
+std::ostream &operator<<(std::ostream &output, const KdTreeStatistics & statistics)
+{
+    std::streamsize precision = output.precision();
+
+    output << "kd-tree: " << statistics.surfaceCount << " surfaces (" << statistics.referenceCount << " references), built in "
+           << fixed << setprecision(3) << statistics.buildSeconds << " s on " << statistics.threadCount << " thread(s)" << endl;
+    output << "     " << statistics.nodeCount << " nodes, " << statistics.leafCount << " leaves ("
+           << statistics.emptyLeafCount << " empty), depth " << statistics.maxDepth << endl;
+    output << "     leaf size avg " << setprecision(2) << statistics.averageLeafSize << " / max " << statistics.maxLeafSize << endl;
+    output << "     traversal memory " << setprecision(1) << statistics.memoryBytes / (1024.0 * 1024.0) << " MiB" << endl;
+    output.unsetf(ios::floatfield);
+    output.precision(precision);
+
+    return output;
+}
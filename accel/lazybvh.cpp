@@ -0,0 +1,420 @@
+#include "../lazybvh.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    // bins live on the stack of the builder
+    const int maxBinCount = 64;
+
+    const int traversalStackSize = 256;
+
+    typedef struct TopSurface
+    {
+        BoundingBox bounds;
+        float centroid[3];
+        SurfaceRef ref;
+    } TopSurface;
+
+    typedef struct TopBin
+    {
+        BoundingBox bounds;
+        int count;
+
+        TopBin() : count(0) {}
+    } TopBin;
+
+    // binned SAH over the centroids, like the full BVH builder but without the
+    // .. leaf costs: every leaf is a subtree
+    class LazyBVHBuilder
+    {
+        private:
+            const LazyBVHBuildOptions & options;
+            vector<TopSurface> & topSurfaces;
+            vector<LazyBVHNode> & nodes;
+            vector< unique_ptr<LazySubtree> > & subtrees;
+
+            // returns where the range is split, -1 if no split separates the centroids
+            int findSplit(int begin, int end, const BoundingBox & centroidBounds, int & axis) const
+            {
+                float bestCost = 1e30f;
+                int bestMiddle = -1;
+
+                for(int splitAxis = 0; splitAxis < 3; splitAxis++)
+                {
+                    float extent = centroidBounds.max[splitAxis] - centroidBounds.min[splitAxis];
+
+                    if(!(extent > 0.0f))
+                        continue;
+
+                    TopBin bins[maxBinCount];
+                    int binCount = options.binCount;
+                    float scale = binCount / extent;
+
+                    for(int i = begin; i < end; i++)
+                    {
+                        int bin = (int)((topSurfaces[i].centroid[splitAxis] - centroidBounds.min[splitAxis]) * scale);
+                        bin = bin < 0 ? 0 : (bin >= binCount ? binCount - 1 : bin);
+
+                        bins[bin].bounds.expand(topSurfaces[i].bounds);
+                        bins[bin].count++;
+                    }
+
+                    float rightArea[maxBinCount];
+                    int rightCount[maxBinCount];
+                    BoundingBox accumulated;
+                    int accumulatedCount = 0;
+
+                    for(int i = binCount - 1; i > 0; i--)
+                    {
+                        accumulated.expand(bins[i].bounds);
+                        accumulatedCount += bins[i].count;
+                        rightArea[i] = accumulated.getSurfaceArea();
+                        rightCount[i] = accumulatedCount;
+                    }
+
+                    accumulated = BoundingBox();
+                    accumulatedCount = 0;
+
+                    for(int i = 1; i < binCount; i++)
+                    {
+                        accumulated.expand(bins[i - 1].bounds);
+                        accumulatedCount += bins[i - 1].count;
+
+                        if(accumulatedCount == 0 || rightCount[i] == 0)
+                            continue;
+
+                        float cost = accumulated.getSurfaceArea() * accumulatedCount + rightArea[i] * rightCount[i];
+
+                        if(cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestMiddle = i;
+                            axis = splitAxis;
+                        }
+                    }
+                }
+
+                if(bestMiddle < 0)
+                    return -1;
+
+                // same binning as above, so the partition matches the counts
+                int splitAxis = axis;
+                int binCount = options.binCount;
+                float scale = binCount / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+
+                TopSurface * middle = std::partition(&topSurfaces[0] + begin, &topSurfaces[0] + end,
+                                                     [&](const TopSurface & surface) {
+                    int bin = (int)((surface.centroid[splitAxis] - centroidBounds.min[splitAxis]) * scale);
+                    return (bin < 0 ? 0 : (bin >= binCount ? binCount - 1 : bin)) < bestMiddle;
+                });
+
+                return middle - &topSurfaces[0];
+            }
+
+        public:
+            LazyBVHBuilder(const LazyBVHBuildOptions & options, vector<TopSurface> & topSurfaces,
+                           vector<LazyBVHNode> & nodes, vector< unique_ptr<LazySubtree> > & subtrees)
+                : options(options), topSurfaces(topSurfaces), nodes(nodes), subtrees(subtrees) {}
+
+            void buildNode(int begin, int end)
+            {
+                BoundingBox bounds, centroidBounds;
+
+                for(int i = begin; i < end; i++)
+                {
+                    bounds.expand(topSurfaces[i].bounds);
+
+                    for(int axis = 0; axis < 3; axis++)
+                    {
+                        centroidBounds.min[axis] = topSurfaces[i].centroid[axis] < centroidBounds.min[axis] ? topSurfaces[i].centroid[axis] : centroidBounds.min[axis];
+                        centroidBounds.max[axis] = topSurfaces[i].centroid[axis] > centroidBounds.max[axis] ? topSurfaces[i].centroid[axis] : centroidBounds.max[axis];
+                    }
+                }
+
+                LazyBVHNode node;
+
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    node.bounds[0][axis] = bounds.min[axis];
+                    node.bounds[1][axis] = bounds.max[axis];
+                }
+
+                int axis = 0;
+                int middle = end - begin > options.subtreeSize ? findSplit(begin, end, centroidBounds, axis) : -1;
+
+                if(middle <= begin || middle >= end)
+                {
+                    // a leaf: the subtree is built when a ray first enters it
+                    unique_ptr<LazySubtree> subtree(new LazySubtree());
+
+                    for(int i = begin; i < end; i++)
+                        subtree->refs.push_back(topSurfaces[i].ref);
+
+                    node.offset = subtrees.size();
+                    node.axis = -1;
+
+                    subtrees.push_back(std::move(subtree));
+                    nodes.push_back(node);
+
+                    return;
+                }
+
+                node.offset = 0;
+                node.axis = axis;
+
+                int nodeIndex = nodes.size();
+                nodes.push_back(node);
+
+                buildNode(begin, middle);
+                nodes[nodeIndex].offset = nodes.size();
+                buildNode(middle, end);
+            }
+    };
+
+    inline bool hitsBox(const LazyBVHNode & node, const float origin[3], const float inverse[3], const int * sign,
+                        float tMin, float tMax)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float tNear = (node.bounds[sign[axis]][axis] - origin[axis]) * inverse[axis];
+            float tFar = (node.bounds[1 - sign[axis]][axis] - origin[axis]) * inverse[axis];
+
+            // slightly enlarged against rounding, comparisons keep tMin / tMax when t is NaN
+            tFar *= 1.0000004f;
+
+            tMin = tNear > tMin ? tNear : tMin;
+            tMax = tFar < tMax ? tFar : tMax;
+        }
+
+        return tMin <= tMax;
+    }
+}
+
+void LazyBVH::build(const Surfaces & surfaces, const LazyBVHBuildOptions & buildOptions, const BVHBuildOptions & subtreeOptions)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    this->surfaces = &surfaces;
+    this->nodes.clear();
+    this->subtrees.clear();
+    this->builtSubtreeCount = 0;
+    this->builtSurfaceCount = 0;
+    this->refineMicroseconds = 0;
+
+    LazyBVHBuildOptions options = buildOptions;
+
+    options.subtreeSize = options.subtreeSize < 1 ? 1 : options.subtreeSize;
+    options.binCount = options.binCount < 2 ? 2 : options.binCount;
+    options.binCount = options.binCount > maxBinCount ? maxBinCount : options.binCount;
+
+    // subtrees are built on render threads, which are the parallelism already
+    this->subtreeOptions = subtreeOptions;
+    this->subtreeOptions.threadCount = 1;
+
+    int surfaceCount = surfaces.size();
+    int triangleCount = surfaces.triangles.size();
+
+    vector<TopSurface> topSurfaces(surfaceCount);
+
+    for(int i = 0; i < surfaceCount; i++)
+    {
+        TopSurface & surface = topSurfaces[i];
+
+        surface.ref.type = i < triangleCount ? triangle_surface : sphere_surface;
+        surface.ref.index = i < triangleCount ? i : i - triangleCount;
+        surface.bounds = surfaces.getBoundingBox(surface.ref);
+
+        for(int axis = 0; axis < 3; axis++)
+            surface.centroid[axis] = surface.bounds.getCentroid(axis);
+    }
+
+    if(surfaceCount > 0)
+    {
+        LazyBVHBuilder builder(options, topSurfaces, this->nodes, this->subtrees);
+        builder.buildNode(0, surfaceCount);
+    }
+
+    this->buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// double-checked: the fast path is one acquire load, the first thread in builds
+// .. under the subtree's lock and publishes the finished BVH with a release store
+const BVH & LazyBVH::getSubtree(int index) const
+{
+    LazySubtree & subtree = *this->subtrees[index];
+
+    const BVH * bvh = subtree.bvh.load(std::memory_order_acquire);
+
+    if(bvh)
+        return *bvh;
+
+    std::lock_guard<std::mutex> lock(subtree.mutex);
+
+    bvh = subtree.bvh.load(std::memory_order_relaxed);
+
+    if(!bvh)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        subtree.owner.reset(new BVH());
+        subtree.owner->build(*this->surfaces, subtree.refs, this->subtreeOptions);
+
+        this->builtSubtreeCount++;
+        this->builtSurfaceCount += subtree.refs.size();
+        this->refineMicroseconds += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+        vector<SurfaceRef>().swap(subtree.refs);
+
+        bvh = subtree.owner.get();
+        subtree.bvh.store(bvh, std::memory_order_release);
+    }
+
+    return *bvh;
+}
+
+bool LazyBVH::getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const
+{
+    TraversalCounts counts;
+    bool hit = false;
+
+    if(!this->nodes.empty())
+    {
+        const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+        const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+        const int * sign = ray.getSign();
+
+        int stack[traversalStackSize];
+        int stackSize = 0;
+        int current = 0;
+
+        while(true)
+        {
+            const LazyBVHNode & node = this->nodes[current];
+
+            counts.nodes++;
+
+            if(hitsBox(node, origin, inverse, sign, epsilon, hit ? hitRecord.t : 1e30f))
+            {
+                if(node.isLeaf())
+                    hit = this->getSubtree(node.offset).findCloserHit(ray, hitRecord, hit, epsilon, counts);
+                else
+                {
+                    // visit the child on the ray's side of the split first
+                    if(sign[node.axis])
+                    {
+                        stack[stackSize++] = current + 1;
+                        current = node.offset;
+                    }
+                    else
+                    {
+                        stack[stackSize++] = node.offset;
+                        current = current + 1;
+                    }
+
+                    continue;
+                }
+            }
+
+            if(stackSize == 0)
+                break;
+
+            current = stack[--stackSize];
+        }
+    }
+
+    this->recordClosestHit(counts);
+
+    return hit;
+}
+
+bool LazyBVH::isOccluded(const Ray & ray, float tMin, float tMax) const
+{
+    TraversalCounts counts;
+    bool occluded = false;
+
+    if(!this->nodes.empty())
+    {
+        const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+        const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+        const int * sign = ray.getSign();
+
+        int stack[traversalStackSize];
+        int stackSize = 0;
+        int current = 0;
+
+        while(true)
+        {
+            const LazyBVHNode & node = this->nodes[current];
+
+            counts.nodes++;
+
+            if(hitsBox(node, origin, inverse, sign, tMin, tMax))
+            {
+                if(node.isLeaf())
+                {
+                    if(this->getSubtree(node.offset).isOccluded(ray, tMin, tMax, counts))
+                    {
+                        occluded = true;
+                        break;
+                    }
+                }
+                else
+                {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+
+                    continue;
+                }
+            }
+
+            if(stackSize == 0)
+                break;
+
+            current = stack[--stackSize];
+        }
+    }
+
+    this->recordOcclusion(counts);
+
+    return occluded;
+}
+
+LazyBVHStatistics LazyBVH::getStatistics() const
+{
+    LazyBVHStatistics stats;
+
+    stats.buildSeconds = this->buildSeconds;
+    stats.refineSeconds = this->refineMicroseconds * 1e-6;
+    stats.surfaceCount = this->surfaces ? this->surfaces->size() : 0;
+    stats.topNodeCount = this->nodes.size();
+    stats.subtreeCount = this->subtrees.size();
+    stats.builtSubtreeCount = this->builtSubtreeCount;
+    stats.builtSurfaceCount = this->builtSurfaceCount;
+
+    return stats;
+}
+
+void LazyBVH::printStatistics(std::ostream & output) const
+{
+    output << this->getStatistics();
+}
+
+std::ostream &operator<<(std::ostream &output, const LazyBVHStatistics & statistics)
+{
+    std::streamsize precision = output.precision();
+
+    output << "lazy BVH: " << statistics.surfaceCount << " surfaces, top levels built in "
+           << fixed << setprecision(3) << statistics.buildSeconds << " s, "
+           << statistics.topNodeCount << " nodes over " << statistics.subtreeCount << " subtrees" << endl;
+    output << "     " << statistics.builtSubtreeCount << " subtrees built (" << statistics.builtSurfaceCount
+           << " surfaces) in " << statistics.refineSeconds << " s" << endl;
+    output.unsetf(ios::floatfield);
+    output.precision(precision);
+
+    return output;
+}
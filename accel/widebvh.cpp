@@ -0,0 +1,795 @@
+#include "../bvh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    // every wide node pushes at most Width - 1 children more than it pops
+    const int wideTraversalStackSize = 512;
+
+    typedef struct WideStackEntry
+    {
+        int child; // as in WideBVHNode::children
+        float t;   // where the ray enters the child's bounds
+    } WideStackEntry;
+
+    // turns the binary tree into wide nodes by pulling grandchildren up:
+    // .. the interior child with the largest surface area is replaced by its
+    // .. two children until Width children are collected
+    template<int Width>
+    class BVHCollapser
+    {
+        private:
+            const vector<BVHNode> & nodes;
+            const vector<SurfaceRef> & refs;
+            const Surfaces & surfaces;
+            vector< WideBVHNode<Width> > & wideNodes;
+            vector<WideBVHLeaf> & leaves;
+            vector<TrianglePacket> & packets;
+            bool largestFirst;
+
+            static float getSurfaceArea(const BVHNode & node)
+            {
+                float dx = node.bounds[1][0] - node.bounds[0][0];
+                float dy = node.bounds[1][1] - node.bounds[0][1];
+                float dz = node.bounds[1][2] - node.bounds[0][2];
+
+                return 2.0f * (dx * dy + dy * dz + dz * dx);
+            }
+
+            int makeLeaf(int binaryIndex)
+            {
+                const BVHNode & node = this->nodes[binaryIndex];
+
+                WideBVHLeaf leaf;
+                leaf.firstPacket = this->packets.size();
+
+                for(int i = 0; i < node.triangleCount; i++)
+                {
+                    if(i % 4 == 0)
+                        this->packets.push_back(TrianglePacket());
+
+                    SurfaceRef ref = this->refs[node.offset + i];
+                    this->packets.back().add(this->surfaces.triangles[ref.index], ref);
+                }
+
+                leaf.packetCount = this->packets.size() - leaf.firstPacket;
+                leaf.firstSphere = node.offset + node.triangleCount;
+                leaf.sphereCount = node.sphereCount;
+
+                this->leaves.push_back(leaf);
+
+                return this->leaves.size() - 1;
+            }
+
+        public:
+            int maxDepth;
+            long long childCount;
+
+            BVHCollapser(const vector<BVHNode> & nodes, const vector<SurfaceRef> & refs, const Surfaces & surfaces,
+                         vector< WideBVHNode<Width> > & wideNodes, vector<WideBVHLeaf> & leaves,
+                         vector<TrianglePacket> & packets, bool largestFirst)
+                : nodes(nodes), refs(refs), surfaces(surfaces), wideNodes(wideNodes), leaves(leaves), packets(packets),
+                  largestFirst(largestFirst), maxDepth(0), childCount(0) {}
+
+            // returns the index of the wide node made of binaryIndex's subtree
+            int collapseNode(int binaryIndex, int depth)
+            {
+                int candidates[Width];
+                int count = 0;
+
+                const BVHNode & node = this->nodes[binaryIndex];
+
+                // a leaf only happens at the root of a tiny scene
+                if(node.isLeaf())
+                    candidates[count++] = binaryIndex;
+                else
+                {
+                    candidates[count++] = binaryIndex + 1;
+                    candidates[count++] = node.offset;
+                }
+
+                while(count < Width)
+                {
+                    int largest = -1;
+                    float largestArea = -1.0f;
+
+                    for(int i = 0; i < count; i++)
+                    {
+                        const BVHNode & candidate = this->nodes[candidates[i]];
+
+                        if(!candidate.isLeaf() && getSurfaceArea(candidate) > largestArea)
+                        {
+                            largest = i;
+                            largestArea = getSurfaceArea(candidate);
+                        }
+                    }
+
+                    if(largest < 0)
+                        break;
+
+                    int opened = candidates[largest];
+
+                    candidates[largest] = opened + 1;
+                    candidates[count++] = this->nodes[opened].offset;
+                }
+
+                // children are collapsed in lane order, so the largest one ends
+                // .. up next to its parent, like in the reordered binary tree
+                if(this->largestFirst)
+                {
+                    for(int i = 1; i < count; i++)
+                    {
+                        for(int j = i; j > 0 && getSurfaceArea(this->nodes[candidates[j]]) > getSurfaceArea(this->nodes[candidates[j - 1]]); j--)
+                            std::swap(candidates[j], candidates[j - 1]);
+                    }
+                }
+
+                int wideIndex = this->wideNodes.size();
+                WideBVHNode<Width> wideNode;
+
+                for(int i = 0; i < Width; i++)
+                {
+                    for(int axis = 0; axis < 3; axis++)
+                    {
+                        wideNode.bounds[0][axis][i] = 1e30f;
+                        wideNode.bounds[1][axis][i] = -1e30f;
+                    }
+
+                    wideNode.children[i] = 0;
+                }
+
+                this->wideNodes.push_back(wideNode);
+
+                this->maxDepth = depth > this->maxDepth ? depth : this->maxDepth;
+                this->childCount += count;
+
+                for(int i = 0; i < count; i++)
+                {
+                    const BVHNode & child = this->nodes[candidates[i]];
+
+                    int encoded = child.isLeaf() ? ~makeLeaf(candidates[i]) : collapseNode(candidates[i], depth + 1);
+
+                    // collapseNode may have moved wideNodes
+                    WideBVHNode<Width> & parent = this->wideNodes[wideIndex];
+
+                    for(int axis = 0; axis < 3; axis++)
+                    {
+                        parent.bounds[0][axis][i] = child.bounds[0][axis];
+                        parent.bounds[1][axis][i] = child.bounds[1][axis];
+                    }
+
+                    parent.children[i] = encoded;
+                }
+
+                return wideIndex;
+            }
+    };
+
+    // grid steps are powers of two, so decoding a bound is exact up to the final addition
+    inline float getGridStep(int exponent)
+    {
+        int bits = (exponent + 127) << 23;
+        float step;
+
+        memcpy(&step, &bits, sizeof(step));
+
+        return step;
+    }
+
+    // smallest exponent whose grid spans extent in 255 steps
+    inline int getGridExponent(float extent)
+    {
+        if(!(extent > 0.0f))
+            return -100;
+
+        int exponent;
+        frexpf(extent / 255.0f, &exponent);
+
+        return exponent < -100 ? -100 : (exponent > 100 ? 100 : exponent);
+    }
+
+    template<int Width>
+    int getValidMask(const WideBVHNode<Width> & node)
+    {
+        int mask = 0;
+
+        for(int i = 0; i < Width; i++)
+        {
+            if(node.bounds[0][0][i] <= node.bounds[1][0][i])
+                mask |= 1 << i;
+        }
+
+        return mask;
+    }
+
+    // rounds every bound outwards onto the grid, checked with the same float
+    // .. arithmetic the traversal decodes with; a coarser grid is used when
+    // .. rounding would not fit into 255 steps
+    template<int Width>
+    void quantizeBounds(const WideBVHNode<Width> & node, int validMask, QuantizedWideBVHNode<Width> & quantized)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float origin = 1e30f;
+            float top = -1e30f;
+
+            for(int i = 0; i < Width; i++)
+            {
+                if(validMask & (1 << i))
+                {
+                    origin = node.bounds[0][axis][i] < origin ? node.bounds[0][axis][i] : origin;
+                    top = node.bounds[1][axis][i] > top ? node.bounds[1][axis][i] : top;
+                }
+            }
+
+            int exponent = getGridExponent(top - origin);
+            bool fits = false;
+
+            while(!fits)
+            {
+                float step = getGridStep(exponent);
+                fits = true;
+
+                for(int i = 0; i < Width; i++)
+                {
+                    quantized.bounds[0][axis][i] = 0;
+                    quantized.bounds[1][axis][i] = 0;
+
+                    if(!(validMask & (1 << i)))
+                        continue;
+
+                    float lower = node.bounds[0][axis][i];
+                    float upper = node.bounds[1][axis][i];
+
+                    float low = floorf((lower - origin) / step);
+                    float high = ceilf((upper - origin) / step);
+
+                    int lowStep = low < 0.0f ? 0 : (low > 255.0f ? 255 : (int)low);
+                    int highStep = high < 0.0f ? 0 : (high > 255.0f ? 255 : (int)high);
+
+                    while(lowStep > 0 && origin + lowStep * step > lower)
+                        lowStep--;
+
+                    while(highStep < 255 && origin + highStep * step < upper)
+                        highStep++;
+
+                    if(origin + lowStep * step > lower || origin + highStep * step < upper)
+                        fits = false;
+
+                    quantized.bounds[0][axis][i] = lowStep;
+                    quantized.bounds[1][axis][i] = highStep;
+                }
+
+                if(!fits)
+                    exponent++;
+            }
+
+            quantized.origin[axis] = origin;
+            quantized.exponent[axis] = exponent;
+        }
+    }
+
+    // breadth first, so that the children of every node get consecutive indices
+    template<int Width>
+    void quantize(const vector< WideBVHNode<Width> > & nodes, const vector<WideBVHLeaf> & leaves,
+                  vector< QuantizedWideBVHNode<Width> > & quantizedNodes, vector<WideBVHLeaf> & quantizedLeaves)
+    {
+        vector< pair<int, int> > queue; // wide node, quantized node
+
+        quantizedNodes.resize(1);
+        queue.push_back(make_pair(0, 0));
+
+        for(size_t next = 0; next < queue.size(); next++)
+        {
+            const WideBVHNode<Width> & node = nodes[queue[next].first];
+            int validMask = getValidMask(node);
+
+            QuantizedWideBVHNode<Width> quantized;
+            quantizeBounds(node, validMask, quantized);
+
+            quantized.firstChild = quantizedNodes.size();
+            quantized.firstLeaf = quantizedLeaves.size();
+            quantized.interiorMask = 0;
+            quantized.validMask = validMask;
+
+            for(int i = 0; i < Width; i++)
+            {
+                if(!(validMask & (1 << i)))
+                    continue;
+
+                if(node.children[i] >= 0)
+                {
+                    quantized.interiorMask |= 1 << i;
+                    queue.push_back(make_pair(node.children[i], (int)quantizedNodes.size()));
+                    quantizedNodes.push_back(QuantizedWideBVHNode<Width>());
+                }
+                else
+                    quantizedLeaves.push_back(leaves[~node.children[i]]);
+            }
+
+            quantizedNodes[queue[next].second] = quantized;
+        }
+    }
+
+    // what the traversal reads, as plain pointers
+    template<class Node>
+    struct WideTree
+    {
+        const Node * nodes;
+        const WideBVHLeaf * leaves;
+        const TrianglePacket * packets;
+        const SurfaceRef * refs;
+        const Sphere * spheres;
+    };
+
+    // one axis of the slab test for all children at once, same arithmetic as
+    // .. the binary traversal
+    template<class FloatN>
+    inline void clipSlabs(const FloatN & nearPlane, const FloatN & farPlane, float origin, float inverse,
+                          FloatN & nearT, FloatN & farT)
+    {
+        FloatN o(origin);
+        FloatN inv(inverse);
+
+        FloatN tNear = (nearPlane - o) * inv;
+        FloatN tFar = (farPlane - o) * inv * FloatN(1.0000004f);
+
+        // max and min keep the second operand when the first is NaN
+        nearT = max(tNear, nearT);
+        farT = min(tFar, farT);
+    }
+
+    // mask of the children hit between tMin and tMax, tNear receives the entry distances
+    template<class FloatN, int Width>
+    inline int hitChildren(const WideBVHNode<Width> & node, const float origin[3], const float inverse[3], const int * sign,
+                           float tMin, float tMax, float * tNear)
+    {
+        FloatN nearT(tMin);
+        FloatN farT(tMax);
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            clipSlabs(FloatN::loadUnaligned(node.bounds[sign[axis]][axis]), FloatN::loadUnaligned(node.bounds[1 - sign[axis]][axis]),
+                      origin[axis], inverse[axis], nearT, farT);
+        }
+
+        nearT.store(tNear);
+
+        return (nearT <= farT).mask();
+    }
+
+    template<class FloatN, int Width>
+    inline int hitChildren(const QuantizedWideBVHNode<Width> & node, const float origin[3], const float inverse[3], const int * sign,
+                           float tMin, float tMax, float * tNear)
+    {
+        FloatN nearT(tMin);
+        FloatN farT(tMax);
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            FloatN gridOrigin(node.origin[axis]);
+            FloatN step(getGridStep(node.exponent[axis]));
+
+            FloatN nearPlane = gridOrigin + FloatN::fromBytes(node.bounds[sign[axis]][axis]) * step;
+            FloatN farPlane = gridOrigin + FloatN::fromBytes(node.bounds[1 - sign[axis]][axis]) * step;
+
+            clipSlabs(nearPlane, farPlane, origin[axis], inverse[axis], nearT, farT);
+        }
+
+        nearT.store(tNear);
+
+        return (nearT <= farT).mask() & node.validMask;
+    }
+
+    template<int Width>
+    inline int getChild(const WideBVHNode<Width> & node, int lane)
+    {
+        return node.children[lane];
+    }
+
+    // children are counted from the first child / leaf by the lanes below
+    template<int Width>
+    inline int getChild(const QuantizedWideBVHNode<Width> & node, int lane)
+    {
+        int below = (1 << lane) - 1;
+
+        if(node.interiorMask & (1 << lane))
+            return node.firstChild + __builtin_popcount(node.interiorMask & below);
+
+        return ~(node.firstLeaf + __builtin_popcount(node.validMask & ~node.interiorMask & below));
+    }
+
+    template<class FloatN, int Width, class Node>
+    bool getClosestHitWide(const WideTree<Node> & tree, const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon,
+                           TraversalCounts & counts)
+    {
+        const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+        const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+        const int * sign = ray.getSign();
+
+        WideStackEntry stack[wideTraversalStackSize];
+        int stackSize = 0;
+        bool hit = hasHit;
+
+        stack[stackSize].child = 0;
+        stack[stackSize].t = epsilon;
+        stackSize++;
+
+        while(stackSize > 0)
+        {
+            WideStackEntry entry = stack[--stackSize];
+
+            // a closer hit was found after the child was pushed
+            if(hit && entry.t > hitRecord.t)
+                continue;
+
+            if(entry.child < 0)
+            {
+                const WideBVHLeaf & leaf = tree.leaves[~entry.child];
+
+                counts.leaves++;
+                counts.surfaces += leaf.sphereCount;
+
+                for(int p = leaf.firstPacket; p < leaf.firstPacket + leaf.packetCount; p++)
+                    counts.surfaces += tree.packets[p].count;
+
+                for(int p = leaf.firstPacket; p < leaf.firstPacket + leaf.packetCount; p++)
+                {
+                    int lane = tree.packets[p].getClosestHit(ray, hitRecord, hit, epsilon);
+
+                    if(lane >= 0)
+                    {
+                        hit = true;
+                        hitRecord.surface = tree.packets[p].refs[lane];
+                    }
+                }
+
+                const SurfaceRef * sphereRefs = tree.refs + leaf.firstSphere;
+                int index = Sphere::getClosestHit(ray, tree.spheres, sphereRefs, leaf.sphereCount, hitRecord, hit, epsilon);
+
+                if(index >= 0)
+                {
+                    hit = true;
+                    hitRecord.surface = sphereRefs[index];
+                }
+
+                continue;
+            }
+
+            const Node & node = tree.nodes[entry.child];
+
+            counts.nodes++;
+
+            alignas(32) float tNear[Width];
+            int mask = hitChildren<FloatN, Width>(node, origin, inverse, sign, epsilon, hit ? hitRecord.t : 1e30f, tNear);
+
+            // hit children go onto the stack far to near, the nearest is visited next
+            int first = stackSize;
+
+            for(; mask != 0; mask &= mask - 1)
+            {
+                int i = __builtin_ctz(mask);
+                int j = stackSize++;
+
+                while(j > first && stack[j - 1].t < tNear[i])
+                {
+                    stack[j] = stack[j - 1];
+                    j--;
+                }
+
+                stack[j].child = getChild(node, i);
+                stack[j].t = tNear[i];
+            }
+        }
+
+        return hit;
+    }
+
+    template<class FloatN, int Width, class Node>
+    bool isOccludedWide(const WideTree<Node> & tree, const Ray & ray, float tMin, float tMax, TraversalCounts & counts)
+    {
+        const float origin[3] = { ray.getOrigin().getX(), ray.getOrigin().getY(), ray.getOrigin().getZ() };
+        const float inverse[3] = { ray.getInverseDirection().getX(), ray.getInverseDirection().getY(), ray.getInverseDirection().getZ() };
+        const int * sign = ray.getSign();
+
+        int stack[wideTraversalStackSize];
+        int stackSize = 0;
+
+        stack[stackSize++] = 0;
+
+        while(stackSize > 0)
+        {
+            int child = stack[--stackSize];
+
+            if(child < 0)
+            {
+                const WideBVHLeaf & leaf = tree.leaves[~child];
+
+                counts.leaves++;
+
+                for(int p = leaf.firstPacket; p < leaf.firstPacket + leaf.packetCount; p++)
+                {
+                    counts.surfaces += tree.packets[p].count;
+
+                    if(tree.packets[p].isOccluding(ray, tMin, tMax))
+                        return true;
+                }
+
+                counts.surfaces += leaf.sphereCount;
+
+                if(Sphere::isOccluding(ray, tree.spheres, tree.refs + leaf.firstSphere, leaf.sphereCount, tMin, tMax))
+                    return true;
+
+                continue;
+            }
+
+            const Node & node = tree.nodes[child];
+
+            counts.nodes++;
+
+            // any order will do for shadow rays
+            alignas(32) float tNear[Width];
+            int mask = hitChildren<FloatN, Width>(node, origin, inverse, sign, tMin, tMax, tNear);
+
+            for(; mask != 0; mask &= mask - 1)
+                stack[stackSize++] = getChild(node, __builtin_ctz(mask));
+        }
+
+        return false;
+    }
+
+    template<class Node>
+    WideTree<Node> getWideTree(const BVHArrays & arrays, const Surfaces & surfaces)
+    {
+        WideTree<Node> tree;
+
+        tree.nodes = static_cast<const Node *>(arrays.wideNodes);
+        tree.leaves = arrays.wideLeaves;
+        tree.packets = arrays.packets;
+        tree.refs = arrays.refs;
+        tree.spheres = surfaces.spheres.data();
+
+        return tree;
+    }
+
+    // a lane the traversal can visit, and the child it visits there
+    template<int Width>
+    inline bool getVisitedChild(const WideBVHNode<Width> & node, int lane, int & child)
+    {
+        child = node.children[lane];
+
+        // unused lanes point at the root, with bounds no ray enters
+        if(child != 0)
+            return true;
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(node.bounds[0][axis][lane] != 1e30f || node.bounds[1][axis][lane] != -1e30f)
+                throw std::runtime_error("Error: A wide BVH node has a child that is its own root.");
+        }
+
+        return false;
+    }
+
+    template<int Width>
+    inline bool getVisitedChild(const QuantizedWideBVHNode<Width> & node, int lane, int & child)
+    {
+        child = getChild(node, lane);
+
+        return (node.validMask & (1 << lane)) != 0;
+    }
+
+    // children after their parent, leaves inside the leaves, and no deeper
+    // .. than the traversal stack holds
+    template<int Width, class Node>
+    void checkWideNodes(const BVHArrays & arrays)
+    {
+        const Node * nodes = static_cast<const Node *>(arrays.wideNodes);
+        vector<int> depths(arrays.wideNodeCount, 1);
+        int maxDepth = 0;
+
+        for(int i = 0; i < arrays.wideNodeCount; i++)
+        {
+            maxDepth = depths[i] > maxDepth ? depths[i] : maxDepth;
+
+            for(int lane = 0; lane < Width; lane++)
+            {
+                int child;
+
+                if(!getVisitedChild(nodes[i], lane, child))
+                    continue;
+
+                if(child < 0 ? ~child >= arrays.wideLeafCount : (child <= i || child >= arrays.wideNodeCount))
+                    throw std::runtime_error("Error: A wide BVH node is outside of the nodes or leaves.");
+
+                if(child > 0)
+                    depths[child] = max(depths[child], depths[i] + 1);
+            }
+        }
+
+        if(maxDepth * (Width - 1) + 1 > wideTraversalStackSize)
+            throw std::runtime_error("Error: BVH is too deep for the traversal stack");
+    }
+}
+
+void BVH::checkWideArrays(const Surfaces & surfaces, const BVHArrays & arrays)
+{
+    if(arrays.width != 4 && arrays.width != 8)
+        throw std::runtime_error("Error: The BVH width is not 2, 4 or 8.");
+
+    if(arrays.wideNodeCount < 0 || arrays.wideLeafCount < 0 || arrays.packetCount < 0 ||
+       (arrays.nodeCount != 0 && arrays.wideNodeCount == 0))
+        throw std::runtime_error("Error: The wide BVH has a negative or missing size.");
+
+    for(int i = 0; i < arrays.packetCount; i++)
+    {
+        const TrianglePacket & packet = arrays.packets[i];
+
+        if(packet.count < 0 || packet.count > 4)
+            throw std::runtime_error("Error: A triangle packet has more than 4 triangles.");
+
+        for(int lane = 0; lane < packet.count; lane++)
+        {
+            if(packet.refs[lane].type != triangle_surface || packet.refs[lane].index >= surfaces.triangles.size())
+                throw std::runtime_error("Error: A triangle packet is outside of the triangles.");
+        }
+    }
+
+    for(int i = 0; i < arrays.wideLeafCount; i++)
+    {
+        const WideBVHLeaf & leaf = arrays.wideLeaves[i];
+
+        if(leaf.firstPacket < 0 || leaf.packetCount < 0 || (long long) leaf.firstPacket + leaf.packetCount > arrays.packetCount ||
+           leaf.firstSphere < 0 || leaf.sphereCount < 0 || (long long) leaf.firstSphere + leaf.sphereCount > arrays.refCount)
+            throw std::runtime_error("Error: A wide BVH leaf is outside of the packets or references.");
+
+        for(int r = leaf.firstSphere; r < leaf.firstSphere + leaf.sphereCount; r++)
+        {
+            if(arrays.refs[r].type != sphere_surface)
+                throw std::runtime_error("Error: A wide BVH leaf refers to the wrong kind of surface.");
+        }
+    }
+
+    if(arrays.width == 4)
+    {
+        if(arrays.compressed)
+            checkWideNodes<4, QuantizedWideBVHNode<4> >(arrays);
+        else
+            checkWideNodes<4, WideBVHNode<4> >(arrays);
+    }
+    else
+    {
+        if(arrays.compressed)
+            checkWideNodes<8, QuantizedWideBVHNode<8> >(arrays);
+        else
+            checkWideNodes<8, WideBVHNode<8> >(arrays);
+    }
+}
+
+void BVH::buildWide(const BVHBuildOptions & options)
+{
+    BVHStatistics & stats = this->statistics;
+
+    stats.width = this->width;
+    stats.compressed = options.compressNodes;
+
+    if(this->nodes.empty())
+        return;
+
+    int maxDepth;
+    long long childCount;
+
+    if(this->width == 4)
+    {
+        BVHCollapser<4> collapser(this->nodes, this->refs, *this->surfaces, this->nodes4, this->wideLeaves, this->packets,
+                                   options.reorderLayout);
+        collapser.collapseNode(0, 1);
+
+        maxDepth = collapser.maxDepth;
+        childCount = collapser.childCount;
+        stats.wideNodeCount = this->nodes4.size();
+        stats.nodeBytes = this->nodes4.size() * sizeof(WideBVHNode<4>);
+
+        if(options.compressNodes)
+        {
+            vector<WideBVHLeaf> quantizedLeaves;
+            quantize(this->nodes4, this->wideLeaves, this->quantizedNodes4, quantizedLeaves);
+
+            this->wideLeaves.swap(quantizedLeaves);
+            vector< WideBVHNode<4> >().swap(this->nodes4);
+            stats.nodeBytes = this->quantizedNodes4.size() * sizeof(QuantizedWideBVHNode<4>);
+        }
+    }
+    else
+    {
+        BVHCollapser<8> collapser(this->nodes, this->refs, *this->surfaces, this->nodes8, this->wideLeaves, this->packets,
+                                   options.reorderLayout);
+        collapser.collapseNode(0, 1);
+
+        maxDepth = collapser.maxDepth;
+        childCount = collapser.childCount;
+        stats.wideNodeCount = this->nodes8.size();
+        stats.nodeBytes = this->nodes8.size() * sizeof(WideBVHNode<8>);
+
+        if(options.compressNodes)
+        {
+            vector<WideBVHLeaf> quantizedLeaves;
+            quantize(this->nodes8, this->wideLeaves, this->quantizedNodes8, quantizedLeaves);
+
+            this->wideLeaves.swap(quantizedLeaves);
+            vector< WideBVHNode<8> >().swap(this->nodes8);
+            stats.nodeBytes = this->quantizedNodes8.size() * sizeof(QuantizedWideBVHNode<8>);
+        }
+    }
+
+    if(maxDepth * (this->width - 1) + 1 > wideTraversalStackSize)
+        throw std::runtime_error("Error: BVH is too deep for the traversal stack");
+
+    this->compressed = options.compressNodes;
+
+    stats.wideMaxDepth = maxDepth;
+    stats.averageChildCount = (float)childCount / stats.wideNodeCount;
+    stats.packetCount = this->packets.size();
+    stats.memoryBytes = stats.nodeBytes + this->wideLeaves.size() * sizeof(WideBVHLeaf) +
+                         this->packets.size() * sizeof(TrianglePacket) +
+                         this->refs.size() * sizeof(SurfaceRef);
+}
+
+bool BVH::getClosestHitWide(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const
+{
+    if(this->arrays.nodeCount == 0)
+        return hasHit;
+
+    if(this->compressed)
+    {
+        if(this->width == 4)
+        {
+            return ::getClosestHitWide<Float4, 4>(getWideTree<QuantizedWideBVHNode<4> >(this->arrays, *this->surfaces),
+                                                  ray, hitRecord, hasHit, epsilon, counts);
+        }
+
+        return ::getClosestHitWide<Float8, 8>(getWideTree<QuantizedWideBVHNode<8> >(this->arrays, *this->surfaces),
+                                              ray, hitRecord, hasHit, epsilon, counts);
+    }
+
+    if(this->width == 4)
+    {
+        return ::getClosestHitWide<Float4, 4>(getWideTree<WideBVHNode<4> >(this->arrays, *this->surfaces),
+                                              ray, hitRecord, hasHit, epsilon, counts);
+    }
+
+    return ::getClosestHitWide<Float8, 8>(getWideTree<WideBVHNode<8> >(this->arrays, *this->surfaces),
+                                          ray, hitRecord, hasHit, epsilon, counts);
+}
+
+bool BVH::isOccludedWide(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const
+{
+    if(this->arrays.nodeCount == 0)
+        return false;
+
+    if(this->compressed)
+    {
+        if(this->width == 4)
+        {
+            return ::isOccludedWide<Float4, 4>(getWideTree<QuantizedWideBVHNode<4> >(this->arrays, *this->surfaces),
+                                               ray, tMin, tMax, counts);
+        }
+
+        return ::isOccludedWide<Float8, 8>(getWideTree<QuantizedWideBVHNode<8> >(this->arrays, *this->surfaces),
+                                           ray, tMin, tMax, counts);
+    }
+
+    if(this->width == 4)
+    {
+        return ::isOccludedWide<Float4, 4>(getWideTree<WideBVHNode<4> >(this->arrays, *this->surfaces),
+                                           ray, tMin, tMax, counts);
+    }
+
+    return ::isOccludedWide<Float8, 8>(getWideTree<WideBVHNode<8> >(this->arrays, *this->surfaces),
+                                       ray, tMin, tMax, counts);
+}
@@ -0,0 +1,98 @@
+#ifndef __ACCELERATOR_H__
+#define __ACCELERATOR_H__
+
+#include "geometry.hpp"
+#include <iostream>
+#include <mutex>
+#include <string>
+
+enum AcceleratorType
+{
+    scene_accelerator,  // whatever the scene file asks for, the BVH if it asks for nothing
+    bvh_accelerator,
+    lazy_bvh_accelerator,
+    grid_accelerator,
+    kdtree_accelerator
+};
+
+// "bvh", "lazybvh", "grid" or "kdtree", false for anything else
+bool parseAcceleratorType(const std::string & name, AcceleratorType & type);
+
+const char * getAcceleratorName(AcceleratorType type);
+
+// traversal work, summed over all rays while Accelerator::setTraversalCounting is on
+typedef struct TraversalCounts
+{
+    long long rays;
+    long long nodes;    // binary nodes whose box was tested, wide nodes, kd-tree nodes or grid cells visited
+    long long leaves;   // leaves or cells with surfaces in them
+    long long surfaces; // intersection tests
+
+    TraversalCounts() : rays(0), nodes(0), leaves(0), surfaces(0) {}
+} TraversalCounts;
+
+// per ray averages
+std::ostream &operator<<(std::ostream &output, const TraversalCounts & counts);
+
+// spatial index over the surfaces of a scene that rays are traced through
+// picking one costs a single virtual call per ray, everything below it is
+// .. the accelerator's own non-virtual traversal
+class Accelerator
+{
+    private:
+        bool countTraversal;
+        mutable std::mutex countMutex;
+        mutable TraversalCounts closestHitCounts;
+        mutable TraversalCounts occlusionCounts;
+
+        void addTraversal(TraversalCounts & total, const TraversalCounts & counts) const;
+
+    protected:
+        const Surfaces * surfaces;
+
+        // the work of one ray, only kept while counting is on
+        void recordClosestHit(const TraversalCounts & counts) const
+        {
+            if(this->countTraversal)
+                this->addTraversal(this->closestHitCounts, counts);
+        }
+
+        void recordOcclusion(const TraversalCounts & counts) const
+        {
+            if(this->countTraversal)
+                this->addTraversal(this->occlusionCounts, counts);
+        }
+
+    public:
+        Accelerator() : countTraversal(false), surfaces(NULL) {}
+        virtual ~Accelerator() {}
+
+        // closest hit with t > epsilon
+        virtual bool getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const = 0;
+
+        // true if any surface is hit with tMin < t <= tMax
+        virtual bool isOccluded(const Ray & ray, float tMin, float tMax) const = 0;
+
+        // build time, size and quality
+        virtual void printStatistics(std::ostream & output) const = 0;
+
+        const Surfaces & getSurfaces() const
+        {
+            return *this->surfaces;
+        }
+
+        // counting costs a lock per ray, it is meant for --stats runs; resets the counts
+        void setTraversalCounting(bool enabled);
+
+        const TraversalCounts & getClosestHitCounts() const
+        {
+            return this->closestHitCounts;
+        }
+
+        const TraversalCounts & getOcclusionCounts() const
+        {
+            return this->occlusionCounts;
+        }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+#include "geometry.hpp"
+#include "transformation.hpp"
+#include <string>
+#include <vector>
+
+// where a camera is at one frame, frames between keys are interpolated linearly
+typedef struct CameraKey
+{
+    int frame;
+    Position3 position;
+    Vector3 gaze;
+    Vector3 up;
+} CameraKey;
+
+// the transformation of an object at one frame: scaling, then rotation by
+// .. angle degrees about axis, then translation; every part is
+// .. interpolated linearly between keys
+typedef struct TransformationKey
+{
+    int frame;
+    Vector3 scaling;
+    float angle;
+    Vector3 axis;
+    Vector3 translation;
+
+    TransformationKey() : frame(0), scaling(1.0f, 1.0f, 1.0f), angle(0.0f), axis(0.0f, 1.0f, 0.0f) {}
+
+    bool operator==(const TransformationKey & rhs) const;
+
+    Transformation getTransformation() const;
+} TransformationKey;
+
+typedef struct ObjectAnimation
+{
+    int object;                          // in Scene::objects
+    std::vector<TransformationKey> keys; // by frame
+    TransformationKey current;           // what the object was last given
+    bool hasCurrent;
+
+    ObjectAnimation() : object(-1), hasCurrent(false) {}
+} ObjectAnimation;
+
+// the <Animation> element of a scene file
+typedef struct Animation
+{
+    int frameCount;                                    // 0: no animation, every camera is rendered once
+    std::vector< std::vector<CameraKey> > cameraKeys;  // per camera, by frame, empty for cameras that stand still
+    std::vector<ObjectAnimation> objects;
+
+    Animation() : frameCount(0) {}
+} Animation;
+
+// keys must be sorted by frame and must not be empty; before the first and
+// .. after the last key the nearest key holds
+CameraKey interpolate(const std::vector<CameraKey> & keys, int frame);
+TransformationKey interpolate(const std::vector<TransformationKey> & keys, int frame);
+
+// name of a camera's image at a frame: "name_0007.ppm" for "name.ppm"
+std::string getFrameImageName(const std::string & imageName, int frame);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// bump allocator for scene objects
+// memory is taken from the system in large chunks and handed out back to back,
+// .. so there is no per-object malloc header and objects created one after
+// .. another (e.g. the vertices of a mesh) are adjacent in memory
+// nothing is freed one by one, all chunks are released together by the destructor,
+// .. therefore only trivially destructible objects should be created in it
+class Arena
+{
+    private:
+        std::vector<char*> chunks;
+        char* current;
+        size_t remaining;
+        size_t chunkSize;
+        size_t allocatedBytes;
+
+        Arena(const Arena &);
+        Arena & operator=(const Arena &);
+
+    public:
+        static const size_t defaultChunkSize = 1 << 20;
+
+        Arena(size_t chunkSize = defaultChunkSize)
+            : current(NULL), remaining(0), chunkSize(chunkSize), allocatedBytes(0) {}
+
+        ~Arena()
+        {
+            release();
+        }
+
+        // raw memory, aligned to alignment which must be a power of two
+        void* allocate(size_t size, size_t alignment);
+
+        // frees every chunk at once
+        void release();
+
+        // construct a T inside the arena
+        template<class T>
+        T* create(const T & value)
+        {
+            return new (allocate(sizeof(T), alignof(T))) T(value);
+        }
+
+        template<class T>
+        T* create()
+        {
+            return new (allocate(sizeof(T), alignof(T))) T();
+        }
+
+        // uninitialized array of count T's
+        template<class T>
+        T* createArray(size_t count)
+        {
+            return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        // number of chunks taken from the system
+        size_t getChunkCount() const
+        {
+            return this->chunks.size();
+        }
+
+        // bytes handed out to callers
+        size_t getAllocatedBytes() const
+        {
+            return this->allocatedBytes;
+        }
+};
+
+#endif
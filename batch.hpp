@@ -0,0 +1,45 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "scene.hpp"
+#include "loadcache.hpp"
+#include "threadpool.hpp"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// raytracer <manifest> --batch renders every scene file the manifest lists in
+// .. one process: the scenes load and render on one thread pool, and their
+// .. textures and meshes go through one LoadCache, so the images and meshes
+// .. they share are decoded and parsed once
+// as many scenes as the pool has threads are in flight at once, their
+// .. accelerators built on their share of the threads and their tiles
+// .. rendered on the whole pool
+class BatchRenderer
+{
+    private:
+        const Scene & settings;     // accelerator choice, build options and threads of every scene
+        ThreadPool pool;
+        LoadCache cache;
+        std::mutex outputMutex;
+
+        // false if it failed, which is reported
+        bool renderScene(const std::string & path, int buildThreads);
+
+    public:
+        // cacheBudget in bytes
+        BatchRenderer(const Scene & settings, size_t cacheBudget);
+
+        // one scene file a line, empty lines and lines starting with # are skipped
+        static std::vector<std::string> readManifest(const std::string & path);
+
+        // the number of scenes that failed
+        int run(const std::vector<std::string> & paths);
+
+        LoadCacheStatistics getCacheStatistics()
+        {
+            return this->cache.getStatistics();
+        }
+};
+
+#endif
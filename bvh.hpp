@@ -0,0 +1,252 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include "accelerator.hpp"
+#include <vector>
+#include <iostream>
+
+class ThreadPool;
+
+// one node of the flattened bounding volume hierarchy, 32 bytes
+// nodes are stored depth first: one child of an interior node is the next
+// .. node in the array, offset is the index of the other one
+typedef struct BVHNode
+{
+    float bounds[2][3];          // bounds[0]: min corner, bounds[1]: max corner
+    int offset;                  // leaf: first surface in BVH::refs, interior: second child
+    unsigned char triangleCount; // leaf: refs start with this many triangles...
+    unsigned char sphereCount;   // ... followed by this many spheres, both 0 for interior nodes
+    unsigned char axis;          // interior: split axis, decides which child is visited first
+    unsigned char swapped;       // interior: 0 if the next node is the child below the split, 1 if it is the one above
+
+    bool isLeaf() const
+    {
+        return triangleCount != 0 || sphereCount != 0;
+    }
+} BVHNode;
+
+// collapsed node of a 4 or 8 wide BVH, the bounds of all children are tested
+// .. at once with Float4 / Float8
+// children[i] >= 0: index of an interior node, < 0: ~index of a WideBVHLeaf
+// .. unused children have empty bounds, which no ray hits
+template<int Width>
+struct WideBVHNode
+{
+    float bounds[2][3][Width]; // [min / max corner][axis][child]
+    int children[Width];
+};
+
+// WideBVHNode with child bounds stored as 8-bit steps on a grid that covers
+// .. the node; steps are rounded outwards, so decoded boxes always contain
+// .. the exact ones
+// children are not stored one by one: the interior children of a node follow
+// .. each other in the node array, and so do its leaves in the leaf array
+template<int Width>
+struct QuantizedWideBVHNode
+{
+    float origin[3];                     // grid origin, the min corner of all children
+    int firstChild;                      // interior child of the lowest lane
+    int firstLeaf;                       // leaf child of the lowest lane
+    unsigned char bounds[2][3][Width];   // [min / max corner][axis][child] in grid steps
+    signed char exponent[3];             // grid step 2^exponent per axis
+    unsigned char interiorMask;          // bit i: child i is an interior node
+    unsigned char validMask;             // bit i: child i is used
+};
+
+typedef struct WideBVHLeaf
+{
+    int firstPacket;  // triangles, in BVH::packets
+    int packetCount;
+    int firstSphere;  // spheres, in BVH::refs
+    int sphereCount;
+} WideBVHLeaf;
+
+// what the traversal reads, as plain pointers: into the vectors of the BVH
+// .. after a build, or into memory someone else owns (see compiled.hpp)
+typedef struct BVHArrays
+{
+    int width;
+    bool compressed;
+    const BVHNode * nodes;          // the binary tree, for every width
+    int nodeCount;
+    const SurfaceRef * refs;
+    int refCount;
+    const void * wideNodes;         // WideBVHNode<width>, or QuantizedWideBVHNode<width> if compressed
+    int wideNodeCount;
+    const WideBVHLeaf * wideLeaves;
+    int wideLeafCount;
+    const TrianglePacket * packets;
+    int packetCount;
+
+    BVHArrays()
+        : width(2), compressed(false), nodes(NULL), nodeCount(0), refs(NULL), refCount(0),
+          wideNodes(NULL), wideNodeCount(0), wideLeaves(NULL), wideLeafCount(0), packets(NULL), packetCount(0) {}
+} BVHArrays;
+
+// knobs of the binned SAH builder
+typedef struct BVHBuildOptions
+{
+    int binCount;           // SAH candidate planes per axis are the bin borders, at most 64
+    int maxLeafSize;        // a leaf is forced above this many surfaces (at most 255 per type)
+    int threadCount;        // 0: one per hardware thread
+    int width;              // 2: binary nodes, 4 / 8: binary tree collapsed into wide nodes
+    bool reorderLayout;     // nodes depth first with the larger child next to its parent, refs in leaf order
+    bool compressNodes;     // wide trees only: quantized 8-bit child bounds instead of floats
+    bool spatialSplits;     // SBVH: also split nodes by planes, surfaces crossing them are referenced twice
+    float spatialSplitBudget; // SBVH: extra references allowed, relative to the surface count
+    float traversalCost;    // SAH cost of visiting an interior node...
+    float intersectionCost; // ... relative to intersecting one surface, or one packet of 4 triangles for wide trees
+
+    BVHBuildOptions()
+        : binCount(16), maxLeafSize(4), threadCount(0), width(2), reorderLayout(true), compressNodes(false),
+          spatialSplits(false), spatialSplitBudget(0.3f),
+          traversalCost(1.0f), intersectionCost(1.0f) {}
+} BVHBuildOptions;
+
+// where BVH::reorderSurfaces moved the surfaces, new index by old index
+typedef struct SurfaceOrder
+{
+    std::vector<int> triangles;
+    std::vector<int> spheres;
+} SurfaceOrder;
+
+// knobs of BVH::refit
+typedef struct BVHRefitOptions
+{
+    float rebuildThreshold;   // subtrees whose surface area grew by more than this factor since they were built are rebuilt, 0: never
+    float maxRebuildFraction; // rebuild the whole tree instead when those subtrees hold more than this fraction of the refs
+
+    BVHRefitOptions() : rebuildThreshold(2.0f), maxRebuildFraction(0.5f) {}
+} BVHRefitOptions;
+
+// build time and quality of the tree
+typedef struct BVHStatistics
+{
+    double buildSeconds;
+    int threadCount;
+    int width;
+    int surfaceCount;
+    int referenceCount;     // more than surfaceCount with spatial splits
+    int nodeCount;
+    int leafCount;
+    int maxDepth;
+    int minLeafSize;
+    int maxLeafSize;
+    float averageLeafSize;
+    float sahCost;          // expected cost of a random ray, in units of intersectionCost
+    std::vector<int> leafSizeHistogram; // leafSizeHistogram[n]: leaves with n surfaces
+    int wideNodeCount;      // wide trees only
+    int wideMaxDepth;
+    float averageChildCount;
+    int packetCount;
+    bool compressed;
+    size_t memoryBytes;     // nodes, refs and packets used by the traversal
+    size_t nodeBytes;       // the nodes alone
+    int refitCount;         // refits since the last full build
+    double refitSeconds;    // the last refit, rebuilt subtrees included
+    int rebuiltSubtreeCount; // by the last refit
+    int rebuiltReferenceCount;
+    bool mapped;            // traversed from arrays it does not own (BVH::useArrays), nothing else is known
+
+    BVHStatistics()
+        : buildSeconds(0.0), threadCount(0), width(2), surfaceCount(0), referenceCount(0), nodeCount(0), leafCount(0),
+          maxDepth(0), minLeafSize(0), maxLeafSize(0), averageLeafSize(0.0f), sahCost(0.0f),
+          wideNodeCount(0), wideMaxDepth(0), averageChildCount(0.0f), packetCount(0), compressed(false), memoryBytes(0), nodeBytes(0),
+          refitCount(0), refitSeconds(0.0), rebuiltSubtreeCount(0), rebuiltReferenceCount(0), mapped(false) {}
+} BVHStatistics;
+
+std::ostream &operator<<(std::ostream &output, const BVHStatistics & statistics);
+
+// bounding volume hierarchy over the surfaces of a scene
+// leaves reference surfaces by SurfaceRef, grouped by type so that every leaf
+// .. runs one non-virtual loop per surface type
+// with width 4 or 8 the binary tree is collapsed into wide nodes after the
+// .. build and traversed instead, their leaves hold triangles in packets
+class BVH : public Accelerator
+{
+    private:
+        int width;
+        std::vector<BVHNode> nodes;
+        std::vector<SurfaceRef> refs;
+        std::vector< WideBVHNode<4> > nodes4;
+        std::vector< WideBVHNode<8> > nodes8;
+        std::vector< QuantizedWideBVHNode<4> > quantizedNodes4; // replace nodes4 / nodes8 when compressed
+        std::vector< QuantizedWideBVHNode<8> > quantizedNodes8;
+        bool compressed;
+        std::vector<WideBVHLeaf> wideLeaves;
+        std::vector<TrianglePacket> packets;
+        BVHBuildOptions options;        // what the tree was built with, refit rebuilds with them
+        std::vector<float> buildAreas;  // surface area of every node when it was built, filled by the first refit
+        BVHStatistics statistics;
+        BVHArrays arrays;
+
+        void build(const Surfaces & surfaces, const SurfaceRef * subset, int surfaceCount, const BVHBuildOptions & options);
+        void reorderNodes();
+        void computeStatistics(const BVHBuildOptions & options);
+        void refitNodes();
+        void rebuildSubtrees(const std::vector<int> & roots);
+        void clearWide();
+        void updateArrays();
+
+        bool getClosestHitBinary(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const;
+        bool isOccludedBinary(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const;
+
+        // throw unless every index of the arrays is inside the array it
+        // .. refers to, children come after their parent and the traversal
+        // .. stack holds the tree's depth
+        static void checkBinaryArrays(const Surfaces & surfaces, const BVHArrays & arrays);
+
+        // accel/widebvh.cpp
+        static void checkWideArrays(const Surfaces & surfaces, const BVHArrays & arrays);
+        void buildWide(const BVHBuildOptions & options);
+        bool getClosestHitWide(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const;
+        bool isOccludedWide(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const;
+
+    public:
+        BVH() : width(2), compressed(false) {}
+
+        // binned SAH build, parallel over subtrees and over the surfaces of large nodes
+        // surfaces must outlive the BVH and must not change afterwards, except by reorderSurfaces
+        void build(const Surfaces & surfaces, const BVHBuildOptions & options);
+
+        // the same over some of the surfaces only
+        void build(const Surfaces & surfaces, const std::vector<SurfaceRef> & subset, const BVHBuildOptions & options);
+
+        // moves the surfaces the BVH was built over into the order their leaves
+        // .. are stored in, so that leaves read neighbouring surfaces; the refs
+        // .. are renumbered to match
+        SurfaceOrder reorderSurfaces(Surfaces & surfaces);
+
+        // after surfaces moved: recomputes the bounds of every node bottom-up from
+        // .. the surfaces, keeping the topology; subtrees that grew too much are
+        // .. rebuilt in place over the surfaces they hold, or the whole tree when
+        // .. they hold most of them; surfaces keep their indices either way
+        void refit(const BVHRefitOptions & options);
+
+        bool getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const;
+        bool isOccluded(const Ray & ray, float tMin, float tMax) const;
+        void printStatistics(std::ostream & output) const;
+
+        // for accelerators made of several BVHs: continues a search that may
+        // .. already have found hitRecord, only closer hits replace it; counts
+        // .. receive the work instead of the totals
+        bool findCloserHit(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon, TraversalCounts & counts) const;
+        bool isOccluded(const Ray & ray, float tMin, float tMax, TraversalCounts & counts) const;
+
+        const BVHStatistics & getStatistics() const
+        {
+            return this->statistics;
+        }
+        
+        const BVHArrays & getArrays() const
+        {
+            return this->arrays;
+        }
+        
+        // traces through arrays of a tree built over surfaces before, which
+        // .. stay owned by the caller; the tree cannot be refit; throws if
+        // .. the arrays refer outside of themselves or of the surfaces
+        void useArrays(const Surfaces & surfaces, const BVHArrays & arrays);
+};
+
+#endif
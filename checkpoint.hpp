@@ -0,0 +1,85 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "image/image.hpp"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the tiles of an image finished so far, kept in a sidecar file next to the
+// .. image so that a render killed before image.write can be resumed
+// the file is a header and then one record per tile, its index and its
+// .. pixels, in the order the tiles finished; a record cut off by the kill is
+// .. dropped when the file is read, so the file is only ever appended to
+// render threads only queue the index of a tile they finished, a writer
+// .. thread appends the queued tiles every interval seconds and syncs the file
+
+typedef struct CheckpointHeader
+{
+    char magic[8];
+    unsigned int version;
+    int width, height;
+    int tileSize;
+    unsigned long long fingerprint;     // of the scene and camera, see Scene::getRenderFingerprint
+} CheckpointHeader;
+
+class RenderCheckpoint
+{
+    private:
+        std::string path;
+        Image & image;
+        CheckpointHeader header;
+        int tileColumns, tileRows;
+        std::vector<bool> done;
+        long validSize;                 // of the file resume read, 0 to start it over
+
+        FILE * file;
+        double interval;
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<int> finished;      // queued since the last write
+        bool stopping;
+
+        void writeLoop();
+        void appendTiles(const std::vector<int> & tiles);
+
+    public:
+        RenderCheckpoint(const std::string & path, Image & image, int width, int height, int tileSize,
+                         unsigned long long fingerprint, double interval);
+        ~RenderCheckpoint();
+
+        // reads the tiles a killed render left in the file into image and
+        // .. returns how many, 0 if there is no file or it is of another render
+        int resume();
+
+        int getTileCount() const
+        {
+            return this->tileColumns * this->tileRows;
+        }
+
+        ImageTile getTile(int index) const;
+
+        bool isDone(int index) const
+        {
+            return this->done[index];
+        }
+
+        // opens the file, started over unless resume restored tiles from it,
+        // .. and starts the writer
+        void start();
+
+        // called from the render thread once the tile's pixels are in image
+        void tileDone(int index);
+
+        // writes what is queued and stops the writer
+        void stop();
+
+        // the image is written, the tiles are not needed anymore
+        void remove();
+};
+
+#endif
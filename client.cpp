@@ -0,0 +1,133 @@
+#include "socket.hpp"
+#include "image/ppm.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// sends one command to a raytracer --serve server and prints what comes back;
+// .. the tiles of a render are printed as their header lines and, with
+// .. --save, put together into an image of the rendered region
+
+void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <socket> <command ...> [--save <file.ppm>]" << std::endl
+              << "  load <scene.xml> | unload <scene> | cameras <scene> | camera <scene> <n> | status | shutdown" << std::endl
+              << "  render <scene> [camera=n position=x,y,z gaze=x,y,z up=x,y,z width=n height=n" << std::endl
+              << "                  region=x,y,width,height tile=n priority=n output=file.ppm]" << std::endl;
+}
+
+typedef struct Tile
+{
+    int x, y, width, height;
+    std::vector<unsigned char> pixels;
+} Tile;
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string command;
+    std::string savePath;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            savePath = argv[++i];
+        else
+            command += (command.empty() ? "" : " ") + std::string(argv[i]);
+    }
+
+    try
+    {
+        int socket = connectUnixSocket(argv[1]);
+        SocketReader reader(socket);
+        std::string line;
+
+        command += "\n";
+
+        if(!sendAll(socket, command.data(), command.size()) || !reader.readLine(line))
+            throw std::runtime_error("Error: The server closed the connection.");
+
+        std::cout << line << std::endl;
+
+        if(line.compare(0, 3, "ok ") != 0 || command.compare(0, 7, "render ") != 0)
+            return line.compare(0, 2, "ok") == 0 ? 0 : 1;
+
+        std::vector<Tile> tiles;
+
+        // the job's tiles, until it is done or failed
+        while(true)
+        {
+            if(!reader.readLine(line))
+                throw std::runtime_error("Error: The server closed the connection.");
+
+            std::cout << line << std::endl;
+
+            std::istringstream reply(line);
+            std::string kind;
+            int job;
+
+            reply >> kind >> job;
+
+            if(kind == "done")
+                break;
+
+            if(kind != "tile")
+                return 1;
+
+            Tile tile;
+            reply >> tile.x >> tile.y >> tile.width >> tile.height;
+
+            tile.pixels.resize(tile.width * tile.height * 3);
+
+            if(!reader.read(tile.pixels.data(), tile.pixels.size()))
+                throw std::runtime_error("Error: The server closed the connection.");
+
+            if(!savePath.empty())
+                tiles.push_back(tile);
+        }
+
+        if(!savePath.empty() && !tiles.empty())
+        {
+            // the tiles cover the region, its corner is the smallest tile corner
+            int left = tiles[0].x, top = tiles[0].y, right = 0, bottom = 0;
+
+            for(size_t i = 0; i < tiles.size(); i++)
+            {
+                left = std::min(left, tiles[i].x);
+                top = std::min(top, tiles[i].y);
+                right = std::max(right, tiles[i].x + tiles[i].width);
+                bottom = std::max(bottom, tiles[i].y + tiles[i].height);
+            }
+
+            int width = right - left;
+            std::vector<unsigned char> image(width * (bottom - top) * 3, 0);
+
+            for(size_t i = 0; i < tiles.size(); i++)
+            {
+                const Tile & tile = tiles[i];
+
+                for(int y = 0; y < tile.height; y++)
+                    memcpy(&image[((tile.y - top + y) * width + tile.x - left) * 3], &tile.pixels[y * tile.width * 3], tile.width * 3);
+            }
+
+            write_ppm(savePath.c_str(), image.data(), width, bottom - top);
+        }
+    }
+    catch(const std::exception & exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef __COMPILED_H__
+#define __COMPILED_H__
+
+#include <cstddef>
+#include <string>
+
+class Scene;
+struct Material;
+
+// a loaded scene written to one file that renderers map read-only instead of
+// .. loading the xml: the materials, textures, vertices, texture coordinates,
+// .. surfaces and the BVH are used where they are in the mapping, so the page
+// .. cache holds them once however many processes render the scene
+// references inside the file are OffsetPointers, or offsets for the BVH, so
+// .. the mapping can be at any address; the objects are stored as they are in
+// .. memory, a file is only accepted by a build with the same layout
+// compiled scenes are traced with their BVH and cannot be animated
+
+// where a section of the file starts and how many elements it has
+typedef struct CompiledSection
+{
+    unsigned long long offset;
+    unsigned long long count;
+} CompiledSection;
+
+typedef struct CompiledCamera
+{
+    float position[3];
+    float gaze[3];
+    float up[3];
+    float nearPlane[4];     // left, right, bottom, top
+    float nearDistance;
+    int width, height;
+    int crop[4];            // x, y, width, height
+    char imageName[256];
+} CompiledCamera;
+
+typedef struct CompiledSceneHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int layout[12];    // sizes of the types stored as they are in memory
+    unsigned long long fileSize;
+
+    float backgroundColor[3];
+    float shadowRayEpsilon;
+    int maxRecursionDepth;
+    float ambientLight[3];
+    int bvhWidth;
+    int bvhCompressed;
+    int bvhNodeCount;           // binary nodes are only stored for width 2, wide trees are traversed without them
+
+    CompiledSection cameras;
+    CompiledSection pointLights;
+    CompiledSection materials;
+    CompiledSection textures;
+    CompiledSection textureImages; // bytes
+    CompiledSection texCoords;
+    CompiledSection vertices;
+    CompiledSection triangles;
+    CompiledSection spheres;
+    CompiledSection bvhNodes;
+    CompiledSection bvhRefs;
+    CompiledSection wideNodes;
+    CompiledSection wideLeaves;
+    CompiledSection packets;
+} CompiledSceneHeader;
+
+// owns the mapping of a compiled scene, which the Scene it was mapped into
+// .. points into while it exists
+class CompiledScene
+{
+    private:
+        void * mapping;
+        size_t size;
+        const Material * materials;
+
+        CompiledScene(const CompiledScene &);
+        CompiledScene & operator=(const CompiledScene &);
+
+        // throws unless the sections are inside the mapping and everything
+        // .. the cameras, textures and surfaces point to is inside its section
+        void checkContents(const CompiledSceneHeader & header, const std::string & path) const;
+
+    public:
+        CompiledScene() : mapping(NULL), size(0), materials(NULL) {}
+        ~CompiledScene();
+
+        // true if the file starts like a compiled scene
+        static bool isCompiledScene(const std::string & path);
+
+        // the scene must be traced with its BVH; the file is written under a
+        // .. temporary name and renamed, processes mapping the old one keep it
+        static void write(const Scene & scene, const std::string & path);
+
+        // maps the file and sets the scene up to render from it; throws if it
+        // .. is not a compiled scene of this build
+        void map(const std::string & path, Scene & scene);
+
+        size_t getSize() const
+        {
+            return this->size;
+        }
+
+        // the materials the surfaces point to, in the order of Scene::materials
+        const Material * getMaterials() const
+        {
+            return this->materials;
+        }
+};
+
+#endif
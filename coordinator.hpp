@@ -0,0 +1,72 @@
+#ifndef __COORDINATOR_H__
+#define __COORDINATOR_H__
+
+#include "image/image.hpp"
+#include "socket.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// renders a scene on worker processes: every worker is a raytracer --serve
+// .. server (see server.hpp) that loads the scene once, the coordinator cuts
+// .. each camera's image into tiles, hands them out as region jobs and puts
+// .. the streamed pixels together; the tiles of a worker whose connection
+// .. breaks go to the others
+// only the socket connection is Unix specific, the protocol is plain lines
+// .. and bytes over a stream and works the same over TCP
+
+typedef struct CoordinatorWorker
+{
+    std::string socketPath;
+    pid_t process;          // spawned by the coordinator, -1 for a server started elsewhere
+    int socket;             // -1 until connected, and once the worker is lost
+    std::unique_ptr<SocketReader> reader;
+    int scene;              // handle of the scene on the worker
+    int renderedTiles;
+
+    CoordinatorWorker() : process(-1), socket(-1), scene(0), renderedTiles(0) {}
+} CoordinatorWorker;
+
+class TileCoordinator
+{
+    private:
+        std::vector<std::unique_ptr<CoordinatorWorker> > workers;
+        int tileSize;
+        int jobsPerWorker;          // region jobs sent ahead, so that a worker never waits for the next one
+
+        // the tiles of the camera being rendered, guarded by mutex
+        std::mutex mutex;
+        std::condition_variable tilesChanged;
+        std::deque<ImageTile> pendingTiles;
+        int remainingTiles;
+        int liveWorkers;
+        int reassignedTiles;
+
+        void connectWorker(CoordinatorWorker & worker);
+        // a line from the worker; the worker is dropped if it is lost or
+        // .. answers with anything but ok
+        std::string request(CoordinatorWorker & worker, const std::string & command);
+        void dropWorker(CoordinatorWorker & worker);
+        void renderTiles(CoordinatorWorker & worker, int camera, Image & image);
+
+    public:
+        TileCoordinator(int tileSize);
+        // shuts down the workers it spawned
+        ~TileCoordinator();
+
+        // starts a raytracer --serve process with options for each worker
+        void spawnWorkers(int count, const std::vector<std::string> & options);
+
+        // a server that is already running
+        void addWorker(const std::string & socketPath);
+
+        // loads the scene on every worker and renders all of its cameras into
+        // .. their image files; throws if every worker is lost
+        void render(const std::string & scenePath);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __DEPENDENCIES_H__
+#define __DEPENDENCIES_H__
+
+#include "geometry.hpp"
+#include "image/image.hpp"
+#include <string>
+#include <vector>
+
+// what the tiles of an image were rendered from, kept next to the image as
+// .. <image>.deps so that after the scene file is edited only the tiles the
+// .. edit can reach are rendered again (see Scene::renderIncremental)
+// a tile keeps the objects and materials its pixels hit, a box around its
+// .. reflection rays and a cone around its shadow rays to each light; an
+// .. edited object reaches a tile if the tile hit it, if its primary rays or
+// .. reflection rays may hit it now, or if it may be in the way of a shadow
+// .. ray of the tile
+
+// an element of <Objects> as it was loaded, keyed by its type, its id and
+// .. how many objects with that type and id come before it, which an edit of
+// .. another element leaves alone
+typedef struct ObjectRecord
+{
+    unsigned long long key;
+    unsigned long long hash;    // of its surfaces' geometry, material and texture
+    BoundingBox bounds;
+} ObjectRecord;
+
+typedef struct LightRecord
+{
+    float position[3];
+    float intensity[3];
+} LightRecord;
+
+// what edits of a scene are told apart by
+typedef struct SceneSnapshot
+{
+    unsigned long long settings;    // background, ambient light, epsilon, depth, textures and texture coordinates
+    bool complete;                  // every surface is of an object, false for compiled scenes
+    BoundingBox bounds;             // of all surfaces
+    std::vector<ObjectRecord> objects;
+    std::vector<LightRecord> lights;
+    std::vector<unsigned long long> materials;     // hash of each material
+    std::vector<unsigned long long> textures;      // hash of the pixels of each texture
+
+    // not stored: the object of each surface, -1 if it is of none, and the
+    // .. objects with surfaces of each texture
+    std::vector<int> triangleObjects;
+    std::vector<int> sphereObjects;
+    std::vector< std::vector<int> > textureObjects;
+} SceneSnapshot;
+
+// what the pixels of one tile were shaded from; objects and materials are
+// .. added to a Bloom filter of 2048 bits by the key of the object and the
+// .. index of the material, so a tile may be taken to depend on something it
+// .. does not, never the other way round
+typedef struct TileDependencies
+{
+    unsigned int filter[64];
+    BoundingBox reflections;    // every reflection ray, up to its hit or to where it left the scene's bounds
+    int hitCount;
+
+    void clear()
+    {
+        for(int i = 0; i < 64; i++)
+            this->filter[i] = 0;
+
+        this->reflections = BoundingBox();
+        this->hitCount = 0;
+    }
+
+    void add(unsigned long long key)
+    {
+        for(int i = 0; i < 3; i++, key >>= 11)
+            this->filter[(key & 2047) >> 5] |= 1u << (key & 31);
+    }
+
+    bool mayContain(unsigned long long key) const
+    {
+        for(int i = 0; i < 3; i++, key >>= 11)
+        {
+            if((this->filter[(key & 2047) >> 5] & (1u << (key & 31))) == 0)
+                return false;
+        }
+
+        return true;
+    }
+} TileDependencies;
+
+// the shadow rays of one tile to one light are inside this cone from the light
+typedef struct ShadowCone
+{
+    float axis[3];
+    float cosine;       // of the angle between the axis and the ray farthest from it
+    float distance;     // of the hit farthest from the light, negative if the tile hit nothing
+} ShadowCone;
+
+typedef struct DependencyHeader
+{
+    char magic[8];
+    unsigned int version;
+    int width, height;
+    int tileSize;
+    unsigned long long view;    // of the camera, see Scene::getRenderFingerprint
+    unsigned long long settings;
+    int complete;
+    int objectCount, lightCount, materialCount, textureCount;
+    BoundingBox bounds;
+} DependencyHeader;
+
+class RenderDependencies
+{
+    private:
+        DependencyHeader header;
+        int tileColumns, tileRows;
+        std::vector<TileDependencies> tiles;
+        std::vector<ShadowCone> shadows;        // the scene's lights of each tile
+        SceneSnapshot scene;
+
+    public:
+        RenderDependencies(int width, int height, int tileSize, unsigned long long view);
+
+        int getTileCount() const
+        {
+            return this->tileColumns * this->tileRows;
+        }
+
+        int getTileColumns() const
+        {
+            return this->tileColumns;
+        }
+
+        int getTileSize() const
+        {
+            return this->header.tileSize;
+        }
+
+        ImageTile getTile(int index) const;
+
+        TileDependencies & getDependencies(int index)
+        {
+            return this->tiles[index];
+        }
+
+        const TileDependencies & getDependencies(int index) const
+        {
+            return this->tiles[index];
+        }
+
+        ShadowCone & getShadowCone(int index, int light)
+        {
+            return this->shadows[index * this->scene.lights.size() + light];
+        }
+
+        const ShadowCone & getShadowCone(int index, int light) const
+        {
+            return this->shadows[index * this->scene.lights.size() + light];
+        }
+
+        // the scene the tiles were rendered from
+        const SceneSnapshot & getScene() const
+        {
+            return this->scene;
+        }
+
+        // the shadow cones are dropped if the lights are not those of before,
+        // .. the tiles with hits have to be rendered again then anyway
+        void setScene(const SceneSnapshot & scene);
+
+        // written under a temporary name and renamed
+        void write(const std::string & path) const;
+
+        // false if there is no file or it is of another camera or resolution
+        bool read(const std::string & path);
+
+        // mixes a key so that its low bits index the filter well
+        static unsigned long long mix(unsigned long long key);
+
+        static unsigned long long getMaterialKey(int material);
+};
+
+#endif
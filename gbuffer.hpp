@@ -0,0 +1,102 @@
+#ifndef __GBUFFER_H__
+#define __GBUFFER_H__
+
+#include "geometry.hpp"
+#include <string>
+#include <vector>
+
+// a hit a pixel's shading used, all that shading it again needs without
+// .. tracing the ray: the primary hit, then the hit of each reflection ray
+// which of the first 32 lights the hit sees is kept as well, so that only
+// .. the shadow rays of lights that moved are traced again
+typedef struct GBufferHit
+{
+    float position[3];
+    float normal[3];
+    float textureColor[3];
+    int material;               // index in Scene::materials, -1: the ray hit nothing
+    unsigned int visibleLights; // bit i: light i is not in shadow, see GBuffer::getKnownLights
+    unsigned int surface;       // SurfaceRef::index of the surface hit
+    unsigned char surfaceType;  // SurfaceRef::type
+    unsigned char hasTexture;
+    unsigned char decalMode;
+    unsigned char padding;
+} GBufferHit;
+
+typedef struct GBufferHeader
+{
+    char magic[8];
+    unsigned int version;
+    int width, height;
+    unsigned long long fingerprint;     // Scene::getRenderFingerprint without shading
+    unsigned long long hitCount;
+
+    // the lights the visibility of the hits is of
+    float shadowRayEpsilon;
+    int lightCount;
+    float lightPositions[32][3];
+} GBufferHeader;
+
+// the hits of one pixel while it is shaded: appended to recorded as they are
+// .. traced, or taken from hits instead of tracing
+typedef struct GBufferPath
+{
+    std::vector<GBufferHit> * recorded;
+    GBufferHit * hits;
+    int hitCount;
+    int current;                // the hit being shaded
+    unsigned int knownLights;   // see GBuffer::getKnownLights
+
+    GBufferHit * getCurrent()
+    {
+        return this->recorded != NULL ? &(*this->recorded)[this->current] : &this->hits[this->current];
+    }
+} GBufferPath;
+
+// the hits of the pixels of one camera, stored next to its image as
+// .. <image>.gbuffer; they stay valid as long as the camera and the surfaces
+// .. are those they were traced with, the lights and materials may change
+class GBuffer
+{
+    private:
+        GBufferHeader header;
+        std::vector<unsigned int> firstHits;    // of pixel (x, y) at x * height + y, one more for the end
+        std::vector<GBufferHit> hits;
+
+    public:
+        GBuffer(int width, int height, unsigned long long fingerprint);
+
+        static GBufferHit getHit(const HitInfo & hitInfo, int material);
+        static GBufferHit getMiss();
+
+        // false if it is a miss
+        static bool getHitInfo(const GBufferHit & hit, HitInfo & hitInfo, int & material);
+
+        // the hits of each pixel of column x, counts[y] of them for pixel
+        // .. (x, y); the columns are set from left to right
+        void setColumn(int x, const std::vector<GBufferHit> & columnHits, const std::vector<int> & counts);
+
+        // a path replaying the hits of the pixel
+        GBufferPath getPath(int x, int y, unsigned int knownLights);
+
+        // one more than the highest material index
+        int getMaterialCount() const;
+
+        // bit i is set if the visibility of light i is stored: it is where it
+        // .. was when its shadow rays were traced, with the same epsilon
+        unsigned int getKnownLights(const std::vector<PointLight> & lights, float shadowRayEpsilon) const;
+
+        // the visibility of the hits is now that of these lights
+        void setLights(const std::vector<PointLight> & lights, float shadowRayEpsilon);
+
+        // written under a temporary name and renamed
+        void write(const std::string & path) const;
+
+        // false if there is no file, it is of another camera or other
+        // .. surfaces or it is damaged: a G-buffer the scene cannot be relit
+        // .. from; the counts are of the scene's triangles, spheres and
+        // .. materials, the lights need not match
+        bool read(const std::string & path, size_t triangleCount, size_t sphereCount, int materialCount);
+};
+
+#endif
@@ -4,6 +4,10 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <cmath>
+#include <utility>
+#include "simd.hpp"
+#include "offset.hpp"
 
 typedef enum Interpolation { nearest, bilinear } Interpolation;
 typedef enum DecalMode { replace_kd, blend_kd, replace_all } DecalMode;
@@ -22,9 +26,15 @@ struct Face;
 struct Mesh;
 struct Sphere;
 struct HitInfo;
+struct HitRecord;
 struct Texture;
 struct TexCoord;
 class Surface;
+struct SurfaceRef;
+struct Surfaces;
+struct TrianglePacket;
+struct BoundingBox;
+class Accelerator;
 
 typedef struct TexCoord
 {
@@ -33,22 +43,27 @@ typedef struct TexCoord
 } TexCoord;
 
 
-class Position3
+// points, vectors and colors are 16-byte aligned with an unused fourth lane,
+// .. so every operation below is a single Float4 operation and inlines
+// .. into its caller
+class alignas(16) Position3
 {
     private:
-        float x, y, z;
+        float x, y, z, w;
+        
+        Float4 load() const { return Float4::load(&this->x); }
         
     public:
         Position3(float x = 0.0, float y = 0.0, float z = 0.0)
-            : x(x), y(y), z(z) {}
+            : x(x), y(y), z(z), w(0.0f) {}
         
-        float getX() const;
-        float getY() const;
-        float getZ() const;
+        float getX() const { return x; }
+        float getY() const { return y; }
+        float getZ() const { return z; }
         
-        void setX(float x);
-        void setY(float y);
-        void setZ(float z);
+        void setX(float x) { this->x = x; }
+        void setY(float y) { this->y = y; }
+        void setZ(float z) { this->z = z; }
         
         // substraction of two points yields a vector
         Vector3 operator-(const Position3 & rhs) const;
@@ -59,94 +74,198 @@ class Position3
         float distanceSquare(const Position3 & rhs) const;
 
         friend class Scene;
+        friend class Vector3;
         
         friend std::ostream &operator<<(std::ostream &output, const Position3 & position);
 };
 
-class Vector3
+class alignas(16) Vector3
 {
     private:
-        float x, y, z;
+        float x, y, z, w;
+        
+        Float4 load() const { return Float4::load(&this->x); }
+        
+        Vector3(const Float4 & v) { v.store(&this->x); }
         
     public:
         Vector3(float x = 0.0, float y = 0.0, float z = 0.0)
-            : x(x), y(y), z(z) {}
+            : x(x), y(y), z(z), w(0.0f) {}
 
-        float getX() const;
-        float getY() const;
-        float getZ() const;
+        float getX() const { return x; }
+        float getY() const { return y; }
+        float getZ() const { return z; }
         
-        void setX(float x);
-        void setY(float y);
-        void setZ(float z);
+        void setX(float x) { this->x = x; }
+        void setY(float y) { this->y = y; }
+        void setZ(float z) { this->z = z; }
         
         // unary (-) operator
-        Vector3 operator-() const;
+        Vector3 operator-() const { return *this * (-1); }
         
         // substraction
-        Vector3 operator-(const Vector3 & rhs) const;
+        Vector3 operator-(const Vector3 & rhs) const { return Vector3(load() - rhs.load()); }
         
         // addition
-        Vector3 operator+(const Vector3 & rhs) const;
+        Vector3 operator+(const Vector3 & rhs) const { return Vector3(load() + rhs.load()); }
         
         // dot product
-        float operator^(const Vector3 & rhs) const;
+        float operator^(const Vector3 & rhs) const { return (load() * rhs.load()).sum3(); }
         
         // cross product
-        Vector3 operator*(const Vector3 & rhs) const;
+        Vector3 operator*(const Vector3 & rhs) const
+        {
+            Float4 a = load(), b = rhs.load();
+            
+            return Vector3(a.yzx() * b.zxy() - a.zxy() * b.yzx());
+        }
         
         // normalize: make it unit vector, then, return self
-        Vector3 & normalize();
+        Vector3 & normalize()
+        {
+            float norm = this->getNorm();
+            
+            // normalize by dividing the vector by its norm
+            *this = *this / norm;
+            
+            return *this;
+        }
         
         // scalar multiplication
-        Vector3 operator*(float rhs) const;
+        Vector3 operator*(float rhs) const { return Vector3(load() * Float4(rhs)); }
         
         // scalar division
-        Vector3 operator/(float rhs) const;
+        Vector3 operator/(float rhs) const
+        {
+            if(rhs == 0.0)
+            {
+                // division by zero!
+                return Vector3(0.0, 0.0, 0.0);
+            }
+            
+            return Vector3(load() / Float4(rhs));
+        }
         
         // get norm
-        float getNorm() const;
+        float getNorm() const { return std::sqrt(*this ^ *this); }
         
         // intensify
-        Vector3 intensify(const Vector3 & intensityVector) const;
+        Vector3 intensify(const Vector3 & intensityVector) const { return Vector3(load() * intensityVector.load()); }
         
         // generate a vector with different direction
         Vector3 generateDifferentlyDirectedVector() const;
         
         friend class Scene;
+        friend class Position3;
         
         friend std::ostream &operator<<(std::ostream &output, const Vector3 & vector);
 };
 
-class Ray
+// 8 vectors in structure-of-arrays form, for batched shading
+// mirrors the Vector3 operations lane by lane, including the division by zero guards
+struct Vector3x8
+{
+    Float8 x, y, z;
+    
+    Vector3x8() {}
+    
+    Vector3x8(const Float8 & x, const Float8 & y, const Float8 & z)
+        : x(x), y(y), z(z) {}
+    
+    // the same vector in all lanes
+    explicit Vector3x8(const Vector3 & v)
+        : x(v.getX()), y(v.getY()), z(v.getZ()) {}
+    
+    Vector3x8 operator+(const Vector3x8 & rhs) const { return Vector3x8(x + rhs.x, y + rhs.y, z + rhs.z); }
+    Vector3x8 operator-(const Vector3x8 & rhs) const { return Vector3x8(x - rhs.x, y - rhs.y, z - rhs.z); }
+    Vector3x8 operator*(const Float8 & rhs) const { return Vector3x8(x * rhs, y * rhs, z * rhs); }
+    
+    // dot product
+    Float8 operator^(const Vector3x8 & rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z; }
+    
+    Vector3x8 intensify(const Vector3x8 & rhs) const { return Vector3x8(x * rhs.x, y * rhs.y, z * rhs.z); }
+    
+    // scalar division, zero where rhs is zero
+    Vector3x8 operator/(const Float8 & rhs) const
+    {
+        Float8 isZero = rhs == Float8(0.0f);
+        Float8 zero(0.0f);
+        
+        return Vector3x8( select(isZero, zero, x / rhs),
+                          select(isZero, zero, y / rhs),
+                          select(isZero, zero, z / rhs) );
+    }
+    
+    Vector3x8 & normalize()
+    {
+        *this = *this / sqrt(*this ^ *this);
+        
+        return *this;
+    }
+};
+
+inline Vector3 Position3::operator-(const Position3 & rhs) const
+{
+    return Vector3(load() - rhs.load());
+}
+
+// a vector from this to rhs
+inline Vector3 Position3::to(const Position3 & rhs) const
+{
+    return rhs.operator-(*this);
+}
+
+inline float Position3::distanceSquare(const Position3 & rhs) const
+{
+    Vector3 difference = *this - rhs;
+    
+    return difference ^ difference;
+}
+
+// kept small and aligned: the inverse direction and its sign bits are
+// .. computed once here, so box slab tests need no divisions
+class alignas(16) Ray
 {
     private:
         Position3 origin;
         Vector3 direction;
+        Vector3 inverseDirection;
+        int sign[3]; // 1 if the direction is negative along the axis
+        
+        void computeInverseDirection();
         
     public:
         Ray() {
             this->origin = Position3();
             this->direction = Vector3();
+            this->computeInverseDirection();
         }
         
         Ray(Position3 origin, Vector3 direction)
-            : origin(origin), direction(direction) { this->direction.normalize(); };
+            : origin(origin), direction(direction) { this->direction.normalize(); this->computeInverseDirection(); };
             
             
-        Position3 getOrigin() const { return this->origin; }
-        Vector3 getDirection() const { return this->direction; }
+        const Position3 & getOrigin() const { return this->origin; }
+        const Vector3 & getDirection() const { return this->direction; }
+        const Vector3 & getInverseDirection() const { return this->inverseDirection; }
+        const int * getSign() const { return this->sign; }
         
         void setOrigin(Position3 position) { this->origin = position; }
-        void setDirection(Vector3 direction) { this->direction = direction.normalize(); }
+        void setDirection(Vector3 direction) { this->direction = direction.normalize(); this->computeInverseDirection(); }
         
         Ray createReflectionRay(const HitInfo &) const;
         Position3 getPoint(const float & t) const;
         
-        bool getClosestHit(Material & material, // return the material of the hit object
-                           HitInfo & hitInfo,   // return the hit info
-                           const std::vector<Surface*> surfaces,
-                           float epsilon); // feed surfaces
+        // closest hit, shaded
+        // the material is not copied, get it by surfaces.get(hitInfo.surface).getMaterial()
+        bool getClosestHit(HitInfo & hitInfo,   // return the hit info
+                           const Accelerator & accelerator,
+                           float epsilon) const; // feed surfaces through their spatial index
+        
+        // only finds the closest surface, nothing is shaded
+        bool getClosestHitRecord(HitRecord & hitRecord,
+                                 const Accelerator & accelerator,
+                                 float epsilon) const;
                            
         float getTValue(const Position3 & hitPosition) const;
        
@@ -167,22 +286,47 @@ class Camera
         Vec4f near_plane;
         float near_distance;
         int image_width, image_height;
+        int crop_x, crop_y, crop_width, crop_height; // pixels generateImages traces, all of them if crop_width is 0
         std::string image_name;
         Ray** rays;
         
         void deleteRays();
 
     public:
+        Camera() : near_distance(0.0f), image_width(0), image_height(0),
+                   crop_x(0), crop_y(0), crop_width(0), crop_height(0), rays(NULL) {}
+        
+        // copies the view, not the rays; generateRays makes the copy its own
+        Camera(const Camera & camera);
+        Camera & operator=(const Camera & camera);
+        
         ~Camera(); // destruct rays
         
         Ray** getRays() const; // width x height
         int getImageW() const;
         int getImageH() const;
         std::string getImageName() const;
+        Position3 getPosition() const { return this->position; }
+        Vector3 getGaze() const { return this->gaze; }
+        Vector3 getUp() const { return this->up; }
+        
+        // both take effect with the next generateRays
+        void setView(const Position3 & position, const Vector3 & gaze, const Vector3 & up);
+        // the near plane is kept, a different aspect ratio stretches the image
+        void setResolution(int width, int height);
+        
+        // a rectangle of the image, the only pixels generateImages traces;
+        // .. a width of 0 traces the whole image
+        void setCrop(int x, int y, int width, int height);
+        bool hasCrop() const { return this->crop_width > 0; }
         
         void generateRays();
         
+        // the ray generateRays makes for pixel (i, j), without the others
+        Ray getRay(int i, int j) const;
+        
         friend class Scene;
+        friend class CompiledScene;
 };
 
 struct PointLight
@@ -209,34 +353,110 @@ struct Material
         static float getDeterminantByUsingIntermediateVector(const Vector3 & intermediateVector, const Vector3 & c);
 };*/
 
-// abstract class for surfaces that can be hit by a ray
+// axis aligned bounding box, empty (min > max) when default constructed
+typedef struct BoundingBox
+{
+    float min[3];
+    float max[3];
+    
+    BoundingBox()
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            min[axis] = 1e30f;
+            max[axis] = -1e30f;
+        }
+    }
+    
+    void expand(const Position3 & point)
+    {
+        const float p[3] = { point.getX(), point.getY(), point.getZ() };
+        
+        for(int axis = 0; axis < 3; axis++)
+        {
+            min[axis] = p[axis] < min[axis] ? p[axis] : min[axis];
+            max[axis] = p[axis] > max[axis] ? p[axis] : max[axis];
+        }
+    }
+    
+    void expand(const BoundingBox & box)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            min[axis] = box.min[axis] < min[axis] ? box.min[axis] : min[axis];
+            max[axis] = box.max[axis] > max[axis] ? box.max[axis] : max[axis];
+        }
+    }
+    
+    bool isEmpty() const
+    {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+    
+    float getCentroid(int axis) const
+    {
+        return (min[axis] + max[axis]) * 0.5f;
+    }
+    
+    float getSurfaceArea() const
+    {
+        if(isEmpty())
+            return 0.0f;
+        
+        float dx = max[0] - min[0];
+        float dy = max[1] - min[1];
+        float dz = max[2] - min[2];
+        
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+    
+    int getLongestAxis() const
+    {
+        float dx = max[0] - min[0];
+        float dy = max[1] - min[1];
+        float dz = max[2] - min[2];
+        
+        if(dx >= dy && dx >= dz)
+            return 0;
+        
+        return dy >= dz ? 1 : 2;
+    }
+} BoundingBox;
+
+// base class for surfaces that can be hit by a ray
+// there are no virtual functions on purpose: every surface type is kept in its
+// .. own array (see Surfaces), so the intersection loops never go through a vtable
+// the pointers of surfaces are OffsetPointers, so that a compiled scene can be
+// .. used wherever it is mapped
 class Surface
 {
     protected:
-        const Material & material;
-        Texture* texture;
-        Surface(const Material& material, Texture* texture) : material(material), texture(texture) {}
+        OffsetPointer<const Material> material;
+        OffsetPointer<Texture> texture;
+        Surface(const Material& material, Texture* texture) : material(&material), texture(texture) {}
 
         
     public:
-        // returns true if ray hits the surface and records the hit position
-        // .. in hitPosition object
-        virtual bool hit(const Ray & ray, HitInfo & hitInfo) const = 0;
-        
         const Material& getMaterial() const
         {
-            return this->material;
+            return *this->material;
         } 
+        
+        // NULL if it has no texture
+        Texture* getTexture() const
+        {
+            return this->texture;
+        }
+        
+        friend class CompiledScene;
 };
 
-// TODO: positions are not deleted
-
 class Triangle : public Surface
 {
     private:
-        const Position3 * vertex[3];
-        const Vector3 normal;
-        const TexCoord* texCoordData[3];
+        OffsetPointer<const Position3> vertex[3];
+        Vector3 normal;
+        OffsetPointer<const TexCoord> texCoordData[3];
         
         void fillLookUpTable();
         
@@ -275,6 +495,11 @@ class Triangle : public Surface
         
         Position3 getVertex(int vertexId) const;
         Vector3 getNormal() const;
+        BoundingBox getBoundingBox() const;
+        
+        // moves the triangle by overwriting the vertices it points to, which
+        // .. must be its own: the loader gives every triangle private copies
+        void setVertices(const Position3 & vertex0, const Position3 & vertex1, const Position3 & vertex2);
     
         static Vector3 computeNormal(const Position3 & vertex0,
                                      const Position3 & vertex1,
@@ -284,7 +509,24 @@ class Triangle : public Surface
                                      
         friend std::ostream &operator<<(std::ostream &output, const Triangle & triangle);
         
-        bool hit(const Ray & ray, HitInfo & hitInfo) const;
+        // returns true if ray hits the surface and records t and the
+        // .. barycentric coordinates in hitRecord, nothing else is computed
+        bool hit(const Ray & ray, HitRecord & hitRecord) const;
+        
+        // normal, hit position and texture color of a hit found by hit()
+        void fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const;
+        
+        // closest hit among the count triangles refs point to, better than hitRecord if hasHit
+        // returns the position in refs of the new closest triangle, -1 if none is closer
+        static int getClosestHit(const Ray & ray, const Triangle * triangles, const SurfaceRef * refs, int count,
+                                 HitRecord & hitRecord, bool hasHit, float epsilon);
+        
+        // true if any of them is hit with tMin < t <= tMax, for shadow rays
+        static bool isOccluding(const Ray & ray, const Triangle * triangles, const SurfaceRef * refs, int count,
+                                float tMin, float tMax);
+        
+        friend struct TrianglePacket;
+        friend class CompiledScene;
 };
 
 class Sphere : public Surface
@@ -297,14 +539,145 @@ class Sphere : public Surface
         Position3 getCenter() const { return this->center; }
         float getRadius() const { return this->radius; }
         
+        void setGeometry(const Position3 & center, float radius)
+        {
+            this->center = center;
+            this->radius = radius;
+        }
+        
         Sphere(Position3 center, float radius, const Material & material, Texture* texture)
             : Surface(material, texture), center(center), radius(radius) {}
         
         bool isIntersecting(const Ray & ray) const;
         
         float discriminant(const Ray & ray) const;
+        
+        BoundingBox getBoundingBox() const;
        
-       bool hit(const Ray & ray, HitInfo & hitInfo) const;
+        bool hit(const Ray & ray, HitRecord & hitRecord) const;
+        
+        void fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const;
+        
+        // see Triangle::getClosestHit and Triangle::isOccluding
+        static int getClosestHit(const Ray & ray, const Sphere * spheres, const SurfaceRef * refs, int count,
+                                 HitRecord & hitRecord, bool hasHit, float epsilon);
+        
+        static bool isOccluding(const Ray & ray, const Sphere * spheres, const SurfaceRef * refs, int count,
+                                float tMin, float tMax);
+};
+
+typedef enum SurfaceType { triangle_surface, sphere_surface } SurfaceType;
+
+// a surface is identified by its type and its index in the array of that type
+// packed into 32 bits to keep hit records small
+typedef struct SurfaceRef
+{
+    unsigned int type : 1; // SurfaceType
+    unsigned int index : 31;
+} SurfaceRef;
+
+// up to 4 triangles in structure-of-arrays form for the batched intersection
+// .. kernel, holding copies of what Triangle::hit reads; lane i of every
+// .. array belongs to refs[i], the kernel gives the same t as Triangle::hit
+typedef struct alignas(16) TrianglePacket
+{
+    float vertex[3][4];  // first vertex, x y z
+    float edge1[3][4];   // Triangle::LookUpTable::A_B
+    float edge2[3][4];   // Triangle::LookUpTable::A_C
+    float normal[3][4];
+    SurfaceRef refs[4];
+    int count;
+    
+    TrianglePacket() : count(0) {}
+    
+    // appends a triangle, there must be a free lane
+    void add(const Triangle & triangle, SurfaceRef ref);
+    
+    // see Triangle::getClosestHit, returns the lane of the new closest triangle or -1
+    int getClosestHit(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon) const;
+    
+    bool isOccluding(const Ray & ray, float tMin, float tMax) const;
+} TrianglePacket;
+
+// the surfaces of one type, owned like in a std::vector, or a read-only view
+// .. of surfaces in memory the array does not own (a mapped compiled scene)
+template<class T>
+class SurfaceArray
+{
+    private:
+        std::vector<T> owned;
+        T * view;
+        size_t viewSize;
+        
+    public:
+        SurfaceArray() : view(NULL), viewSize(0) {}
+        
+        // drops the owned surfaces, count surfaces at surfaces are used from then on
+        void setView(const T * surfaces, size_t count)
+        {
+            std::vector<T>().swap(this->owned);
+            this->view = const_cast<T *>(surfaces);
+            this->viewSize = count;
+        }
+        
+        size_t size() const { return this->view != NULL ? this->viewSize : this->owned.size(); }
+        bool empty() const { return this->size() == 0; }
+        
+        T * data() { return this->view != NULL ? this->view : this->owned.data(); }
+        const T * data() const { return this->view != NULL ? this->view : this->owned.data(); }
+        
+        T & operator[](size_t index) { return this->data()[index]; }
+        const T & operator[](size_t index) const { return this->data()[index]; }
+        
+        // owned arrays only
+        void push_back(const T & surface) { this->owned.push_back(surface); }
+        void reserve(size_t count) { this->owned.reserve(count); }
+        
+        void swap(SurfaceArray & array)
+        {
+            this->owned.swap(array.owned);
+            std::swap(this->view, array.view);
+            std::swap(this->viewSize, array.viewSize);
+        }
+};
+
+// all surfaces of a scene, sorted by type into homogeneous arrays
+struct Surfaces
+{
+    SurfaceArray<Triangle> triangles;
+    SurfaceArray<Sphere> spheres;
+    
+    const Surface & get(const SurfaceRef & ref) const
+    {
+        if(ref.type == triangle_surface)
+            return this->triangles[ref.index];
+        
+        return this->spheres[ref.index];
+    }
+    
+    BoundingBox getBoundingBox(const SurfaceRef & ref) const
+    {
+        if(ref.type == triangle_surface)
+            return this->triangles[ref.index].getBoundingBox();
+        
+        return this->spheres[ref.index].getBoundingBox();
+    }
+    
+    int size() const
+    {
+        return this->triangles.size() + this->spheres.size();
+    }
+    
+    void fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const;
+};
+
+// the result of an intersection test, shading is done later from this
+// 16 bytes, this is what the intersection loops copy around
+struct HitRecord
+{
+    float t;
+    SurfaceRef surface;
+    float beta, gamma; // barycentric coordinates, only for triangles
 };
 
 struct HitInfo
@@ -315,6 +688,7 @@ struct HitInfo
     DecalMode decalMode;
     bool hasTexture;
     float t;
+    SurfaceRef surface;
 };
 
 struct Texture
@@ -322,7 +696,7 @@ struct Texture
     Interpolation interpolation;
     DecalMode decalMode;
     Appearance appearance;
-    unsigned char* image = NULL;
+    OffsetPointer<unsigned char> image;
     int width;
     int height;
 };
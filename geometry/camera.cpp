@@ -25,6 +25,37 @@ void Camera::deleteRays()
     }
 }
 
+Camera::Camera(const Camera & camera)
+    : position(camera.position), gaze(camera.gaze), up(camera.up), near_plane(camera.near_plane),
+      near_distance(camera.near_distance), image_width(camera.image_width), image_height(camera.image_height),
+      crop_x(camera.crop_x), crop_y(camera.crop_y), crop_width(camera.crop_width), crop_height(camera.crop_height),
+      image_name(camera.image_name), rays(NULL)
+{
+}
+
+Camera & Camera::operator=(const Camera & camera)
+{
+    if(this != &camera)
+    {
+        this->deleteRays();
+        
+        this->position = camera.position;
+        this->gaze = camera.gaze;
+        this->up = camera.up;
+        this->near_plane = camera.near_plane;
+        this->near_distance = camera.near_distance;
+        this->image_width = camera.image_width;
+        this->image_height = camera.image_height;
+        this->crop_x = camera.crop_x;
+        this->crop_y = camera.crop_y;
+        this->crop_width = camera.crop_width;
+        this->crop_height = camera.crop_height;
+        this->image_name = camera.image_name;
+    }
+    
+    return *this;
+}
+
 Camera::~Camera()
 {
     this->deleteRays();
@@ -50,19 +81,38 @@ std::string Camera::getImageName() const
     return this->image_name;
 }
 
-void Camera::generateRays()
+void Camera::setView(const Position3 & position, const Vector3 & gaze, const Vector3 & up)
 {
-    // first, delete the rays that are already generated
+    this->position = position;
+    this->gaze = gaze;
+    this->up = up;
+}
+
+void Camera::setResolution(int width, int height)
+{
+    // the rays are sized by the old resolution
     this->deleteRays();
     
+    this->image_width = width;
+    this->image_height = height;
+}
+
+void Camera::setCrop(int x, int y, int width, int height)
+{
+    this->crop_x = x;
+    this->crop_y = y;
+    this->crop_width = width;
+    this->crop_height = height;
+}
+
+Ray Camera::getRay(int i, int j) const
+{
     // get the fields to make the computations clearer
     const int imageWidth = this->getImageW();
     const int imageHeight = this->getImageH();
     
     Vector3 gaze = this->gaze;
     
-    const Position3 cameraPosition = this->position;
-    
     const float left   = this->near_plane.x;
     const float right  = this->near_plane.y;
     const float bottom = this->near_plane.z;
@@ -81,12 +131,27 @@ void Camera::generateRays()
    
     vecV = vecW * vecU;
     
-    // normally, the computations are done as follows
-    // however, to increase the speed, some of the parameters will be used as constants
     float uConstant = (right - left) / imageWidth;
     float vConstant = (top - bottom) / imageHeight;
     
-    Vector3 initialDirection = gaze * d;
+    float u = left + (i + 0.5) * uConstant;
+    float v = top - (j + 0.5) * vConstant;
+    
+    Vector3 direction = gaze * d + vecU * u + vecV * v;
+    
+    // normalize the direction
+    direction.normalize();
+    
+    return Ray(this->position, direction);
+}
+
+void Camera::generateRays()
+{
+    // first, delete the rays that are already generated
+    this->deleteRays();
+    
+    const int imageWidth = this->getImageW();
+    const int imageHeight = this->getImageH();
     
     this->rays = new Ray*[imageWidth];
     
@@ -94,25 +159,7 @@ void Camera::generateRays()
     {
         this->rays[i] = new Ray[imageHeight];
         
-        float u = left + (i + 0.5) * uConstant;
-        
         for(int j = 0; j < imageHeight; j++)
-        {
-            float v = top - (j + 0.5) * vConstant;
-            
-            Vector3 direction = initialDirection + vecU * u + vecV * v;
-            
-            // normalize the direction
-            direction.normalize();
-            
-            this->rays[i][j] = Ray(cameraPosition, direction);
-        }
+            this->rays[i][j] = this->getRay(i, j);
     }
-    
 }
-
-
-
-
-
-
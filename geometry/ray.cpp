@@ -1,4 +1,5 @@
 #include "../geometry.hpp"
+#include "../accelerator.hpp"
 #include <vector>
 #include <iostream>
 
@@ -17,36 +18,46 @@ float Ray::getTValue(const Position3 & hitPosition) const
     else return -1.0f;
 }       
 
-bool Ray::getClosestHit(Material & material, // return the material of the hit object
-                   HitInfo & hitInfo,   // return the hit info
-                   const std::vector<Surface*> surfaces,
-                   float epsilon) // feed surfaces
+void Ray::computeInverseDirection()
 {
-    bool hit = false;
+    // division by zero gives +-inf, which is what slab tests expect
+    inverseDirection = Vector3( 1.0f / direction.getX(),
+                                1.0f / direction.getY(),
+                                1.0f / direction.getZ() );
     
-    for(int i = 0; i < surfaces.size(); i++)
-    {
-        Surface & surface = *surfaces[i];
-        
-        HitInfo currentSurfaceHitInfo;
-        
-        // do I hit the current surface?        
-        if(surface.hit(*this, currentSurfaceHitInfo))
-        {
-            // if I did not hit a surface before, make it the first hit
-            if(!hit || (currentSurfaceHitInfo.t < hitInfo.t))
-            {
-                if(currentSurfaceHitInfo.t > epsilon)
-                {
-                    hit = true;
-                    hitInfo = currentSurfaceHitInfo;
-                    material = surface.getMaterial();
-                }
-            }
-        }
-    }
+    sign[0] = inverseDirection.getX() < 0.0f;
+    sign[1] = inverseDirection.getY() < 0.0f;
+    sign[2] = inverseDirection.getZ() < 0.0f;
+}
+
+bool Ray::getClosestHit(HitInfo & hitInfo,   // return the hit info
+                   const Accelerator & accelerator,
+                   float epsilon) const // feed surfaces through their spatial index
+{
+    HitRecord hitRecord;
     
-    return hit;
+    if(!this->getClosestHitRecord(hitRecord, accelerator, epsilon))
+        return false;
+    
+    // shade only the closest hit
+    accelerator.getSurfaces().fillHitInfo(*this, hitRecord, hitInfo);
+    
+    return true;
+}
+
+bool Ray::getClosestHitRecord(HitRecord & hitRecord,
+                              const Accelerator & accelerator,
+                              float epsilon) const
+{
+    return accelerator.getClosestHit(*this, hitRecord, epsilon);
+}
+
+void Surfaces::fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const
+{
+    if(hitRecord.surface.type == triangle_surface)
+        this->triangles[hitRecord.surface.index].fillHitInfo(ray, hitRecord, hitInfo);
+    else
+        this->spheres[hitRecord.surface.index].fillHitInfo(ray, hitRecord, hitInfo);
 }
 
 Position3 Ray::getPoint(const float & t) const
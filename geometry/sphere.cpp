@@ -21,6 +21,16 @@ float Sphere::discriminant(const Ray & ray) const
 
 }
 
+BoundingBox Sphere::getBoundingBox() const
+{
+    BoundingBox box;
+    
+    box.expand(Position3(center.getX() - radius, center.getY() - radius, center.getZ() - radius));
+    box.expand(Position3(center.getX() + radius, center.getY() + radius, center.getZ() + radius));
+    
+    return box;
+}
+
 bool Sphere::isIntersecting (const Ray & ray) const
 {
     if(discriminant(ray) >= 0.0)
@@ -29,7 +39,7 @@ bool Sphere::isIntersecting (const Ray & ray) const
 
 }
 
-bool Sphere::hit(const Ray & ray, HitInfo & hitInfo) const
+bool Sphere::hit(const Ray & ray, HitRecord & hitRecord) const
 {
     float disc = discriminant(ray);
     
@@ -42,134 +52,171 @@ bool Sphere::hit(const Ray & ray, HitInfo & hitInfo) const
         float t1 = ( A + sqrt(disc) ) / B ;
         float t2 = ( A - sqrt(disc) ) / B ;
 
-        hitInfo.t = t1 > t2 ? t2 : t1;
+        hitRecord.t = t1 > t2 ? t2 : t1;
         
         if(t2 < 0)
-            hitInfo.t = t1;
+            hitRecord.t = t1;
         else if(t1 < 0)
-            hitInfo.t = t2;
+            hitRecord.t = t2;
         
         /*if(hitInfo.t < 0.0f)
             return false;*/
+            
+        return true;    
+    }
+    // the ray grazes
+    else if (disc == 0.0f) 
+    {
+        hitRecord.t = A / B;
         
-        hitInfo.normal = (this->getCenter().to(ray.getPoint(hitInfo.t))).normalize();
-        hitInfo.hitPosition = ray.getPoint(hitInfo.t);
+        return hitRecord.t > 0.0f;
+    }
+    // no intersection
+    else 
+        return false;
+
+}
+
+// normal, position and texture lookup, only done for the closest hit
+void Sphere::fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const
+{
+    hitInfo.t = hitRecord.t;
+    hitInfo.surface = hitRecord.surface;
+    hitInfo.normal = (this->getCenter().to(ray.getPoint(hitInfo.t))).normalize();
+    hitInfo.hitPosition = ray.getPoint(hitInfo.t);
+    
+    hitInfo.hasTexture = false;
+    
+    if(this->texture != NULL) 
+    {
+        hitInfo.hasTexture = true;
+        hitInfo.decalMode = texture->decalMode;
         
-        hitInfo.hasTexture = false;
+        Vector3 hitPositionWRTSphere = center.to(hitInfo.hitPosition);
         
-        if(this->texture != NULL) 
-        {
-            hitInfo.hasTexture = true;
-            hitInfo.decalMode = texture->decalMode;
-            
-            Vector3 hitPositionWRTSphere = center.to(hitInfo.hitPosition);
-            
-            unsigned char* textureImage = texture->image;
-            
-            double acosParam = hitPositionWRTSphere.getY() / this->radius;
-            
-            
-            float theta =acos(hitPositionWRTSphere.getY() / this->radius);
-            /*
-            if(acosParam >= 1.0)
-                theta = 0.0;
-            else
-                theta = acos(hitPositionWRTSphere.getY() / this->radius);
-           
+        unsigned char* textureImage = texture->image;
+        
+        double acosParam = hitPositionWRTSphere.getY() / this->radius;
+        
+        
+        float theta =acos(hitPositionWRTSphere.getY() / this->radius);
+        /*
+        if(acosParam >= 1.0)
+            theta = 0.0;
+        else
+            theta = acos(hitPositionWRTSphere.getY() / this->radius);
+       
 */
+        
+        float fi = atan2(hitPositionWRTSphere.getZ(), hitPositionWRTSphere.getX());
+        
+        float u = (-fi + PI) / (2 * PI);
+        float v = theta / PI ;
+        
+
+        float i = u * texture -> width;
+        float j = v * texture -> height;
+        
+        // pixel indexes
+        int nearest_x, nearest_y;
+        
+        nearest_x = i;
+        if ( i - nearest_x > 0.5)
+            nearest_x++;
             
-            float fi = atan2(hitPositionWRTSphere.getZ(), hitPositionWRTSphere.getX());
-            
-            float u = (-fi + PI) / (2 * PI);
-            float v = theta / PI ;
+        nearest_y = j;
+        if( j - nearest_y > 0.5 )
+            nearest_y++;
+        
+        //cout << "[" << nearest_x << ", " << nearest_y << "]" << endl;
+        // since they will be inside in the Vector3
+        float r, g, b;
+        int width = texture->width;
+        int height = texture->height;
+        
+        if (texture -> interpolation == nearest)
+        {
+            int colorIndex = (nearest_y * width + nearest_x) * 3;
             
-
-            float i = u * texture -> width;
-            float j = v * texture -> height;
+            // get color from texture->image unsigned char array
+            r = textureImage[colorIndex];
+            g = textureImage[colorIndex + 1];
+            b = textureImage[colorIndex + 2];
             
-            // pixel indexes
-            int nearest_x, nearest_y;
+        }
+        // bilinear
+        else 
+        {
+            // floor 
+            int p = i;
+            int q = j;
             
-            nearest_x = i;
-            if ( i - nearest_x > 0.5)
-                nearest_x++;
-                
-            nearest_y = j;
-            if( j - nearest_y > 0.5 )
-                nearest_y++;
+            float dx = i - p;
+            float dy = j - q;
             
-            //cout << "[" << nearest_x << ", " << nearest_y << "]" << endl;
-            // since they will be inside in the Vector3
-            float r, g, b;
-            int width = texture->width;
-            int height = texture->height;
+            int colorIndex1 = ( q * width + p )*3;
+            int colorIndex2 = ( q * width + p+1 )*3;
+            int colorIndex3 = ( (q+1) * width + p )*3;
+            int colorIndex4 = ( (q+1) * width + (p+1) )*3;
             
-            if (texture -> interpolation == nearest)
-            {
-                int colorIndex = (nearest_y * width + nearest_x) * 3;
-                
-                // get color from texture->image unsigned char array
-                r = textureImage[colorIndex];
-                g = textureImage[colorIndex + 1];
-                b = textureImage[colorIndex + 2];
-                
-            }
-            // bilinear
-            else 
-            {
-                // floor 
-                int p = i;
-                int q = j;
-                
-                float dx = i - p;
-                float dy = j - q;
-                
-                int colorIndex1 = ( q * width + p )*3;
-                int colorIndex2 = ( q * width + p+1 )*3;
-                int colorIndex3 = ( (q+1) * width + p )*3;
-                int colorIndex4 = ( (q+1) * width + (p+1) )*3;
-                
-                r = textureImage[colorIndex1] * (1 - dx) * (1 - dy) +
-                    textureImage[colorIndex2] * (dx) * (1 - dy) +
-                    textureImage[colorIndex3] * (1 - dx) * (dy) +
-                    textureImage[colorIndex4] * (dx) * (dy);
-                    
-                g = textureImage[colorIndex1 + 1] * (1 - dx) * (1 - dy) +
-                    textureImage[colorIndex2 + 1] * (dx) * (1 - dy) +
-                    textureImage[colorIndex3 + 1] * (1 - dx) * (dy) +
-                    textureImage[colorIndex4 + 1] * (dx) * (dy);
+            r = textureImage[colorIndex1] * (1 - dx) * (1 - dy) +
+                textureImage[colorIndex2] * (dx) * (1 - dy) +
+                textureImage[colorIndex3] * (1 - dx) * (dy) +
+                textureImage[colorIndex4] * (dx) * (dy);
                 
-                b = textureImage[colorIndex1 + 2] * (1 - dx) * (1 - dy) +
-                    textureImage[colorIndex2 + 2] * (dx) * (1 - dy) +
-                    textureImage[colorIndex3 + 2] * (1 - dx) * (dy) +
-                    textureImage[colorIndex4 + 2] * (dx) * (dy);
-                
-            }
-            hitInfo.textureColor = Vector3(r, g, b);
+            g = textureImage[colorIndex1 + 1] * (1 - dx) * (1 - dy) +
+                textureImage[colorIndex2 + 1] * (dx) * (1 - dy) +
+                textureImage[colorIndex3 + 1] * (1 - dx) * (dy) +
+                textureImage[colorIndex4 + 1] * (dx) * (dy);
             
-        }
-
+            b = textureImage[colorIndex1 + 2] * (1 - dx) * (1 - dy) +
+                textureImage[colorIndex2 + 2] * (dx) * (1 - dy) +
+                textureImage[colorIndex3 + 2] * (1 - dx) * (dy) +
+                textureImage[colorIndex4 + 2] * (dx) * (dy);
             
-        return true;    
+        }
+        hitInfo.textureColor = Vector3(r, g, b);
+        
     }
-    // the ray grazes
-    else if (disc == 0.0f) 
+}
+
+// kept in this file so that hit can be inlined into the loops
+int Sphere::getClosestHit(const Ray & ray, const Sphere * spheres, const SurfaceRef * refs, int count,
+                          HitRecord & hitRecord, bool hasHit, float epsilon)
+{
+    int closest = -1;
+    
+    for(int i = 0; i < count; i++)
     {
-        hitInfo.t = A / B;
+        HitRecord currentHitRecord;
         
-        if(hitInfo.t > 0.0f)
+        if(spheres[refs[i].index].hit(ray, currentHitRecord))
         {
-            hitInfo.normal = (this->getCenter().to(ray.getPoint(hitInfo.t))).normalize();
-            hitInfo.hitPosition = ray.getPoint(hitInfo.t);
-            return true;
-        }
-        else
-        {
-            return false;
+            if(!hasHit || (currentHitRecord.t < hitRecord.t))
+            {
+                if(currentHitRecord.t > epsilon)
+                {
+                    hasHit = true;
+                    hitRecord = currentHitRecord;
+                    closest = i;
+                }
+            }
         }
     }
-    // no intersection
-    else 
-        return false;
+    
+    return closest;
+}
 
+bool Sphere::isOccluding(const Ray & ray, const Sphere * spheres, const SurfaceRef * refs, int count,
+                         float tMin, float tMax)
+{
+    for(int i = 0; i < count; i++)
+    {
+        HitRecord hitRecord;
+        
+        if(spheres[refs[i].index].hit(ray, hitRecord) && hitRecord.t > tMin && hitRecord.t <= tMax)
+            return true;
+    }
+    
+    return false;
 }
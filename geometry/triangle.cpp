@@ -16,6 +16,17 @@ Vector3 Triangle::getNormal() const
     return this->normal;
 }
 
+BoundingBox Triangle::getBoundingBox() const
+{
+    BoundingBox box;
+    
+    box.expand(*vertex[0]);
+    box.expand(*vertex[1]);
+    box.expand(*vertex[2]);
+    
+    return box;
+}
+
 Vector3 Triangle::computeNormal(const Position3 & vertex0,
                              const Position3 & vertex1,
                              const Position3 & vertex2 )
@@ -27,6 +38,17 @@ Vector3 Triangle::computeNormal(const Position3 & vertex0,
     return normal;
 }
 
+void Triangle::setVertices(const Position3 & vertex0, const Position3 & vertex1, const Position3 & vertex2)
+{
+    *const_cast<Position3 *>(this->vertex[0].get()) = vertex0;
+    *const_cast<Position3 *>(this->vertex[1].get()) = vertex1;
+    *const_cast<Position3 *>(this->vertex[2].get()) = vertex2;
+    
+    this->normal = computeNormal(vertex0, vertex1, vertex2);
+    
+    fillLookUpTable();
+}
+
 std::ostream &operator<<(std::ostream &output, const Triangle & triangle)
 {
     output << "T[ " << *triangle.vertex[0] << ", " <<
@@ -100,7 +122,7 @@ void Triangle::fillLookUpTable()
 }*/
 
 
-bool Triangle::hit(const Ray & ray, HitInfo & hitInfo) const
+bool Triangle::hit(const Ray & ray, HitRecord & hitRecord) const
 {
     const Vector3 & rayDirection = ray.getDirection();
     const Position3 & rayOrigin = ray.getOrigin();
@@ -160,10 +182,24 @@ bool Triangle::hit(const Ray & ray, HitInfo & hitInfo) const
 
      if(T <= 0.0f)
         return false;
-        
-        hitInfo.t = T;
-        hitInfo.normal = this->getNormal();  
-        hitInfo.hitPosition = ray.getPoint(hitInfo.t);
+     
+     // shading is deferred to fillHitInfo, keep what it needs
+     hitRecord.t = T;
+     hitRecord.beta = B;
+     hitRecord.gamma = Y;
+     
+     return true;
+}
+
+void Triangle::fillHitInfo(const Ray & ray, const HitRecord & hitRecord, HitInfo & hitInfo) const
+{
+    const float B = hitRecord.beta;
+    const float Y = hitRecord.gamma;
+    
+    hitInfo.t = hitRecord.t;
+    hitInfo.surface = hitRecord.surface;
+    hitInfo.normal = this->getNormal();  
+    hitInfo.hitPosition = ray.getPoint(hitInfo.t);
 
     // check texture!
     hitInfo.hasTexture = false;
@@ -171,6 +207,7 @@ bool Triangle::hit(const Ray & ray, HitInfo & hitInfo) const
     if(this->texture != NULL)
     {
         hitInfo.hasTexture = true;
+        hitInfo.decalMode = texture->decalMode;
         
         unsigned char* textureImage = texture->image;
         
@@ -285,19 +322,171 @@ bool Triangle::hit(const Ray & ray, HitInfo & hitInfo) const
         
     }
     
-    return true;
-
 }
 
+// kept in this file so that hit can be inlined into the loops
+int Triangle::getClosestHit(const Ray & ray, const Triangle * triangles, const SurfaceRef * refs, int count,
+                            HitRecord & hitRecord, bool hasHit, float epsilon)
+{
+    int closest = -1;
+    
+    for(int i = 0; i < count; i++)
+    {
+        HitRecord currentHitRecord;
+        
+        if(triangles[refs[i].index].hit(ray, currentHitRecord))
+        {
+            if(!hasHit || (currentHitRecord.t < hitRecord.t))
+            {
+                if(currentHitRecord.t > epsilon)
+                {
+                    hasHit = true;
+                    hitRecord = currentHitRecord;
+                    closest = i;
+                }
+            }
+        }
+    }
+    
+    return closest;
+}
 
+bool Triangle::isOccluding(const Ray & ray, const Triangle * triangles, const SurfaceRef * refs, int count,
+                           float tMin, float tMax)
+{
+    for(int i = 0; i < count; i++)
+    {
+        HitRecord hitRecord;
+        
+        if(triangles[refs[i].index].hit(ray, hitRecord) && hitRecord.t > tMin && hitRecord.t <= tMax)
+            return true;
+    }
+    
+    return false;
+}
 
+void TrianglePacket::add(const Triangle & triangle, SurfaceRef ref)
+{
+    const Position3 & vertex0 = *triangle.vertex[0];
+    const Vector3 & A_B = triangle.lookUpTable.A_B;
+    const Vector3 & A_C = triangle.lookUpTable.A_C;
+    
+    int lane = this->count++;
+    
+    this->vertex[0][lane] = vertex0.getX();
+    this->vertex[1][lane] = vertex0.getY();
+    this->vertex[2][lane] = vertex0.getZ();
+    this->edge1[0][lane] = A_B.getX();
+    this->edge1[1][lane] = A_B.getY();
+    this->edge1[2][lane] = A_B.getZ();
+    this->edge2[0][lane] = A_C.getX();
+    this->edge2[1][lane] = A_C.getY();
+    this->edge2[2][lane] = A_C.getZ();
+    this->normal[0][lane] = triangle.normal.getX();
+    this->normal[1][lane] = triangle.normal.getY();
+    this->normal[2][lane] = triangle.normal.getZ();
+    this->refs[lane] = ref;
+    
+    // unused lanes repeat the last triangle, their results are masked out
+    for(int i = lane + 1; i < 4; i++)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            this->vertex[axis][i] = this->vertex[axis][lane];
+            this->edge1[axis][i] = this->edge1[axis][lane];
+            this->edge2[axis][i] = this->edge2[axis][lane];
+            this->normal[axis][i] = this->normal[axis][lane];
+        }
+    }
+}
 
+// Triangle::hit on 4 lanes with the same operations in the same order,
+// .. returns the mask of the lanes that are hit
+static inline int intersectPacket(const TrianglePacket & packet, const Ray & ray, float * t, float * beta, float * gamma)
+{
+    const Vector3 & rayDirection = ray.getDirection();
+    const Position3 & rayOrigin = ray.getOrigin();
+    
+    const Float4 g(rayDirection.getX());
+    const Float4 h(rayDirection.getY());
+    const Float4 i(rayDirection.getZ());
+    const Float4 zero(0.0f);
+    const Float4 one(1.0f);
+    
+    // back facing triangles are ignored
+    Float4 facing = Float4::load(packet.normal[0]) * g + Float4::load(packet.normal[1]) * h + Float4::load(packet.normal[2]) * i;
+    
+    const Float4 a = Float4::load(packet.edge1[0]);
+    const Float4 b = Float4::load(packet.edge1[1]);
+    const Float4 c = Float4::load(packet.edge1[2]);
+    
+    const Float4 d = Float4::load(packet.edge2[0]);
+    const Float4 e = Float4::load(packet.edge2[1]);
+    const Float4 f = Float4::load(packet.edge2[2]);
+    
+    const Float4 j = Float4::load(packet.vertex[0]) - Float4(rayOrigin.getX());
+    const Float4 k = Float4::load(packet.vertex[1]) - Float4(rayOrigin.getY());
+    const Float4 l = Float4::load(packet.vertex[2]) - Float4(rayOrigin.getZ());
+    
+    const Float4 cv1 = e*i - h*f;
+    const Float4 cv2 = g*f - d*i;
+    const Float4 cv3 = d*h - e*g;
+    const Float4 cv4 = a*k - j*b;
+    const Float4 cv5 = j*c - a*l;
+    const Float4 cv6 = b*l - k*c;
+    
+    const Float4 determinantA = a*cv1 + b*cv2 + c*cv3;
+    
+    Float4 Y = (i*cv4 + h*cv5 + g*cv6) / determinantA;
+    Float4 B = (j*cv1 + k*cv2 + l*cv3) / determinantA;
+    Float4 T = zero - (f*cv4 + e*cv5 + d*cv6) / determinantA;
+    
+    int rejected = (facing > zero).mask() | (determinantA == zero).mask() |
+                   (Y < zero).mask() | (Y > one).mask() |
+                   (B < zero).mask() | (B + Y > one).mask() |
+                   (T <= zero).mask();
+    
+    T.store(t);
+    B.store(beta);
+    Y.store(gamma);
+    
+    return ~rejected & ((1 << packet.count) - 1);
+}
 
+int TrianglePacket::getClosestHit(const Ray & ray, HitRecord & hitRecord, bool hasHit, float epsilon) const
+{
+    alignas(16) float t[4], beta[4], gamma[4];
+    
+    int hits = intersectPacket(*this, ray, t, beta, gamma);
+    int closest = -1;
+    
+    // lanes in order, so ties go to the same triangle as in Triangle::getClosestHit
+    for(int lane = 0; hits != 0; lane++, hits >>= 1)
+    {
+        if((hits & 1) && (!hasHit || t[lane] < hitRecord.t) && t[lane] > epsilon)
+        {
+            hasHit = true;
+            hitRecord.t = t[lane];
+            hitRecord.beta = beta[lane];
+            hitRecord.gamma = gamma[lane];
+            closest = lane;
+        }
+    }
+    
+    return closest;
+}
 
-
-
-
-
-
-
-
+bool TrianglePacket::isOccluding(const Ray & ray, float tMin, float tMax) const
+{
+    alignas(16) float t[4], beta[4], gamma[4];
+    
+    int hits = intersectPacket(*this, ray, t, beta, gamma);
+    
+    for(int lane = 0; hits != 0; lane++, hits >>= 1)
+    {
+        if((hits & 1) && t[lane] > tMin && t[lane] <= tMax)
+            return true;
+    }
+    
+    return false;
+}
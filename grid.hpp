@@ -0,0 +1,70 @@
+#ifndef __GRID_H__
+#define __GRID_H__
+
+#include "accelerator.hpp"
+#include <vector>
+#include <iostream>
+
+typedef struct GridBuildOptions
+{
+    float density;    // cells per surface, the resolution per axis follows from it and the scene's shape
+    int maxCellCount; // caps the memory of very large scenes
+
+    GridBuildOptions() : density(4.0f), maxCellCount(1 << 24) {}
+} GridBuildOptions;
+
+typedef struct GridStatistics
+{
+    double buildSeconds;
+    int surfaceCount;
+    int resolution[3];
+    int cellCount;
+    int emptyCellCount;
+    int referenceCount;     // surfaces are listed in every cell their box overlaps
+    int maxCellSize;
+    size_t memoryBytes;
+
+    GridStatistics()
+        : buildSeconds(0.0), surfaceCount(0), cellCount(0), emptyCellCount(0), referenceCount(0), maxCellSize(0),
+          memoryBytes(0)
+    {
+        resolution[0] = resolution[1] = resolution[2] = 0;
+    }
+} GridStatistics;
+
+std::ostream &operator<<(std::ostream &output, const GridStatistics & statistics);
+
+// uniform grid over the surfaces of a scene, rays walk it cell by cell with 3D-DDA
+// every cell lists the surfaces whose box overlaps it, triangles first
+// suits many surfaces of similar size spread evenly (particles), a few large
+// .. surfaces among many small ones fill cells unevenly
+class UniformGrid : public Accelerator
+{
+    private:
+        BoundingBox bounds;
+        int resolution[3];
+        float cellSize[3];
+        float inverseCellSize[3];
+        std::vector<int> cellStart;          // refs of cell c are cellStart[c] .. cellStart[c + 1] - 1...
+        std::vector<int> cellTriangleCount;  // ... the first cellTriangleCount[c] of them triangles
+        std::vector<SurfaceRef> refs;
+        GridStatistics statistics;
+
+        // clamped to the grid
+        int getCell(int axis, float position) const;
+
+    public:
+        // surfaces must outlive the grid and must not change afterwards
+        void build(const Surfaces & surfaces, const GridBuildOptions & options);
+
+        bool getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const;
+        bool isOccluded(const Ray & ray, float tMin, float tMax) const;
+        void printStatistics(std::ostream & output) const;
+
+        const GridStatistics & getStatistics() const
+        {
+            return this->statistics;
+        }
+};
+
+#endif
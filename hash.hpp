@@ -0,0 +1,29 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <cstddef>
+
+// FNV-1a, what the fingerprints and sidecar files identify scenes with
+static const unsigned long long hashBasis = 14695981039346656037ULL;
+
+// FNV-1a of the bytes of values
+template <typename T>
+static inline unsigned long long hashValues(unsigned long long hash, const T * values, size_t count)
+{
+    const unsigned char * bytes = (const unsigned char *) values;
+    
+    for(size_t i = 0; i < count * sizeof(T); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    
+    return hash;
+}
+
+template <typename V>
+static inline unsigned long long hashVector(unsigned long long hash, const V & vector)
+{
+    const float values[3] = { vector.getX(), vector.getY(), vector.getZ() };
+    
+    return hashValues(hash, values, 3);
+}
+
+#endif
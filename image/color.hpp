@@ -3,49 +3,41 @@
 
 #include "../geometry.hpp"
 
-class Color
+// same layout as Vector3: 16-byte aligned with an unused fourth lane
+class alignas(16) Color
 {
     private:
-        float R, G, B;
+        float R, G, B, A;
+        
+        Float4 load() const { return Float4::load(&this->R); }
+        
+        Color(const Float4 & v) { v.store(&this->R); }
+        
     public:
         /*Color(unsigned char R = 0, unsigned char G = 0, unsigned char B = 0)
             : R(R), G(G), B(B) {}    */
         
         Color(float R = 0.0f, float G = 0.0f, float B = 0.0f)
-        {
-            this->R = R;// < 0.0f ? 0.0f : R;
-            this->G = G;// < 0.0f ? 0.0f : G;
-            this->B = B;// < 0.0f ? 0.0f : B;
-                        
-            this->R = R;// > 255.0f ? 255.0f : R;
-            this->G = G;// > 255.0f ? 255.0f : G;
-            this->B = B;// > 255.0f ? 255.0f : B;
-        }
+            : R(R), G(G), B(B), A(0.0f) {}
         
         Color(const Vector3 & colorVector)
         :   Color(colorVector.getX(), colorVector.getY(), colorVector.getZ()) {}
         
         Color operator+(const Color & rhs) const
         {
-            return Color( R + rhs.getFR(),
-                          G + rhs.getFG(),
-                          B + rhs.getFB() );
+            return Color(load() + rhs.load());
         }
         
         Color & intensify(const Vector3 & rhs)
         {
-            this->setR(this->R * rhs.getX());
-            this->setG(this->G * rhs.getY());
-            this->setB(this->B * rhs.getZ());
+            *this = Color(load() * Float4(rhs.getX(), rhs.getY(), rhs.getZ(), 0.0f));
             
             return *this;
         }
         
         Color & operator+=(const Color & rhs)
         {
-            setR( R + rhs.getFR() );
-            setG( G + rhs.getFG() );
-            setB( B + rhs.getFB() );
+            *this = Color(load() + rhs.load());
 
             return *this;
         }
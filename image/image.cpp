@@ -1,7 +1,9 @@
 #include "image.hpp"
 #include "color.hpp"
 #include "ppm.h"
+#include<algorithm>
 #include<string>
+#include<vector>
 
 
 Image::Image(int width, int height)
@@ -47,6 +49,31 @@ void Image::write(std::string fileName) const
     write_ppm(fileName.data(), this->imageArray, this->width, this->height);
 }
 
+void Image::writeRegion(std::string fileName, const ImageTile & region) const
+{
+    if(this->imageArray == nullptr)
+        return;
+    
+    std::vector<unsigned char> pixels(region.width * region.height * 3);
+    
+    for(int y = 0; y < region.height; y++)
+    {
+        const unsigned char * row = this->imageArray + ((region.y + y) * this->width + region.x) * 3;
+        
+        std::copy(row, row + region.width * 3, pixels.begin() + y * region.width * 3);
+    }
+    
+    write_ppm(fileName.data(), pixels.data(), region.width, region.height);
+}
+
+void Image::read(std::string fileName)
+{
+    if(this->imageArray == nullptr)
+        return;
+    
+    read_ppm(fileName.data(), this->imageArray, this->width, this->height);
+}
+
 Color Image::getColor(int positionX, int positionY) const
 {
     if(positionX > this->width || positionY > this->height)
@@ -4,6 +4,13 @@
 #include "color.hpp"
 #include<string>
 
+// a rectangle of pixels, x and y are its top left corner
+typedef struct ImageTile
+{
+    int x, y;
+    int width, height;
+} ImageTile;
+
 class Image
 {
     private:
@@ -22,7 +29,13 @@ class Image
         
         Color getColor(int positionX, int positionY) const;
         
-        void write(std::string fileName) const;      
+        void write(std::string fileName) const;
+        
+        // writes only the pixels of region, as an image of the region's size
+        void writeRegion(std::string fileName, const ImageTile & region) const;
+        
+        // replaces the pixels with those of a ppm file of the same size
+        void read(std::string fileName);
 };
 
 #endif
@@ -1,5 +1,7 @@
 #include "ppm.h"
+#include <cstdio>
 #include <stdexcept>
+#include <string>
 
 void write_ppm(const char* filename, unsigned char* data, int width, int height)
 {
@@ -37,3 +39,57 @@ void write_ppm(const char* filename, unsigned char* data, int width, int height)
 
     (void) fclose(outfile);
 }
+
+void read_ppm(const char* filename, unsigned char* data, int width, int height)
+{
+    FILE *infile;
+
+    if ((infile = fopen(filename, "rb")) == NULL)
+    {
+        throw std::runtime_error(std::string("Error: The ppm file ") + filename + " cannot be opened for reading.");
+    }
+
+    char format[3] = { 0, 0, 0 };
+    int fileWidth = 0, fileHeight = 0, maxValue = 0;
+
+    if (fscanf(infile, "%2s %d %d %d", format, &fileWidth, &fileHeight, &maxValue) != 4 ||
+        (std::string(format) != "P3" && std::string(format) != "P6") || maxValue != 255)
+    {
+        (void) fclose(infile);
+        throw std::runtime_error(std::string("Error: ") + filename + " is not an 8-bit P3 or P6 ppm file.");
+    }
+
+    if (fileWidth != width || fileHeight != height)
+    {
+        (void) fclose(infile);
+        throw std::runtime_error(std::string("Error: ") + filename + " is " + std::to_string(fileWidth) + "x" +
+                                 std::to_string(fileHeight) + ", not " + std::to_string(width) + "x" + std::to_string(height) + ".");
+    }
+
+    size_t size = (size_t) width * height * 3;
+    bool complete = true;
+
+    if (format[1] == '6')
+    {
+        // a single whitespace separates the header from the bytes
+        (void) fgetc(infile);
+        complete = fread(data, 1, size, infile) == size;
+    }
+    else
+    {
+        for (size_t idx = 0; idx < size && complete; ++idx)
+        {
+            int color;
+
+            complete = fscanf(infile, "%d", &color) == 1;
+            data[idx] = (unsigned char) color;
+        }
+    }
+
+    (void) fclose(infile);
+
+    if (!complete)
+    {
+        throw std::runtime_error(std::string("Error: ") + filename + " ends before its last pixel.");
+    }
+}
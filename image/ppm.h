@@ -3,4 +3,7 @@
 
 void write_ppm(const char* filename, unsigned char* data, int width, int height);
 
+// reads a P3 or P6 image of exactly width x height into data
+void read_ppm(const char* filename, unsigned char* data, int width, int height);
+
 #endif // __ppm_h__
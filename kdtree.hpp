@@ -0,0 +1,90 @@
+#ifndef __KDTREE_H__
+#define __KDTREE_H__
+
+#include "accelerator.hpp"
+#include <vector>
+#include <iostream>
+
+// one node of the flattened kd-tree, 16 bytes
+// nodes are stored depth first: the child below the plane of an interior
+// .. node is the next node in the array, offset is the child above it
+typedef struct KdTreeNode
+{
+    float split;                   // interior: position of the plane
+    int offset;                    // interior: child above the plane, leaf: first surface in KdTree::refs
+    int triangleCount;             // leaf: refs start with this many triangles...
+    unsigned int sphereCount : 30; // ... followed by this many spheres
+    unsigned int axis : 2;         // 0 - 2: split axis of an interior node, 3: leaf
+
+    bool isLeaf() const
+    {
+        return axis == 3;
+    }
+} KdTreeNode;
+
+// knobs of the binned SAH builder
+typedef struct KdTreeBuildOptions
+{
+    int binCount;           // candidate planes per axis are the bin borders, at most 64
+    int maxLeafSize;        // nodes with more surfaces are split while it pays off
+    int maxDepth;           // 0: 8 + 1.3 log2(surfaces)
+    int threadCount;        // 0: one per hardware thread
+    float traversalCost;    // SAH cost of visiting an interior node...
+    float intersectionCost; // ... relative to intersecting one surface
+    float emptyBonus;       // cost reduction of splits that cut off empty space
+
+    KdTreeBuildOptions()
+        : binCount(32), maxLeafSize(2), maxDepth(0), threadCount(0),
+          traversalCost(1.0f), intersectionCost(4.0f), emptyBonus(0.5f) {}
+} KdTreeBuildOptions;
+
+typedef struct KdTreeStatistics
+{
+    double buildSeconds;
+    int threadCount;
+    int surfaceCount;
+    int referenceCount;     // surfaces are listed in every leaf their box overlaps
+    int nodeCount;
+    int leafCount;
+    int emptyLeafCount;
+    int maxDepth;
+    int maxLeafSize;
+    float averageLeafSize;  // of the non-empty leaves
+    size_t memoryBytes;
+
+    KdTreeStatistics()
+        : buildSeconds(0.0), threadCount(0), surfaceCount(0), referenceCount(0), nodeCount(0), leafCount(0),
+          emptyLeafCount(0), maxDepth(0), maxLeafSize(0), averageLeafSize(0.0f), memoryBytes(0) {}
+} KdTreeStatistics;
+
+std::ostream &operator<<(std::ostream &output, const KdTreeStatistics & statistics);
+
+// kd-tree over the surfaces of a scene, split by the surface area heuristic
+// leaves cut space into disjoint cells, so a ray visits them front to back
+// .. and stops at the first leaf that holds a hit; surfaces crossing a plane
+// .. are listed on both sides
+class KdTree : public Accelerator
+{
+    private:
+        BoundingBox bounds;
+        std::vector<KdTreeNode> nodes;
+        std::vector<SurfaceRef> refs;
+        KdTreeStatistics statistics;
+
+        void computeStatistics();
+
+    public:
+        // surfaces must outlive the tree and must not change afterwards
+        void build(const Surfaces & surfaces, const KdTreeBuildOptions & options);
+
+        bool getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const;
+        bool isOccluded(const Ray & ray, float tMin, float tMax) const;
+        void printStatistics(std::ostream & output) const;
+
+        const KdTreeStatistics & getStatistics() const
+        {
+            return this->statistics;
+        }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __LAZYBVH_H__
+#define __LAZYBVH_H__
+
+#include "bvh.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <iostream>
+
+// node of the top levels, laid out like BVHNode
+typedef struct LazyBVHNode
+{
+    float bounds[2][3];
+    int offset;          // interior: second child (the first is the next node), leaf: index of its LazySubtree
+    int axis;            // interior: split axis, -1: leaf
+
+    bool isLeaf() const
+    {
+        return axis < 0;
+    }
+} LazyBVHNode;
+
+// the surfaces below one leaf of the top levels, and their BVH once a ray
+// .. has entered the leaf
+typedef struct LazySubtree
+{
+    std::vector<SurfaceRef> refs;     // released once the BVH is built
+    std::atomic<const BVH *> bvh;     // published with release, NULL until built
+    std::unique_ptr<BVH> owner;
+    std::mutex mutex;                 // held while building
+
+    LazySubtree() : bvh(NULL) {}
+} LazySubtree;
+
+typedef struct LazyBVHBuildOptions
+{
+    int subtreeSize;   // the top levels split nodes down to this many surfaces
+    int binCount;      // SAH bins per axis for the top levels
+
+    LazyBVHBuildOptions() : subtreeSize(1 << 12), binCount(16) {}
+} LazyBVHBuildOptions;
+
+typedef struct LazyBVHStatistics
+{
+    double buildSeconds;     // top levels only
+    double refineSeconds;    // subtree builds so far, summed over threads
+    int surfaceCount;
+    int topNodeCount;
+    int subtreeCount;
+    int builtSubtreeCount;
+    long long builtSurfaceCount;
+
+    LazyBVHStatistics()
+        : buildSeconds(0.0), refineSeconds(0.0), surfaceCount(0), topNodeCount(0), subtreeCount(0),
+          builtSubtreeCount(0), builtSurfaceCount(0) {}
+} LazyBVHStatistics;
+
+std::ostream &operator<<(std::ostream &output, const LazyBVHStatistics & statistics);
+
+// BVH whose top levels are built up front and whose subtrees are built by
+// .. the first ray that enters them, so surfaces no ray comes near are never
+// .. sorted into a tree; render threads may refine concurrently, a thread
+// .. entering a subtree that is being built waits for it
+class LazyBVH : public Accelerator
+{
+    private:
+        std::vector<LazyBVHNode> nodes;
+        std::vector< std::unique_ptr<LazySubtree> > subtrees;
+        BVHBuildOptions subtreeOptions;
+        double buildSeconds;
+
+        mutable std::atomic<int> builtSubtreeCount;
+        mutable std::atomic<long long> builtSurfaceCount;
+        mutable std::atomic<long long> refineMicroseconds;
+
+        const BVH & getSubtree(int index) const;
+
+    public:
+        LazyBVH() : buildSeconds(0.0), builtSubtreeCount(0), builtSurfaceCount(0), refineMicroseconds(0) {}
+
+        // subtrees are built with subtreeOptions on the thread that needs them, so
+        // .. their threadCount is ignored; surfaces must outlive the tree and
+        // .. must not change afterwards
+        void build(const Surfaces & surfaces, const LazyBVHBuildOptions & options, const BVHBuildOptions & subtreeOptions);
+
+        bool getClosestHit(const Ray & ray, HitRecord & hitRecord, float epsilon) const;
+        bool isOccluded(const Ray & ray, float tMin, float tMax) const;
+        void printStatistics(std::ostream & output) const;
+
+        // a snapshot, subtrees keep being built while rays are traced
+        LazyBVHStatistics getStatistics() const;
+};
+
+#endif
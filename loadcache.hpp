@@ -0,0 +1,77 @@
+#ifndef __LOADCACHE_H__
+#define __LOADCACHE_H__
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// what loading a scene file decodes or parses out of the bytes of a file or
+// .. an element: a texture's pixels, the <VertexData> or the <Faces> of a mesh
+typedef struct LoadCacheEntry
+{
+    int width, height;                  // textures only
+    std::vector<unsigned char> data;
+} LoadCacheEntry;
+
+typedef struct LoadCacheStatistics
+{
+    long long hits;
+    long long misses;
+    long long evictions;
+    size_t bytes;           // of the entries held
+} LoadCacheStatistics;
+
+// decoded textures and parsed meshes of the scenes loaded in one process, by
+// .. a hash of the bytes they came from, so that scenes sharing an image or a
+// .. mesh decode or parse it once (see BatchRenderer)
+// once the entries are over the budget the least recently used are dropped;
+// .. scenes copy what they find into their arena, so dropping an entry never
+// .. reaches a scene loaded from it
+// threads missing the same key at once each decode it, the last insert is kept
+class LoadCache
+{
+    private:
+        typedef std::pair< unsigned long long, std::shared_ptr<const LoadCacheEntry> > Item;
+
+        std::mutex mutex;
+        size_t budget;
+        std::list<Item> items;      // most recently used first
+        std::unordered_map< unsigned long long, std::list<Item>::iterator > index;
+        LoadCacheStatistics statistics;
+
+        LoadCache(const LoadCache &);
+        LoadCache & operator=(const LoadCache &);
+
+        static size_t getSize(const LoadCacheEntry & entry)
+        {
+            return sizeof(LoadCacheEntry) + entry.data.size();
+        }
+
+        void erase(std::list<Item>::iterator item);
+
+    public:
+        // budget in bytes
+        LoadCache(size_t budget);
+
+        // kind tells apart what is decoded from the same bytes in different ways
+        static unsigned long long getKey(char kind, const void * bytes, size_t size);
+
+        // NULL if it is not held, counted as a miss then
+        std::shared_ptr<const LoadCacheEntry> find(unsigned long long key);
+
+        // an entry over the whole budget is not kept
+        void insert(unsigned long long key, const std::shared_ptr<const LoadCacheEntry> & entry);
+
+        LoadCacheStatistics getStatistics();
+
+        size_t getBudget() const
+        {
+            return this->budget;
+        }
+};
+
+#endif
@@ -1,11 +1,449 @@
 #include "scene.hpp"
+#include "server.hpp"
+#include "coordinator.hpp"
+#include "watcher.hpp"
+#include "batch.hpp"
+#include "image/image.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <scene.xml | compiled scene> [options]" << std::endl
+              << "       " << program << " --serve <socket> [options]   render jobs sent by raytracer-client, see server.hpp" << std::endl
+              << "       " << program << " <manifest> --batch [options]   render every scene file the manifest lists, see batch.hpp" << std::endl
+              << "  --accel <name>    bvh, lazybvh, grid or kdtree, overrides the scene's <Accelerator> (default bvh)" << std::endl
+              << "  --threads <n>     threads used to render and to build the BVH / kd-tree, 0: one per hardware thread" << std::endl
+              << "  --bvh-bins <n>    SAH bins per axis (default 16)" << std::endl
+              << "  --bvh-leaf <n>    maximum surfaces per BVH leaf (default 4)" << std::endl
+              << "  --bvh-width <n>   2: binary BVH, 4 / 8: BVH4 / BVH8 with SIMD box tests (default 2)" << std::endl
+              << "  --bvh-build-order keep nodes and surfaces in build order instead of the cache-friendly layout" << std::endl
+              << "  --bvh-compress    quantized 8-bit child bounds in BVH4 / BVH8 nodes" << std::endl
+              << "  --sbvh            allow spatial splits in the BVH build" << std::endl
+              << "  --sbvh-budget <f> extra BVH references spatial splits may add, relative to the surfaces (default 0.3)" << std::endl
+              << "  --lazy-subtree <n> surfaces below a leaf of the lazy BVH's top levels (default 4096)" << std::endl
+              << "  --grid-density <f> grid cells per surface (default 4)" << std::endl
+              << "  --stats           print accelerator build time and quality, traversal work and timings" << std::endl
+              << "  --benchmark       render with every accelerator and report which is fastest" << std::endl
+              << "  --checkpoint <s>  keep the finished tiles of each image in <image>.checkpoint, written every s seconds" << std::endl
+              << "  --resume          render only the tiles missing from the images' checkpoints, keeps checkpointing" << std::endl
+              << "  --crop x,y,w,h    trace only that rectangle of every camera's image and write it as an image of its own" << std::endl
+              << "  --composite       write crops, given with --crop or a camera's <Crop>, into the image already at the image name" << std::endl
+              << "  --gbuffer         keep what the primary rays hit in <image>.gbuffer, with --relight only where it is missing or stale" << std::endl
+              << "  --relight         shade the images from their <image>.gbuffer with the scene's lights and materials" << std::endl
+              << "  --incremental     render only the tiles an edit of the scene reached since <image>.deps was written with the image" << std::endl
+              << "  --cutoff <t>      stop reflecting once the product of the mirror reflectances is below t (e.g. 0.004)" << std::endl
+              << "  --roulette        reflect below the --cutoff with a chance of the product to t, weighted to stay unbiased" << std::endl
+              << "  --raster          find the triangles the primary rays hit by rasterizing them, then shade and trace from there" << std::endl
+              << "  --watch           render, then render again, incrementally, whenever the scene file or a texture is saved" << std::endl
+              << "  --cache-mb <n>    memory a batch keeps decoded textures and parsed meshes in (default 512)" << std::endl
+              << "  --compile <file>  write the loaded scene and its BVH to a file that renders map instead of loading, then exit" << std::endl
+              << "  --workers <n>     render tiles on n worker processes started for this render" << std::endl
+              << "  --worker <socket> render tiles on a raytracer --serve already running there, repeatable" << std::endl
+              << "  --tile <n>        tile size handed to a worker (default 64)" << std::endl;
+}
 
 int main(int argc, char* argv[])
 {
     Scene scene;
+    bool printStatistics = false;
+    bool benchmark = false;
+    
+    if(argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    // --serve takes the place of the scene file
+    int firstOption = 2;
+    std::string serveSocket;
+    
+    if(strcmp(argv[1], "--serve") == 0)
+    {
+        if(argc < 3)
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        
+        serveSocket = argv[2];
+        firstOption = 3;
+    }
+    
+    // the scene options are passed on to spawned workers
+    int spawnedWorkers = 0;
+    int tileSize = 64;
+    bool hasThreads = false;
+    std::vector<std::string> workerSockets;
+    std::vector<std::string> workerOptions;
+    std::string compilePath;
+    bool hasCrop = false;
+    ImageTile crop;
+    bool watch = false;
+    bool batch = false;
+    size_t cacheBudget = 512;
+    
+    for(int i = firstOption; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        int option = i;
+        
+        if(strcmp(argv[i], "--workers") == 0 && hasValue)
+        {
+            spawnedWorkers = atoi(argv[++i]);
+            continue;
+        }
+        else if(strcmp(argv[i], "--worker") == 0 && hasValue)
+        {
+            workerSockets.push_back(argv[++i]);
+            continue;
+        }
+        else if(strcmp(argv[i], "--tile") == 0 && hasValue)
+        {
+            tileSize = atoi(argv[++i]);
+            continue;
+        }
+        else if(strcmp(argv[i], "--compile") == 0 && hasValue)
+        {
+            compilePath = argv[++i];
+            continue;
+        }
+        else if(strcmp(argv[i], "--accel") == 0 && hasValue)
+        {
+            if(!parseAcceleratorType(argv[++i], scene.acceleratorType))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && hasValue)
+        {
+            scene.bvhBuildOptions.threadCount = atoi(argv[++i]);
+            scene.kdTreeBuildOptions.threadCount = scene.bvhBuildOptions.threadCount;
+            scene.threadCount = scene.bvhBuildOptions.threadCount;
+            hasThreads = true;
+        }
+        else if(strcmp(argv[i], "--bvh-bins") == 0 && hasValue)
+            scene.bvhBuildOptions.binCount = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--bvh-leaf") == 0 && hasValue)
+            scene.bvhBuildOptions.maxLeafSize = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--bvh-width") == 0 && hasValue)
+            scene.bvhBuildOptions.width = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--bvh-build-order") == 0)
+            scene.bvhBuildOptions.reorderLayout = false;
+        else if(strcmp(argv[i], "--bvh-compress") == 0)
+            scene.bvhBuildOptions.compressNodes = true;
+        else if(strcmp(argv[i], "--sbvh") == 0)
+            scene.bvhBuildOptions.spatialSplits = true;
+        else if(strcmp(argv[i], "--sbvh-budget") == 0 && hasValue)
+            scene.bvhBuildOptions.spatialSplitBudget = atof(argv[++i]);
+        else if(strcmp(argv[i], "--lazy-subtree") == 0 && hasValue)
+            scene.lazyBVHBuildOptions.subtreeSize = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--grid-density") == 0 && hasValue)
+            scene.gridBuildOptions.density = atof(argv[++i]);
+        else if(strcmp(argv[i], "--cutoff") == 0 && hasValue)
+            scene.throughputCutoff = atof(argv[++i]);
+        else if(strcmp(argv[i], "--roulette") == 0)
+            scene.russianRoulette = true;
+        else if(strcmp(argv[i], "--checkpoint") == 0 && hasValue)
+        {
+            scene.checkpointInterval = atof(argv[++i]);
+            continue;
+        }
+        else if(strcmp(argv[i], "--crop") == 0 && hasValue)
+        {
+            char end;
+            
+            if(sscanf(argv[++i], "%d,%d,%d,%d%c", &crop.x, &crop.y, &crop.width, &crop.height, &end) != 4 || crop.width < 1)
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            
+            hasCrop = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--composite") == 0)
+        {
+            scene.compositeCrops = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--gbuffer") == 0)
+        {
+            scene.writeGBuffers = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--relight") == 0)
+        {
+            scene.relightGBuffers = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--batch") == 0)
+        {
+            batch = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--cache-mb") == 0 && hasValue)
+        {
+            cacheBudget = strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+        else if(strcmp(argv[i], "--watch") == 0)
+        {
+            watch = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--raster") == 0)
+        {
+            scene.rasterizePrimary = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--incremental") == 0)
+        {
+            scene.incrementalRender = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--resume") == 0)
+        {
+            scene.resumeCheckpoints = true;
+            continue;
+        }
+        else if(strcmp(argv[i], "--stats") == 0)
+            printStatistics = true;
+        else if(strcmp(argv[i], "--benchmark") == 0)
+            benchmark = true;
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        
+        if(strcmp(argv[option], "--stats") != 0 && strcmp(argv[option], "--benchmark") != 0)
+            workerOptions.insert(workerOptions.end(), argv + option, argv + i + 1);
+    }
+    
+    // only the render of a single scene on this process traces crops, and
+    // .. only on their own
+    if(hasCrop && (!serveSocket.empty() || spawnedWorkers > 0 || !workerSockets.empty() || batch || watch ||
+                   scene.writeGBuffers || scene.relightGBuffers || scene.incrementalRender || scene.rasterizePrimary ||
+                   scene.checkpointInterval > 0.0 || scene.resumeCheckpoints))
+    {
+        std::cerr << "Error: --crop cannot be combined with --serve, --workers, --worker, --batch, --watch, --gbuffer, --relight, "
+                  << "--incremental, --raster, --checkpoint or --resume." << std::endl;
+        return 1;
+    }
+    
+    // workers and the server trace tiles, G-buffers and incremental renders
+    // .. trace their primary rays themselves
+    if(scene.rasterizePrimary && (!serveSocket.empty() || spawnedWorkers > 0 || !workerSockets.empty() || watch ||
+                                  scene.writeGBuffers || scene.relightGBuffers || scene.incrementalRender))
+    {
+        std::cerr << "Error: --raster cannot be combined with --serve, --workers, --worker, --watch, --gbuffer, --relight "
+                  << "or --incremental." << std::endl;
+        return 1;
+    }
+    
+    // the options apply to every scene the server loads
+    if(strcmp(argv[1], "--serve") == 0)
+    {
+        RenderServer server(scene);
+        server.run(serveSocket);
+        
+        return 0;
+    }
+    
+    if(spawnedWorkers > 0 || !workerSockets.empty())
+    {
+        TileCoordinator coordinator(tileSize > 0 ? tileSize : 64);
+        
+        // local workers share the hardware threads unless told otherwise
+        if(spawnedWorkers > 0 && !hasThreads)
+        {
+            int threads = std::max(1, (int) std::thread::hardware_concurrency() / spawnedWorkers);
+            
+            workerOptions.push_back("--threads");
+            workerOptions.push_back(std::to_string(threads));
+        }
+        
+        // caught so that the coordinator shuts its workers down
+        try
+        {
+            coordinator.spawnWorkers(spawnedWorkers, workerOptions);
+            
+            for(size_t i = 0; i < workerSockets.size(); i++)
+                coordinator.addWorker(workerSockets[i]);
+            
+            coordinator.render(argv[1]);
+        }
+        catch(const std::exception & exception)
+        {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+        
+        return 0;
+    }
+    
+    // argv[1] is the manifest
+    if(batch)
+    {
+        try
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            std::vector<std::string> paths = BatchRenderer::readManifest(argv[1]);
+            BatchRenderer renderer(scene, cacheBudget << 20);
+            int failed = renderer.run(paths);
+            LoadCacheStatistics cache = renderer.getCacheStatistics();
+            
+            std::cout << paths.size() - failed << " of " << paths.size() << " scenes rendered in " << std::fixed
+                      << std::setprecision(3) << std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()
+                      << " s, cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+                      << " evictions, " << std::setprecision(1) << cache.bytes / 1048576.0 << " MB held" << std::endl;
+            
+            return failed > 0 ? 1 : 0;
+        }
+        catch(const std::exception & exception)
+        {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    // runs until killed
+    if(watch)
+    {
+        try
+        {
+            SceneWatcher watcher(argv[1], scene);
+            watcher.run();
+        }
+        catch(const std::exception & exception)
+        {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    // a compiled scene has its BVH and nothing to build another accelerator from
+    if(CompiledScene::isCompiledScene(argv[1]) &&
+       (benchmark || (scene.acceleratorType != scene_accelerator && scene.acceleratorType != bvh_accelerator)))
+    {
+        std::cerr << "Error: A compiled scene can only be traced with its BVH, --benchmark and --accel other than bvh need the scene file."
+                  << std::endl;
+        return 1;
+    }
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    try
+    {
+        scene.load(argv[1]);
+    }
+    catch(const std::exception & exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    
+    // the crop of the command line replaces those of the scene file
+    if(hasCrop)
+    {
+        for(size_t i = 0; i < scene.cameras.size(); i++)
+            scene.cameras[i].setCrop(crop.x, crop.y, crop.width, crop.height);
+    }
+    
+    std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+    
+    if(!compilePath.empty())
+    {
+        CompiledScene::write(scene, compilePath);
+        
+        std::cout << "compiled " << scene.surfaces.triangles.size() << " triangles and " << scene.surfaces.spheres.size()
+                  << " spheres into " << compilePath << " in " << std::fixed << std::setprecision(3)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - loaded).count() << " s" << std::endl;
+        
+        return 0;
+    }
+    
+    if(benchmark)
+    {
+        const AcceleratorType types[4] = { bvh_accelerator, lazy_bvh_accelerator, grid_accelerator, kdtree_accelerator };
+        int fastest = 0;
+        double renderSeconds[4];
+        
+        for(int t = 0; t < 4; t++)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            
+            scene.buildAccelerator(types[t]);
+            
+            std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+            
+            scene.generateImages();
+            
+            std::chrono::steady_clock::time_point rendered = std::chrono::steady_clock::now();
+            
+            renderSeconds[t] = std::chrono::duration<double>(rendered - built).count();
+            fastest = renderSeconds[t] < renderSeconds[fastest] ? t : fastest;
+            
+            std::cout << std::fixed << std::setprecision(3) << std::left << std::setw(8) << getAcceleratorName(types[t])
+                      << "build " << std::chrono::duration<double>(built - begin).count() << " s, render "
+                      << renderSeconds[t] << " s" << std::endl;
+        }
+        
+        std::cout << "fastest: " << getAcceleratorName(types[fastest]) << std::endl;
+        
+        return 0;
+    }
+    
+    if(printStatistics)
+        scene.accelerator->setTraversalCounting(true);
+    
+    // a scene with an <Animation> renders all of its frames
+    try
+    {
+        if(scene.animation.frameCount > 0)
+            scene.generateAnimation();
+        else
+            scene.generateImages();
+    }
+    catch(const std::exception & exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
     
-    scene.loadFromXml(argv[1]);
-    scene.generateImages();
+    if(printStatistics)
+    {
+        std::chrono::steady_clock::time_point rendered = std::chrono::steady_clock::now();
+        
+        // printed after rendering so that lazily built parts are included
+        scene.accelerator->printStatistics(std::cout);
+        
+        std::cout << std::fixed << std::setprecision(2)
+                  << "closest hit: " << scene.accelerator->getClosestHitCounts() << std::endl
+                  << "shadow:      " << scene.accelerator->getOcclusionCounts() << std::endl;
+        
+        if(scene.throughputCutoff > 0.0f)
+        {
+            std::cout << "reflection:  " << scene.reflectionsTraced << " traced, " << scene.reflectionsCut << " cut, up to "
+                      << scene.bouncesSaved << " bounces saved" << std::endl;
+        }
+        
+        std::cout << std::setprecision(3)
+                  << "load " << std::chrono::duration<double>(loaded - start).count() << " s, first pixel "
+                  << std::chrono::duration<double>(scene.firstPixelTime - start).count() << " s, render "
+                  << std::chrono::duration<double>(rendered - loaded).count() << " s" << std::endl;
+    }
    
     return 0;
 }
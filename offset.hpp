@@ -0,0 +1,68 @@
+#ifndef __OFFSET_H__
+#define __OFFSET_H__
+
+#include <cstddef>
+
+// a pointer stored as the distance from itself to its target, so that objects
+// .. pointing into the same block of memory stay valid wherever the block is
+// .. mapped (see compiled.hpp); copies point to the same target as the
+// .. original, their distance is computed from where they are
+template<class T>
+class OffsetPointer
+{
+    private:
+        std::ptrdiff_t offset; // 0: NULL, nothing points to itself
+
+        void set(T * target)
+        {
+            this->offset = target != NULL ? reinterpret_cast<const char *>(target) - reinterpret_cast<const char *>(this) : 0;
+        }
+
+    public:
+        OffsetPointer(T * target = NULL)
+        {
+            this->set(target);
+        }
+
+        OffsetPointer(const OffsetPointer & pointer)
+        {
+            this->set(pointer.get());
+        }
+
+        OffsetPointer & operator=(const OffsetPointer & pointer)
+        {
+            this->set(pointer.get());
+            return *this;
+        }
+
+        OffsetPointer & operator=(T * target)
+        {
+            this->set(target);
+            return *this;
+        }
+
+        T * get() const
+        {
+            if(this->offset == 0)
+                return NULL;
+
+            return reinterpret_cast<T *>(const_cast<char *>(reinterpret_cast<const char *>(this)) + this->offset);
+        }
+
+        operator T *() const
+        {
+            return this->get();
+        }
+
+        T * operator->() const
+        {
+            return this->get();
+        }
+
+        T & operator*() const
+        {
+            return *this->get();
+        }
+};
+
+#endif
@@ -4,17 +4,58 @@
 #include "geometry.hpp"
 #include "image/color.hpp"
 #include "transformation.hpp"
+#include "arena.hpp"
+#include "bvh.hpp"
+#include "lazybvh.hpp"
+#include "grid.hpp"
+#include "kdtree.hpp"
+#include "animation.hpp"
+#include "compiled.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <chrono>
+
+class Image;
+class ThreadPool;
+class RenderCheckpoint;
+class GBuffer;
+struct GBufferPath;
+struct GBufferHit;
+class RenderDependencies;
+class LoadCache;
+class VisibilityBuffer;
+struct SceneSnapshot;
+struct ImageTile;
+
+namespace tinyxml2 { class XMLNode; }
+
+typedef enum ObjectType { mesh_object, mesh_instance_object, triangle_object, sphere_object } ObjectType;
+
+// an element of <Objects> and the surfaces it became, kept so that it can be
+// .. moved after loading
+typedef struct SceneObject
+{
+    ObjectType type;
+    int id;                         // its id attribute, 0 if it has none
+    Transformation transformation;  // what its <Transformations> compose to, or what setTransformation gave it
+    int baseMesh;                   // mesh instances: their mesh in Scene::objects
+    std::vector<int> surfaces;      // its triangles, or its sphere, in Surfaces
+    std::vector<int> vertexIds;     // into vertexData: three per triangle (mesh instances use their mesh's), a sphere's centre
+    float radius;                   // spheres, untransformed
+    bool moved;                     // given a new transformation since the last Scene::updateObjects
+    
+    SceneObject() : type(mesh_object), id(0), baseMesh(-1), radius(0.0f), moved(false) {}
+} SceneObject;
 
 class Scene
 {
     public:
         
-        ~Scene()
-        {
-           for(int i = 0; i < surfaces.size(); i++)
-                delete surfaces[i];
-        }
+        // owns the vertices, texture coordinates and textures the surfaces point to,
+        // .. everything is released at once together with the scene
+        Arena arena;
         
         Color backgroundColor;
         float shadowRayEpsilon;
@@ -24,17 +65,232 @@ class Scene
         std::vector<PointLight> pointLights;
         std::vector<Material> materials;
         std::vector<Position3> vertexData;
-        std::vector<Surface*> surfaces;
+        Surfaces surfaces;
         std::vector<Texture*> textures;
+        std::vector<std::string> textureNames;  // the image file of each texture, empty for compiled scenes
         std::vector<Scaling> scalings;
         std::vector<Rotation> rotations;
         std::vector<Translation> translations;
         std::vector<TexCoord*> texCoordData;
+        std::vector<SceneObject> objects;
+        Animation animation;
+        
+        // rays are traced through accelerator, built over surfaces at the end of
+        // .. loadFromXml; acceleratorType picks it, scene_accelerator leaves the
+        // .. choice to the <Accelerator> element of the scene file
+        AcceleratorType acceleratorType;
+        Accelerator * accelerator;
+        BVH bvh;
+        BVHBuildOptions bvhBuildOptions;
+        LazyBVH lazyBVH;
+        LazyBVHBuildOptions lazyBVHBuildOptions; // its subtrees use bvhBuildOptions
+        UniformGrid grid;
+        GridBuildOptions gridBuildOptions;
+        KdTree kdTree;
+        KdTreeBuildOptions kdTreeBuildOptions;
+        BVHRefitOptions bvhRefitOptions;
+        
+        // set while the scene is mapped from a compiled scene file, whose
+        // .. mapping the surfaces, textures and BVH are used from
+        std::shared_ptr<CompiledScene> compiled;
+        
+        // render threads, 0: one per hardware thread
+        int threadCount;
+        
+        // generateImages keeps the finished tiles of each image in
+        // .. <image>.checkpoint every checkpointInterval seconds, 0: never;
+        // .. resumeCheckpoints renders only the tiles missing from it
+        double checkpointInterval;
+        bool resumeCheckpoints;
+        
+        // cameras with a crop (Camera::setCrop) write their crop alone,
+        // .. unless compositeCrops traces it into the image already at their
+        // .. image name
+        bool compositeCrops;
+        
+        // writeGBuffers keeps the primary hits of each image in <image>.gbuffer,
+        // .. relightGBuffers shades the images from those files instead of
+        // .. tracing their primary rays (see GBuffer); relighting alone skips
+        // .. the images whose file is missing or stale and throws once the
+        // .. others are written
+        bool writeGBuffers;
+        bool relightGBuffers;
+        
+        // generateImages renders only the tiles of each image that an edit of
+        // .. the scene since the image was written reaches, see RenderDependencies
+        bool incrementalRender;
+        
+        // generateImages and generateAnimation find the triangles the primary
+        // .. rays hit by rasterizing them (see VisibilityBuffer), only shading and the
+        // .. shadow and reflection rays are traced
+        bool rasterizePrimary;
+        
+        // a reflection whose path throughput, the product of the mirror
+        // .. reflectances it went through, is below throughputCutoff in every
+        // .. component is not traced, 0: all are; russianRoulette traces it
+        // .. with the chance of its throughput to the cutoff and weighs what
+        // .. it gives by the inverse instead, which keeps the image unbiased
+        float throughputCutoff;
+        bool russianRoulette;
+        
+        // counted while throughputCutoff is on: the reflections traced, those
+        // .. cut or lost at the roulette, and the bounces the cut ones would
+        // .. have gone on for at most (the recursion depth they had left)
+        std::atomic<long long> reflectionsTraced;
+        std::atomic<long long> reflectionsCut;
+        std::atomic<long long> bouncesSaved;
+        
+        // set, loading takes the textures and meshes it holds from it and
+        // .. adds those it does not; not owned
+        LoadCache * loadCache;
+        
+        // when generateImages finished its first pixel
+        std::chrono::steady_clock::time_point firstPixelTime;
+        
+        Scene() : acceleratorType(scene_accelerator), accelerator(NULL), threadCount(0),
+                  checkpointInterval(0.0), resumeCheckpoints(false), compositeCrops(false),
+                  writeGBuffers(false), relightGBuffers(false), incrementalRender(false), rasterizePrimary(false),
+                  throughputCutoff(0.0f), russianRoulette(false), reflectionsTraced(0), reflectionsCut(0), bouncesSaved(0),
+                  loadCache(NULL) {}
         
         void loadFromXml(const std::string& filepath);
+        
+        // the sections of the scene file the surfaces are not built from,
+        // .. which loadFromXml reads with these and SceneWatcher reads again:
+        // .. the background, epsilon and recursion depth, and the cameras,
+        // .. lights and materials, which are appended
+        void loadSettings(const tinyxml2::XMLNode * root);
+        void loadCameras(const tinyxml2::XMLNode * root);
+        void loadLights(const tinyxml2::XMLNode * root);
+        void loadMaterials(const tinyxml2::XMLNode * root);
+        
+        // the accelerator choice, build options, threads, reflection cutoff
+        // .. and rasterization of settings, which hold the command line's
+        // .. options for every scene loaded
+        void copyLoadOptions(const Scene & settings);
+        
+        // scene/loadcache.cpp
+        // the decoded image file, the parsed <VertexData> appended to
+        // .. vertexData and the parsed <Faces>, three vertex ids a face
+        void readTexture(const std::string & imageName, Texture & texture);
+        void readVertexData(const char * text);
+        void readFaces(const char * text, std::vector<int> & vertexIds);
+        
+        // scene/compiled.cpp
+        // a scene file, or a compiled scene written by CompiledScene::write
+        void load(const std::string& filepath);
         void generateImages();
-        Color getRayColor(Ray & ray, int recursionDepth, bool);
-        Color getReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth);
+        
+        // scene/scene.cpp
+        // on a pool shared with other work, e.g. the other scenes of a batch
+        void generateImages(ThreadPool & pool);
+        
+        // scene/animation.cpp
+        // puts the cameras and objects where the animation has them at frame
+        void setFrame(int frame);
+        
+        // renders every frame of the animation with every camera, to images
+        // .. named by getFrameImageName; frame N is written while frame N + 1
+        // .. renders
+        void generateAnimation();
+        
+        // traces every pixel of the camera into image; with a checkpoint only
+        // .. the tiles it does not have yet, reporting each one finished to it
+        void renderImage(Camera & camera, Image & image, ThreadPool & pool, std::atomic<bool> & hasFirstPixel,
+                         RenderCheckpoint * checkpoint = NULL);
+        
+        // traces the pixels of region, cut into tiles of tileSize squared, into
+        // .. image, which has the camera's resolution; tileDone is called from
+        // .. the render thread that finished the tile, the tiles not started
+        // .. yet are skipped once it returned false
+        void renderTiles(Camera & camera, const ImageTile & region, int tileSize, Image & image, ThreadPool & pool,
+                         const std::function<bool(const ImageTile &)> & tileDone);
+        
+        // identifies what the camera sees: its view, its resolution and the
+        // .. surfaces with their materials, with shading also the materials, lights and the other
+        // .. settings shading uses; textures are only counted
+        unsigned long long getRenderFingerprint(const Camera & camera, bool shading) const;
+        
+        // scene/gbuffer.cpp
+        // traces every pixel of the camera into image, keeping the hits the
+        // .. shading used in the G-buffer
+        void renderGBuffer(Camera & camera, GBuffer & gbuffer, Image & image, ThreadPool & pool);
+        
+        // shades the hits of the G-buffer into image with the scene's lights
+        // .. and materials; it only traces the shadow rays of lights the
+        // .. G-buffer has no visibility of, and the reflections of materials
+        // .. that did not reflect before; true if it traced shadow rays, whose
+        // .. visibility the G-buffer has now
+        bool relight(Camera & camera, GBuffer & gbuffer, Image & image, ThreadPool & pool);
+        
+        Color getPathReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth, GBufferPath & path);
+        
+        // shades the ray as getRayColor does, appending the hits it used to hits
+        Color getRecordedRayColor(const Ray & ray, std::vector<GBufferHit> & hits);
+        
+        // scene/dependencies.cpp
+        // what edits of the scene are told apart by
+        void getSnapshot(SceneSnapshot & snapshot) const;
+        
+        // the tiles of previous that an edit from its scene to now reaches
+        std::vector<bool> getChangedTiles(const Camera & camera, const RenderDependencies & previous,
+                                          const SceneSnapshot & now) const;
+        
+        // renders the tiles of the camera's image the edit since
+        // .. <image>.deps was written reaches over the image written then,
+        // .. all of them if either file is missing or of another render, and
+        // .. writes <image>.deps again; beforeTiles is called with the tiles to be
+        // .. rendered once image holds the pixels kept
+        void renderIncremental(Camera & camera, Image & image, ThreadPool & pool, const SceneSnapshot & snapshot,
+                               const std::function<void(const std::vector<ImageTile> &)> & beforeTiles = nullptr);
+        
+        // scene/visibility.cpp
+        // the closest triangle of each pixel of the camera, and the spheres
+        // .. that may be in front of it
+        void rasterizeVisibility(Camera & camera, VisibilityBuffer & buffer, ThreadPool & pool);
+        
+        // shades every pixel of the camera from its rasterized hit; pixels
+        // .. whose ray misses the triangle rasterized there are traced,
+        // .. returns how many
+        int renderRasterized(Camera & camera, Image & image, ThreadPool & pool);
+        
+        // builds the accelerator of the given type and traces through it from then on
+        // the BVH moves the surfaces into leaf order, which invalidates the others
+        void buildAccelerator(AcceleratorType type);
+        
+        // index of the element of <Objects> of that type and id, -1 if there is none
+        int findObject(ObjectType type, int id) const;
+        
+        // replaces the transformation an object got from the scene file; it is
+        // .. applied to the untransformed vertices, after the mesh's for mesh
+        // .. instances, spheres get their centre transformed and their radius
+        // .. scaled by the length of the transformed x axis; nothing moves
+        // .. before updateObjects
+        void setTransformation(int object, const Transformation & transformation);
+        
+        // moves the surfaces of the objects given new transformations, and of
+        // .. the instances of such meshes, then refits the BVH, which rebuilds
+        // .. what degraded too much (see bvhRefitOptions); other accelerators
+        // .. are built again
+        void updateObjects();
+        
+        // throughput is what the color of the ray is weighed by in the pixel,
+        // .. the product of the mirror reflectances it was reflected by
+        Color getRayColor(Ray & ray, int recursionDepth, bool, const Vector3 & throughput = Vector3(1.0f, 1.0f, 1.0f));
+        
+        // with a path, the visibility of its known lights and the reflected
+        // .. hits are taken from it, or recorded in it (see GBufferPath); its
+        // .. reflections are all traced, relighting may weigh them differently
+        Color getHitColor(const Ray & ray, const HitInfo & hitInfo, const Material & material, int recursionDepth,
+                          GBufferPath * path = NULL, const Vector3 & throughput = Vector3(1.0f, 1.0f, 1.0f));
+        Color getReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth,
+                                 const Vector3 & throughput = Vector3(1.0f, 1.0f, 1.0f));
+        
+        // false if the reflection off the hit, of that throughput, is not
+        // .. traced by throughputCutoff; weight is what its color is to be
+        // .. multiplied by, more than 1 for the survivors of the roulette
+        bool isReflectionTraced(const Ray & ray, const HitInfo & hitInfo, const Vector3 & throughput, int recursionDepth,
+                                float & weight);
 };
 
 #endif
@@ -0,0 +1,208 @@
+#include "../animation.hpp"
+#include "../scene.hpp"
+#include "../image/image.hpp"
+#include "../threadpool.hpp"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    inline float lerp(float a, float b, float t)
+    {
+        return a + (b - a) * t;
+    }
+
+    inline Vector3 lerp(const Vector3 & a, const Vector3 & b, float t)
+    {
+        return Vector3(lerp(a.getX(), b.getX(), t), lerp(a.getY(), b.getY(), t), lerp(a.getZ(), b.getZ(), t));
+    }
+
+    inline bool equals(const Vector3 & a, const Vector3 & b)
+    {
+        return a.getX() == b.getX() && a.getY() == b.getY() && a.getZ() == b.getZ();
+    }
+
+    // the key at or before frame and the weight of the one after it
+    template<class Key>
+    int findKey(const vector<Key> & keys, int frame, float & t)
+    {
+        t = 0.0f;
+
+        if(frame <= keys.front().frame)
+            return 0;
+
+        for(size_t i = 0; i + 1 < keys.size(); i++)
+        {
+            if(frame < keys[i + 1].frame)
+            {
+                t = (float)(frame - keys[i].frame) / (keys[i + 1].frame - keys[i].frame);
+                return i;
+            }
+        }
+
+        return keys.size() - 1;
+    }
+}
+
+bool TransformationKey::operator==(const TransformationKey & rhs) const
+{
+    return equals(scaling, rhs.scaling) && angle == rhs.angle && equals(axis, rhs.axis) && equals(translation, rhs.translation);
+}
+
+Transformation TransformationKey::getTransformation() const
+{
+    Transformation transformation;
+
+    transformation += Scaling(scaling.getX(), scaling.getY(), scaling.getZ());
+
+    // a rotation needs an axis, and none is no rotation
+    if(angle != 0.0f)
+        transformation += Rotation(angle, axis);
+
+    transformation += Translation(translation.getX(), translation.getY(), translation.getZ());
+
+    return transformation;
+}
+
+CameraKey interpolate(const std::vector<CameraKey> & keys, int frame)
+{
+    float t;
+    int i = findKey(keys, frame, t);
+
+    if(t == 0.0f)
+        return keys[i];
+
+    const CameraKey & a = keys[i];
+    const CameraKey & b = keys[i + 1];
+
+    CameraKey key;
+    key.frame = frame;
+    key.position = Position3(lerp(a.position.getX(), b.position.getX(), t),
+                             lerp(a.position.getY(), b.position.getY(), t),
+                             lerp(a.position.getZ(), b.position.getZ(), t));
+    key.gaze = lerp(a.gaze, b.gaze, t);
+    key.up = lerp(a.up, b.up, t);
+
+    return key;
+}
+
+TransformationKey interpolate(const std::vector<TransformationKey> & keys, int frame)
+{
+    float t;
+    int i = findKey(keys, frame, t);
+
+    if(t == 0.0f)
+        return keys[i];
+
+    const TransformationKey & a = keys[i];
+    const TransformationKey & b = keys[i + 1];
+
+    TransformationKey key;
+    key.frame = frame;
+    key.scaling = lerp(a.scaling, b.scaling, t);
+    key.angle = lerp(a.angle, b.angle, t);
+    key.axis = lerp(a.axis, b.axis, t);
+    key.translation = lerp(a.translation, b.translation, t);
+
+    return key;
+}
+
+std::string getFrameImageName(const std::string & imageName, int frame)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%04d", frame);
+
+    size_t dot = imageName.rfind('.');
+
+    if(dot == string::npos || imageName.find('/', dot) != string::npos)
+        return imageName + number;
+
+    return imageName.substr(0, dot) + number + imageName.substr(dot);
+}
+
+void Scene::setFrame(int frame)
+{
+    for(size_t i = 0; i < animation.cameraKeys.size() && i < cameras.size(); i++)
+    {
+        if(animation.cameraKeys[i].empty())
+            continue;
+
+        CameraKey key = interpolate(animation.cameraKeys[i], frame);
+
+        cameras[i].position = key.position;
+        cameras[i].gaze = key.gaze;
+        cameras[i].up = key.up;
+    }
+
+    // objects between the same two keys for a while keep their transformation
+    // .. and are not moved again
+    for(size_t i = 0; i < animation.objects.size(); i++)
+    {
+        ObjectAnimation & object = animation.objects[i];
+        TransformationKey key = interpolate(object.keys, frame);
+
+        if(object.hasCurrent && key == object.current)
+            continue;
+
+        setTransformation(object.object, key.getTransformation());
+
+        object.current = key;
+        object.hasCurrent = true;
+    }
+
+    updateObjects();
+}
+
+void Scene::generateAnimation()
+{
+    ThreadPool pool(this->threadCount);
+    std::atomic<bool> hasFirstPixel(false);
+
+    // frames are whole images
+    for(size_t i = 0; i < cameras.size(); i++)
+    {
+        if(cameras[i].hasCrop())
+            throw std::runtime_error("Error: " + cameras[i].image_name + " has a crop, the frames of an animation are not cropped.");
+    }
+
+    // the only worker of this pool writes an image while the next one renders
+    ThreadPool writer(2);
+    TaskGroup writes(writer);
+
+    for(int frame = 0; frame < animation.frameCount; frame++)
+    {
+        setFrame(frame);
+
+        for(size_t i = 0; i < cameras.size(); i++)
+        {
+            Camera & camera = cameras[i];
+
+            shared_ptr<Image> image(new Image(camera.getImageW(), camera.getImageH()));
+
+            if(rasterizePrimary)
+            {
+                renderRasterized(camera, *image, pool);
+
+                if(!hasFirstPixel.exchange(true))
+                    firstPixelTime = std::chrono::steady_clock::now();
+            }
+            else
+                renderImage(camera, *image, pool, hasFirstPixel);
+
+            // at most one image waits for the disk
+            writes.wait();
+
+            string imageName = getFrameImageName(camera.image_name, frame);
+
+            writes.run([image, imageName]() {
+                image->write(imageName.data());
+            });
+        }
+    }
+
+    writes.wait();
+}
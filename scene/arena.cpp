@@ -0,0 +1,59 @@
+#include "../arena.hpp"
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    size_t padding = (alignment - ((uintptr_t)current & (alignment - 1))) & (alignment - 1);
+
+    if(current == NULL || padding + size > remaining)
+    {
+        // objects bigger than a chunk (e.g. texture images) get a chunk of their own,
+        // .. the rest of the current chunk can still be used afterwards
+        if(size + alignment > chunkSize)
+        {
+            char* chunk = (char*)malloc(size + alignment);
+
+            if(chunk == NULL)
+                throw bad_alloc();
+
+            chunks.push_back(chunk);
+            allocatedBytes += size;
+
+            padding = (alignment - ((uintptr_t)chunk & (alignment - 1))) & (alignment - 1);
+
+            return chunk + padding;
+        }
+
+        current = (char*)malloc(chunkSize);
+
+        if(current == NULL)
+            throw bad_alloc();
+
+        chunks.push_back(current);
+        remaining = chunkSize;
+
+        padding = (alignment - ((uintptr_t)current & (alignment - 1))) & (alignment - 1);
+    }
+
+    char* result = current + padding;
+
+    current += padding + size;
+    remaining -= padding + size;
+    allocatedBytes += size;
+
+    return result;
+}
+
+void Arena::release()
+{
+    for(size_t i = 0; i < chunks.size(); i++)
+        free(chunks[i]);
+
+    chunks.clear();
+    current = NULL;
+    remaining = 0;
+    allocatedBytes = 0;
+}
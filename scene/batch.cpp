@@ -0,0 +1,105 @@
+#include "../batch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+BatchRenderer::BatchRenderer(const Scene & settings, size_t cacheBudget)
+    : settings(settings), pool(settings.threadCount), cache(cacheBudget)
+{
+}
+
+std::vector<std::string> BatchRenderer::readManifest(const std::string & path)
+{
+    std::ifstream file(path.c_str());
+
+    if(!file)
+        throw std::runtime_error("Error: The manifest " + path + " cannot be read.");
+
+    std::vector<std::string> paths;
+    std::string line;
+
+    while(std::getline(file, line))
+    {
+        size_t begin = line.find_first_not_of(" \t\r");
+        size_t end = line.find_last_not_of(" \t\r");
+
+        if(begin == std::string::npos || line[begin] == '#')
+            continue;
+
+        paths.push_back(line.substr(begin, end - begin + 1));
+    }
+
+    return paths;
+}
+
+bool BatchRenderer::renderScene(const std::string & path, int buildThreads)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string failure;
+
+    try
+    {
+        Scene scene;
+        scene.copyLoadOptions(this->settings);
+        scene.bvhBuildOptions.threadCount = buildThreads;
+        scene.kdTreeBuildOptions.threadCount = buildThreads;
+        scene.loadCache = this->cache.getBudget() > 0 ? &this->cache : NULL;
+
+        scene.load(path);
+
+        if(scene.animation.frameCount > 0)
+            throw std::runtime_error("Error: Animated scenes cannot be rendered in a batch.");
+
+        scene.generateImages(this->pool);
+
+        std::lock_guard<std::mutex> lock(this->outputMutex);
+
+        std::cout << path << ": " << scene.cameras.size() << " images in " << std::fixed << std::setprecision(3)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+
+        return true;
+    }
+    catch(const std::exception & exception)
+    {
+        failure = exception.what();
+    }
+
+    std::lock_guard<std::mutex> lock(this->outputMutex);
+    std::cerr << path << ": " << failure << std::endl;
+
+    return false;
+}
+
+int BatchRenderer::run(const std::vector<std::string> & paths)
+{
+    // each runner takes the next scene until there is none; they are queued
+    // .. before any tile, so the idle threads take them first
+    int runnerCount = std::min(this->pool.getThreadCount(), (int) paths.size());
+    int buildThreads = std::max(1, this->pool.getThreadCount() / std::max(runnerCount, 1));
+
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+
+    TaskGroup runners(this->pool);
+
+    for(int r = 0; r < runnerCount; r++)
+    {
+        runners.run([&]() {
+            for(int i = next++; i < (int) paths.size(); i = next++)
+            {
+                if(!this->renderScene(paths[i], buildThreads))
+                    failed++;
+            }
+        });
+    }
+
+    runners.wait();
+
+    return failed;
+}
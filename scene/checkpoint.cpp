@@ -0,0 +1,223 @@
+#include "../checkpoint.hpp"
+#include "../scene.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+static const char checkpointMagic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+
+RenderCheckpoint::RenderCheckpoint(const std::string & path, Image & image, int width, int height, int tileSize,
+                                   unsigned long long fingerprint, double interval)
+    : path(path), image(image), validSize(0), file(NULL), interval(interval), stopping(false)
+{
+    memset(&this->header, 0, sizeof(CheckpointHeader));
+    memcpy(this->header.magic, checkpointMagic, sizeof(checkpointMagic));
+    this->header.version = 1;
+    this->header.width = width;
+    this->header.height = height;
+    this->header.tileSize = tileSize;
+    this->header.fingerprint = fingerprint;
+
+    this->tileColumns = (width + tileSize - 1) / tileSize;
+    this->tileRows = (height + tileSize - 1) / tileSize;
+    this->done.assign(this->tileColumns * this->tileRows, false);
+}
+
+RenderCheckpoint::~RenderCheckpoint()
+{
+    this->stop();
+}
+
+ImageTile RenderCheckpoint::getTile(int index) const
+{
+    int tileSize = this->header.tileSize;
+
+    ImageTile tile;
+    tile.x = (index % this->tileColumns) * tileSize;
+    tile.y = (index / this->tileColumns) * tileSize;
+    tile.width = min(tileSize, this->header.width - tile.x);
+    tile.height = min(tileSize, this->header.height - tile.y);
+
+    return tile;
+}
+
+int RenderCheckpoint::resume()
+{
+    FILE * input = fopen(this->path.c_str(), "rb");
+
+    if(input == NULL)
+        return 0;
+
+    CheckpointHeader stored;
+
+    // resolution, tile size and fingerprint all have to match, anything else
+    // .. is a checkpoint of another render and is started over
+    if(fread(&stored, sizeof(CheckpointHeader), 1, input) != 1 || memcmp(&stored, &this->header, sizeof(CheckpointHeader)) != 0)
+    {
+        fclose(input);
+        return 0;
+    }
+
+    int restored = 0;
+    long size = sizeof(CheckpointHeader);
+    std::vector<unsigned char> pixels;
+
+    while(true)
+    {
+        int index;
+
+        if(fread(&index, sizeof(int), 1, input) != 1 || index < 0 || index >= this->getTileCount())
+            break;
+
+        ImageTile tile = this->getTile(index);
+        pixels.resize(tile.width * tile.height * 3);
+
+        if(fread(pixels.data(), 1, pixels.size(), input) != pixels.size())
+            break;
+
+        for(int y = 0; y < tile.height; y++)
+        {
+            for(int x = 0; x < tile.width; x++)
+            {
+                const unsigned char * pixel = &pixels[(y * tile.width + x) * 3];
+
+                this->image.setColor(tile.x + x, tile.y + y, Color(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+
+        restored += this->done[index] ? 0 : 1;
+        this->done[index] = true;
+        size += sizeof(int) + pixels.size();
+    }
+
+    fclose(input);
+
+    this->validSize = size;
+
+    return restored;
+}
+
+void RenderCheckpoint::start()
+{
+    // a torn record at the end is cut off before appending behind it
+    if(this->validSize > 0)
+    {
+        this->file = fopen(this->path.c_str(), "r+b");
+
+        if(this->file != NULL && (ftruncate(fileno(this->file), this->validSize) != 0 || fseek(this->file, 0, SEEK_END) != 0))
+        {
+            fclose(this->file);
+            this->file = NULL;
+        }
+    }
+
+    if(this->file == NULL)
+    {
+        this->file = fopen(this->path.c_str(), "wb");
+
+        if(this->file == NULL || fwrite(&this->header, sizeof(CheckpointHeader), 1, this->file) != 1)
+            throw std::runtime_error("Error: could not write the checkpoint " + this->path);
+    }
+
+    this->stopping = false;
+    this->writer = std::thread(&RenderCheckpoint::writeLoop, this);
+}
+
+void RenderCheckpoint::tileDone(int index)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->finished.push_back(index);
+}
+
+void RenderCheckpoint::writeLoop()
+{
+    std::vector<int> tiles;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while(true)
+    {
+        this->wake.wait_for(lock, std::chrono::duration<double>(this->interval), [this] { return this->stopping; });
+
+        tiles.swap(this->finished);
+        bool last = this->stopping;
+
+        // the render threads keep queueing while the tiles are written
+        lock.unlock();
+
+        if(!tiles.empty())
+            this->appendTiles(tiles);
+
+        tiles.clear();
+        lock.lock();
+
+        if(last)
+            break;
+    }
+}
+
+void RenderCheckpoint::appendTiles(const std::vector<int> & tiles)
+{
+    if(this->file == NULL)
+        return;
+
+    const unsigned char * imageArray = this->image.getImageArray();
+    bool written = true;
+
+    // the pixels of a finished tile are not written to anymore, they are read
+    // .. while other tiles render
+    for(size_t i = 0; i < tiles.size() && written; i++)
+    {
+        ImageTile tile = this->getTile(tiles[i]);
+
+        written = fwrite(&tiles[i], sizeof(int), 1, this->file) == 1;
+
+        for(int y = tile.y; y < tile.y + tile.height && written; y++)
+        {
+            size_t rowSize = tile.width * 3;
+
+            written = fwrite(imageArray + (y * this->header.width + tile.x) * 3, 1, rowSize, this->file) == rowSize;
+        }
+    }
+
+    // synced so that the tiles survive the machine going away, not only the process
+    if(!written || fflush(this->file) != 0 || fdatasync(fileno(this->file)) != 0)
+    {
+        std::cerr << "Error: could not write the checkpoint " << this->path << ", the render goes on without it" << std::endl;
+
+        fclose(this->file);
+        this->file = NULL;
+    }
+}
+
+void RenderCheckpoint::stop()
+{
+    if(this->writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->wake.notify_one();
+        this->writer.join();
+    }
+
+    if(this->file != NULL)
+    {
+        fclose(this->file);
+        this->file = NULL;
+    }
+}
+
+void RenderCheckpoint::remove()
+{
+    this->stop();
+
+    unlink(this->path.c_str());
+}
@@ -0,0 +1,531 @@
+#include "../compiled.hpp"
+#include "../scene.hpp"
+#include "../threadpool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const char compiledSceneMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+    const unsigned int compiledSceneVersion = 2;
+
+    // sections start on cache lines
+    const unsigned long long sectionAlignment = 64;
+
+    // a larger recursion depth in a file is taken for corruption
+    const int maxCompiledRecursionDepth = 1024;
+
+    void getLayout(unsigned int layout[12])
+    {
+        layout[0] = sizeof(Triangle);
+        layout[1] = sizeof(Sphere);
+        layout[2] = sizeof(Material);
+        layout[3] = sizeof(Texture);
+        layout[4] = sizeof(TexCoord);
+        layout[5] = sizeof(Position3);
+        layout[6] = sizeof(PointLight);
+        layout[7] = sizeof(BVHNode);
+        layout[8] = sizeof(SurfaceRef);
+        layout[9] = sizeof(WideBVHLeaf);
+        layout[10] = sizeof(TrianglePacket);
+        layout[11] = sizeof(WideBVHNode<8>);
+    }
+
+    size_t getWideNodeSize(int width, bool compressed)
+    {
+        if(width == 4)
+            return compressed ? sizeof(QuantizedWideBVHNode<4>) : sizeof(WideBVHNode<4>);
+
+        return compressed ? sizeof(QuantizedWideBVHNode<8>) : sizeof(WideBVHNode<8>);
+    }
+
+    // places the sections one after another
+    class SectionLayout
+    {
+        private:
+            unsigned long long end;
+
+        public:
+            SectionLayout() : end(sizeof(CompiledSceneHeader)) {}
+
+            CompiledSection add(unsigned long long count, size_t elementSize)
+            {
+                CompiledSection section;
+
+                section.offset = (this->end + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+                section.count = count;
+                this->end = section.offset + count * elementSize;
+
+                return section;
+            }
+
+            unsigned long long getSize() const
+            {
+                return this->end;
+            }
+    };
+
+    template<class T>
+    T * getSection(void * mapping, const CompiledSection & section)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(mapping) + section.offset);
+    }
+
+    // the section starts after the header, on a cache line, and ends in the
+    // .. file; the counts the traversal keeps as ints fit in one
+    bool isInside(const CompiledSection & section, size_t elementSize, unsigned long long fileSize)
+    {
+        return section.offset >= sizeof(CompiledSceneHeader) && section.offset % sectionAlignment == 0 &&
+               section.offset <= fileSize && section.count <= (fileSize - section.offset) / elementSize &&
+               section.count <= (unsigned long long) std::numeric_limits<int>::max();
+    }
+
+    // pointer is at an element of the section; NULL is not
+    bool isElement(const void * pointer, const void * mapping, const CompiledSection & section, size_t elementSize)
+    {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(mapping) + section.offset;
+        uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+
+        return address >= begin && address - begin < section.count * elementSize && (address - begin) % elementSize == 0;
+    }
+}
+
+CompiledScene::~CompiledScene()
+{
+    if(this->mapping != NULL)
+        munmap(this->mapping, this->size);
+}
+
+bool CompiledScene::isCompiledScene(const std::string & path)
+{
+    char magic[sizeof(compiledSceneMagic)];
+    int file = open(path.c_str(), O_RDONLY);
+
+    if(file < 0)
+        return false;
+
+    bool isCompiled = read(file, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, compiledSceneMagic, sizeof(magic)) == 0;
+
+    close(file);
+
+    return isCompiled;
+}
+
+void CompiledScene::write(const Scene & scene, const std::string & path)
+{
+    if(scene.accelerator != &scene.bvh)
+        throw std::runtime_error("Error: Only scenes traced with the BVH can be compiled.");
+
+    const Surfaces & surfaces = scene.surfaces;
+    const BVHArrays & arrays = scene.bvh.getArrays();
+    const int triangleCount = surfaces.triangles.size();
+
+    bool hasTexCoords = false;
+    unsigned long long textureBytes = 0;
+
+    for(int i = 0; i < triangleCount && !hasTexCoords; i++)
+        hasTexCoords = surfaces.triangles[i].texCoordData[0] != NULL;
+
+    for(size_t i = 0; i < scene.textures.size(); i++)
+        textureBytes += (unsigned long long) scene.textures[i]->width * scene.textures[i]->height * 3;
+
+    CompiledSceneHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, compiledSceneMagic, sizeof(header.magic));
+    header.version = compiledSceneVersion;
+    getLayout(header.layout);
+
+    header.backgroundColor[0] = scene.backgroundColor.getFR();
+    header.backgroundColor[1] = scene.backgroundColor.getFG();
+    header.backgroundColor[2] = scene.backgroundColor.getFB();
+    header.shadowRayEpsilon = scene.shadowRayEpsilon;
+    header.maxRecursionDepth = scene.maxRecursionDepth;
+    header.ambientLight[0] = scene.ambientLight.getX();
+    header.ambientLight[1] = scene.ambientLight.getY();
+    header.ambientLight[2] = scene.ambientLight.getZ();
+    header.bvhWidth = arrays.width;
+    header.bvhCompressed = arrays.compressed;
+    header.bvhNodeCount = arrays.nodeCount;
+
+    SectionLayout layout;
+    header.cameras = layout.add(scene.cameras.size(), sizeof(CompiledCamera));
+    header.pointLights = layout.add(scene.pointLights.size(), sizeof(PointLight));
+    header.materials = layout.add(scene.materials.size(), sizeof(Material));
+    header.textures = layout.add(scene.textures.size(), sizeof(Texture));
+    header.textureImages = layout.add(textureBytes, 1);
+    header.texCoords = layout.add(hasTexCoords ? 3 * triangleCount : 0, sizeof(TexCoord));
+    header.vertices = layout.add(3 * triangleCount, sizeof(Position3));
+    header.triangles = layout.add(triangleCount, sizeof(Triangle));
+    header.spheres = layout.add(surfaces.spheres.size(), sizeof(Sphere));
+    header.bvhNodes = layout.add(arrays.width == 2 ? arrays.nodeCount : 0, sizeof(BVHNode));
+    header.bvhRefs = layout.add(arrays.refCount, sizeof(SurfaceRef));
+    header.wideNodes = layout.add(arrays.width > 2 ? arrays.wideNodeCount : 0, getWideNodeSize(arrays.width, arrays.compressed));
+    header.wideLeaves = layout.add(arrays.wideLeafCount, sizeof(WideBVHLeaf));
+    header.packets = layout.add(arrays.packetCount, sizeof(TrianglePacket));
+    header.fileSize = layout.getSize();
+
+    std::string temporaryPath = path + ".tmp";
+    int file = open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if(file < 0)
+        throw std::runtime_error("Error: The compiled scene cannot be opened for writing.");
+
+    void * mapping = MAP_FAILED;
+
+    if(ftruncate(file, header.fileSize) == 0)
+        mapping = mmap(NULL, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+    close(file);
+
+    if(mapping == MAP_FAILED)
+    {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("Error: The compiled scene cannot be written.");
+    }
+
+    memcpy(mapping, &header, sizeof(header));
+
+    CompiledCamera * cameras = getSection<CompiledCamera>(mapping, header.cameras);
+
+    for(size_t i = 0; i < scene.cameras.size(); i++)
+    {
+        const Camera & source = scene.cameras[i];
+        CompiledCamera & camera = cameras[i];
+
+        const float position[3] = { source.position.getX(), source.position.getY(), source.position.getZ() };
+        const float gaze[3] = { source.gaze.getX(), source.gaze.getY(), source.gaze.getZ() };
+        const float up[3] = { source.up.getX(), source.up.getY(), source.up.getZ() };
+        const float nearPlane[4] = { source.near_plane.x, source.near_plane.y, source.near_plane.z, source.near_plane.w };
+
+        memcpy(camera.position, position, sizeof(position));
+        memcpy(camera.gaze, gaze, sizeof(gaze));
+        memcpy(camera.up, up, sizeof(up));
+        memcpy(camera.nearPlane, nearPlane, sizeof(nearPlane));
+        camera.nearDistance = source.near_distance;
+        camera.width = source.image_width;
+        camera.height = source.image_height;
+        camera.crop[0] = source.crop_x;
+        camera.crop[1] = source.crop_y;
+        camera.crop[2] = source.crop_width;
+        camera.crop[3] = source.crop_height;
+        strncpy(camera.imageName, source.image_name.c_str(), sizeof(camera.imageName) - 1);
+    }
+
+    PointLight * pointLights = getSection<PointLight>(mapping, header.pointLights);
+
+    for(size_t i = 0; i < scene.pointLights.size(); i++)
+        new (&pointLights[i]) PointLight(scene.pointLights[i]);
+
+    Material * materials = getSection<Material>(mapping, header.materials);
+
+    for(size_t i = 0; i < scene.materials.size(); i++)
+        new (&materials[i]) Material(scene.materials[i]);
+
+    // textures by their address in the scene
+    std::map<const Texture *, Texture *> textures;
+    Texture * compiledTextures = getSection<Texture>(mapping, header.textures);
+    unsigned char * textureImage = getSection<unsigned char>(mapping, header.textureImages);
+
+    textures[NULL] = NULL;
+
+    for(size_t i = 0; i < scene.textures.size(); i++)
+    {
+        const Texture & source = *scene.textures[i];
+        size_t bytes = (size_t) source.width * source.height * 3;
+
+        Texture * texture = new (&compiledTextures[i]) Texture(source);
+        memcpy(textureImage, source.image, bytes);
+        texture->image = textureImage;
+        textureImage += bytes;
+
+        textures[scene.textures[i]] = texture;
+    }
+
+    // surfaces point to their material in Scene::materials, the same index in the file
+    const Material * sceneMaterials = scene.materials.data();
+    const size_t materialCount = scene.materials.size();
+
+    TexCoord * texCoords = getSection<TexCoord>(mapping, header.texCoords);
+    Position3 * vertices = getSection<Position3>(mapping, header.vertices);
+    Triangle * triangles = getSection<Triangle>(mapping, header.triangles);
+    Sphere * spheres = getSection<Sphere>(mapping, header.spheres);
+
+    ThreadPool pool(scene.threadCount);
+    std::atomic<bool> unknownReference(false);
+
+    // every triangle gets its own vertices and texture coordinates, like the loader gives it
+    parallelFor(pool, 0, triangleCount, 1 << 14, [&](int begin, int end) {
+        for(int i = begin; i < end; i++)
+        {
+            const Triangle & source = surfaces.triangles[i];
+            Triangle * triangle = new (&triangles[i]) Triangle(source);
+
+            size_t material = source.material.get() - sceneMaterials;
+
+            if(material >= materialCount || textures.count(source.texture.get()) == 0)
+                unknownReference = true;
+
+            triangle->material = &materials[material < materialCount ? material : 0];
+            triangle->texture = textures.count(source.texture.get()) ? textures.find(source.texture.get())->second : NULL;
+
+            for(int k = 0; k < 3; k++)
+            {
+                Position3 * vertex = new (&vertices[3 * i + k]) Position3(*source.vertex[k]);
+                triangle->vertex[k] = vertex;
+
+                if(hasTexCoords && source.texCoordData[k] != NULL)
+                {
+                    texCoords[3 * i + k] = *source.texCoordData[k];
+                    triangle->texCoordData[k] = &texCoords[3 * i + k];
+                }
+                else
+                    triangle->texCoordData[k] = NULL;
+            }
+        }
+    });
+
+    for(size_t i = 0; i < surfaces.spheres.size(); i++)
+    {
+        const Sphere & source = surfaces.spheres[i];
+        Sphere * sphere = new (&spheres[i]) Sphere(source);
+
+        size_t material = source.material.get() - sceneMaterials;
+
+        if(material >= materialCount || textures.count(source.texture.get()) == 0)
+            unknownReference = true;
+
+        sphere->material = &materials[material < materialCount ? material : 0];
+        sphere->texture = textures.count(source.texture.get()) ? textures[source.texture.get()] : NULL;
+    }
+
+    // the BVH refers to surfaces and to its own arrays by index
+    memcpy(getSection<char>(mapping, header.bvhNodes), arrays.nodes, header.bvhNodes.count * sizeof(BVHNode));
+    memcpy(getSection<char>(mapping, header.bvhRefs), arrays.refs, header.bvhRefs.count * sizeof(SurfaceRef));
+    memcpy(getSection<char>(mapping, header.wideNodes), arrays.wideNodes, header.wideNodes.count * getWideNodeSize(arrays.width, arrays.compressed));
+    memcpy(getSection<char>(mapping, header.wideLeaves), arrays.wideLeaves, header.wideLeaves.count * sizeof(WideBVHLeaf));
+    memcpy(getSection<char>(mapping, header.packets), arrays.packets, header.packets.count * sizeof(TrianglePacket));
+
+    munmap(mapping, header.fileSize);
+
+    if(unknownReference)
+    {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("Error: A surface of the scene refers to a material or texture the scene does not have.");
+    }
+
+    if(rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("Error: The compiled scene cannot be written.");
+    }
+}
+
+void CompiledScene::checkContents(const CompiledSceneHeader & header, const std::string & path) const
+{
+    const std::runtime_error corrupted("Error: " + path + " is corrupted, compile it again.");
+    void * mapping = this->mapping;
+
+    const std::pair<const CompiledSection *, size_t> sections[14] = {
+        std::make_pair(&header.cameras, sizeof(CompiledCamera)), std::make_pair(&header.pointLights, sizeof(PointLight)),
+        std::make_pair(&header.materials, sizeof(Material)), std::make_pair(&header.textures, sizeof(Texture)),
+        std::make_pair(&header.textureImages, (size_t) 1), std::make_pair(&header.texCoords, sizeof(TexCoord)),
+        std::make_pair(&header.vertices, sizeof(Position3)), std::make_pair(&header.triangles, sizeof(Triangle)),
+        std::make_pair(&header.spheres, sizeof(Sphere)), std::make_pair(&header.bvhNodes, sizeof(BVHNode)),
+        std::make_pair(&header.bvhRefs, sizeof(SurfaceRef)),
+        std::make_pair(&header.wideNodes, getWideNodeSize(header.bvhWidth, header.bvhCompressed != 0)),
+        std::make_pair(&header.wideLeaves, sizeof(WideBVHLeaf)), std::make_pair(&header.packets, sizeof(TrianglePacket))
+    };
+
+    for(int i = 0; i < 14; i++)
+    {
+        if(!isInside(*sections[i].first, sections[i].second, this->size))
+            throw corrupted;
+    }
+
+    // every reflection is a level of recursion on the render thread's stack
+    if(header.maxRecursionDepth < 0 || header.maxRecursionDepth > maxCompiledRecursionDepth)
+        throw corrupted;
+
+    // the binary nodes are only stored for binary trees
+    if(header.bvhNodeCount < 0 || (header.bvhWidth == 2 && (unsigned long long) header.bvhNodeCount != header.bvhNodes.count))
+        throw corrupted;
+
+    const CompiledCamera * cameras = getSection<CompiledCamera>(mapping, header.cameras);
+
+    for(unsigned long long i = 0; i < header.cameras.count; i++)
+    {
+        const CompiledCamera & camera = cameras[i];
+
+        if(camera.width < 1 || camera.height < 1 || (long long) camera.width * camera.height * 3 > std::numeric_limits<int>::max() ||
+           memchr(camera.imageName, '\0', sizeof(camera.imageName)) == NULL)
+            throw corrupted;
+    }
+
+    const Texture * textures = getSection<Texture>(mapping, header.textures);
+    const unsigned char * textureImages = getSection<unsigned char>(mapping, header.textureImages);
+
+    for(unsigned long long i = 0; i < header.textures.count; i++)
+    {
+        const Texture & texture = textures[i];
+
+        if(texture.width < 1 || texture.height < 1 || !isElement(texture.image.get(), mapping, header.textureImages, 1) ||
+           (unsigned long long) texture.width * texture.height * 3 > header.textureImages.count - (texture.image.get() - textureImages))
+            throw corrupted;
+    }
+
+    const Triangle * triangles = getSection<Triangle>(mapping, header.triangles);
+
+    for(unsigned long long i = 0; i < header.triangles.count; i++)
+    {
+        const Triangle & triangle = triangles[i];
+
+        if(!isElement(triangle.material.get(), mapping, header.materials, sizeof(Material)) ||
+           (triangle.texture.get() != NULL && !isElement(triangle.texture.get(), mapping, header.textures, sizeof(Texture))))
+            throw corrupted;
+
+        for(int k = 0; k < 3; k++)
+        {
+            if(!isElement(triangle.vertex[k].get(), mapping, header.vertices, sizeof(Position3)) ||
+               (triangle.texCoordData[k].get() != NULL &&
+                !isElement(triangle.texCoordData[k].get(), mapping, header.texCoords, sizeof(TexCoord))))
+                throw corrupted;
+        }
+    }
+
+    const Sphere * spheres = getSection<Sphere>(mapping, header.spheres);
+
+    for(unsigned long long i = 0; i < header.spheres.count; i++)
+    {
+        if(!isElement(spheres[i].material.get(), mapping, header.materials, sizeof(Material)) ||
+           (spheres[i].texture.get() != NULL && !isElement(spheres[i].texture.get(), mapping, header.textures, sizeof(Texture))))
+            throw corrupted;
+    }
+}
+
+void CompiledScene::map(const std::string & path, Scene & scene)
+{
+    int file = open(path.c_str(), O_RDONLY);
+    struct stat status;
+
+    if(file < 0 || fstat(file, &status) != 0)
+    {
+        if(file >= 0)
+            close(file);
+
+        throw std::runtime_error("Error: The compiled scene cannot be opened.");
+    }
+
+    void * mapping = MAP_FAILED;
+
+    if((size_t) status.st_size >= sizeof(CompiledSceneHeader))
+        mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+
+    close(file);
+
+    if(mapping == MAP_FAILED)
+        throw std::runtime_error("Error: The compiled scene cannot be mapped.");
+
+    this->mapping = mapping;
+    this->size = status.st_size;
+
+    const CompiledSceneHeader & header = *static_cast<const CompiledSceneHeader *>(mapping);
+    unsigned int layout[12];
+    getLayout(layout);
+
+    if(memcmp(header.magic, compiledSceneMagic, sizeof(header.magic)) != 0 || header.fileSize != this->size)
+        throw std::runtime_error("Error: " + path + " is not a compiled scene.");
+
+    if(header.version != compiledSceneVersion || memcmp(header.layout, layout, sizeof(layout)) != 0)
+        throw std::runtime_error("Error: " + path + " was compiled by a different build, compile it again.");
+
+    this->checkContents(header, path);
+
+    scene.backgroundColor = Color(header.backgroundColor[0], header.backgroundColor[1], header.backgroundColor[2]);
+    scene.shadowRayEpsilon = header.shadowRayEpsilon;
+    scene.maxRecursionDepth = header.maxRecursionDepth;
+    scene.ambientLight = Vector3(header.ambientLight[0], header.ambientLight[1], header.ambientLight[2]);
+
+    const CompiledCamera * cameras = getSection<CompiledCamera>(mapping, header.cameras);
+
+    for(unsigned long long i = 0; i < header.cameras.count; i++)
+    {
+        const CompiledCamera & source = cameras[i];
+        Camera camera;
+
+        camera.position = Position3(source.position[0], source.position[1], source.position[2]);
+        camera.gaze = Vector3(source.gaze[0], source.gaze[1], source.gaze[2]);
+        camera.up = Vector3(source.up[0], source.up[1], source.up[2]);
+        camera.near_plane.x = source.nearPlane[0];
+        camera.near_plane.y = source.nearPlane[1];
+        camera.near_plane.z = source.nearPlane[2];
+        camera.near_plane.w = source.nearPlane[3];
+        camera.near_distance = source.nearDistance;
+        camera.image_width = source.width;
+        camera.image_height = source.height;
+        camera.setCrop(source.crop[0], source.crop[1], source.crop[2], source.crop[3]);
+        camera.image_name = source.imageName;
+
+        scene.cameras.push_back(camera);
+    }
+
+    const PointLight * pointLights = getSection<PointLight>(mapping, header.pointLights);
+    scene.pointLights.assign(pointLights, pointLights + header.pointLights.count);
+
+    // the surfaces point to the materials and textures in the file, these are copies
+    const Material * materials = getSection<Material>(mapping, header.materials);
+    this->materials = materials;
+    scene.materials.assign(materials, materials + header.materials.count);
+
+    Texture * textures = getSection<Texture>(mapping, header.textures);
+
+    for(unsigned long long i = 0; i < header.textures.count; i++)
+        scene.textures.push_back(&textures[i]);
+
+    scene.surfaces.triangles.setView(getSection<Triangle>(mapping, header.triangles), header.triangles.count);
+    scene.surfaces.spheres.setView(getSection<Sphere>(mapping, header.spheres), header.spheres.count);
+
+    BVHArrays arrays;
+    arrays.width = header.bvhWidth;
+    arrays.compressed = header.bvhCompressed != 0;
+    arrays.nodes = getSection<BVHNode>(mapping, header.bvhNodes);
+    arrays.nodeCount = header.bvhNodeCount;
+    arrays.refs = getSection<SurfaceRef>(mapping, header.bvhRefs);
+    arrays.refCount = header.bvhRefs.count;
+    arrays.wideNodes = getSection<char>(mapping, header.wideNodes);
+    arrays.wideNodeCount = header.wideNodes.count;
+    arrays.wideLeaves = getSection<WideBVHLeaf>(mapping, header.wideLeaves);
+    arrays.wideLeafCount = header.wideLeaves.count;
+    arrays.packets = getSection<TrianglePacket>(mapping, header.packets);
+    arrays.packetCount = header.packets.count;
+
+    scene.bvh.useArrays(scene.surfaces, arrays);
+    scene.acceleratorType = bvh_accelerator;
+    scene.accelerator = &scene.bvh;
+}
+
+void Scene::load(const std::string & filepath)
+{
+    if(!CompiledScene::isCompiledScene(filepath))
+    {
+        this->loadFromXml(filepath);
+        return;
+    }
+
+    if(this->acceleratorType != scene_accelerator && this->acceleratorType != bvh_accelerator)
+        throw std::runtime_error("Error: A compiled scene can only be traced with its BVH.");
+
+    this->compiled = std::make_shared<CompiledScene>();
+    this->compiled->map(filepath, *this);
+}
@@ -0,0 +1,730 @@
+#include "../dependencies.hpp"
+#include "../scene.hpp"
+#include "../gbuffer.hpp"
+#include "../hash.hpp"
+#include "../image/image.hpp"
+#include "../threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <unistd.h>
+
+using namespace std;
+
+static const char dependenciesMagic[8] = { 'R', 'T', 'D', 'E', 'P', 'S', '0', '1' };
+
+RenderDependencies::RenderDependencies(int width, int height, int tileSize, unsigned long long view)
+{
+    // the box is empty until setScene, the fields without a constructor are zero
+    this->header = DependencyHeader();
+    memcpy(this->header.magic, dependenciesMagic, sizeof(dependenciesMagic));
+    this->header.version = 2;
+    this->header.width = width;
+    this->header.height = height;
+    this->header.tileSize = tileSize;
+    this->header.view = view;
+    this->header.settings = 0;
+    this->header.complete = 0;
+    this->header.objectCount = 0;
+    this->header.lightCount = 0;
+    this->header.materialCount = 0;
+    this->header.textureCount = 0;
+
+    this->tileColumns = (width + tileSize - 1) / tileSize;
+    this->tileRows = (height + tileSize - 1) / tileSize;
+    this->tiles.resize(this->tileColumns * this->tileRows);
+
+    for(size_t i = 0; i < this->tiles.size(); i++)
+        this->tiles[i].clear();
+}
+
+ImageTile RenderDependencies::getTile(int index) const
+{
+    int tileSize = this->header.tileSize;
+
+    ImageTile tile;
+    tile.x = (index % this->tileColumns) * tileSize;
+    tile.y = (index / this->tileColumns) * tileSize;
+    tile.width = min(tileSize, this->header.width - tile.x);
+    tile.height = min(tileSize, this->header.height - tile.y);
+
+    return tile;
+}
+
+void RenderDependencies::setScene(const SceneSnapshot & scene)
+{
+    if(scene.lights.size() != this->scene.lights.size())
+    {
+        ShadowCone none = { { 0.0f, 0.0f, 0.0f }, 1.0f, -1.0f };
+
+        this->shadows.assign(this->tiles.size() * scene.lights.size(), none);
+    }
+
+    this->scene = scene;
+
+    this->header.settings = scene.settings;
+    this->header.complete = scene.complete ? 1 : 0;
+    this->header.objectCount = scene.objects.size();
+    this->header.lightCount = scene.lights.size();
+    this->header.materialCount = scene.materials.size();
+    this->header.textureCount = scene.textures.size();
+    this->header.bounds = scene.bounds;
+}
+
+void RenderDependencies::write(const std::string & path) const
+{
+    std::string temporaryPath = path + ".tmp";
+    FILE * file = fopen(temporaryPath.c_str(), "wb");
+
+    if(file == NULL)
+        throw std::runtime_error("Error: The dependencies " + path + " cannot be opened for writing.");
+
+    bool written = fwrite(&this->header, sizeof(DependencyHeader), 1, file) == 1 &&
+                   fwrite(this->tiles.data(), sizeof(TileDependencies), this->tiles.size(), file) == this->tiles.size() &&
+                   fwrite(this->shadows.data(), sizeof(ShadowCone), this->shadows.size(), file) == this->shadows.size() &&
+                   fwrite(this->scene.objects.data(), sizeof(ObjectRecord), this->scene.objects.size(), file) == this->scene.objects.size() &&
+                   fwrite(this->scene.lights.data(), sizeof(LightRecord), this->scene.lights.size(), file) == this->scene.lights.size() &&
+                   fwrite(this->scene.materials.data(), sizeof(unsigned long long), this->scene.materials.size(), file) == this->scene.materials.size() &&
+                   fwrite(this->scene.textures.data(), sizeof(unsigned long long), this->scene.textures.size(), file) == this->scene.textures.size();
+
+    written = fclose(file) == 0 && written;
+
+    if(!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("Error: The dependencies " + path + " cannot be written.");
+    }
+}
+
+bool RenderDependencies::read(const std::string & path)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+
+    if(file == NULL)
+        return false;
+
+    DependencyHeader stored;
+
+    bool matches = fread(&stored, sizeof(DependencyHeader), 1, file) == 1 &&
+                   memcmp(stored.magic, this->header.magic, sizeof(stored.magic)) == 0 &&
+                   stored.version == this->header.version && stored.width == this->header.width &&
+                   stored.height == this->header.height && stored.tileSize == this->header.tileSize &&
+                   stored.view == this->header.view &&
+                   stored.objectCount >= 0 && stored.lightCount >= 0 && stored.materialCount >= 0 && stored.textureCount >= 0 &&
+                   fread(this->tiles.data(), sizeof(TileDependencies), this->tiles.size(), file) == this->tiles.size();
+
+    if(matches)
+    {
+        this->scene.objects.resize(stored.objectCount);
+        this->scene.lights.resize(stored.lightCount);
+        this->scene.materials.resize(stored.materialCount);
+        this->scene.textures.resize(stored.textureCount);
+        this->shadows.resize(this->tiles.size() * stored.lightCount);
+
+        matches = fread(this->shadows.data(), sizeof(ShadowCone), this->shadows.size(), file) == this->shadows.size() &&
+                  fread(this->scene.objects.data(), sizeof(ObjectRecord), this->scene.objects.size(), file) == this->scene.objects.size() &&
+                  fread(this->scene.lights.data(), sizeof(LightRecord), this->scene.lights.size(), file) == this->scene.lights.size() &&
+                  fread(this->scene.materials.data(), sizeof(unsigned long long), this->scene.materials.size(), file) == this->scene.materials.size() &&
+                  fread(this->scene.textures.data(), sizeof(unsigned long long), this->scene.textures.size(), file) == this->scene.textures.size();
+    }
+
+    fclose(file);
+
+    if(!matches)
+        return false;
+
+    this->header = stored;
+    this->scene.settings = stored.settings;
+    this->scene.complete = stored.complete != 0;
+    this->scene.bounds = stored.bounds;
+
+    return true;
+}
+
+unsigned long long RenderDependencies::mix(unsigned long long key)
+{
+    // the finalizer of splitmix64
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+
+    return key ^ (key >> 31);
+}
+
+unsigned long long RenderDependencies::getMaterialKey(int material)
+{
+    const long long values[2] = { -1, material };
+
+    return mix(hashValues(hashBasis, values, 2));
+}
+
+void Scene::getSnapshot(SceneSnapshot & snapshot) const
+{
+    unsigned long long settings = hashBasis;
+
+    const float scalars[2] = { this->shadowRayEpsilon, (float) this->maxRecursionDepth };
+    settings = hashValues(settings, scalars, 2);
+
+    // only when on, so that the .deps written before it stay valid
+    if(this->throughputCutoff > 0.0f)
+    {
+        const float cutoff[2] = { this->throughputCutoff, this->russianRoulette ? 1.0f : 0.0f };
+        settings = hashValues(settings, cutoff, 2);
+    }
+    settings = hashVector(settings, Vector3(this->backgroundColor.getFR(), this->backgroundColor.getFG(), this->backgroundColor.getFB()));
+    settings = hashVector(settings, this->ambientLight);
+
+    // the surfaces refer to textures by index, the texture coordinates are
+    // .. shared by all of them; an image edited under the same name only
+    // .. changes the tiles that hit it
+    std::unordered_map<const Texture *, int> textureIndices;
+
+    snapshot.textures.resize(this->textures.size());
+    snapshot.textureObjects.assign(this->textures.size(), std::vector<int>());
+
+    for(size_t i = 0; i < this->textures.size(); i++)
+    {
+        const Texture & texture = *this->textures[i];
+        const int descriptor[5] = { texture.interpolation, texture.decalMode, texture.appearance, texture.width, texture.height };
+
+        settings = hashValues(settings, descriptor, 5);
+        snapshot.textures[i] = hashValues(hashBasis, texture.image.get(), (size_t) texture.width * texture.height * 3);
+        textureIndices[this->textures[i]] = i;
+    }
+
+    for(size_t i = 0; i < this->texCoordData.size(); i++)
+        settings = hashValues(settings, this->texCoordData[i], 1);
+
+    snapshot.settings = settings;
+    snapshot.bounds = BoundingBox();
+    snapshot.objects.resize(this->objects.size());
+    snapshot.triangleObjects.assign(this->surfaces.triangles.size(), -1);
+    snapshot.sphereObjects.assign(this->surfaces.spheres.size(), -1);
+
+    std::map<std::pair<int, int>, int> occurrences;
+
+    for(size_t i = 0; i < this->objects.size(); i++)
+    {
+        const SceneObject & object = this->objects[i];
+        ObjectRecord & record = snapshot.objects[i];
+
+        const long long identity[3] = { object.type, object.id, occurrences[std::make_pair((int) object.type, object.id)]++ };
+        record.key = RenderDependencies::mix(hashValues(hashBasis, identity, 3));
+        record.hash = hashBasis;
+        record.bounds = BoundingBox();
+
+        for(size_t s = 0; s < object.surfaces.size(); s++)
+        {
+            int index = object.surfaces[s];
+            const Surface * surface;
+
+            if(object.type == sphere_object)
+            {
+                const Sphere & sphere = this->surfaces.spheres[index];
+                float radius = sphere.getRadius();
+
+                record.hash = hashValues(hashVector(record.hash, sphere.getCenter()), &radius, 1);
+                record.bounds.expand(sphere.getBoundingBox());
+                snapshot.sphereObjects[index] = i;
+                surface = &sphere;
+            }
+            else
+            {
+                const Triangle & triangle = this->surfaces.triangles[index];
+
+                for(int v = 0; v < 3; v++)
+                    record.hash = hashVector(record.hash, triangle.getVertex(v));
+
+                record.bounds.expand(triangle.getBoundingBox());
+                snapshot.triangleObjects[index] = i;
+                surface = &triangle;
+            }
+
+            std::unordered_map<const Texture *, int>::const_iterator texture = textureIndices.find(surface->getTexture());
+            const int references[2] = { (int) (&surface->getMaterial() - this->materials.data()),
+                                        texture != textureIndices.end() ? texture->second : -1 };
+
+            record.hash = hashValues(record.hash, references, 2);
+
+            if(references[1] >= 0 && (snapshot.textureObjects[references[1]].empty() || snapshot.textureObjects[references[1]].back() != (int) i))
+                snapshot.textureObjects[references[1]].push_back(i);
+        }
+
+        snapshot.bounds.expand(record.bounds);
+    }
+
+    // a compiled scene has no objects, what it is made of is not known
+    snapshot.complete = !this->compiled && !this->objects.empty() &&
+                        std::find(snapshot.triangleObjects.begin(), snapshot.triangleObjects.end(), -1) == snapshot.triangleObjects.end() &&
+                        std::find(snapshot.sphereObjects.begin(), snapshot.sphereObjects.end(), -1) == snapshot.sphereObjects.end();
+
+    snapshot.lights.resize(this->pointLights.size());
+
+    for(size_t i = 0; i < this->pointLights.size(); i++)
+    {
+        const PointLight & light = this->pointLights[i];
+        LightRecord & record = snapshot.lights[i];
+
+        record.position[0] = light.position.getX();
+        record.position[1] = light.position.getY();
+        record.position[2] = light.position.getZ();
+        record.intensity[0] = light.intensity.getX();
+        record.intensity[1] = light.intensity.getY();
+        record.intensity[2] = light.intensity.getZ();
+    }
+
+    snapshot.materials.resize(this->materials.size());
+
+    for(size_t i = 0; i < this->materials.size(); i++)
+    {
+        const Material & material = this->materials[i];
+
+        unsigned long long hash = hashVector(hashVector(hashVector(hashVector(hashBasis, material.ambient), material.diffuse), material.specular), material.mirror);
+        snapshot.materials[i] = hashValues(hash, &material.phong_exponent, 1);
+    }
+}
+
+static bool overlaps(const BoundingBox & a, const BoundingBox & b, float margin)
+{
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(a.min[axis] - margin > b.max[axis] || b.min[axis] - margin > a.max[axis])
+            return false;
+    }
+
+    return !a.isEmpty() && !b.isEmpty();
+}
+
+// whether the object in the box may be in the way of a shadow ray in the
+// .. cone, the object taken as the sphere around its box grown by margin
+static bool mayShadow(const BoundingBox & object, const ShadowCone & cone, const float light[3], float margin)
+{
+    float toObject[3];
+    float distance = 0.0f, radius = 0.0f;
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        float extent = (object.max[axis] - object.min[axis]) * 0.5f;
+
+        toObject[axis] = object.min[axis] + extent - light[axis];
+        distance += toObject[axis] * toObject[axis];
+        radius += extent * extent;
+    }
+
+    distance = sqrt(distance);
+    radius = sqrt(radius) + margin;
+
+    if(cone.distance < 0.0f)
+        return false;
+
+    if(distance <= radius)
+        return true;
+
+    // farther from the light than any hit
+    if(distance - radius > cone.distance)
+        return false;
+
+    float cosine = (toObject[0] * cone.axis[0] + toObject[1] * cone.axis[1] + toObject[2] * cone.axis[2]) / distance;
+    float angle = acos(max(-1.0f, min(1.0f, cosine)));
+
+    return angle <= acos(cone.cosine) + asin(radius / distance) + 1e-4f;
+}
+
+// the cone from the light around the hits
+static ShadowCone getShadowCone(const std::vector<Position3> & hits, const LightRecord & light)
+{
+    ShadowCone cone = { { 0.0f, 0.0f, 0.0f }, 1.0f, -1.0f };
+
+    if(hits.empty())
+        return cone;
+
+    Vector3 axis;
+    std::vector<Vector3> directions(hits.size());
+
+    for(size_t i = 0; i < hits.size(); i++)
+    {
+        directions[i] = hits[i] - Position3(light.position[0], light.position[1], light.position[2]);
+
+        float distance = sqrt(directions[i] ^ directions[i]);
+
+        cone.distance = max(cone.distance, distance);
+        directions[i] = distance > 0.0f ? directions[i] / distance : Vector3(1.0f, 0.0f, 0.0f);
+        axis = axis + directions[i];
+    }
+
+    if((axis ^ axis) == 0.0f)
+        axis = Vector3(1.0f, 0.0f, 0.0f);
+
+    axis.normalize();
+
+    for(size_t i = 0; i < hits.size(); i++)
+        cone.cosine = min(cone.cosine, directions[i] ^ axis);
+
+    cone.axis[0] = axis.getX();
+    cone.axis[1] = axis.getY();
+    cone.axis[2] = axis.getZ();
+
+    return cone;
+}
+
+std::vector<bool> Scene::getChangedTiles(const Camera & camera, const RenderDependencies & previous, const SceneSnapshot & now) const
+{
+    const SceneSnapshot & before = previous.getScene();
+    const int tileCount = previous.getTileCount();
+
+    // an edit no object, light or material tells apart
+    if(!before.complete || !now.complete || before.settings != now.settings)
+        return std::vector<bool>(tileCount, true);
+
+    // every hit is shaded with every light
+    bool lightsChanged = before.lights.size() != now.lights.size() ||
+                         memcmp(before.lights.data(), now.lights.data(), before.lights.size() * sizeof(LightRecord)) != 0;
+
+    std::vector<unsigned long long> changedKeys;
+    std::vector<BoundingBox> changedBounds;
+
+    for(size_t i = 0; i < before.materials.size(); i++)
+    {
+        if(i >= now.materials.size() || before.materials[i] != now.materials[i])
+            changedKeys.push_back(RenderDependencies::getMaterialKey(i));
+    }
+
+    // the settings tell apart how many textures there are, the tiles that
+    // .. hit an object of an edited image are changed, its geometry is not
+    for(size_t i = 0; i < now.textures.size() && i < before.textures.size(); i++)
+    {
+        if(before.textures[i] == now.textures[i])
+            continue;
+
+        for(size_t k = 0; k < now.textureObjects[i].size(); k++)
+            changedKeys.push_back(now.objects[now.textureObjects[i][k]].key);
+    }
+
+    // objects are matched by their keys, unmatched ones were added or removed
+    std::unordered_map<unsigned long long, int> beforeObjects;
+    std::vector<bool> matched(before.objects.size(), false);
+
+    for(size_t i = 0; i < before.objects.size(); i++)
+        beforeObjects[before.objects[i].key] = i;
+
+    for(size_t i = 0; i < now.objects.size(); i++)
+    {
+        std::unordered_map<unsigned long long, int>::const_iterator found = beforeObjects.find(now.objects[i].key);
+
+        if(found != beforeObjects.end())
+        {
+            matched[found->second] = true;
+
+            if(before.objects[found->second].hash == now.objects[i].hash)
+                continue;
+
+            changedBounds.push_back(before.objects[found->second].bounds);
+        }
+
+        changedKeys.push_back(now.objects[i].key);
+        changedBounds.push_back(now.objects[i].bounds);
+    }
+
+    for(size_t i = 0; i < before.objects.size(); i++)
+    {
+        if(!matched[i])
+        {
+            changedKeys.push_back(before.objects[i].key);
+            changedBounds.push_back(before.objects[i].bounds);
+        }
+    }
+
+    // hits are on the surfaces, the boxes around them only as exact as floats
+    BoundingBox scene = before.bounds;
+    scene.expand(now.bounds);
+
+    float extent = 0.0f;
+
+    for(int axis = 0; axis < 3; axis++)
+        extent = max(extent, scene.max[axis] - scene.min[axis]);
+
+    const float margin = 1e-4f * extent + this->shadowRayEpsilon;
+
+    // the tiles whose primary rays may hit something in a changed box, the
+    // .. box's corners projected as getRay makes rays
+    std::vector<bool> changed(tileCount, false);
+
+    Vector3 gaze = camera.gaze;
+    gaze.normalize();
+
+    Vector3 vecV = camera.up;
+    vecV.normalize();
+
+    Vector3 vecW = -camera.gaze;
+    vecW.normalize();
+
+    Vector3 vecU = vecV * vecW;
+    vecU.normalize();
+
+    vecV = vecW * vecU;
+
+    const int imageWidth = camera.getImageW();
+    const int imageHeight = camera.getImageH();
+    const int tileSize = previous.getTileSize();
+    const int tileColumns = previous.getTileColumns();
+    const float uConstant = (camera.near_plane.y - camera.near_plane.x) / imageWidth;
+    const float vConstant = (camera.near_plane.w - camera.near_plane.z) / imageHeight;
+
+    // reflection rays that left the scene were cut off at its bounds
+    bool outsideBounds = false;
+
+    for(size_t b = 0; b < changedBounds.size(); b++)
+    {
+        const BoundingBox & box = changedBounds[b];
+
+        if(box.isEmpty())
+            continue;
+
+        float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+        bool behind = false;
+
+        for(int corner = 0; corner < 8 && !behind; corner++)
+        {
+            Position3 point((corner & 1) ? box.max[0] : box.min[0], (corner & 2) ? box.max[1] : box.min[1],
+                            (corner & 4) ? box.max[2] : box.min[2]);
+            Vector3 toPoint = point - camera.position;
+
+            float depth = toPoint ^ gaze;
+
+            // seen through the whole image, or from behind the camera by reflections alone
+            if(depth <= 1e-6f)
+            {
+                behind = true;
+                break;
+            }
+
+            float x = ((toPoint ^ vecU) * camera.near_distance / depth - camera.near_plane.x) / uConstant;
+            float y = (camera.near_plane.w - (toPoint ^ vecV) * camera.near_distance / depth) / vConstant;
+
+            minX = min(minX, x);
+            maxX = max(maxX, x);
+            minY = min(minY, y);
+            maxY = max(maxY, y);
+        }
+
+        if(behind)
+        {
+            minX = minY = 0.0f;
+            maxX = imageWidth;
+            maxY = imageHeight;
+        }
+
+        // a pixel more on each side for the rounding of the rays
+        int firstX = max(0, (int) floor(minX) - 1), lastX = min(imageWidth - 1, (int) floor(maxX) + 1);
+        int firstY = max(0, (int) floor(minY) - 1), lastY = min(imageHeight - 1, (int) floor(maxY) + 1);
+
+        for(int row = firstY / tileSize; firstX <= lastX && row <= lastY / tileSize; row++)
+        {
+            for(int column = firstX / tileSize; column <= lastX / tileSize; column++)
+                changed[row * tileColumns + column] = true;
+        }
+
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(box.min[axis] < before.bounds.min[axis] - margin || box.max[axis] > before.bounds.max[axis] + margin)
+                outsideBounds = true;
+        }
+    }
+
+    for(int t = 0; t < tileCount; t++)
+    {
+        const TileDependencies & tile = previous.getDependencies(t);
+
+        if(changed[t] || tile.hitCount == 0)
+            continue;
+
+        bool reached = lightsChanged || (outsideBounds && !tile.reflections.isEmpty());
+
+        for(size_t k = 0; k < changedKeys.size() && !reached; k++)
+            reached = tile.mayContain(changedKeys[k]);
+
+        for(size_t b = 0; b < changedBounds.size() && !reached; b++)
+        {
+            reached = overlaps(changedBounds[b], tile.reflections, margin);
+
+            for(size_t l = 0; l < before.lights.size() && !reached; l++)
+                reached = mayShadow(changedBounds[b], previous.getShadowCone(t, l), before.lights[l].position, margin);
+        }
+
+        changed[t] = reached;
+    }
+
+    return changed;
+}
+
+// adds what the hits of one pixel, as getRecordedRayColor made them, were
+// .. shaded from to the tile's dependencies
+static void addPathDependencies(const Ray & ray, const std::vector<GBufferHit> & hits, const std::vector<Material> & materials,
+                                const SceneSnapshot & snapshot, TileDependencies & tile, std::vector<Position3> & hitPositions)
+{
+    float direction[3] = { ray.getDirection().getX(), ray.getDirection().getY(), ray.getDirection().getZ() };
+
+    for(size_t k = 0; k < hits.size(); k++)
+    {
+        const GBufferHit & hit = hits[k];
+
+        if(hit.material < 0)
+        {
+            if(k == 0)
+                break;
+
+            // the reflection ray left the scene, up to where it left its bounds
+            const GBufferHit & from = hits[k - 1];
+            float dot = direction[0] * from.normal[0] + direction[1] * from.normal[1] + direction[2] * from.normal[2];
+            float exit = 1e30f;
+
+            for(int axis = 0; axis < 3; axis++)
+            {
+                direction[axis] -= 2.0f * dot * from.normal[axis];
+
+                if(direction[axis] > 0.0f)
+                    exit = min(exit, (snapshot.bounds.max[axis] - from.position[axis]) / direction[axis]);
+                else if(direction[axis] < 0.0f)
+                    exit = min(exit, (snapshot.bounds.min[axis] - from.position[axis]) / direction[axis]);
+            }
+
+            exit = max(exit, 0.0f);
+
+            tile.reflections.expand(Position3(from.position[0], from.position[1], from.position[2]));
+            tile.reflections.expand(Position3(from.position[0] + direction[0] * exit, from.position[1] + direction[1] * exit,
+                                              from.position[2] + direction[2] * exit));
+            break;
+        }
+
+        Position3 position(hit.position[0], hit.position[1], hit.position[2]);
+        const std::vector<int> & objects = hit.surfaceType == triangle_surface ? snapshot.triangleObjects : snapshot.sphereObjects;
+
+        hitPositions.push_back(position);
+        tile.hitCount++;
+        tile.add(snapshot.objects[objects[hit.surface]].key);
+        tile.add(RenderDependencies::getMaterialKey(hit.material));
+
+        if(k > 0)
+        {
+            const GBufferHit & from = hits[k - 1];
+            float length = 0.0f;
+
+            for(int axis = 0; axis < 3; axis++)
+            {
+                direction[axis] = hit.position[axis] - from.position[axis];
+                length += direction[axis] * direction[axis];
+            }
+
+            length = sqrt(length);
+
+            for(int axis = 0; axis < 3 && length > 0.0f; axis++)
+                direction[axis] /= length;
+
+            tile.reflections.expand(Position3(from.position[0], from.position[1], from.position[2]));
+            tile.reflections.expand(position);
+        }
+
+        // what a material without mirror reflects does not show
+        const Vector3 & mirror = materials[hit.material].mirror;
+
+        if(mirror.getX() == 0.0f && mirror.getY() == 0.0f && mirror.getZ() == 0.0f)
+            break;
+    }
+}
+
+void Scene::renderIncremental(Camera & camera, Image & image, ThreadPool & pool, const SceneSnapshot & snapshot,
+                              const std::function<void(const std::vector<ImageTile> &)> & beforeTiles)
+{
+    const int imageWidth = camera.getImageW();
+    const int imageHeight = camera.getImageH();
+    const std::string path = camera.image_name + ".deps";
+
+    // the view alone, the surfaces are compared object by object
+    const float view[14] = {
+        camera.position.getX(), camera.position.getY(), camera.position.getZ(),
+        camera.gaze.getX(), camera.gaze.getY(), camera.gaze.getZ(),
+        camera.up.getX(), camera.up.getY(), camera.up.getZ(),
+        camera.near_plane.x, camera.near_plane.y, camera.near_plane.z, camera.near_plane.w,
+        camera.near_distance
+    };
+
+    RenderDependencies dependencies(imageWidth, imageHeight, 32, hashValues(hashBasis, view, 14));
+    std::vector<bool> changed;
+
+    // the tiles the edit does not reach are kept from the image written before
+    if(snapshot.complete && dependencies.read(path))
+    {
+        try
+        {
+            image.read(camera.image_name);
+            changed = this->getChangedTiles(camera, dependencies, snapshot);
+        }
+        catch(const std::exception &)
+        {
+            changed.clear();
+        }
+    }
+
+    if(changed.empty())
+        changed.assign(dependencies.getTileCount(), true);
+
+    std::vector<int> tiles;
+
+    for(int t = 0; t < dependencies.getTileCount(); t++)
+    {
+        if(changed[t])
+            tiles.push_back(t);
+    }
+
+    std::cout << camera.image_name << ": rendering " << tiles.size() << " of " << dependencies.getTileCount() << " tiles" << std::endl;
+
+    if(beforeTiles)
+    {
+        std::vector<ImageTile> rectangles(tiles.size());
+
+        for(size_t i = 0; i < tiles.size(); i++)
+            rectangles[i] = dependencies.getTile(tiles[i]);
+
+        beforeTiles(rectangles);
+    }
+
+    // the lights the shadow cones are made for
+    dependencies.setScene(snapshot);
+
+    parallelFor(pool, 0, tiles.size(), 1, [&](int begin, int end) {
+        std::vector<GBufferHit> hits;
+        std::vector<Position3> hitPositions;
+
+        for(int i = begin; i < end; i++)
+        {
+            ImageTile tile = dependencies.getTile(tiles[i]);
+            TileDependencies & tileDependencies = dependencies.getDependencies(tiles[i]);
+
+            tileDependencies.clear();
+            hitPositions.clear();
+
+            for(int y = tile.y; y < tile.y + tile.height; y++)
+            {
+                for(int x = tile.x; x < tile.x + tile.width; x++)
+                {
+                    Ray ray = camera.getRay(x, y);
+
+                    hits.clear();
+                    image.setColor(x, y, this->getRecordedRayColor(ray, hits));
+
+                    if(snapshot.complete)
+                        addPathDependencies(ray, hits, this->materials, snapshot, tileDependencies, hitPositions);
+                }
+            }
+
+            for(size_t l = 0; l < snapshot.lights.size(); l++)
+                dependencies.getShadowCone(tiles[i], l) = getShadowCone(hitPositions, snapshot.lights[l]);
+        }
+    });
+
+    dependencies.write(path);
+}
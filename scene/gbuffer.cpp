@@ -0,0 +1,348 @@
+#include "../gbuffer.hpp"
+#include "../scene.hpp"
+#include "../image/image.hpp"
+#include "../threadpool.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+static const char gbufferMagic[8] = { 'R', 'T', 'G', 'B', 'U', 'F', '0', '1' };
+
+GBuffer::GBuffer(int width, int height, unsigned long long fingerprint)
+    : firstHits(width * height + 1, 0)
+{
+    memset(&this->header, 0, sizeof(GBufferHeader));
+    memcpy(this->header.magic, gbufferMagic, sizeof(gbufferMagic));
+    this->header.version = 2;
+    this->header.width = width;
+    this->header.height = height;
+    this->header.fingerprint = fingerprint;
+}
+
+GBufferHit GBuffer::getHit(const HitInfo & hitInfo, int material)
+{
+    GBufferHit hit;
+
+    hit.position[0] = hitInfo.hitPosition.getX();
+    hit.position[1] = hitInfo.hitPosition.getY();
+    hit.position[2] = hitInfo.hitPosition.getZ();
+    hit.normal[0] = hitInfo.normal.getX();
+    hit.normal[1] = hitInfo.normal.getY();
+    hit.normal[2] = hitInfo.normal.getZ();
+    hit.textureColor[0] = hitInfo.textureColor.getX();
+    hit.textureColor[1] = hitInfo.textureColor.getY();
+    hit.textureColor[2] = hitInfo.textureColor.getZ();
+    hit.material = material;
+    hit.visibleLights = 0;
+    hit.hasTexture = hitInfo.hasTexture ? 1 : 0;
+    hit.decalMode = hitInfo.hasTexture ? (unsigned char) hitInfo.decalMode : 0;
+    hit.surface = hitInfo.surface.index;
+    hit.surfaceType = hitInfo.surface.type;
+    hit.padding = 0;
+
+    return hit;
+}
+
+GBufferHit GBuffer::getMiss()
+{
+    GBufferHit hit;
+
+    memset(&hit, 0, sizeof(GBufferHit));
+    hit.material = -1;
+
+    return hit;
+}
+
+bool GBuffer::getHitInfo(const GBufferHit & hit, HitInfo & hitInfo, int & material)
+{
+    if(hit.material < 0)
+        return false;
+
+    hitInfo.hitPosition = Position3(hit.position[0], hit.position[1], hit.position[2]);
+    hitInfo.normal = Vector3(hit.normal[0], hit.normal[1], hit.normal[2]);
+    hitInfo.textureColor = Vector3(hit.textureColor[0], hit.textureColor[1], hit.textureColor[2]);
+    hitInfo.hasTexture = hit.hasTexture != 0;
+    hitInfo.decalMode = (DecalMode) hit.decalMode;
+    hitInfo.t = 0.0f;
+    material = hit.material;
+
+    return true;
+}
+
+void GBuffer::setColumn(int x, const std::vector<GBufferHit> & columnHits, const std::vector<int> & counts)
+{
+    int height = this->header.height;
+
+    for(int y = 0; y < height; y++)
+        this->firstHits[x * height + y + 1] = this->firstHits[x * height + y] + counts[y];
+
+    this->hits.insert(this->hits.end(), columnHits.begin(), columnHits.end());
+    this->header.hitCount = this->hits.size();
+}
+
+GBufferPath GBuffer::getPath(int x, int y, unsigned int knownLights)
+{
+    int pixel = x * this->header.height + y;
+
+    GBufferPath path;
+    path.recorded = NULL;
+    path.hits = &this->hits[this->firstHits[pixel]];
+    path.hitCount = this->firstHits[pixel + 1] - this->firstHits[pixel];
+    path.current = 0;
+    path.knownLights = knownLights;
+
+    return path;
+}
+
+int GBuffer::getMaterialCount() const
+{
+    int count = 0;
+
+    for(size_t i = 0; i < this->hits.size(); i++)
+        count = max(count, this->hits[i].material + 1);
+
+    return count;
+}
+
+unsigned int GBuffer::getKnownLights(const std::vector<PointLight> & lights, float shadowRayEpsilon) const
+{
+    unsigned int known = 0;
+
+    if(shadowRayEpsilon != this->header.shadowRayEpsilon)
+        return 0;
+
+    for(int i = 0; i < this->header.lightCount && i < (int) lights.size(); i++)
+    {
+        const float * position = this->header.lightPositions[i];
+
+        if(position[0] == lights[i].position.getX() && position[1] == lights[i].position.getY() &&
+           position[2] == lights[i].position.getZ())
+            known |= 1u << i;
+    }
+
+    return known;
+}
+
+void GBuffer::setLights(const std::vector<PointLight> & lights, float shadowRayEpsilon)
+{
+    this->header.shadowRayEpsilon = shadowRayEpsilon;
+    this->header.lightCount = min((int) lights.size(), 32);
+
+    for(int i = 0; i < this->header.lightCount; i++)
+    {
+        this->header.lightPositions[i][0] = lights[i].position.getX();
+        this->header.lightPositions[i][1] = lights[i].position.getY();
+        this->header.lightPositions[i][2] = lights[i].position.getZ();
+    }
+}
+
+void GBuffer::write(const std::string & path) const
+{
+    std::string temporaryPath = path + ".tmp";
+    FILE * file = fopen(temporaryPath.c_str(), "wb");
+
+    if(file == NULL)
+        throw std::runtime_error("Error: The G-buffer " + path + " cannot be opened for writing.");
+
+    bool written = fwrite(&this->header, sizeof(GBufferHeader), 1, file) == 1 &&
+                   fwrite(this->firstHits.data(), sizeof(unsigned int), this->firstHits.size(), file) == this->firstHits.size() &&
+                   fwrite(this->hits.data(), sizeof(GBufferHit), this->hits.size(), file) == this->hits.size();
+
+    written = fclose(file) == 0 && written;
+
+    if(!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        throw std::runtime_error("Error: The G-buffer " + path + " cannot be written.");
+    }
+}
+
+bool GBuffer::read(const std::string & path, size_t triangleCount, size_t sphereCount, int materialCount)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+
+    if(file == NULL)
+        return false;
+
+    GBufferHeader stored;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+
+    bool matches = size >= 0 && fseek(file, 0, SEEK_SET) == 0 &&
+                   fread(&stored, sizeof(GBufferHeader), 1, file) == 1 &&
+                   memcmp(stored.magic, this->header.magic, sizeof(stored.magic)) == 0 &&
+                   stored.version == this->header.version && stored.width == this->header.width &&
+                   stored.height == this->header.height && stored.fingerprint == this->header.fingerprint &&
+                   stored.lightCount >= 0 && stored.lightCount <= 32 &&
+                   fread(this->firstHits.data(), sizeof(unsigned int), this->firstHits.size(), file) == this->firstHits.size() &&
+                   this->firstHits.front() == 0 && this->firstHits.back() == stored.hitCount &&
+                   (unsigned long long) size == sizeof(GBufferHeader) + this->firstHits.size() * sizeof(unsigned int) +
+                                                stored.hitCount * sizeof(GBufferHit);
+
+    // every pixel has its primary hit, or miss, and its hits follow those of the one before
+    for(size_t i = 0; matches && i + 1 < this->firstHits.size(); i++)
+        matches = this->firstHits[i] < this->firstHits[i + 1];
+
+    if(matches)
+    {
+        this->hits.resize(stored.hitCount);
+        matches = fread(this->hits.data(), sizeof(GBufferHit), this->hits.size(), file) == this->hits.size();
+    }
+
+    fclose(file);
+
+    // what shading the hits again looks up must be there
+    for(size_t i = 0; matches && i < this->hits.size(); i++)
+    {
+        const GBufferHit & hit = this->hits[i];
+
+        if(hit.material < 0)
+            matches = hit.material == -1;
+        else
+            matches = hit.material < materialCount && hit.hasTexture <= 1 && (!hit.hasTexture || hit.decalMode <= replace_all) &&
+                      (hit.surfaceType == triangle_surface ? hit.surface < triangleCount :
+                       hit.surfaceType == sphere_surface && hit.surface < sphereCount);
+    }
+
+    if(matches)
+        this->header = stored;
+    else
+        this->hits.clear();
+
+    return matches;
+}
+
+// the index of a material is where the surface points to in the array of
+// .. materials, which is in the file for compiled scenes
+static int getMaterialIndex(const Scene & scene, const HitInfo & hitInfo)
+{
+    const Material * materials = scene.compiled ? scene.compiled->getMaterials() : scene.materials.data();
+
+    return (int) (&scene.surfaces.get(hitInfo.surface).getMaterial() - materials);
+}
+
+Color Scene::getPathReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth, GBufferPath & path)
+{
+    if(recursionDepth == 0)
+        return Color::Black();
+
+    Ray reflectionRay = ray.createReflectionRay(hitInfo);
+    HitInfo reflectionHitInfo;
+    int material;
+
+    if(path.recorded != NULL)
+    {
+        bool hit = reflectionRay.getClosestHit(reflectionHitInfo, *this->accelerator, -1.0f);
+
+        path.recorded->push_back(hit ? GBuffer::getHit(reflectionHitInfo, getMaterialIndex(*this, reflectionHitInfo)) : GBuffer::getMiss());
+        path.current = path.recorded->size() - 1;
+
+        if(!hit)
+            return this->backgroundColor;
+
+        return this->getHitColor(reflectionRay, reflectionHitInfo, this->surfaces.get(reflectionHitInfo.surface).getMaterial(),
+                                 recursionDepth - 1, &path);
+    }
+
+    // a material that reflects now and did not when the hits were traced
+    if(path.current + 1 >= path.hitCount)
+        return this->getReflectionColor(ray, hitInfo, recursionDepth);
+
+    path.current++;
+
+    if(!GBuffer::getHitInfo(path.hits[path.current], reflectionHitInfo, material))
+        return this->backgroundColor;
+
+    return this->getHitColor(reflectionRay, reflectionHitInfo, this->materials[material], recursionDepth - 1, &path);
+}
+
+Color Scene::getRecordedRayColor(const Ray & ray, std::vector<GBufferHit> & hits)
+{
+    HitInfo hitInfo;
+
+    if(!ray.getClosestHit(hitInfo, *this->accelerator, -1.0f))
+    {
+        hits.push_back(GBuffer::getMiss());
+        return this->backgroundColor;
+    }
+
+    hits.push_back(GBuffer::getHit(hitInfo, getMaterialIndex(*this, hitInfo)));
+
+    GBufferPath path;
+    path.recorded = &hits;
+    path.hits = NULL;
+    path.hitCount = 0;
+    path.current = hits.size() - 1;
+    path.knownLights = 0;
+
+    return this->getHitColor(ray, hitInfo, this->surfaces.get(hitInfo.surface).getMaterial(), this->maxRecursionDepth, &path);
+}
+
+void Scene::renderGBuffer(Camera & camera, GBuffer & gbuffer, Image & image, ThreadPool & pool)
+{
+    const int imageWidth = camera.getImageW();
+    const int imageHeight = camera.getImageH();
+
+    std::vector<std::vector<GBufferHit> > columnHits(imageWidth);
+    std::vector<std::vector<int> > columnCounts(imageWidth, std::vector<int>(imageHeight));
+
+    // shaded as renderImage does, keeping the hits
+    parallelFor(pool, 0, imageWidth, 4, [&](int begin, int end) {
+        for(int x = begin; x < end; x++)
+        {
+            std::vector<GBufferHit> & hits = columnHits[x];
+
+            for(int y = 0; y < imageHeight; y++)
+            {
+                size_t first = hits.size();
+
+                image.setColor(x, y, this->getRecordedRayColor(camera.getRay(x, y), hits));
+                columnCounts[x][y] = hits.size() - first;
+            }
+        }
+    });
+
+    for(int x = 0; x < imageWidth; x++)
+    {
+        gbuffer.setColumn(x, columnHits[x], columnCounts[x]);
+        std::vector<GBufferHit>().swap(columnHits[x]);
+    }
+
+    gbuffer.setLights(this->pointLights, this->shadowRayEpsilon);
+}
+
+bool Scene::relight(Camera & camera, GBuffer & gbuffer, Image & image, ThreadPool & pool)
+{
+    if(gbuffer.getMaterialCount() > (int) this->materials.size())
+        throw std::runtime_error("Error: The G-buffer of " + camera.image_name + " refers to materials the scene does not have.");
+
+    const int imageHeight = camera.getImageH();
+    const int lightCount = min((int) this->pointLights.size(), 32);
+    const unsigned int knownLights = gbuffer.getKnownLights(this->pointLights, this->shadowRayEpsilon);
+
+    // the primary rays are made again for their directions, they are not traced
+    parallelFor(pool, 0, camera.getImageW(), 4, [&](int begin, int end) {
+        for(int x = begin; x < end; x++)
+        {
+            for(int y = 0; y < imageHeight; y++)
+            {
+                Ray ray = camera.getRay(x, y);
+                GBufferPath path = gbuffer.getPath(x, y, knownLights);
+                HitInfo hitInfo;
+                int material;
+
+                if(GBuffer::getHitInfo(path.hits[0], hitInfo, material))
+                    image.setColor(x, y, this->getHitColor(ray, hitInfo, this->materials[material], this->maxRecursionDepth, &path));
+                else
+                    image.setColor(x, y, this->backgroundColor);
+            }
+        }
+    });
+
+    gbuffer.setLights(this->pointLights, this->shadowRayEpsilon);
+
+    return knownLights != (lightCount < 32 ? (1u << lightCount) - 1 : ~0u);
+}
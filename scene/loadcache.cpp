@@ -0,0 +1,225 @@
+#include "../loadcache.hpp"
+#include "../hash.hpp"
+#include "../scene.hpp"
+#include "../jpeg.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+LoadCache::LoadCache(size_t budget)
+    : budget(budget)
+{
+    this->statistics.hits = 0;
+    this->statistics.misses = 0;
+    this->statistics.evictions = 0;
+    this->statistics.bytes = 0;
+}
+
+unsigned long long LoadCache::getKey(char kind, const void * bytes, size_t size)
+{
+    unsigned long long key = hashValues(hashBasis, &kind, 1);
+    key = hashValues(key, &size, 1);
+
+    return hashValues(key, (const unsigned char *) bytes, size);
+}
+
+void LoadCache::erase(std::list<Item>::iterator item)
+{
+    this->statistics.bytes -= getSize(*item->second);
+    this->index.erase(item->first);
+    this->items.erase(item);
+}
+
+std::shared_ptr<const LoadCacheEntry> LoadCache::find(unsigned long long key)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::unordered_map< unsigned long long, std::list<Item>::iterator >::iterator found = this->index.find(key);
+
+    if(found == this->index.end())
+    {
+        this->statistics.misses++;
+        return std::shared_ptr<const LoadCacheEntry>();
+    }
+
+    this->statistics.hits++;
+
+    // the most recently used move to the front
+    this->items.splice(this->items.begin(), this->items, found->second);
+
+    return found->second->second;
+}
+
+void LoadCache::insert(unsigned long long key, const std::shared_ptr<const LoadCacheEntry> & entry)
+{
+    size_t size = getSize(*entry);
+
+    if(size > this->budget)
+        return;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::unordered_map< unsigned long long, std::list<Item>::iterator >::iterator found = this->index.find(key);
+
+    if(found != this->index.end())
+        this->erase(found->second);
+
+    while(!this->items.empty() && this->statistics.bytes + size > this->budget)
+    {
+        this->erase(--this->items.end());
+        this->statistics.evictions++;
+    }
+
+    this->items.push_front(Item(key, entry));
+    this->index[key] = this->items.begin();
+    this->statistics.bytes += size;
+}
+
+LoadCacheStatistics LoadCache::getStatistics()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    return this->statistics;
+}
+
+// the parts of loading a scene file that go through its loadCache
+
+void Scene::readTexture(const std::string & imageName, Texture & texture)
+{
+    std::shared_ptr<const LoadCacheEntry> entry;
+    unsigned long long key = 0;
+
+    if(this->loadCache)
+    {
+        std::ifstream file(imageName.c_str(), std::ios::binary | std::ios::ate);
+        std::vector<char> bytes(file ? (size_t) file.tellg() : 0);
+
+        file.seekg(0);
+        file.read(bytes.data(), bytes.size());
+
+        key = LoadCache::getKey('t', bytes.data(), bytes.size());
+        entry = this->loadCache->find(key);
+    }
+
+    if(entry)
+    {
+        texture.width = entry->width;
+        texture.height = entry->height;
+
+        unsigned char * image = arena.createArray<unsigned char>(entry->data.size());
+        std::copy(entry->data.begin(), entry->data.end(), image);
+        texture.image = image;
+
+        return;
+    }
+
+    int width, height;
+    read_jpeg_header(imageName.data(), width, height);
+
+    texture.width = width;
+    texture.height = height;
+
+    unsigned char * image = arena.createArray<unsigned char>(width * height * 3);
+    read_jpeg(imageName.data(), image, width, height);
+    texture.image = image;
+
+    if(this->loadCache)
+    {
+        std::shared_ptr<LoadCacheEntry> decoded = std::make_shared<LoadCacheEntry>();
+        decoded->width = width;
+        decoded->height = height;
+        decoded->data.assign(image, image + width * height * 3);
+
+        this->loadCache->insert(key, decoded);
+    }
+}
+
+void Scene::readVertexData(const char * text)
+{
+    std::shared_ptr<const LoadCacheEntry> entry;
+    unsigned long long key = 0;
+
+    if(this->loadCache)
+    {
+        key = LoadCache::getKey('v', text, strlen(text));
+        entry = this->loadCache->find(key);
+    }
+
+    std::vector<float> coordinates;
+
+    if(entry)
+    {
+        coordinates.resize(entry->data.size() / sizeof(float));
+        memcpy(coordinates.data(), entry->data.data(), entry->data.size());
+    }
+    else
+    {
+        std::stringstream stream;
+        stream << text << std::endl;
+
+        float vertex_x, vertex_y, vertex_z;
+        while (!(stream >> vertex_x).eof())
+        {
+            stream >> vertex_y >> vertex_z;
+            coordinates.push_back(vertex_x);
+            coordinates.push_back(vertex_y);
+            coordinates.push_back(vertex_z);
+        }
+    }
+
+    for(size_t i = 0; i + 2 < coordinates.size(); i += 3)
+        vertexData.push_back(Position3(coordinates[i], coordinates[i + 1], coordinates[i + 2]));
+
+    if(this->loadCache && !entry)
+    {
+        std::shared_ptr<LoadCacheEntry> parsed = std::make_shared<LoadCacheEntry>();
+        parsed->width = parsed->height = 0;
+        parsed->data.resize(coordinates.size() * sizeof(float));
+        memcpy(parsed->data.data(), coordinates.data(), parsed->data.size());
+
+        this->loadCache->insert(key, parsed);
+    }
+}
+
+void Scene::readFaces(const char * text, std::vector<int> & vertexIds)
+{
+    std::shared_ptr<const LoadCacheEntry> entry;
+    unsigned long long key = 0;
+
+    if(this->loadCache)
+    {
+        key = LoadCache::getKey('f', text, strlen(text));
+        entry = this->loadCache->find(key);
+    }
+
+    if(entry)
+    {
+        vertexIds.resize(entry->data.size() / sizeof(int));
+        memcpy(vertexIds.data(), entry->data.data(), entry->data.size());
+
+        return;
+    }
+
+    std::stringstream stream;
+    stream << text << std::endl;
+
+    int v0_id, v1_id, v2_id;
+    while (!(stream >> v0_id).eof())
+    {
+        stream >> v1_id >> v2_id;
+        vertexIds.push_back(v0_id);
+        vertexIds.push_back(v1_id);
+        vertexIds.push_back(v2_id);
+    }
+
+    if(this->loadCache)
+    {
+        std::shared_ptr<LoadCacheEntry> parsed = std::make_shared<LoadCacheEntry>();
+        parsed->width = parsed->height = 0;
+        parsed->data.resize(vertexIds.size() * sizeof(int));
+        memcpy(parsed->data.data(), vertexIds.data(), parsed->data.size());
+
+        this->loadCache->insert(key, parsed);
+    }
+}
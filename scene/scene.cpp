@@ -6,6 +6,13 @@
 #include "../matrix4.hpp"
 #include "../transformation.hpp"
 #include "../jpeg.h"
+#include "../threadpool.hpp"
+#include "../checkpoint.hpp"
+#include "../gbuffer.hpp"
+#include "../dependencies.hpp"
+#include "../hash.hpp"
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -17,6 +24,7 @@ using namespace std;
 typedef struct MeshInstance{
         int base_mesh_id;
         int material_id;
+        int object;
         Transformation transformation;
         Texture* texturePtr;
     } MeshInstance;
@@ -31,56 +39,96 @@ std::ostream &operator<<(std::ostream &output, const Matrix4 & m)
     return output;
 }
 
-Color getDiffuseColorWithoutTexture(const Material & material, const HitInfo & hitInfo, const PointLight & pointLight)
-{ 
-    // hit to light
-    Vector3 hit2light = pointLight.position - hitInfo.hitPosition;
-                        
-    // distanceSquare
-    float distanceSq = hit2light ^ hit2light;
-
-    // intensity
-    Vector3 intensity = pointLight.intensity / distanceSq;
-
-    hit2light.normalize();
+// diffuse reflectance at the hit point, the texture color replaces or blends kd
+Vector3 getDiffuseReflectance(const Material & material, const HitInfo & hitInfo)
+{
+    if(hitInfo.hasTexture && hitInfo.decalMode == replace_kd)
+        return hitInfo.textureColor / 255;
     
-    float normalDotLight = (hitInfo.normal ^ hit2light);
+    if(hitInfo.hasTexture && hitInfo.decalMode == blend_kd)
+        return ((hitInfo.textureColor / 255) + material.diffuse) / 2;
     
-    if(normalDotLight < 0.0f)
-        normalDotLight = 0.0f;
-        
-    Color diffuseColor = Color(material.diffuse.intensify(intensity) * normalDotLight);
-
-    return diffuseColor;
+    return material.diffuse;
 }
 
-Color getDiffuseColor(const Material & material, const HitInfo & hitInfo, const PointLight & pointLight)
+// diffuse and specular colors of count (at most 8) point lights, one light per lane
+// lane by lane, the computations are exactly those of the former scalar
+// .. getDiffuseColorWithoutTexture and getSpecular:
+// .. diffuse  = kd * (I / d^2) * max(0, n . l)
+// .. specular = ks * (I / d^2) * max(0, n . h)^p
+void getPointLightColors8(const Ray & ray,
+                          const Material & material,
+                          const Vector3 & diffuseReflectance,
+                          const HitInfo & hitInfo,
+                          const PointLight * pointLights,
+                          int count,
+                          Color * diffuseColors,
+                          Color * specularColors)
 {
-    if(!hitInfo.hasTexture)
-        return getDiffuseColorWithoutTexture(material, hitInfo, pointLight);
-        
-    if(hitInfo.decalMode == replace_kd)
-    {
-        Material newMaterial = material;
-        newMaterial.diffuse = hitInfo.textureColor / 255;
-        
-        return getDiffuseColorWithoutTexture(newMaterial, hitInfo, pointLight);
-    }
-    else if(hitInfo.decalMode == blend_kd)
+    alignas(32) float lightX[8] = {}, lightY[8] = {}, lightZ[8] = {};
+    alignas(32) float intensityX[8] = {}, intensityY[8] = {}, intensityZ[8] = {};
+    
+    for(int i = 0; i < count; i++)
     {
-        Material newMaterial = material;
-        newMaterial.diffuse = ((hitInfo.textureColor / 255) + material.diffuse) / 2;
+        lightX[i] = pointLights[i].position.getX();
+        lightY[i] = pointLights[i].position.getY();
+        lightZ[i] = pointLights[i].position.getZ();
         
-        return getDiffuseColorWithoutTexture(newMaterial, hitInfo, pointLight);
+        intensityX[i] = pointLights[i].intensity.getX();
+        intensityY[i] = pointLights[i].intensity.getY();
+        intensityZ[i] = pointLights[i].intensity.getZ();
     }
-    else if(hitInfo.decalMode == replace_all)
+    
+    const Vector3x8 hitPosition( Float8(hitInfo.hitPosition.getX()),
+                                 Float8(hitInfo.hitPosition.getY()),
+                                 Float8(hitInfo.hitPosition.getZ()) );
+    const Vector3x8 normal(hitInfo.normal);
+    const Float8 zero(0.0f);
+    
+    // hit to light
+    Vector3x8 hit2light = Vector3x8( Float8::load(lightX), Float8::load(lightY), Float8::load(lightZ) ) - hitPosition;
+    
+    // distanceSquare
+    Float8 distanceSq = hit2light ^ hit2light;
+    
+    // intensity
+    Vector3x8 intensity = Vector3x8( Float8::load(intensityX), Float8::load(intensityY), Float8::load(intensityZ) ) / distanceSq;
+    
+    Vector3x8 l = hit2light;
+    l.normalize();
+    
+    // diffuse
+    Float8 normalDotLight = max(normal ^ l, zero);
+    
+    Vector3x8 diffuse = Vector3x8(diffuseReflectance).intensify(intensity) * normalDotLight;
+    
+    // specular, the power is the only scalar part
+    Vector3x8 h = Vector3x8(-ray.getDirection()) + l;
+    h.normalize();
+    
+    alignas(32) float normalDotHalf[8];
+    max(normal ^ h, zero).store(normalDotHalf);
+    
+    for(int i = 0; i < count; i++)
+        normalDotHalf[i] = pow(normalDotHalf[i], material.phong_exponent);
+    
+    Vector3x8 specular = Vector3x8(material.specular).intensify(intensity) * Float8::load(normalDotHalf);
+    
+    alignas(32) float colors[6][8];
+    diffuse.x.store(colors[0]);
+    diffuse.y.store(colors[1]);
+    diffuse.z.store(colors[2]);
+    specular.x.store(colors[3]);
+    specular.y.store(colors[4]);
+    specular.z.store(colors[5]);
+    
+    for(int i = 0; i < count; i++)
     {
-        return Color(hitInfo.textureColor);
+        diffuseColors[i] = Color(colors[0][i], colors[1][i], colors[2][i]);
+        specularColors[i] = Color(colors[3][i], colors[4][i], colors[5][i]);
     }
 }
 
-
-
 /*
 Color getDiffuseColor(const Material & material, Texture* texture, const HitInfo & hitInfo, const PointLight & pointLight)
 { 
@@ -116,64 +164,24 @@ Color getDiffuseColor(const Material & material, Texture* texture, const HitInfo
 }
 */
 
-Color getSpecular(const Ray & ray, const Material & material, const HitInfo & hitInfo, const PointLight & pointLight)
-{
-    Vector3 hit2light = hitInfo.hitPosition.to(pointLight.position);
-    float distanceSq = hit2light ^ hit2light;
-    
-    Vector3 l = hit2light;
-    l.normalize();
-    
-    Vector3 intensity = pointLight.intensity / distanceSq;
-    
-    Vector3 h = (( -ray.getDirection()) + l ).normalize();
-    
-    float max = hitInfo.normal ^ h;
-    max = max < 0.0f ? 0.0f : max;
-    max = pow(max, material.phong_exponent);
-    
-    Vector3 colorVector = material.specular.intensify(intensity) * max;
-    
-    return Color(colorVector);
-}
-
 Color getAmbientColor(const Material & material, const Vector3 & ambientLight)
 {
     return Color(ambientLight.intensify(material.ambient));
 }
 
 
-bool isLyingInShadow(const HitInfo & hitInfo, const PointLight & pointLight, const std::vector<Surface*> & surfaces, float shadowRayEpsilon)
+bool isLyingInShadow(const HitInfo & hitInfo, const PointLight & pointLight, const Accelerator & accelerator, float shadowRayEpsilon)
 {   
     // first, create the shadow ray
     Ray shadowRay(hitInfo.hitPosition, hitInfo.hitPosition.to(pointLight.position));
     
-    Material dummyMaterial;
-    HitInfo shadowRayHitInfo;
-    
-   // return shadowRay.getClosestHit(dummyMaterial, shadowRayHitInfo, surfaces, shadowRayEpsilon);
+    // any surface between the point and the light will do, the closest one is not needed
+    float hitPointToLightT = shadowRay.getTValue(pointLight.position);
     
-    
-    if(shadowRay.getClosestHit(dummyMaterial, shadowRayHitInfo, surfaces, shadowRayEpsilon))
-    {   
-        float hitPointToLightT = shadowRay.getTValue(pointLight.position);
-        
-        if(hitPointToLightT < shadowRayHitInfo.t)
-        {
-            // cheers! point is closer to us
-            return false;
-        }
-        else
-        {
-            // in shadow..
-            return true;
-        }
-    }
-    else
-        return false;
+    return accelerator.isOccluded(shadowRay, shadowRayEpsilon, hitPointToLightT);
 }
 
-Color Scene::getReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth)
+Color Scene::getReflectionColor(const Ray & ray, const HitInfo & hitInfo, int recursionDepth, const Vector3 & throughput)
 {
     if(recursionDepth == 0)
     {
@@ -182,110 +190,503 @@ Color Scene::getReflectionColor(const Ray & ray, const HitInfo & hitInfo, int re
 
     Ray reflectionRay = ray.createReflectionRay(hitInfo);
     
-    return getRayColor(reflectionRay, recursionDepth - 1, true);
+    return getRayColor(reflectionRay, recursionDepth - 1, true, throughput);
+    
+}
+
+bool Scene::isReflectionTraced(const Ray & ray, const HitInfo & hitInfo, const Vector3 & throughput, int recursionDepth,
+                               float & weight)
+{
+    weight = 1.0f;
+    
+    // at depth 0 getReflectionColor traces nothing anyway
+    if(this->throughputCutoff <= 0.0f || recursionDepth == 0)
+        return true;
+    
+    float largest = std::max(throughput.getX(), std::max(throughput.getY(), throughput.getZ()));
+    
+    if(largest >= this->throughputCutoff)
+    {
+        this->reflectionsTraced.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    if(this->russianRoulette)
+    {
+        // the chance is drawn from the hit, so that a pixel renders the same
+        // .. whatever thread or tile traces it
+        const float values[6] = {
+            hitInfo.hitPosition.getX(), hitInfo.hitPosition.getY(), hitInfo.hitPosition.getZ(),
+            ray.getDirection().getX(), ray.getDirection().getY(), ray.getDirection().getZ()
+        };
+        
+        float chance = largest / this->throughputCutoff;
+        float draw = (hashValues(hashBasis, values, 6) >> 40) / 16777216.0f;
+        
+        if(draw < chance)
+        {
+            weight = 1.0f / chance;
+            this->reflectionsTraced.fetch_add(1, std::memory_order_relaxed);
+            
+            return true;
+        }
+    }
     
+    this->reflectionsCut.fetch_add(1, std::memory_order_relaxed);
+    this->bouncesSaved.fetch_add(recursionDepth, std::memory_order_relaxed);
+    
+    return false;
 }
 
-Color Scene::getRayColor(Ray & ray, int recursionDepth, bool isRef)
+Color Scene::getRayColor(Ray & ray, int recursionDepth, bool isRef, const Vector3 & throughput)
 {
     HitInfo hitInfo;
-    Material material;
     
-    if( ray.getClosestHit(material, hitInfo, this->surfaces, -1.0f) )
+    if( ray.getClosestHit(hitInfo, *this->accelerator, -1.0f) )
+    {
+        return this->getHitColor(ray, hitInfo, this->surfaces.get(hitInfo.surface).getMaterial(), recursionDepth, NULL,
+                                 throughput);
+    }
+    else
     {
-        Color color(0.0f, 0.0f, 0.0f);
+        return this->backgroundColor;
+    }
+}
+
+// what getRayColor gives a ray that hit, shading a G-buffer too
+Color Scene::getHitColor(const Ray & ray, const HitInfo & hitInfo, const Material & material, int recursionDepth,
+                         GBufferPath * path, const Vector3 & throughput)
+{
+    Color color(0.0f, 0.0f, 0.0f);
+    
+    // ambient
+    if(!hitInfo.hasTexture || (hitInfo.hasTexture && hitInfo.decalMode != replace_all) )
+        color += getAmbientColor(material, this->ambientLight);
+    
+    Vector3 diffuseReflectance = getDiffuseReflectance(material, hitInfo);
+    
+    // traverse point lights, 8 at a time
+    for(int first = 0; first < (int)this->pointLights.size(); first += 8)
+    {
+        int count = this->pointLights.size() - first;
+        count = count > 8 ? 8 : count;
+        
+        Color diffuseColors[8], specularColors[8];
         
-        // ambient
-        if(!hitInfo.hasTexture || (hitInfo.hasTexture && hitInfo.decalMode != replace_all) )
-            color += getAmbientColor(material, this->ambientLight);
+        getPointLightColors8(ray, material, diffuseReflectance, hitInfo, &this->pointLights[first], count,
+                             diffuseColors, specularColors);
         
-        // traverse point lights
-        for(int p = 0; p < this->pointLights.size(); p++ )
+        for(int p = 0; p < count; p++)
         {
-            PointLight & pointLight = this->pointLights[p];
+            PointLight & pointLight = this->pointLights[first + p];
+            const unsigned int lightBit = first + p < 32 ? 1u << (first + p) : 0u;
+            bool isVisible;
             
             // if light is not seenable, continue
-            if(!isLyingInShadow(hitInfo, pointLight, this->surfaces, this->shadowRayEpsilon) )
+            if(path != NULL && (path->knownLights & lightBit))
+                isVisible = (path->getCurrent()->visibleLights & lightBit) != 0;
+            else
+            {
+                isVisible = !isLyingInShadow(hitInfo, pointLight, *this->accelerator, this->shadowRayEpsilon);
+                
+                if(path != NULL)
+                {
+                    unsigned int & visibleLights = path->getCurrent()->visibleLights;
+                    visibleLights = isVisible ? visibleLights | lightBit : visibleLights & ~lightBit;
+                }
+            }
+            
+            if(isVisible)
             {
-                 
                 // diffuse
-                color += getDiffuseColor(material, hitInfo, pointLight);
+                if(hitInfo.hasTexture && hitInfo.decalMode == replace_all)
+                    color += Color(hitInfo.textureColor);
+                else
+                    color += diffuseColors[p];
                 
                 // specular
                 if(!hitInfo.hasTexture || (hitInfo.hasTexture && hitInfo.decalMode != replace_all ))
-                    color += getSpecular(ray, material, hitInfo, pointLight);
-
+                    color += specularColors[p];
             }
+        }
+    }
+    
+    // reflection
+    bool hasReflection = material.mirror.getX() != 0.0f || material.mirror.getY() != 0.0f || material.mirror.getZ() != 0.0f;
+            
+    if(hasReflection && (!hitInfo.hasTexture || hitInfo.decalMode != replace_all))
+    {
+        if(path != NULL)
+            color += getPathReflectionColor(ray, hitInfo, recursionDepth, *path).intensify(material.mirror);
+        else
+        {
+            Vector3 reflectionThroughput(throughput.getX() * material.mirror.getX(), throughput.getY() * material.mirror.getY(),
+                                         throughput.getZ() * material.mirror.getZ());
+            float weight;
             
+            if(this->isReflectionTraced(ray, hitInfo, reflectionThroughput, recursionDepth, weight))
+            {
+                color += getReflectionColor(ray, hitInfo, recursionDepth, reflectionThroughput * weight)
+                         .intensify(weight == 1.0f ? material.mirror : material.mirror * weight);
+            }
         }
+    }      
+    return color;           
+}
+
+unsigned long long Scene::getRenderFingerprint(const Camera & camera, bool shading) const
+{
+    const unsigned long long basis = hashBasis;
+    
+    const float view[14] = {
+        camera.position.getX(), camera.position.getY(), camera.position.getZ(),
+        camera.gaze.getX(), camera.gaze.getY(), camera.gaze.getZ(),
+        camera.up.getX(), camera.up.getY(), camera.up.getZ(),
+        camera.near_plane.x, camera.near_plane.y, camera.near_plane.z, camera.near_plane.w,
+        camera.near_distance
+    };
+    
+    const long long sizes[5] = {
+        camera.image_width, camera.image_height, (long long) this->surfaces.triangles.size(),
+        (long long) this->surfaces.spheres.size(), (long long) this->textures.size()
+    };
+    
+    unsigned long long hash = hashValues(hashValues(basis, view, 14), sizes, 5);
+    
+    // the surfaces are summed, so that their order, which the BVH changes,
+    // .. does not matter; which material each one has is part of it, the
+    // .. hits of a G-buffer keep the material index
+    const Material * materials = this->compiled ? this->compiled->getMaterials() : this->materials.data();
+    unsigned long long surfaces = 0;
+    
+    for(size_t i = 0; i < this->surfaces.triangles.size(); i++)
+    {
+        const Triangle & triangle = this->surfaces.triangles[i];
+        const long long material = &triangle.getMaterial() - materials;
         
-        // reflection
-        bool hasReflection = material.mirror.getX() != 0.0f || material.mirror.getY() != 0.0f || material.mirror.getZ() != 0.0f;
-                
-        if(hasReflection && !hitInfo.hasTexture ||(hitInfo.hasTexture && hitInfo.decalMode != replace_all ))
-        {
-            color += getReflectionColor(ray, hitInfo, recursionDepth).intensify(material.mirror);
-        }      
-        return color;           
+        surfaces += hashValues(hashVector(hashVector(hashVector(basis, triangle.getVertex(0)), triangle.getVertex(1)), triangle.getVertex(2)),
+                               &material, 1);
     }
-    else
+    
+    for(size_t i = 0; i < this->surfaces.spheres.size(); i++)
     {
-        return this->backgroundColor;
+        const Sphere & sphere = this->surfaces.spheres[i];
+        const float radius = sphere.getRadius();
+        const long long material = &sphere.getMaterial() - materials;
+        
+        surfaces += hashValues(hashValues(hashVector(basis, sphere.getCenter()), &radius, 1), &material, 1);
+    }
+    
+    hash = hashValues(hash, &surfaces, 1);
+    
+    if(!shading)
+        return hash;
+    
+    const float scalars[2] = { this->shadowRayEpsilon, (float) this->maxRecursionDepth };
+    const float cutoff[2] = { this->throughputCutoff, this->russianRoulette ? 1.0f : 0.0f };
+    
+    hash = hashValues(hash, scalars, 2);
+    hash = hashValues(hash, cutoff, 2);
+    hash = hashVector(hash, Vector3(this->backgroundColor.getFR(), this->backgroundColor.getFG(), this->backgroundColor.getFB()));
+    hash = hashVector(hash, this->ambientLight);
+    
+    for(size_t i = 0; i < this->materials.size(); i++)
+    {
+        const Material & material = this->materials[i];
+        
+        hash = hashVector(hashVector(hashVector(hashVector(hash, material.ambient), material.diffuse), material.specular), material.mirror);
+        hash = hashValues(hash, &material.phong_exponent, 1);
     }
+    
+    for(size_t i = 0; i < this->pointLights.size(); i++)
+        hash = hashVector(hashVector(hash, this->pointLights[i].position), this->pointLights[i].intensity);
+    
+    return hash;
 }
 
-void Scene::generateImages()
+void Scene::renderImage(Camera & camera, Image & image, ThreadPool & pool, std::atomic<bool> & hasFirstPixel,
+                        RenderCheckpoint * checkpoint)
 {
-    // generate one image for each camera
-    for(int i = 0; i < this->cameras.size(); i++)
+    if(checkpoint != NULL)
     {
-        Camera & camera = this->cameras[i];
+        std::vector<int> missing;
         
-        int imageWidth = camera.getImageW();
-        int imageHeight = camera.getImageH();
-        
-        Image image(imageWidth, imageHeight);
-        
-        // generate the rays
-        camera.generateRays();
+        for(int t = 0; t < checkpoint->getTileCount(); t++)
+        {
+            if(!checkpoint->isDone(t))
+                missing.push_back(t);
+        }
         
-        Ray ** rays = camera.getRays();
+        // tiles so that a checkpoint has whole ones to keep, their rays are made one by one
+        parallelFor(pool, 0, (int) missing.size(), 1, [&](int begin, int end) {
+            for(int i = begin; i < end; i++)
+            {
+                ImageTile tile = checkpoint->getTile(missing[i]);
+                
+                for(int y = tile.y; y < tile.y + tile.height; y++)
+                {
+                    for(int x = tile.x; x < tile.x + tile.width; x++)
+                    {
+                        Ray ray = camera.getRay(x, y);
+                        
+                        image.setColor(x, y, this->getRayColor(ray, this->maxRecursionDepth, false));
+                    }
+                }
+                
+                if(!hasFirstPixel.load(std::memory_order_relaxed) && !hasFirstPixel.exchange(true))
+                    this->firstPixelTime = std::chrono::steady_clock::now();
+                
+                checkpoint->tileDone(missing[i]);
+            }
+        });
         
-        for(int x = 0; x < imageWidth; x++)
+        return;
+    }
+    
+    int imageWidth = camera.getImageW();
+    int imageHeight = camera.getImageH();
+    
+    // generate the rays
+    camera.generateRays();
+    
+    Ray ** rays = camera.getRays();
+    
+    // pixels are independent, columns are spread over the render threads
+    parallelFor(pool, 0, imageWidth, 4, [&](int begin, int end) {
+        for(int x = begin; x < end; x++)
         {
             for(int y = 0; y < imageHeight; y++)
             {
                 Ray & ray = rays[x][y];
                 
                 image.setColor(x, y, this->getRayColor(ray, this->maxRecursionDepth, false));
-             
+                
+                if(!hasFirstPixel.load(std::memory_order_relaxed) && !hasFirstPixel.exchange(true))
+                    this->firstPixelTime = std::chrono::steady_clock::now();
             }
         }
-        
-        image.write(camera.image_name.data());
-    }
+    });
+}
+
+void Scene::renderTiles(Camera & camera, const ImageTile & region, int tileSize, Image & image, ThreadPool & pool,
+                        const std::function<bool(const ImageTile &)> & tileDone)
+{
+    // a region is usually a small part of the image, only its rays are made
+    int tileColumns = (region.width + tileSize - 1) / tileSize;
+    int tileRows = (region.height + tileSize - 1) / tileSize;
+    std::atomic<bool> cancelled(false);
     
+    // row by row, so that a client sees the image fill from the top
+    parallelFor(pool, 0, tileColumns * tileRows, 1, [&](int begin, int end) {
+        for(int t = begin; t < end && !cancelled.load(std::memory_order_relaxed); t++)
+        {
+            ImageTile tile;
+            tile.x = region.x + (t % tileColumns) * tileSize;
+            tile.y = region.y + (t / tileColumns) * tileSize;
+            tile.width = min(tileSize, region.x + region.width - tile.x);
+            tile.height = min(tileSize, region.y + region.height - tile.y);
+            
+            for(int y = tile.y; y < tile.y + tile.height; y++)
+            {
+                for(int x = tile.x; x < tile.x + tile.width; x++)
+                {
+                    Ray ray = camera.getRay(x, y);
+                    
+                    image.setColor(x, y, this->getRayColor(ray, this->maxRecursionDepth, false));
+                }
+            }
+            
+            if(!tileDone(tile))
+                cancelled = true;
+        }
+    });
 }
 
-void Scene::loadFromXml(const std::string& filepath)
+void Scene::generateImages()
 {
-    tinyxml2::XMLDocument file;
-    std::stringstream stream;
+    ThreadPool pool(this->threadCount);
     
-    auto res = file.LoadFile(filepath.c_str());
-    if (res)
+    this->generateImages(pool);
+}
+
+void Scene::generateImages(ThreadPool & pool)
+{
+    std::atomic<bool> hasFirstPixel(false);
+    SceneSnapshot snapshot;
+    int skipped = 0;
+    
+    if(this->incrementalRender)
+        this->getSnapshot(snapshot);
+    
+    // every crop is checked before any image is written
+    for(size_t i = 0; i < this->cameras.size(); i++)
     {
-        throw std::runtime_error("Error: The xml file cannot be loaded.");
+        const Camera & camera = this->cameras[i];
+        
+        if(!camera.hasCrop())
+            continue;
+        
+        if(this->writeGBuffers || this->relightGBuffers)
+            throw std::runtime_error("Error: " + camera.image_name + " has a crop, G-buffers are only kept of whole images.");
+        
+        // the crop is traced on its own, none of these would be done
+        if(this->incrementalRender || this->rasterizePrimary || this->checkpointInterval > 0.0 || this->resumeCheckpoints)
+            throw std::runtime_error("Error: " + camera.image_name + " has a crop, which cannot be rendered incrementally, "
+                                     "rasterized or checkpointed.");
+        
+        if(camera.crop_x < 0 || camera.crop_y < 0 || camera.crop_width < 1 || camera.crop_height < 1 ||
+           camera.crop_width > camera.getImageW() - camera.crop_x || camera.crop_height > camera.getImageH() - camera.crop_y)
+            throw std::runtime_error("Error: The crop of " + camera.image_name + " is outside of its " +
+                                     std::to_string(camera.getImageW()) + "x" + std::to_string(camera.getImageH()) + " image.");
     }
-
-    auto root = file.FirstChild();
-    if (!root)
+    
+    // generate one image for each camera
+    for(int i = 0; i < this->cameras.size(); i++)
     {
-        throw std::runtime_error("Error: Root is not found.");
+        Camera & camera = this->cameras[i];
+        
+        Image image(camera.getImageW(), camera.getImageH());
+        
+        // the primary hits of an earlier render are shaded again while its
+        // .. camera and surfaces are unchanged, else they are traced
+        if(this->writeGBuffers || this->relightGBuffers)
+        {
+            std::string path = camera.image_name + ".gbuffer";
+            GBuffer gbuffer(camera.getImageW(), camera.getImageH(), this->getRenderFingerprint(camera, false));
+            
+            if(this->relightGBuffers && gbuffer.read(path, this->surfaces.triangles.size(), this->surfaces.spheres.size(),
+                                                     (int) this->materials.size()))
+            {
+                // written again when it got the visibility of lights that moved
+                if(this->relight(camera, gbuffer, image, pool))
+                    gbuffer.write(path);
+            }
+            else
+            {
+                // the other cameras are still relit, the skipped ones are
+                // .. reported once they are done
+                if(!this->writeGBuffers)
+                {
+                    std::cerr << "Error: " << path << " is missing, cannot be read or was not rendered with this camera and these surfaces, "
+                              << camera.image_name << " is skipped." << std::endl;
+                    skipped++;
+                    continue;
+                }
+                
+                this->renderGBuffer(camera, gbuffer, image, pool);
+                gbuffer.write(path);
+            }
+            
+            if(!hasFirstPixel.exchange(true))
+                this->firstPixelTime = std::chrono::steady_clock::now();
+            
+            image.write(camera.image_name.data());
+            continue;
+        }
+        
+        // only the crop is traced, written alone or over the image written before
+        if(camera.hasCrop())
+        {
+            ImageTile crop = { camera.crop_x, camera.crop_y, camera.crop_width, camera.crop_height };
+            
+            if(this->compositeCrops)
+                image.read(camera.image_name);
+            
+            this->renderTiles(camera, crop, 32, image, pool, [&](const ImageTile &) {
+                if(!hasFirstPixel.load(std::memory_order_relaxed) && !hasFirstPixel.exchange(true))
+                    this->firstPixelTime = std::chrono::steady_clock::now();
+                
+                return true;
+            });
+            
+            if(this->compositeCrops)
+                image.write(camera.image_name);
+            else
+                image.writeRegion(camera.image_name, crop);
+            
+            continue;
+        }
+        
+        if(this->incrementalRender)
+        {
+            this->renderIncremental(camera, image, pool, snapshot);
+            
+            if(!hasFirstPixel.exchange(true))
+                this->firstPixelTime = std::chrono::steady_clock::now();
+            
+            image.write(camera.image_name.data());
+            continue;
+        }
+        
+        if(this->rasterizePrimary)
+        {
+            int traced = this->renderRasterized(camera, image, pool);
+            
+            std::cout << camera.image_name << ": rasterized, " << traced << " of "
+                      << camera.getImageW() * camera.getImageH() << " pixels traced" << std::endl;
+            
+            if(!hasFirstPixel.exchange(true))
+                this->firstPixelTime = std::chrono::steady_clock::now();
+            
+            image.write(camera.image_name.data());
+            continue;
+        }
+        
+        if(this->checkpointInterval <= 0.0 && !this->resumeCheckpoints)
+        {
+            this->renderImage(camera, image, pool, hasFirstPixel);
+            
+            image.write(camera.image_name.data());
+            continue;
+        }
+        
+        RenderCheckpoint checkpoint(camera.image_name + ".checkpoint", image, camera.getImageW(), camera.getImageH(), 32,
+                                    this->getRenderFingerprint(camera, true), this->checkpointInterval > 0.0 ? this->checkpointInterval : 60.0);
+        
+        if(this->resumeCheckpoints)
+        {
+            int restored = checkpoint.resume();
+            
+            if(restored > 0)
+                std::cout << camera.image_name << ": resuming with " << restored << " of " << checkpoint.getTileCount()
+                          << " tiles" << std::endl;
+        }
+        
+        checkpoint.start();
+        
+        this->renderImage(camera, image, pool, hasFirstPixel, &checkpoint);
+        
+        // the tiles are kept until the image they make up is written
+        checkpoint.stop();
+        image.write(camera.image_name.data());
+        checkpoint.remove();
     }
+    
+    if(skipped > 0)
+        throw std::runtime_error("Error: " + std::to_string(skipped) + " of " + std::to_string(this->cameras.size()) +
+                                 " images were not relit.");
+}
 
+void Scene::copyLoadOptions(const Scene & settings)
+{
+    this->acceleratorType = settings.acceleratorType;
+    this->bvhBuildOptions = settings.bvhBuildOptions;
+    this->lazyBVHBuildOptions = settings.lazyBVHBuildOptions;
+    this->gridBuildOptions = settings.gridBuildOptions;
+    this->kdTreeBuildOptions = settings.kdTreeBuildOptions;
+    this->bvhRefitOptions = settings.bvhRefitOptions;
+    this->threadCount = settings.threadCount;
+    this->throughputCutoff = settings.throughputCutoff;
+    this->russianRoulette = settings.russianRoulette;
+    this->rasterizePrimary = settings.rasterizePrimary;
+}
+
+void Scene::loadSettings(const tinyxml2::XMLNode * root)
+{
+    std::stringstream stream;
+    
     //Get BackgroundColor
-    auto element = root->FirstChildElement("BackgroundColor");
+    const tinyxml2::XMLElement * element = root->FirstChildElement("BackgroundColor");
     if (element)
     {
         stream << element->GetText() << std::endl;
@@ -323,9 +724,14 @@ void Scene::loadFromXml(const std::string& filepath)
         stream << "0" << std::endl;
     }
     stream >> maxRecursionDepth;
+}
 
+void Scene::loadCameras(const tinyxml2::XMLNode * root)
+{
+    std::stringstream stream;
+    
     //Get Cameras
-    element = root->FirstChildElement("Cameras");
+    const tinyxml2::XMLElement * element = root->FirstChildElement("Cameras");
     element = element->FirstChildElement("Camera");
     Camera camera;
     while (element)
@@ -353,14 +759,31 @@ void Scene::loadFromXml(const std::string& filepath)
         stream >> camera.image_width >> camera.image_height;
         stream >> camera.image_name;
         
+        // optional, x y width height of the only pixels to trace
+        child = element->FirstChildElement("Crop");
+        int crop[4] = { 0, 0, 0, 0 };
+        
+        if(child)
+        {
+            stream << child->GetText() << std::endl;
+            stream >> crop[0] >> crop[1] >> crop[2] >> crop[3];
+        }
+        
+        camera.setCrop(crop[0], crop[1], crop[2], crop[3]);
+        
         camera.rays = NULL;
 
         cameras.push_back(camera);
         element = element->NextSiblingElement("Camera");
     }
+}
 
+void Scene::loadLights(const tinyxml2::XMLNode * root)
+{
+    std::stringstream stream;
+    
     //Get Lights
-    element = root->FirstChildElement("Lights");
+    const tinyxml2::XMLElement * element = root->FirstChildElement("Lights");
     auto child = element->FirstChildElement("AmbientLight");
     stream << child->GetText() << std::endl;
     stream >> ambientLight.x >> ambientLight.y >> ambientLight.z;
@@ -379,10 +802,16 @@ void Scene::loadFromXml(const std::string& filepath)
         pointLights.push_back(pointLight);
         element = element->NextSiblingElement("PointLight");
     }
+}
 
+void Scene::loadMaterials(const tinyxml2::XMLNode * root)
+{
+    std::stringstream stream;
+    
     //Get Materials
-    element = root->FirstChildElement("Materials");
+    const tinyxml2::XMLElement * element = root->FirstChildElement("Materials");
     element = element->FirstChildElement("Material");
+    const tinyxml2::XMLElement * child;
     Material material;
     while (element)
     {
@@ -424,6 +853,42 @@ void Scene::loadFromXml(const std::string& filepath)
         materials.push_back(material);
         element = element->NextSiblingElement("Material");
     }
+}
+
+void Scene::loadFromXml(const std::string& filepath)
+{
+    tinyxml2::XMLDocument file;
+    std::stringstream stream;
+    
+    auto res = file.LoadFile(filepath.c_str());
+    if (res)
+    {
+        throw std::runtime_error("Error: The xml file cannot be loaded.");
+    }
+
+    auto root = file.FirstChild();
+    if (!root)
+    {
+        throw std::runtime_error("Error: Root is not found.");
+    }
+
+    this->loadSettings(root);
+    
+    //Get Accelerator, the command line has the last word
+    auto element = root->FirstChildElement("Accelerator");
+    if (element && acceleratorType == scene_accelerator)
+    {
+        if (!element->GetText() || !parseAcceleratorType(element->GetText(), acceleratorType))
+        {
+            throw std::runtime_error("Error: Accelerator must be bvh, lazybvh, grid or kdtree.");
+        }
+    }
+
+    this->loadCameras(root);
+    this->loadLights(root);
+    this->loadMaterials(root);
+    
+    tinyxml2::XMLElement * child;
     
     
     // TODO Get Textures
@@ -438,11 +903,10 @@ void Scene::loadFromXml(const std::string& filepath)
     
     Texture *texturePtr;
 
-    int width, height; 
     std::string imageName;
     while (element)
     {
-        texturePtr = new Texture;
+        texturePtr = arena.create<Texture>();
         Texture & texture = *texturePtr;
         
         child = element->FirstChildElement("ImageName");
@@ -456,15 +920,7 @@ void Scene::loadFromXml(const std::string& filepath)
 
         stream >> imageName;
         
-        
-        read_jpeg_header(imageName.data(), width, height);
-        
-        texture.width = width;
-        texture.height = height;
-        
-        unsigned char * image = new unsigned char[width * height * 3];
-        read_jpeg(imageName.data(), image, width, height);
-        texture.image = image;
+        readTexture(imageName, texture);
         
         // take the parameters as string then accordingly change the enumaration 
         std::string tempInterpolationType, tempDecalMode, tempAppearance;
@@ -491,6 +947,7 @@ void Scene::loadFromXml(const std::string& filepath)
             texture.appearance = Appearance::repeat;
             
         textures.push_back(texturePtr);
+        textureNames.push_back(imageName);
         
         element = element->NextSiblingElement("Texture");
     }
@@ -557,14 +1014,7 @@ void Scene::loadFromXml(const std::string& filepath)
 
     //Get VertexData
     element = root->FirstChildElement("VertexData");
-    stream << element->GetText() << std::endl;
-    float vertex_x, vertex_y, vertex_z;
-    while (!(stream >> vertex_x).eof())
-    {
-        stream >> vertex_y >> vertex_z;
-        vertexData.push_back(Position3(vertex_x, vertex_y, vertex_z));
-    }
-    stream.clear();
+    readVertexData(element->GetText());
     
     // Get TexCoordData
     element = root->FirstChildElement("TexCoordData");
@@ -578,7 +1028,7 @@ void Scene::loadFromXml(const std::string& filepath)
         {
             stream >> coord_v;
             
-            TexCoord* texCoord= new TexCoord;
+            TexCoord* texCoord = arena.create<TexCoord>();
             
             texCoord->u = coord_u;
             texCoord->v = coord_v;
@@ -598,8 +1048,11 @@ void Scene::loadFromXml(const std::string& filepath)
     {
         int base_mesh_id, material_id;
         Transformation transformation;
+        SceneObject object;
         
         element->QueryAttribute("baseMeshId", &base_mesh_id);
+        element->QueryAttribute("id", &object.id);
+        object.type = mesh_instance_object;
         
         // material
         child = element->FirstChildElement("Material");
@@ -658,9 +1111,13 @@ void Scene::loadFromXml(const std::string& filepath)
         meshInstance.base_mesh_id = base_mesh_id;
         meshInstance.transformation = transformation;
         meshInstance.material_id = material_id;
+        meshInstance.object = objects.size();
         
         meshInstances.push_back(meshInstance);
         
+        object.transformation = transformation;
+        objects.push_back(object);
+        
         stream.clear();
         
         element = element->NextSiblingElement("MeshInstance");
@@ -681,6 +1138,17 @@ void Scene::loadFromXml(const std::string& filepath)
         // get mesh id
         element->QueryAttribute("id", &mesh_id);
         
+        int meshObject = objects.size();
+        objects.push_back(SceneObject());
+        objects[meshObject].type = mesh_object;
+        objects[meshObject].id = mesh_id;
+        
+        for(int i = 0; i < (int)meshInstances.size(); i++)
+        {
+            if(meshInstances[i].base_mesh_id == mesh_id)
+                objects[meshInstances[i].object].baseMesh = meshObject;
+        }
+        
         child = element->FirstChildElement("Material");
         stream << child->GetText() << std::endl;
         stream >> material_id;
@@ -734,59 +1202,45 @@ void Scene::loadFromXml(const std::string& filepath)
             }
         }
         stream.clear();
+        
+        objects[meshObject].transformation = transformation;
+        
         child = element->FirstChildElement("Faces");
-        stream << child->GetText() << std::endl;
-        int v0_id, v1_id, v2_id;
-        while (!(stream >> v0_id).eof())
+        std::vector<int> faceIds;
+        readFaces(child->GetText(), faceIds);
+        
+        for(size_t face = 0; face + 2 < faceIds.size(); face += 3)
         {
-            stream >> v1_id >> v2_id;
+            int v0_id = faceIds[face], v1_id = faceIds[face + 1], v2_id = faceIds[face + 2];
 
-            Triangle * triangle;
-            
             Position3 *v0, *v1, *v2;
             
             if(needsTransformation)
             {
                 // TODO: maybe something else is needed
-                v0 = new Position3(transformation.transform<Position3>(vertexData[v0_id - 1]));
-                v1 = new Position3(transformation.transform<Position3>(vertexData[v1_id - 1]));
-                v2 = new Position3(transformation.transform<Position3>(vertexData[v2_id - 1]));
+                v0 = arena.create(Position3(transformation.transform<Position3>(vertexData[v0_id - 1])));
+                v1 = arena.create(Position3(transformation.transform<Position3>(vertexData[v1_id - 1])));
+                v2 = arena.create(Position3(transformation.transform<Position3>(vertexData[v2_id - 1])));
 
 
             }
             else
             {
                 // TODO: maybe some memory reallocation needed
-                v0 = new Position3(vertexData[v0_id - 1]);
-                v1 = new Position3(vertexData[v1_id - 1]);
-                v2 = new Position3(vertexData[v2_id - 1]);
+                v0 = arena.create(Position3(vertexData[v0_id - 1]));
+                v1 = arena.create(Position3(vertexData[v1_id - 1]));
+                v2 = arena.create(Position3(vertexData[v2_id - 1]));
                 
             }
             
+            TexCoord *t0 = NULL, *t1 = NULL, *t2 = NULL;
+            
             if(v2_id <= (int)texCoordData.size())
             {
-                triangle = new Triangle( materials[material_id - 1],
-                                           texturePtr,
-                                           *v0,
-                                           *v1,
-                                           *v2,
-                                           texCoordData[v0_id - 1],
-                                           texCoordData[v1_id - 1],
-                                           texCoordData[v2_id - 1] );
-            }
-            else
-            {
-                triangle = new Triangle( materials[material_id - 1],
-                                           texturePtr,
-                                           *v0,
-                                           *v1,
-                                           *v2,
-                                           NULL,
-                                           NULL,
-                                           NULL );
+                t0 = texCoordData[v0_id - 1];
+                t1 = texCoordData[v1_id - 1];
+                t2 = texCoordData[v2_id - 1];
             }
-            
-
                                        
             // now, search if there are instances of this mesh
             for(int i = 0; i < (int)meshInstances.size(); i++)
@@ -795,41 +1249,36 @@ void Scene::loadFromXml(const std::string& filepath)
                 {
                     Position3 *new_v0, *new_v1, *new_v2;
                     
-                    new_v0 = new Position3(meshInstances[i].transformation.transform<Position3>(*v0));
-                    new_v1 = new Position3(meshInstances[i].transformation.transform<Position3>(*v1));
-                    new_v2 = new Position3(meshInstances[i].transformation.transform<Position3>(*v2));
-
-                    Triangle * new_triangle;
-                    
-                    if(v2_id <= (int)texCoordData.size())
-                    {
-                        new_triangle = new Triangle( materials[meshInstances[i].material_id - 1],
-                                                   texturePtr,
-                                                   *new_v0,
-                                                   *new_v1,
-                                                   *new_v2,
-                                                   texCoordData[v0_id - 1],
-                                                   texCoordData[v1_id - 1],
-                                                   texCoordData[v2_id - 1] );
-                    }
-                    else
-                    {
-                        new_triangle = new Triangle( materials[meshInstances[i].material_id - 1],
-                                                   texturePtr,
-                                                   *new_v0,
-                                                   *new_v1,
-                                                   *new_v2,
-                                                   NULL,
-                                                   NULL,
-                                                   NULL );
-                    }
-                                               
-                    surfaces.push_back((Surface*)(new_triangle));
+                    objects[meshInstances[i].object].surfaces.push_back(surfaces.triangles.size());
                     
+                    new_v0 = arena.create(Position3(meshInstances[i].transformation.transform<Position3>(*v0)));
+                    new_v1 = arena.create(Position3(meshInstances[i].transformation.transform<Position3>(*v1)));
+                    new_v2 = arena.create(Position3(meshInstances[i].transformation.transform<Position3>(*v2)));
+
+                    surfaces.triangles.push_back(Triangle( materials[meshInstances[i].material_id - 1],
+                                                           texturePtr,
+                                                           *new_v0,
+                                                           *new_v1,
+                                                           *new_v2,
+                                                           t0,
+                                                           t1,
+                                                           t2 ));
                 }
             }
             
-            surfaces.push_back((Surface*)(triangle));
+            objects[meshObject].surfaces.push_back(surfaces.triangles.size());
+            objects[meshObject].vertexIds.push_back(v0_id - 1);
+            objects[meshObject].vertexIds.push_back(v1_id - 1);
+            objects[meshObject].vertexIds.push_back(v2_id - 1);
+            
+            surfaces.triangles.push_back(Triangle( materials[material_id - 1],
+                                                   texturePtr,
+                                                   *v0,
+                                                   *v1,
+                                                   *v2,
+                                                   t0,
+                                                   t1,
+                                                   t2 ));
         }
         stream.clear();
 
@@ -844,6 +1293,10 @@ void Scene::loadFromXml(const std::string& filepath)
     while (element)
     {
         int v0_id, v1_id, v2_id, material_id;
+        SceneObject object;
+        
+        object.type = triangle_object;
+        element->QueryAttribute("id", &object.id);
         
         child = element->FirstChildElement("Material");
         stream << child->GetText() << std::endl;
@@ -916,47 +1369,45 @@ void Scene::loadFromXml(const std::string& filepath)
        {
                 
            // TODO: maybe something else is needed
-           v0 = new Position3(transformation.transform<Position3>(vertexData[v0_id - 1]));
-           v1 = new Position3(transformation.transform<Position3>(vertexData[v1_id - 1]));
-           v2 = new Position3(transformation.transform<Position3>(vertexData[v2_id - 1]));
+           v0 = arena.create(Position3(transformation.transform<Position3>(vertexData[v0_id - 1])));
+           v1 = arena.create(Position3(transformation.transform<Position3>(vertexData[v1_id - 1])));
+           v2 = arena.create(Position3(transformation.transform<Position3>(vertexData[v2_id - 1])));
 
        }
        else
        {
            // TODO: maybe some memory reallocation needed
-           v0 = new Position3(vertexData[v0_id - 1]);
-           v1 = new Position3(vertexData[v1_id - 1]);
-           v2 = new Position3(vertexData[v2_id - 1]);
+           v0 = arena.create(Position3(vertexData[v0_id - 1]));
+           v1 = arena.create(Position3(vertexData[v1_id - 1]));
+           v2 = arena.create(Position3(vertexData[v2_id - 1]));
                 
 
        }
        
-       Triangle * triangle;
+       TexCoord *t0 = NULL, *t1 = NULL, *t2 = NULL;
        
-            if(v2_id <= (int)texCoordData.size())
-            {
-                triangle = new Triangle( materials[material_id - 1],
-                                           texturePtr,
-                                           *v0,
-                                           *v1,
-                                           *v2,
-                                           texCoordData[v0_id - 1],
-                                           texCoordData[v1_id - 1],
-                                           texCoordData[v2_id - 1] );
-            }
-            else
-            {
-                triangle = new Triangle( materials[material_id - 1],
-                                           texturePtr,
-                                           *v0,
-                                           *v1,
-                                           *v2,
-                                           NULL,
-                                           NULL,
-                                           NULL );
-            }
-            
-        surfaces.push_back((Surface*)(triangle));
+       if(v2_id <= (int)texCoordData.size())
+       {
+           t0 = texCoordData[v0_id - 1];
+           t1 = texCoordData[v1_id - 1];
+           t2 = texCoordData[v2_id - 1];
+       }
+       
+       object.transformation = transformation;
+       object.surfaces.push_back(surfaces.triangles.size());
+       object.vertexIds.push_back(v0_id - 1);
+       object.vertexIds.push_back(v1_id - 1);
+       object.vertexIds.push_back(v2_id - 1);
+       objects.push_back(object);
+       
+       surfaces.triangles.push_back(Triangle( materials[material_id - 1],
+                                              texturePtr,
+                                              *v0,
+                                              *v1,
+                                              *v2,
+                                              t0,
+                                              t1,
+                                              t2 ));
                 
         element = element->NextSiblingElement("Triangle");
     }
@@ -969,6 +1420,10 @@ void Scene::loadFromXml(const std::string& filepath)
     {
         int center_vertex_id, material_id;
         float radius;
+        SceneObject object;
+        
+        object.type = sphere_object;
+        element->QueryAttribute("id", &object.id);
 
         child = element->FirstChildElement("Material");
         stream << child->GetText() << std::endl;
@@ -989,6 +1444,9 @@ void Scene::loadFromXml(const std::string& filepath)
         stream << child->GetText() << std::endl;
         stream >> radius;
         
+        object.vertexIds.push_back(center_vertex_id);
+        object.radius = radius;
+        
         // get Texture
         Texture* texturePtr = NULL;
         child = element->FirstChildElement("Texture");
@@ -1049,13 +1507,300 @@ void Scene::loadFromXml(const std::string& filepath)
         }
         stream.clear();
         
-        Sphere * sphere = new Sphere(center, radius, materials[material_id - 1], texturePtr);
+        object.transformation = transformation;
+        object.surfaces.push_back(surfaces.spheres.size());
+        objects.push_back(object);
         
-        surfaces.push_back((Surface*)(sphere));
+        surfaces.spheres.push_back(Sphere(center, radius, materials[material_id - 1], texturePtr));
 
         element = element->NextSiblingElement("Sphere");
     }       
     
+    //Get Animation
+    element = root->FirstChildElement("Animation");
+    if(element)
+    {
+        int lastFrame = -1;
+        
+        animation.cameraKeys.resize(cameras.size());
+        
+        child = element->FirstChildElement("CameraKey");
+        while(child)
+        {
+            int cameraId = 0;
+            CameraKey key;
+            
+            key.frame = 0;
+            child->QueryAttribute("camera", &cameraId);
+            child->QueryAttribute("frame", &key.frame);
+            
+            if(cameraId < 1 || cameraId > (int)cameras.size())
+                throw std::runtime_error("Error: CameraKey refers to a camera that does not exist.");
+            
+            // what is not given stays where the camera is
+            key.position = cameras[cameraId - 1].position;
+            key.gaze = cameras[cameraId - 1].gaze;
+            key.up = cameras[cameraId - 1].up;
+            
+            auto keyChild = child->FirstChildElement("Position");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.position.x >> key.position.y >> key.position.z;
+            }
+            
+            keyChild = child->FirstChildElement("Gaze");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.gaze.x >> key.gaze.y >> key.gaze.z;
+            }
+            
+            keyChild = child->FirstChildElement("Up");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.up.x >> key.up.y >> key.up.z;
+            }
+            
+            animation.cameraKeys[cameraId - 1].push_back(key);
+            lastFrame = key.frame > lastFrame ? key.frame : lastFrame;
+            
+            child = child->NextSiblingElement("CameraKey");
+        }
+        
+        child = element->FirstChildElement("ObjectKey");
+        while(child)
+        {
+            int objectId = 0;
+            const char * typeName = child->Attribute("type");
+            TransformationKey key;
+            ObjectType type;
+            
+            child->QueryAttribute("id", &objectId);
+            child->QueryAttribute("frame", &key.frame);
+            
+            if(typeName && string(typeName) == "Mesh")
+                type = mesh_object;
+            else if(typeName && string(typeName) == "MeshInstance")
+                type = mesh_instance_object;
+            else if(typeName && string(typeName) == "Triangle")
+                type = triangle_object;
+            else if(typeName && string(typeName) == "Sphere")
+                type = sphere_object;
+            else
+                throw std::runtime_error("Error: ObjectKey type must be Mesh, MeshInstance, Triangle or Sphere.");
+            
+            int object = findObject(type, objectId);
+            
+            if(object < 0)
+                throw std::runtime_error("Error: ObjectKey refers to an object that does not exist.");
+            
+            auto keyChild = child->FirstChildElement("Scaling");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.scaling.x >> key.scaling.y >> key.scaling.z;
+            }
+            
+            keyChild = child->FirstChildElement("Rotation");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.angle >> key.axis.x >> key.axis.y >> key.axis.z;
+            }
+            
+            keyChild = child->FirstChildElement("Translation");
+            if(keyChild)
+            {
+                stream << keyChild->GetText() << std::endl;
+                stream >> key.translation.x >> key.translation.y >> key.translation.z;
+            }
+            
+            int index = 0;
+            
+            while(index < (int)animation.objects.size() && animation.objects[index].object != object)
+                index++;
+            
+            if(index == (int)animation.objects.size())
+            {
+                animation.objects.push_back(ObjectAnimation());
+                animation.objects[index].object = object;
+            }
+            
+            animation.objects[index].keys.push_back(key);
+            lastFrame = key.frame > lastFrame ? key.frame : lastFrame;
+            
+            child = child->NextSiblingElement("ObjectKey");
+        }
+        
+        for(size_t i = 0; i < animation.cameraKeys.size(); i++)
+        {
+            std::stable_sort(animation.cameraKeys[i].begin(), animation.cameraKeys[i].end(),
+                             [](const CameraKey & a, const CameraKey & b) { return a.frame < b.frame; });
+        }
+        
+        for(size_t i = 0; i < animation.objects.size(); i++)
+        {
+            std::stable_sort(animation.objects[i].keys.begin(), animation.objects[i].keys.end(),
+                             [](const TransformationKey & a, const TransformationKey & b) { return a.frame < b.frame; });
+        }
+        
+        animation.frameCount = lastFrame + 1;
+        element->QueryAttribute("frameCount", &animation.frameCount);
+        
+        // the accelerator is built over the first frame
+        if(animation.frameCount > 0)
+            setFrame(0);
+    }
+    
+    // all surfaces are in place, after this they only move into BVH leaf order
+    buildAccelerator(acceleratorType);
+}
+
+void Scene::buildAccelerator(AcceleratorType type)
+{
+    // its BVH is all a compiled scene has, and it is read-only
+    if(this->compiled)
+    {
+        if(type != bvh_accelerator && type != scene_accelerator)
+            throw std::runtime_error("Error: A compiled scene can only be traced with its BVH.");
+
+        return;
+    }
+    
+    if(type == grid_accelerator)
+    {
+        grid.build(surfaces, gridBuildOptions);
+        accelerator = &grid;
+    }
+    else if(type == kdtree_accelerator)
+    {
+        kdTree.build(surfaces, kdTreeBuildOptions);
+        accelerator = &kdTree;
+    }
+    else if(type == lazy_bvh_accelerator)
+    {
+        lazyBVH.build(surfaces, lazyBVHBuildOptions, bvhBuildOptions);
+        accelerator = &lazyBVH;
+    }
+    else
+    {
+        bvh.build(surfaces, bvhBuildOptions);
+
+        if(bvhBuildOptions.reorderLayout)
+        {
+            SurfaceOrder order = bvh.reorderSurfaces(surfaces);
+
+            for(size_t i = 0; i < objects.size(); i++)
+            {
+                const vector<int> & newIndex = objects[i].type == sphere_object ? order.spheres : order.triangles;
+
+                for(size_t k = 0; k < objects[i].surfaces.size(); k++)
+                    objects[i].surfaces[k] = newIndex[objects[i].surfaces[k]];
+            }
+        }
+
+        accelerator = &bvh;
+    }
+}
+
+int Scene::findObject(ObjectType type, int id) const
+{
+    for(int i = 0; i < (int)objects.size(); i++)
+    {
+        if(objects[i].type == type && objects[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+void Scene::setTransformation(int object, const Transformation & transformation)
+{
+    if(object < 0 || object >= (int)objects.size())
+        throw std::runtime_error("Error: There is no such object to transform.");
+
+    objects[object].transformation = transformation;
+    objects[object].moved = true;
+}
+
+void Scene::updateObjects()
+{
+    ThreadPool pool(this->threadCount);
+    bool anyMoved = false;
+
+    for(size_t i = 0; i < objects.size(); i++)
+    {
+        SceneObject & object = objects[i];
+        const SceneObject * mesh = object.baseMesh >= 0 ? &objects[object.baseMesh] : NULL;
+
+        if(!object.moved && !(mesh && mesh->moved))
+            continue;
+
+        anyMoved = true;
+
+        // like the loader, scaling only grows the radius and the center is
+        // .. only rotated and translated; keys scale first, so taking the
+        // .. scale back out of the rotated center is all it takes
+        if(object.type == sphere_object)
+        {
+            const Matrix4 & matrix = object.transformation.getTransformationMatrix();
+            float scale = sqrt(matrix[0][0] * matrix[0][0] + matrix[1][0] * matrix[1][0] + matrix[2][0] * matrix[2][0]);
+
+            Position3 translation = object.transformation.transform(Position3(0.0f, 0.0f, 0.0f));
+            Position3 center = translation;
+
+            if(scale > 0.0f)
+            {
+                Vector3 offset = (object.transformation.transform(vertexData[object.vertexIds[0]]) - translation) / scale;
+
+                center = Position3(translation.getX() + offset.getX(),
+                                   translation.getY() + offset.getY(),
+                                   translation.getZ() + offset.getZ());
+            }
+
+            surfaces.spheres[object.surfaces[0]].setGeometry(center, object.radius * scale);
+            continue;
+        }
+
+        // the same two steps the loader takes for mesh instances
+        const vector<int> & vertexIds = mesh ? mesh->vertexIds : object.vertexIds;
+
+        parallelFor(pool, 0, object.surfaces.size(), 1 << 12, [&](int begin, int end) {
+            for(int k = begin; k < end; k++)
+            {
+                Position3 vertex[3];
+
+                for(int corner = 0; corner < 3; corner++)
+                {
+                    vertex[corner] = vertexData[vertexIds[3 * k + corner]];
+
+                    if(mesh)
+                        vertex[corner] = mesh->transformation.transform(vertex[corner]);
+
+                    vertex[corner] = object.transformation.transform(vertex[corner]);
+                }
+
+                surfaces.triangles[object.surfaces[k]].setVertices(vertex[0], vertex[1], vertex[2]);
+            }
+        });
+    }
+
+    for(size_t i = 0; i < objects.size(); i++)
+        objects[i].moved = false;
+
+    if(!anyMoved || accelerator == NULL)
+        return;
+
+    if(accelerator == &bvh)
+        bvh.refit(bvhRefitOptions);
+    else if(accelerator == &lazyBVH)
+        lazyBVH.build(surfaces, lazyBVHBuildOptions, bvhBuildOptions);
+    else if(accelerator == &grid)
+        grid.build(surfaces, gridBuildOptions);
+    else if(accelerator == &kdTree)
+        kdTree.build(surfaces, kdTreeBuildOptions);
 }
 
 
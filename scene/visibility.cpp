@@ -0,0 +1,565 @@
+#include "../scene.hpp"
+#include "../visibility.hpp"
+#include "../threadpool.hpp"
+#include "../image/image.hpp"
+#include "../simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+// pixels a triangle covers are those whose centre is at most this far
+// .. outside of it, so that rounding never leaves out a pixel the tracer
+// .. hits it in; a pixel given a triangle its ray misses is traced
+static const float coverageMargin = 0.01f;
+
+static const int rasterChunkSize = 1 << 12;
+static const int rasterTileSize = 64;
+
+// a triangle set up for the tiles it reaches, in pixel coordinates where
+// .. the centre of pixel (x, y) is at (x + 0.5, y + 0.5)
+typedef struct RasterTriangle
+{
+    double edges[3][3];     // a x + b y + c: the distance inside of each edge in pixels
+    double depth[3];        // the same for 1 / the distance along the gaze
+    int bounds[4];          // first and last pixel x, first and last pixel y
+    int triangle;
+} RasterTriangle;
+
+typedef struct RasterSphere
+{
+    int bounds[4];
+    int sphere;
+    bool inFront;           // beyond the nearest distance, tested by rasterizeSphereInFront
+    float center[3];        // along u, v and the gaze
+    float radius;
+} RasterSphere;
+
+// where the camera's rays go through the pixels, as Camera::getRay has it
+typedef struct RasterView
+{
+    Position3 position;
+    Vector3 u, v, gaze;
+    float left, top, distance;
+    float pixelWidth, pixelHeight;
+    float nearest;          // what is closer along the gaze is clipped away
+    int width, height;
+} RasterView;
+
+typedef struct RasterVertex
+{
+    double x, y, z;         // along u, v and the gaze
+} RasterVertex;
+
+VisibilityBuffer::VisibilityBuffer(int width, int height, int triangleCount)
+    : width(width), height(height), triangleCount(triangleCount),
+      primitives(width * height, -1), depths(width * height, std::numeric_limits<float>::infinity())
+{
+}
+
+static RasterVertex toView(const RasterView & view, const Position3 & position)
+{
+    Vector3 offset = position - view.position;
+    RasterVertex vertex = { offset ^ view.u, offset ^ view.v, offset ^ view.gaze };
+
+    return vertex;
+}
+
+static void toPixels(const RasterView & view, const RasterVertex & vertex, double & x, double & y)
+{
+    x = (vertex.x * view.distance / vertex.z - view.left) / view.pixelWidth;
+    y = (view.top - vertex.y * view.distance / vertex.z) / view.pixelHeight;
+}
+
+// the pixels whose centres are in [min, max] widened by the margin, clamped to the image
+static void getPixelBounds(const RasterView & view, double minX, double minY, double maxX, double maxY, int bounds[4])
+{
+    const double limit = 1 << 24;
+
+    bounds[0] = (int) std::ceil(std::max(-1.0, std::min(limit, minX - coverageMargin - 0.5)));
+    bounds[1] = (int) std::ceil(std::max(-1.0, std::min(limit, minY - coverageMargin - 0.5)));
+    bounds[2] = (int) std::floor(std::max(-1.0, std::min(limit, maxX + coverageMargin - 0.5)));
+    bounds[3] = (int) std::floor(std::max(-1.0, std::min(limit, maxY + coverageMargin - 0.5)));
+
+    bounds[0] = std::max(bounds[0], 0);
+    bounds[1] = std::max(bounds[1], 0);
+    bounds[2] = std::min(bounds[2], view.width - 1);
+    bounds[3] = std::min(bounds[3], view.height - 1);
+}
+
+// false if it covers no pixel
+static bool setUpTriangle(const RasterView & view, const RasterVertex vertices[3], int triangle, RasterTriangle & raster)
+{
+    double x[3], y[3];
+
+    for(int i = 0; i < 3; i++)
+        toPixels(view, vertices[i], x[i], y[i]);
+
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+    if(!(area != 0.0) || !std::isfinite(area))
+        return false;
+
+    getPixelBounds(view, std::min(x[0], std::min(x[1], x[2])), std::min(y[0], std::min(y[1], y[2])),
+                   std::max(x[0], std::max(x[1], x[2])), std::max(y[0], std::max(y[1], y[2])), raster.bounds);
+
+    if(raster.bounds[0] > raster.bounds[2] || raster.bounds[1] > raster.bounds[3])
+        return false;
+
+    for(int i = 0; i < 3; i++)
+        raster.depth[i] = 0.0;
+
+    // edge i is the one facing vertex i, at vertex i it is the area
+    for(int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        double a = y[j] - y[k];
+        double b = x[k] - x[j];
+        double c = (y[k] - y[j]) * x[j] - (x[k] - x[j]) * y[j];
+        double length = std::sqrt(a * a + b * b) * (area > 0.0 ? 1.0 : -1.0);
+
+        raster.edges[i][0] = a / length;
+        raster.edges[i][1] = b / length;
+        raster.edges[i][2] = c / length;
+
+        // 1 / z is linear in the pixels, the weight of vertex i is edge i / area
+        raster.depth[0] += a / area / vertices[i].z;
+        raster.depth[1] += b / area / vertices[i].z;
+        raster.depth[2] += c / area / vertices[i].z;
+    }
+
+    raster.triangle = triangle;
+
+    return true;
+}
+
+// the triangle clipped to what is in front of view.nearest, as one or two
+// .. triangles set up for rasterizing
+static int clipTriangle(const RasterView & view, const Triangle & triangle, int index, RasterTriangle rasters[2])
+{
+    RasterVertex vertices[3];
+
+    for(int i = 0; i < 3; i++)
+        vertices[i] = toView(view, triangle.getVertex(i));
+
+    RasterVertex polygon[4];
+    int count = 0;
+
+    for(int i = 0; i < 3; i++)
+    {
+        const RasterVertex & from = vertices[i];
+        const RasterVertex & to = vertices[(i + 1) % 3];
+        bool fromInside = from.z >= view.nearest;
+        bool toInside = to.z >= view.nearest;
+
+        if(fromInside)
+            polygon[count++] = from;
+
+        if(fromInside != toInside)
+        {
+            double s = (view.nearest - from.z) / (to.z - from.z);
+            RasterVertex crossing = { from.x + s * (to.x - from.x), from.y + s * (to.y - from.y), view.nearest };
+
+            polygon[count++] = crossing;
+        }
+    }
+
+    int rasterCount = 0;
+
+    for(int i = 2; i < count; i++)
+    {
+        RasterVertex fan[3] = { polygon[0], polygon[i - 1], polygon[i] };
+
+        if(setUpTriangle(view, fan, index, rasters[rasterCount]))
+            rasterCount++;
+    }
+
+    return rasterCount;
+}
+
+// the closest triangle and its 1 / depth of each pixel of the tile, in
+// .. rows of tileSize; pixels outside of the image are rasterized too
+static void rasterizeTile(const RasterTriangle & raster, int tileX, int tileY, int tileSize, float * depths, int * triangles)
+{
+    alignas(32) static const float laneOffsets[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+
+    const int firstX = std::max(raster.bounds[0], tileX) - tileX;
+    const int lastX = std::min(raster.bounds[2], tileX + tileSize - 1) - tileX;
+    const int firstY = std::max(raster.bounds[1], tileY) - tileY;
+    const int lastY = std::min(raster.bounds[3], tileY + tileSize - 1) - tileY;
+
+    if(firstX > lastX || firstY > lastY)
+        return;
+
+    // relative to the tile's corner, where floats are precise enough
+    Float8 a[3];
+    double c[3];
+
+    for(int i = 0; i < 3; i++)
+    {
+        a[i] = Float8((float) raster.edges[i][0]);
+        c[i] = raster.edges[i][2] + raster.edges[i][0] * tileX + raster.edges[i][1] * tileY;
+    }
+
+    Float8 depthA((float) raster.depth[0]);
+    double depthC = raster.depth[2] + raster.depth[0] * tileX + raster.depth[1] * tileY;
+
+    const Float8 margin(-coverageMargin);
+    const Float8 zero(0.0f);
+
+    for(int y = firstY; y <= lastY; y++)
+    {
+        const double rowY = y + 0.5;
+        Float8 row[3];
+
+        for(int i = 0; i < 3; i++)
+            row[i] = Float8((float) (raster.edges[i][1] * rowY + c[i]));
+
+        Float8 depthRow((float) (raster.depth[1] * rowY + depthC));
+
+        for(int x = firstX & ~7; x <= lastX; x += 8)
+        {
+            Float8 pixelX = Float8((float) x) + Float8::load(laneOffsets);
+
+            Float8 inside = (margin <= a[0] * pixelX + row[0]) & (margin <= a[1] * pixelX + row[1]) &
+                            (margin <= a[2] * pixelX + row[2]);
+
+            Float8 depth = depthA * pixelX + depthRow;
+            Float8 stored = Float8::load(depths + y * tileSize + x);
+            Float8 closer = inside & (depth > stored) & (depth > zero);
+
+            int lanes = closer.mask();
+
+            if(lanes == 0)
+                continue;
+
+            select(closer, depth, stored).store(depths + y * tileSize + x);
+
+            for(int lane = 0; lanes != 0; lane++, lanes >>= 1)
+            {
+                if(lanes & 1)
+                    triangles[y * tileSize + x + lane] = raster.triangle;
+            }
+        }
+    }
+}
+
+// a sphere in front of the camera, 8 pixels at a time by the rays of
+// .. Camera::getRay in view space, (u, v, distance) unnormalized; the radius
+// .. is widened by more than these floats can be off, a pixel given a
+// .. sphere its ray misses is traced
+static void rasterizeSphereInFront(const RasterView & view, const RasterSphere & raster, int primitive, int tileX, int tileY,
+                                   float * depths, int * primitives)
+{
+    alignas(32) static const float laneOffsets[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+
+    const int firstX = std::max(raster.bounds[0], tileX) - tileX;
+    const int lastX = std::min(raster.bounds[2], tileX + rasterTileSize - 1) - tileX;
+    const int firstY = std::max(raster.bounds[1], tileY) - tileY;
+    const int lastY = std::min(raster.bounds[3], tileY + rasterTileSize - 1) - tileY;
+
+    const float centerSquare = raster.center[0] * raster.center[0] + raster.center[1] * raster.center[1] +
+                               raster.center[2] * raster.center[2];
+    const float radiusSquare = raster.radius * raster.radius;
+    const float wideRadiusSquare = radiusSquare * 1.002f + centerSquare * 1e-6f;
+
+    const Float8 centerX(raster.center[0]);
+    const Float8 distance(view.distance);
+    const Float8 outside(centerSquare - radiusSquare);
+    const Float8 wideOutside(centerSquare - wideRadiusSquare);
+    const Float8 zero(0.0f);
+
+    for(int y = firstY; y <= lastY; y++)
+    {
+        const float v = view.top - (tileY + y + 0.5f) * view.pixelHeight;
+        const Float8 rowDotCenter(v * raster.center[1] + view.distance * raster.center[2]);
+        const Float8 rowSquare(v * v + view.distance * view.distance);
+
+        for(int x = firstX & ~7; x <= lastX; x += 8)
+        {
+            Float8 u = Float8(view.left) + (Float8((float) (tileX + x)) + Float8::load(laneOffsets)) * Float8(view.pixelWidth);
+
+            Float8 dotCenter = u * centerX + rowDotCenter;
+            Float8 square = u * u + rowSquare;
+            Float8 discriminant = dotCenter * dotCenter - square * outside;
+            Float8 wideDiscriminant = dotCenter * dotCenter - square * wideOutside;
+
+            // 1 / the distance along the gaze of the nearer hit, without
+            // .. subtracting the root from dotCenter
+            Float8 depth = (dotCenter + sqrt(max(discriminant, zero))) / (outside * distance);
+            Float8 stored = Float8::load(depths + y * rasterTileSize + x);
+            Float8 closer = (zero <= wideDiscriminant) & (depth > stored);
+
+            int lanes = closer.mask();
+
+            if(lanes == 0)
+                continue;
+
+            select(closer, depth, stored).store(depths + y * rasterTileSize + x);
+
+            for(int lane = 0; lanes != 0; lane++, lanes >>= 1)
+            {
+                if(lanes & 1)
+                    primitives[y * rasterTileSize + x + lane] = primitive;
+            }
+        }
+    }
+}
+
+// the sphere into the pixels of the tile its ray hits it closer in, by
+// .. the ray test the tracer uses; a hit behind the camera, which the
+// .. tracer takes as the closest, is given the largest 1 / depth
+static void rasterizeSphere(const Camera & camera, const RasterView & view, const Sphere & sphere, const RasterSphere & raster,
+                            int primitive, int tileX, int tileY, float * depths, int * primitives)
+{
+    for(int y = std::max(raster.bounds[1], tileY); y <= std::min(raster.bounds[3], tileY + rasterTileSize - 1); y++)
+    {
+        for(int x = std::max(raster.bounds[0], tileX); x <= std::min(raster.bounds[2], tileX + rasterTileSize - 1); x++)
+        {
+            Ray ray = camera.getRay(x, y);
+            HitRecord hitRecord;
+
+            if(!sphere.hit(ray, hitRecord) || hitRecord.t <= -1.0f)
+                continue;
+
+            float along = hitRecord.t * (ray.getDirection() ^ view.gaze);
+            float depth = along > 0.0f ? 1.0f / along : std::numeric_limits<float>::max();
+            int local = (y - tileY) * rasterTileSize + x - tileX;
+
+            if(depth > depths[local])
+            {
+                depths[local] = depth;
+                primitives[local] = primitive;
+            }
+        }
+    }
+}
+
+void Scene::rasterizeVisibility(Camera & camera, VisibilityBuffer & buffer, ThreadPool & pool)
+{
+    RasterView view;
+
+    // the basis Camera::getRay builds the rays from
+    Vector3 gaze = camera.gaze;
+    Vector3 vecV = camera.up;
+    vecV.normalize();
+
+    Vector3 vecW = -gaze;
+    gaze.normalize();
+    vecW.normalize();
+
+    Vector3 vecU = vecV * vecW;
+    vecU.normalize();
+
+    vecV = vecW * vecU;
+
+    view.position = camera.position;
+    view.u = vecU;
+    view.v = vecV;
+    view.gaze = gaze;
+    view.left = camera.near_plane.x;
+    view.top = camera.near_plane.w;
+    view.distance = camera.near_distance;
+    view.pixelWidth = (camera.near_plane.y - camera.near_plane.x) / camera.getImageW();
+    view.pixelHeight = (camera.near_plane.w - camera.near_plane.z) / camera.getImageH();
+    view.nearest = camera.near_distance * 1e-3f;
+    view.width = camera.getImageW();
+    view.height = camera.getImageH();
+
+    const int tileColumns = (view.width + rasterTileSize - 1) / rasterTileSize;
+    const int tileCount = tileColumns * ((view.height + rasterTileSize - 1) / rasterTileSize);
+    const int triangleCount = this->surfaces.triangles.size();
+    const int chunkCount = (triangleCount + rasterChunkSize - 1) / rasterChunkSize;
+
+    // set up and binned by chunks of triangles, each chunk into bins of its
+    // .. own, so the tiles take the triangles in the order of the scene
+    std::vector< std::vector<RasterTriangle> > chunkTriangles(chunkCount);
+    std::vector< std::vector< std::vector<int> > > chunkBins(chunkCount, std::vector< std::vector<int> >(tileCount));
+
+    parallelFor(pool, 0, chunkCount, 1, [&](int begin, int end) {
+        for(int chunk = begin; chunk < end; chunk++)
+        {
+            std::vector<RasterTriangle> & rasters = chunkTriangles[chunk];
+            std::vector< std::vector<int> > & bins = chunkBins[chunk];
+            int last = std::min(triangleCount, (chunk + 1) * rasterChunkSize);
+
+            for(int t = chunk * rasterChunkSize; t < last; t++)
+            {
+                const Triangle & triangle = this->surfaces.triangles[t];
+
+                // the side Triangle::hit ignores faces away from every ray of the camera
+                if((triangle.getNormal() ^ (triangle.getVertex(0) - view.position)) > 0)
+                    continue;
+
+                RasterTriangle clipped[2];
+                int count = clipTriangle(view, triangle, t, clipped);
+
+                for(int i = 0; i < count; i++)
+                {
+                    const int * bounds = clipped[i].bounds;
+
+                    for(int tileY = bounds[1] / rasterTileSize; tileY <= bounds[3] / rasterTileSize; tileY++)
+                    {
+                        for(int tileX = bounds[0] / rasterTileSize; tileX <= bounds[2] / rasterTileSize; tileX++)
+                            bins[tileY * tileColumns + tileX].push_back(rasters.size());
+                    }
+
+                    rasters.push_back(clipped[i]);
+                }
+            }
+        }
+    });
+
+    // the spheres in front by the screen bounds of a box around them in
+    // .. view space; a sphere reaching behind the nearest distance is tested
+    // .. by every pixel, unless it is behind the camera where no ray can hit
+    // .. it (the tracer takes hits up to 1 behind the origin of a ray)
+    std::vector<RasterSphere> spheres;
+    std::vector< std::vector<int> > sphereBins(tileCount);
+
+    for(size_t s = 0; s < this->surfaces.spheres.size(); s++)
+    {
+        const Sphere & sphere = this->surfaces.spheres[s];
+        RasterVertex center = toView(view, sphere.getCenter());
+        RasterSphere raster = { { 0, 0, view.width - 1, view.height - 1 }, (int) s, center.z - sphere.getRadius() >= view.nearest,
+                                { (float) center.x, (float) center.y, (float) center.z }, sphere.getRadius() };
+
+        double centerDistance = std::sqrt(center.x * center.x + center.y * center.y + center.z * center.z);
+
+        if(center.z + sphere.getRadius() < view.nearest && centerDistance - sphere.getRadius() >= 1.0)
+            continue;
+
+        if(raster.inFront)
+        {
+            double minX = std::numeric_limits<double>::infinity(), minY = minX;
+            double maxX = -minX, maxY = -minX;
+
+            for(int corner = 0; corner < 8; corner++)
+            {
+                RasterVertex vertex = { center.x + (corner & 1 ? 1 : -1) * sphere.getRadius(),
+                                        center.y + (corner & 2 ? 1 : -1) * sphere.getRadius(),
+                                        center.z + (corner & 4 ? 1 : -1) * sphere.getRadius() };
+                double x, y;
+
+                toPixels(view, vertex, x, y);
+
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+            }
+
+            // a pixel more, for the widened radius
+            getPixelBounds(view, minX - 1.0, minY - 1.0, maxX + 1.0, maxY + 1.0, raster.bounds);
+        }
+
+        if(raster.bounds[0] > raster.bounds[2] || raster.bounds[1] > raster.bounds[3])
+            continue;
+
+        for(int tileY = raster.bounds[1] / rasterTileSize; tileY <= raster.bounds[3] / rasterTileSize; tileY++)
+        {
+            for(int tileX = raster.bounds[0] / rasterTileSize; tileX <= raster.bounds[2] / rasterTileSize; tileX++)
+                sphereBins[tileY * tileColumns + tileX].push_back(spheres.size());
+        }
+
+        spheres.push_back(raster);
+    }
+
+    parallelFor(pool, 0, tileCount, 1, [&](int begin, int end) {
+        std::vector<float> depths(rasterTileSize * rasterTileSize + 8);
+        std::vector<int> primitives(rasterTileSize * rasterTileSize);
+
+        // Float8::load wants 32 bytes alignment
+        float * alignedDepths = (float *) (((size_t) depths.data() + 31) & ~(size_t) 31);
+
+        for(int tile = begin; tile < end; tile++)
+        {
+            const int tileX = (tile % tileColumns) * rasterTileSize;
+            const int tileY = (tile / tileColumns) * rasterTileSize;
+
+            std::fill(alignedDepths, alignedDepths + rasterTileSize * rasterTileSize, 0.0f);
+            std::fill(primitives.begin(), primitives.end(), -1);
+
+            for(int chunk = 0; chunk < chunkCount; chunk++)
+            {
+                const std::vector<int> & bin = chunkBins[chunk][tile];
+
+                for(size_t i = 0; i < bin.size(); i++)
+                    rasterizeTile(chunkTriangles[chunk][bin[i]], tileX, tileY, rasterTileSize, alignedDepths, primitives.data());
+            }
+
+            for(size_t i = 0; i < sphereBins[tile].size(); i++)
+            {
+                const RasterSphere & raster = spheres[sphereBins[tile][i]];
+
+                if(raster.inFront)
+                    rasterizeSphereInFront(view, raster, triangleCount + raster.sphere, tileX, tileY, alignedDepths, primitives.data());
+                else
+                    rasterizeSphere(camera, view, this->surfaces.spheres[raster.sphere], raster, triangleCount + raster.sphere,
+                                    tileX, tileY, alignedDepths, primitives.data());
+            }
+
+            for(int y = tileY; y < std::min(tileY + rasterTileSize, view.height); y++)
+            {
+                for(int x = tileX; x < std::min(tileX + rasterTileSize, view.width); x++)
+                {
+                    int local = (y - tileY) * rasterTileSize + x - tileX;
+
+                    if(primitives[local] >= 0)
+                        buffer.set(x, y, primitives[local], 1.0f / alignedDepths[local]);
+                }
+            }
+        }
+    });
+}
+
+int Scene::renderRasterized(Camera & camera, Image & image, ThreadPool & pool)
+{
+    VisibilityBuffer buffer(camera.getImageW(), camera.getImageH(), this->surfaces.triangles.size());
+    this->rasterizeVisibility(camera, buffer, pool);
+
+    std::atomic<int> traced(0);
+
+    parallelFor(pool, 0, buffer.getHeight(), 8, [&](int begin, int end) {
+        int rowsTraced = 0;
+
+        for(int y = begin; y < end; y++)
+        {
+            for(int x = 0; x < buffer.getWidth(); x++)
+            {
+                Ray ray = camera.getRay(x, y);
+                HitRecord hitRecord;
+
+                if(!buffer.getSurface(x, y, hitRecord.surface))
+                {
+                    image.setColor(x, y, this->backgroundColor);
+                    continue;
+                }
+
+                // the ray test the tracer would have found it with; a
+                // .. triangle the ray misses was rasterized over an edge
+                bool hit = hitRecord.surface.type == triangle_surface ?
+                           this->surfaces.triangles[hitRecord.surface.index].hit(ray, hitRecord) :
+                           this->surfaces.spheres[hitRecord.surface.index].hit(ray, hitRecord);
+
+                if(!hit)
+                {
+                    image.setColor(x, y, this->getRayColor(ray, this->maxRecursionDepth, false));
+                    rowsTraced++;
+                    continue;
+                }
+
+                HitInfo hitInfo;
+                this->surfaces.fillHitInfo(ray, hitRecord, hitInfo);
+
+                image.setColor(x, y, this->getHitColor(ray, hitInfo, this->surfaces.get(hitInfo.surface).getMaterial(),
+                                                       this->maxRecursionDepth));
+            }
+        }
+
+        traced += rowsTraced;
+    });
+
+    return traced;
+}
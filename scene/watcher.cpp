@@ -0,0 +1,386 @@
+#include "../watcher.hpp"
+#include "../dependencies.hpp"
+#include "../hash.hpp"
+#include "../filemanip/tinyxml2.h"
+#include "../image/image.hpp"
+#include "../jpeg.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+// what reload reads into the loaded scene, everything else loads the file again
+static const char * const readableSections[6] = {
+    "BackgroundColor", "ShadowRayEpsilon", "MaxRecursionDepth", "Cameras", "Lights", "Materials"
+};
+
+// the file with its directory resolved, as inotify names it
+static std::string getAbsolutePath(const std::string & file)
+{
+    size_t slash = file.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : file.substr(0, max(slash, (size_t) 1));
+    char resolved[PATH_MAX];
+
+    if(realpath(directory.c_str(), resolved) == NULL)
+        return file;
+
+    return std::string(resolved) + "/" + file.substr(slash + 1);
+}
+
+static std::string getDirectory(const std::string & absolutePath)
+{
+    return absolutePath.substr(0, max(absolutePath.rfind('/'), (size_t) 1));
+}
+
+// the hash of the text of each top level element, elements of the same name together
+static void getSections(const tinyxml2::XMLNode * root, std::map<std::string, unsigned long long> & sections)
+{
+    sections.clear();
+
+    for(const tinyxml2::XMLElement * element = root->FirstChildElement(); element != NULL; element = element->NextSiblingElement())
+    {
+        tinyxml2::XMLPrinter printer;
+        element->Accept(&printer);
+
+        std::map<std::string, unsigned long long>::iterator section = sections.insert(std::make_pair(element->Name(), hashBasis)).first;
+        section->second = hashValues(section->second, printer.CStr(), printer.CStrSize());
+    }
+}
+
+static double getSeconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+SceneWatcher::SceneWatcher(const std::string & path, const Scene & settings)
+    : path(path), settings(settings), pool(settings.threadCount), inotify(-1)
+{
+}
+
+SceneWatcher::~SceneWatcher()
+{
+    if(this->inotify >= 0)
+        close(this->inotify);
+}
+
+bool SceneWatcher::load()
+{
+    std::unique_ptr<Scene> loaded(new Scene());
+    loaded->copyLoadOptions(this->settings);
+
+    tinyxml2::XMLDocument document;
+
+    try
+    {
+        loaded->load(this->path);
+
+        if(document.LoadFile(this->path.c_str()) || document.FirstChild() == NULL)
+            throw std::runtime_error("Error: The xml file cannot be loaded.");
+    }
+    catch(const std::exception & exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return false;
+    }
+
+    getSections(document.FirstChild(), this->sections);
+    this->scene.swap(loaded);
+
+    return true;
+}
+
+bool SceneWatcher::reload()
+{
+    tinyxml2::XMLDocument document;
+
+    // saved half way, the next save is waited for
+    if(document.LoadFile(this->path.c_str()) || document.FirstChild() == NULL)
+    {
+        std::cerr << "Error: " << this->path << " cannot be read, waiting for the next save" << std::endl;
+        return false;
+    }
+
+    const tinyxml2::XMLNode * root = document.FirstChild();
+    std::map<std::string, unsigned long long> sections;
+    getSections(root, sections);
+
+    std::set<std::string> changed;
+
+    for(std::map<std::string, unsigned long long>::iterator section = sections.begin(); section != sections.end(); ++section)
+    {
+        std::map<std::string, unsigned long long>::const_iterator loaded = this->sections.find(section->first);
+
+        if(loaded == this->sections.end() || loaded->second != section->second)
+            changed.insert(section->first);
+    }
+
+    for(std::map<std::string, unsigned long long>::iterator section = this->sections.begin(); section != this->sections.end(); ++section)
+    {
+        if(sections.count(section->first) == 0)
+            changed.insert(section->first);
+    }
+
+    if(changed.empty())
+        return false;
+
+    bool readable = true;
+
+    for(std::set<std::string>::iterator section = changed.begin(); section != changed.end(); ++section)
+        readable = readable && std::find(readableSections, readableSections + 6, *section) != readableSections + 6;
+
+    // the surfaces point into the materials, they are overwritten in place
+    Scene parsed;
+
+    if(readable && changed.count("Materials"))
+    {
+        parsed.loadMaterials(root);
+        readable = parsed.materials.size() == this->scene->materials.size();
+    }
+
+    if(!readable)
+    {
+        if(!this->load())
+            return false;
+
+        std::cout << this->path << ": loaded again" << std::endl;
+        this->watchDirectories();
+
+        return true;
+    }
+
+    std::cout << this->path << ": read";
+
+    if(changed.count("BackgroundColor") || changed.count("ShadowRayEpsilon") || changed.count("MaxRecursionDepth"))
+        this->scene->loadSettings(root);
+
+    if(changed.count("Cameras"))
+    {
+        this->scene->cameras.clear();
+        this->scene->loadCameras(root);
+    }
+
+    if(changed.count("Lights"))
+    {
+        this->scene->pointLights.clear();
+        this->scene->loadLights(root);
+    }
+
+    if(changed.count("Materials"))
+        std::copy(parsed.materials.begin(), parsed.materials.end(), this->scene->materials.begin());
+
+    for(std::set<std::string>::iterator section = changed.begin(); section != changed.end(); ++section)
+        std::cout << " " << *section;
+
+    std::cout << " again" << std::endl;
+
+    this->sections.swap(sections);
+
+    return true;
+}
+
+bool SceneWatcher::reloadTexture(const std::string & file)
+{
+    bool found = false;
+
+    for(size_t i = 0; i < this->scene->textureNames.size(); i++)
+    {
+        if(getAbsolutePath(this->scene->textureNames[i]) != file)
+            continue;
+
+        Texture & texture = *this->scene->textures[i];
+        int width, height;
+
+        // the old image stays in the arena when the size changed, until the scene is released
+        try
+        {
+            read_jpeg_header(file.c_str(), width, height);
+
+            unsigned char * image = width == texture.width && height == texture.height ? texture.image.get() :
+                                    this->scene->arena.createArray<unsigned char>(width * height * 3);
+
+            read_jpeg(file.c_str(), image, width, height);
+
+            texture.image = image;
+            texture.width = width;
+            texture.height = height;
+            found = true;
+        }
+        catch(const std::exception & exception)
+        {
+            std::cerr << exception.what() << std::endl;
+        }
+    }
+
+    if(found)
+        std::cout << file << ": decoded again" << std::endl;
+
+    return found;
+}
+
+void SceneWatcher::watchDirectories()
+{
+    std::set<std::string> watched;
+
+    watched.insert(getDirectory(getAbsolutePath(this->path)));
+
+    for(size_t i = 0; i < this->scene->textureNames.size(); i++)
+        watched.insert(getDirectory(getAbsolutePath(this->scene->textureNames[i])));
+
+    // the directories, since editors save by writing another file and renaming it
+    for(std::set<std::string>::iterator directory = watched.begin(); directory != watched.end(); ++directory)
+    {
+        int descriptor = inotify_add_watch(this->inotify, directory->c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+        if(descriptor < 0)
+            throw std::runtime_error("Error: " + *directory + " cannot be watched.");
+
+        this->directories[descriptor] = *directory;
+    }
+}
+
+std::set<std::string> SceneWatcher::waitForChanges()
+{
+    std::set<std::string> changed;
+    alignas(struct inotify_event) char buffer[4096];
+    int timeout = -1;
+
+    while(true)
+    {
+        struct pollfd descriptor = { this->inotify, POLLIN, 0 };
+        int ready = poll(&descriptor, 1, timeout);
+
+        if(ready < 0 && errno == EINTR)
+            continue;
+
+        if(ready < 0)
+            throw std::runtime_error("Error: The scene cannot be watched anymore.");
+
+        // nothing more was saved for a while
+        if(ready == 0)
+            break;
+
+        ssize_t length = read(this->inotify, buffer, sizeof(buffer));
+
+        for(ssize_t offset = 0; offset < length; )
+        {
+            const struct inotify_event * event = (const struct inotify_event *) (buffer + offset);
+            std::map<int, std::string>::const_iterator directory = this->directories.find(event->wd);
+
+            if(directory != this->directories.end() && event->len > 0)
+                changed.insert(directory->second + "/" + event->name);
+
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+
+        // a save is often several writes and a rename
+        timeout = 50;
+    }
+
+    return changed;
+}
+
+void SceneWatcher::render(std::chrono::steady_clock::time_point since)
+{
+    Scene & scene = *this->scene;
+
+    SceneSnapshot snapshot;
+    scene.getSnapshot(snapshot);
+
+    for(size_t i = 0; i < scene.cameras.size(); i++)
+    {
+        Camera & camera = scene.cameras[i];
+        Image image(camera.getImageW(), camera.getImageH());
+
+        // one ray for each 4 x 4 pixels of the tiles, the kept pixels around them
+        scene.renderIncremental(camera, image, this->pool, snapshot, [&](const std::vector<ImageTile> & tiles) {
+            parallelFor(this->pool, 0, tiles.size(), 1, [&](int begin, int end) {
+                for(int t = begin; t < end; t++)
+                {
+                    const ImageTile & tile = tiles[t];
+
+                    for(int y = tile.y; y < tile.y + tile.height; y += 4)
+                    {
+                        for(int x = tile.x; x < tile.x + tile.width; x += 4)
+                        {
+                            Ray ray = camera.getRay(x, y);
+                            Color color = scene.getRayColor(ray, scene.maxRecursionDepth, false);
+
+                            for(int blockY = y; blockY < min(y + 4, tile.y + tile.height); blockY++)
+                            {
+                                for(int blockX = x; blockX < min(x + 4, tile.x + tile.width); blockX++)
+                                    image.setColor(blockX, blockY, color);
+                            }
+                        }
+                    }
+                }
+            });
+
+            image.write(camera.getImageName());
+
+            std::cout << camera.getImageName() << ": preview after " << std::fixed << std::setprecision(3)
+                      << getSeconds(since) << " s" << std::endl;
+        });
+
+        image.write(camera.getImageName());
+
+        std::cout << camera.getImageName() << ": rendered after " << std::fixed << std::setprecision(3)
+                  << getSeconds(since) << " s" << std::endl;
+    }
+}
+
+void SceneWatcher::run()
+{
+    if(CompiledScene::isCompiledScene(this->path))
+        throw std::runtime_error("Error: --watch needs the scene file, not a compiled scene.");
+
+    if(!this->load())
+        throw std::runtime_error("Error: The scene " + this->path + " cannot be loaded.");
+
+    this->inotify = inotify_init1(IN_CLOEXEC);
+
+    if(this->inotify < 0)
+        throw std::runtime_error("Error: inotify is not available.");
+
+    this->watchDirectories();
+    this->render(std::chrono::steady_clock::now());
+
+    const std::string scenePath = getAbsolutePath(this->path);
+
+    while(true)
+    {
+        // the images written by the render are among the files saved too
+        std::set<std::string> changed = this->waitForChanges();
+        std::chrono::steady_clock::time_point noticed = std::chrono::steady_clock::now();
+        bool reloaded = false;
+
+        if(changed.count(scenePath))
+        {
+            changed.erase(scenePath);
+            reloaded = this->reload();
+        }
+
+        // the texture images are not part of <image>.deps, the images are rendered in full
+        bool texturesChanged = false;
+
+        for(std::set<std::string>::iterator file = changed.begin(); file != changed.end(); ++file)
+            texturesChanged = this->reloadTexture(*file) || texturesChanged;
+
+        if(texturesChanged)
+        {
+            for(size_t i = 0; i < this->scene->cameras.size(); i++)
+                unlink((this->scene->cameras[i].getImageName() + ".deps").c_str());
+        }
+
+        if(reloaded || texturesChanged)
+            this->render(noticed);
+    }
+}
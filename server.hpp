@@ -0,0 +1,103 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "scene.hpp"
+#include "threadpool.hpp"
+#include "image/image.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// raytracer --serve <socket> keeps scenes loaded between renders and takes
+// .. commands over a Unix domain socket, one per line:
+//
+//   load <scene file>          ok <scene>     xml or compiled, a loaded path gives its handle again
+//   unload <scene>             ok             queued jobs still finish
+//   render <scene> [key=value ...]
+//                              ok <job>       then, on the same connection:
+//     tile <job> <x> <y> <width> <height>     and width * height * 3 bytes of RGB, top row first
+//     done <job> <seconds>  or  failed <job> <message>
+//   cameras <scene>            ok <count>
+//   camera <scene> <n>         ok <width> <height> <image name>
+//   status                     ok <scenes> scenes <jobs> queued
+//   shutdown                   ok             stops after the job that is rendering
+//
+// render keys, all optional:
+//   camera=<n>                 1 based index into the scene's cameras (default 1)
+//   position=, gaze=, up=<x,y,z>   override the camera's view
+//   width=, height=<n>         override the resolution, the near plane stays
+//   region=<x,y,width,height>  pixels to render (default the whole image)
+//   tile=<n>                   tile size (default 32)
+//   priority=<n>               higher runs first, equal ones in order (default 0)
+//   output=<file.ppm>          also write the region to a file on the server side
+//
+// anything malformed is answered with "error <message>"
+
+class ServerConnection;
+
+typedef struct RenderJob
+{
+    int id;
+    int priority;
+    long long sequence;     // submission order among equal priorities
+    std::shared_ptr<Scene> scene;
+    std::shared_ptr<ServerConnection> connection;
+    Camera camera;          // the scene's camera with the overrides applied
+    ImageTile region;
+    int tileSize;
+    std::string output;
+} RenderJob;
+
+// orders the job queue, highest priority and then oldest on top
+struct RenderJobOrder
+{
+    bool operator()(const std::shared_ptr<RenderJob> & a, const std::shared_ptr<RenderJob> & b) const
+    {
+        if(a->priority != b->priority)
+            return a->priority < b->priority;
+
+        return a->sequence > b->sequence;
+    }
+};
+
+class RenderServer
+{
+    private:
+        const Scene & settings;     // accelerator choice, build options and threads for every scene
+        ThreadPool pool;            // renders one job at a time with every thread
+        int listener;
+        std::atomic<bool> stopping;
+
+        // guards everything below
+        std::mutex mutex;
+        std::condition_variable jobQueued;
+        std::map<int, std::shared_ptr<Scene> > scenes;
+        std::map<std::string, int> scenePaths;
+        std::priority_queue<std::shared_ptr<RenderJob>, std::vector<std::shared_ptr<RenderJob> >, RenderJobOrder> jobs;
+        std::vector<std::shared_ptr<ServerConnection> > connections;
+        int nextScene;
+        int nextJob;
+        long long nextSequence;
+
+        void serveConnection(std::shared_ptr<ServerConnection> connection);
+        void handleCommand(const std::string & line, const std::shared_ptr<ServerConnection> & connection);
+        void loadScene(const std::string & path, ServerConnection & connection);
+        void queueJob(std::istringstream & arguments, const std::shared_ptr<ServerConnection> & connection);
+        void dispatchJobs();
+        void runJob(RenderJob & job);
+
+    public:
+        RenderServer(const Scene & settings);
+
+        // serves until a shutdown command, throws if the socket cannot be opened
+        void run(const std::string & socketPath);
+};
+
+#endif
@@ -0,0 +1,402 @@
+#include "../coordinator.hpp"
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // a region job that was sent to a worker, job is -1 until it is acknowledged
+    typedef struct SentTile
+    {
+        ImageTile tile;
+        int job;
+    } SentTile;
+
+    std::string getExecutablePath()
+    {
+        char path[PATH_MAX];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+        if(length <= 0)
+            throw std::runtime_error("Error: The raytracer executable cannot be found.");
+
+        return std::string(path, length);
+    }
+}
+
+TileCoordinator::TileCoordinator(int tileSize)
+    : tileSize(tileSize), jobsPerWorker(2), remainingTiles(0), liveWorkers(0), reassignedTiles(0)
+{
+}
+
+TileCoordinator::~TileCoordinator()
+{
+    for(size_t i = 0; i < this->workers.size(); i++)
+    {
+        CoordinatorWorker & worker = *this->workers[i];
+
+        if(worker.process < 0)
+        {
+            this->dropWorker(worker);
+            continue;
+        }
+
+        // a worker that cannot be asked to stop is not waited for
+        if(worker.socket < 0 || this->request(worker, "shutdown").empty())
+            kill(worker.process, SIGTERM);
+
+        this->dropWorker(worker);
+
+        waitpid(worker.process, NULL, 0);
+        unlink(worker.socketPath.c_str());
+    }
+}
+
+void TileCoordinator::spawnWorkers(int count, const std::vector<std::string> & options)
+{
+    std::string executable = getExecutablePath();
+
+    for(int i = 0; i < count; i++)
+    {
+        std::unique_ptr<CoordinatorWorker> worker(new CoordinatorWorker());
+        worker->socketPath = "/tmp/raytracer-" + std::to_string(getpid()) + "-" + std::to_string(i) + ".sock";
+
+        std::vector<std::string> arguments;
+        arguments.push_back(executable);
+        arguments.push_back("--serve");
+        arguments.push_back(worker->socketPath);
+        arguments.insert(arguments.end(), options.begin(), options.end());
+
+        std::vector<char *> argv;
+        for(size_t a = 0; a < arguments.size(); a++)
+            argv.push_back(&arguments[a][0]);
+        argv.push_back(NULL);
+
+        worker->process = fork();
+
+        if(worker->process < 0)
+            throw std::runtime_error("Error: A worker process cannot be started.");
+
+        if(worker->process == 0)
+        {
+            // the server's "listening at" would interleave with ours
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+
+            execv(executable.c_str(), argv.data());
+            _exit(127);
+        }
+
+        this->workers.push_back(std::move(worker));
+    }
+}
+
+void TileCoordinator::addWorker(const std::string & socketPath)
+{
+    std::unique_ptr<CoordinatorWorker> worker(new CoordinatorWorker());
+    worker->socketPath = socketPath;
+
+    this->workers.push_back(std::move(worker));
+}
+
+void TileCoordinator::connectWorker(CoordinatorWorker & worker)
+{
+    // a spawned server needs a moment before it listens
+    for(int attempt = 0; worker.socket < 0; attempt++)
+    {
+        try
+        {
+            worker.socket = connectUnixSocket(worker.socketPath);
+        }
+        catch(const std::runtime_error & error)
+        {
+            if(worker.process < 0 || attempt == 100 || waitpid(worker.process, NULL, WNOHANG) != 0)
+            {
+                std::cerr << "worker " << worker.socketPath << " lost: " << error.what() << std::endl;
+                return;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    worker.reader.reset(new SocketReader(worker.socket));
+}
+
+std::string TileCoordinator::request(CoordinatorWorker & worker, const std::string & command)
+{
+    std::string line = command + "\n";
+
+    if(!sendAll(worker.socket, line.data(), line.size()) || !worker.reader->readLine(line))
+        line = "error Error: The connection is lost.";
+
+    if(line.compare(0, 2, "ok") == 0)
+        return line;
+
+    std::cerr << "worker " << worker.socketPath << " lost: " << line << std::endl;
+    this->dropWorker(worker);
+
+    return std::string();
+}
+
+void TileCoordinator::dropWorker(CoordinatorWorker & worker)
+{
+    if(worker.socket >= 0)
+        close(worker.socket);
+
+    worker.socket = -1;
+    worker.reader.reset();
+}
+
+void TileCoordinator::render(const std::string & scenePath)
+{
+    char absolutePath[PATH_MAX];
+
+    if(realpath(scenePath.c_str(), absolutePath) == NULL)
+        throw std::runtime_error("Error: The xml file cannot be loaded.");
+
+    for(size_t i = 0; i < this->workers.size(); i++)
+        this->connectWorker(*this->workers[i]);
+
+    // every worker loads at the same time
+    std::string load = std::string("load ") + absolutePath + "\n";
+
+    for(size_t i = 0; i < this->workers.size(); i++)
+    {
+        CoordinatorWorker & worker = *this->workers[i];
+
+        if(worker.socket >= 0 && !sendAll(worker.socket, load.data(), load.size()))
+            this->dropWorker(worker);
+    }
+
+    CoordinatorWorker * first = NULL;
+
+    for(size_t i = 0; i < this->workers.size(); i++)
+    {
+        CoordinatorWorker & worker = *this->workers[i];
+        std::string line;
+
+        if(worker.socket < 0)
+            continue;
+
+        if(!worker.reader->readLine(line) || sscanf(line.c_str(), "ok %d", &worker.scene) != 1)
+        {
+            std::cerr << "worker " << worker.socketPath << " lost: " << line << std::endl;
+            this->dropWorker(worker);
+            continue;
+        }
+
+        first = first != NULL ? first : &worker;
+    }
+
+    if(first == NULL)
+        throw std::runtime_error("Error: No worker could load the scene.");
+
+    int cameraCount;
+    std::string reply = this->request(*first, "cameras " + std::to_string(first->scene));
+
+    if(sscanf(reply.c_str(), "ok %d", &cameraCount) != 1)
+        throw std::runtime_error("Error: The cameras of the scene cannot be listed.");
+
+    for(int camera = 1; camera <= cameraCount; camera++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // from any worker that is still there
+        int width = 0, height = 0, nameStart = 0;
+
+        for(size_t i = 0; i < this->workers.size() && width == 0; i++)
+        {
+            if(this->workers[i]->socket >= 0)
+            {
+                reply = this->request(*this->workers[i], "camera " + std::to_string(this->workers[i]->scene) + " " + std::to_string(camera));
+                sscanf(reply.c_str(), "ok %d %d %n", &width, &height, &nameStart);
+            }
+        }
+
+        if(width == 0)
+            throw std::runtime_error("Error: Every worker was lost.");
+
+        Image image(width, height);
+
+        this->pendingTiles.clear();
+        this->liveWorkers = 0;
+        this->reassignedTiles = 0;
+
+        for(int y = 0; y < height; y += this->tileSize)
+        {
+            for(int x = 0; x < width; x += this->tileSize)
+            {
+                ImageTile tile;
+                tile.x = x;
+                tile.y = y;
+                tile.width = min(this->tileSize, width - x);
+                tile.height = min(this->tileSize, height - y);
+
+                this->pendingTiles.push_back(tile);
+            }
+        }
+
+        int tileCount = this->pendingTiles.size();
+        this->remainingTiles = tileCount;
+
+        std::vector<std::thread> threads;
+
+        for(size_t i = 0; i < this->workers.size(); i++)
+        {
+            if(this->workers[i]->socket >= 0)
+            {
+                this->liveWorkers++;
+                threads.push_back(std::thread(&TileCoordinator::renderTiles, this, std::ref(*this->workers[i]), camera, std::ref(image)));
+            }
+        }
+
+        for(size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+
+        if(this->remainingTiles > 0)
+            throw std::runtime_error("Error: Every worker was lost.");
+
+        image.write(reply.substr(nameStart));
+
+        std::cout << reply.substr(nameStart) << ": " << tileCount << " tiles, " << this->liveWorkers << " worker(s) left, " << this->reassignedTiles << " reassigned, "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    }
+}
+
+void TileCoordinator::renderTiles(CoordinatorWorker & worker, int camera, Image & image)
+{
+    std::deque<SentTile> sent;
+    std::vector<unsigned char> pixels;
+    std::string line;
+    bool lost = false;
+
+    while(!lost)
+    {
+        std::string commands;
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+
+            while((int) sent.size() < this->jobsPerWorker && !this->pendingTiles.empty())
+            {
+                SentTile next = { this->pendingTiles.front(), -1 };
+                this->pendingTiles.pop_front();
+
+                commands += "render " + std::to_string(worker.scene) + " camera=" + std::to_string(camera) + " region=" +
+                            std::to_string(next.tile.x) + "," + std::to_string(next.tile.y) + "," +
+                            std::to_string(next.tile.width) + "," + std::to_string(next.tile.height) +
+                            " tile=" + std::to_string(this->tileSize) + "\n";
+
+                sent.push_back(next);
+            }
+
+            if(sent.empty())
+            {
+                if(this->remainingTiles == 0)
+                    return;
+
+                // a lost worker may hand its tiles back
+                this->tilesChanged.wait(lock);
+                continue;
+            }
+        }
+
+        if(!commands.empty() && !sendAll(worker.socket, commands.data(), commands.size()))
+        {
+            lost = true;
+            break;
+        }
+
+        if(!worker.reader->readLine(line))
+        {
+            lost = true;
+            break;
+        }
+
+        std::istringstream reply(line);
+        std::string kind;
+        int job;
+
+        reply >> kind >> job;
+
+        if(kind == "ok")
+        {
+            // acknowledgements come in the order the jobs were sent
+            for(size_t i = 0; i < sent.size(); i++)
+            {
+                if(sent[i].job < 0)
+                {
+                    sent[i].job = job;
+                    break;
+                }
+            }
+        }
+        else if(kind == "tile")
+        {
+            ImageTile tile;
+            reply >> tile.x >> tile.y >> tile.width >> tile.height;
+
+            pixels.resize(tile.width * tile.height * 3);
+
+            if(!worker.reader->read(pixels.data(), pixels.size()))
+            {
+                lost = true;
+                break;
+            }
+
+            // tiles never overlap, the workers write to the image at the same time
+            for(int y = 0, index = 0; y < tile.height; y++)
+            {
+                for(int x = 0; x < tile.width; x++, index += 3)
+                    image.setColor(tile.x + x, tile.y + y, Color(pixels[index], pixels[index + 1], pixels[index + 2]));
+            }
+        }
+        else if(kind == "done")
+        {
+            for(size_t i = 0; i < sent.size(); i++)
+            {
+                if(sent[i].job == job)
+                {
+                    sent.erase(sent.begin() + i);
+                    break;
+                }
+            }
+
+            worker.renderedTiles++;
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            if(--this->remainingTiles == 0)
+                this->tilesChanged.notify_all();
+        }
+        else
+        {
+            std::cerr << "worker " << worker.socketPath << ": " << line << std::endl;
+            lost = true;
+        }
+    }
+
+    std::cerr << "worker " << worker.socketPath << " lost, " << sent.size() << " tile(s) handed to the others" << std::endl;
+
+    this->dropWorker(worker);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for(size_t i = 0; i < sent.size(); i++)
+        this->pendingTiles.push_back(sent[i].tile);
+
+    this->reassignedTiles += sent.size();
+    this->liveWorkers--;
+    this->tilesChanged.notify_all();
+}
@@ -0,0 +1,514 @@
+#include "../server.hpp"
+#include "../socket.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+// a client; replies and tiles for it come from its own thread and from the
+// .. dispatcher, the write mutex keeps their lines and tile data whole
+class ServerConnection
+{
+    private:
+        std::mutex writeMutex;
+        std::atomic<bool> open;
+
+    public:
+        const int socket;
+
+        ServerConnection(int socket) : open(true), socket(socket) {}
+
+        ~ServerConnection()
+        {
+            close(this->socket);
+        }
+
+        bool isOpen() const
+        {
+            return this->open;
+        }
+
+        // a line, then size bytes of data; false once the client is gone
+        bool send(const std::string & line, const void * data = NULL, size_t size = 0)
+        {
+            std::lock_guard<std::mutex> lock(this->writeMutex);
+
+            if(this->open && !(sendAll(this->socket, (line + "\n").data(), line.size() + 1) && sendAll(this->socket, data, size)))
+                this->open = false;
+
+            return this->open;
+        }
+};
+
+namespace
+{
+    bool parseVector(const std::string & text, Vector3 & vector)
+    {
+        float x, y, z;
+        char end;
+
+        if(sscanf(text.c_str(), "%f,%f,%f%c", &x, &y, &z, &end) != 3)
+            return false;
+
+        vector = Vector3(x, y, z);
+
+        return true;
+    }
+
+    bool parseInt(const std::string & text, int & value)
+    {
+        char end;
+
+        return sscanf(text.c_str(), "%d%c", &value, &end) == 1;
+    }
+}
+
+RenderServer::RenderServer(const Scene & settings)
+    : settings(settings), pool(settings.threadCount), listener(-1), stopping(false),
+      nextScene(1), nextJob(1), nextSequence(0)
+{
+}
+
+void RenderServer::run(const std::string & socketPath)
+{
+    this->listener = listenUnixSocket(socketPath);
+
+    std::cout << "listening at " << socketPath << std::endl;
+
+    std::thread dispatcher(&RenderServer::dispatchJobs, this);
+    std::vector<std::thread> threads;
+
+    while(!this->stopping)
+    {
+        int client = accept(this->listener, NULL, NULL);
+
+        if(client < 0)
+        {
+            if(errno == EINTR && !this->stopping)
+                continue;
+
+            break;
+        }
+
+        std::shared_ptr<ServerConnection> connection(new ServerConnection(client));
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->connections.push_back(connection);
+        threads.push_back(std::thread(&RenderServer::serveConnection, this, connection));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->jobQueued.notify_all();
+    dispatcher.join();
+
+    // wakes the connection threads blocked on reads
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        for(size_t i = 0; i < this->connections.size(); i++)
+            ::shutdown(this->connections[i]->socket, SHUT_RDWR);
+    }
+
+    for(size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    close(this->listener);
+    unlink(socketPath.c_str());
+}
+
+void RenderServer::serveConnection(std::shared_ptr<ServerConnection> connection)
+{
+    SocketReader reader(connection->socket);
+    std::string line;
+
+    while(!this->stopping && reader.readLine(line))
+    {
+        try
+        {
+            this->handleCommand(line, connection);
+        }
+        catch(const std::exception & exception)
+        {
+            connection->send(std::string("error ") + exception.what());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for(size_t i = 0; i < this->connections.size(); i++)
+    {
+        if(this->connections[i] == connection)
+        {
+            this->connections.erase(this->connections.begin() + i);
+            break;
+        }
+    }
+}
+
+void RenderServer::handleCommand(const std::string & line, const std::shared_ptr<ServerConnection> & connection)
+{
+    std::istringstream arguments(line);
+    std::string command;
+
+    arguments >> command;
+
+    if(command == "load")
+    {
+        std::string path;
+        std::getline(arguments >> std::ws, path);
+
+        if(path.empty())
+            throw std::runtime_error("Error: load needs a scene file.");
+
+        this->loadScene(path, *connection);
+    }
+    else if(command == "unload")
+    {
+        int handle;
+
+        if(!(arguments >> handle))
+            throw std::runtime_error("Error: unload needs a scene handle.");
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        if(this->scenes.erase(handle) == 0)
+            throw std::runtime_error("Error: There is no scene " + std::to_string(handle) + ".");
+
+        for(std::map<std::string, int>::iterator path = this->scenePaths.begin(); path != this->scenePaths.end(); ++path)
+        {
+            if(path->second == handle)
+            {
+                this->scenePaths.erase(path);
+                break;
+            }
+        }
+
+        connection->send("ok");
+    }
+    else if(command == "cameras" || command == "camera")
+    {
+        int handle, index = 0;
+
+        if(!(arguments >> handle) || (command == "camera" && !(arguments >> index)))
+            throw std::runtime_error("Error: " + command + " needs a scene handle" + (command == "camera" ? " and a camera." : "."));
+
+        std::shared_ptr<Scene> scene;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            std::map<int, std::shared_ptr<Scene> >::iterator loaded = this->scenes.find(handle);
+
+            if(loaded == this->scenes.end())
+                throw std::runtime_error("Error: There is no scene " + std::to_string(handle) + ".");
+
+            scene = loaded->second;
+        }
+
+        if(command == "cameras")
+            connection->send("ok " + std::to_string(scene->cameras.size()));
+        else if(index < 1 || index > (int) scene->cameras.size())
+            throw std::runtime_error("Error: The scene has no camera " + std::to_string(index) + ".");
+        else
+        {
+            const Camera & camera = scene->cameras[index - 1];
+
+            connection->send("ok " + std::to_string(camera.getImageW()) + " " + std::to_string(camera.getImageH()) + " " +
+                             camera.getImageName());
+        }
+    }
+    else if(command == "render")
+        this->queueJob(arguments, connection);
+    else if(command == "status")
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        connection->send("ok " + std::to_string(this->scenes.size()) + " scenes " + std::to_string(this->jobs.size()) + " queued");
+    }
+    else if(command == "shutdown")
+    {
+        connection->send("ok");
+
+        this->stopping = true;
+        this->jobQueued.notify_all();
+
+        // makes the accept in run return
+        ::shutdown(this->listener, SHUT_RDWR);
+    }
+    else if(!command.empty())
+        throw std::runtime_error("Error: Unknown command " + command + ".");
+}
+
+void RenderServer::loadScene(const std::string & path, ServerConnection & connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        std::map<std::string, int>::iterator loaded = this->scenePaths.find(path);
+
+        if(loaded != this->scenePaths.end())
+        {
+            connection.send("ok " + std::to_string(loaded->second));
+            return;
+        }
+    }
+
+    // loaded without the lock, the dispatcher keeps rendering meanwhile
+    std::shared_ptr<Scene> scene(new Scene());
+    scene->copyLoadOptions(this->settings);
+
+    scene->load(path);
+
+    int handle;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        // two clients may have loaded the same file at once, the first one stays
+        std::map<std::string, int>::iterator loaded = this->scenePaths.find(path);
+
+        if(loaded != this->scenePaths.end())
+            handle = loaded->second;
+        else
+        {
+            handle = this->nextScene++;
+            this->scenes[handle] = scene;
+            this->scenePaths[path] = handle;
+        }
+    }
+
+    connection.send("ok " + std::to_string(handle));
+}
+
+void RenderServer::queueJob(std::istringstream & arguments, const std::shared_ptr<ServerConnection> & connection)
+{
+    std::shared_ptr<RenderJob> job(new RenderJob());
+    int handle;
+
+    if(!(arguments >> handle))
+        throw std::runtime_error("Error: render needs a scene handle.");
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        std::map<int, std::shared_ptr<Scene> >::iterator scene = this->scenes.find(handle);
+
+        if(scene == this->scenes.end())
+            throw std::runtime_error("Error: There is no scene " + std::to_string(handle) + ".");
+
+        job->scene = scene->second;
+    }
+
+    // the camera's fields are only known once the camera is picked
+    std::map<std::string, std::string> options;
+    std::string option;
+
+    while(arguments >> option)
+    {
+        size_t equals = option.find('=');
+
+        if(equals == std::string::npos)
+            throw std::runtime_error("Error: Expected key=value instead of " + option + ".");
+
+        options[option.substr(0, equals)] = option.substr(equals + 1);
+    }
+
+    int cameraIndex = 1;
+    int width = 0, height = 0;
+    bool hasRegion = false;
+
+    job->priority = 0;
+    job->tileSize = 32;
+
+    for(std::map<std::string, std::string>::iterator entry = options.begin(); entry != options.end(); ++entry)
+    {
+        const std::string & key = entry->first;
+        const std::string & value = entry->second;
+        bool valid;
+
+        if(key == "camera")
+            valid = parseInt(value, cameraIndex);
+        else if(key == "width")
+            valid = parseInt(value, width) && width > 0;
+        else if(key == "height")
+            valid = parseInt(value, height) && height > 0;
+        else if(key == "tile")
+            valid = parseInt(value, job->tileSize) && job->tileSize > 0;
+        else if(key == "priority")
+            valid = parseInt(value, job->priority);
+        else if(key == "output")
+            valid = !(job->output = value).empty();
+        else if(key == "region")
+        {
+            char end;
+            ImageTile & region = job->region;
+            valid = sscanf(value.c_str(), "%d,%d,%d,%d%c", &region.x, &region.y, &region.width, &region.height, &end) == 4;
+            hasRegion = true;
+        }
+        else if(key == "position" || key == "gaze" || key == "up")
+        {
+            Vector3 vector;
+            valid = parseVector(value, vector);
+        }
+        else
+            throw std::runtime_error("Error: Unknown render option " + key + ".");
+
+        if(!valid)
+            throw std::runtime_error("Error: Invalid value for " + key + ".");
+    }
+
+    if(cameraIndex < 1 || cameraIndex > (int) job->scene->cameras.size())
+        throw std::runtime_error("Error: The scene has no camera " + std::to_string(cameraIndex) + ".");
+
+    job->camera = job->scene->cameras[cameraIndex - 1];
+
+    Camera & camera = job->camera;
+
+    if(options.count("position") || options.count("gaze") || options.count("up"))
+    {
+        Position3 cameraPosition = camera.getPosition();
+        Vector3 position(cameraPosition.getX(), cameraPosition.getY(), cameraPosition.getZ());
+        Vector3 gaze = camera.getGaze();
+        Vector3 up = camera.getUp();
+
+        if(options.count("position"))
+            parseVector(options["position"], position);
+        if(options.count("gaze"))
+            parseVector(options["gaze"], gaze);
+        if(options.count("up"))
+            parseVector(options["up"], up);
+
+        camera.setView(Position3(position.getX(), position.getY(), position.getZ()), gaze, up);
+    }
+
+    if(width > 0 || height > 0)
+    {
+        width = width > 0 ? width : camera.getImageW();
+        height = height > 0 ? height : camera.getImageH();
+
+        // images index their bytes with an int
+        if((long long) width * height * 3 > std::numeric_limits<int>::max())
+            throw std::runtime_error("Error: The resolution " + std::to_string(width) + "x" + std::to_string(height) +
+                                     " is too large.");
+
+        camera.setResolution(width, height);
+    }
+
+    ImageTile & region = job->region;
+
+    if(!hasRegion)
+    {
+        region.x = 0;
+        region.y = 0;
+        region.width = camera.getImageW();
+        region.height = camera.getImageH();
+    }
+
+    if(region.x < 0 || region.y < 0 || region.width < 1 || region.height < 1 ||
+       region.width > camera.getImageW() - region.x || region.height > camera.getImageH() - region.y)
+        throw std::runtime_error("Error: The region is outside of the image.");
+
+    job->connection = connection;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        job->id = this->nextJob++;
+        job->sequence = this->nextSequence++;
+
+        // acknowledged before it is queued, so that no tile comes before the job id
+        connection->send("ok " + std::to_string(job->id));
+
+        this->jobs.push(job);
+    }
+
+    this->jobQueued.notify_one();
+}
+
+void RenderServer::dispatchJobs()
+{
+    while(true)
+    {
+        std::shared_ptr<RenderJob> job;
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+
+            while(!this->stopping && this->jobs.empty())
+                this->jobQueued.wait(lock);
+
+            if(this->stopping)
+                break;
+
+            job = this->jobs.top();
+            this->jobs.pop();
+        }
+
+        // nobody to stream to and nothing to write
+        if(!job->connection->isOpen() && job->output.empty())
+            continue;
+
+        try
+        {
+            this->runJob(*job);
+        }
+        catch(const std::exception & exception)
+        {
+            job->connection->send("failed " + std::to_string(job->id) + " " + exception.what());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for(; !this->jobs.empty(); this->jobs.pop())
+        this->jobs.top()->connection->send("failed " + std::to_string(this->jobs.top()->id) + " Error: The server is shutting down.");
+}
+
+void RenderServer::runJob(RenderJob & job)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    Camera & camera = job.camera;
+    const int imageWidth = camera.getImageW();
+    const std::string jobId = std::to_string(job.id);
+
+    Image image(imageWidth, camera.getImageH());
+    const unsigned char * pixels = image.getImageArray();
+
+    job.scene->renderTiles(camera, job.region, job.tileSize, image, this->pool, [&](const ImageTile & tile) {
+        // once the client went away a job with nothing to write is cancelled
+        if(!job.connection->isOpen())
+            return !job.output.empty();
+
+        std::vector<unsigned char> data(tile.width * tile.height * 3);
+
+        for(int y = 0; y < tile.height; y++)
+            memcpy(&data[y * tile.width * 3], pixels + ((tile.y + y) * imageWidth + tile.x) * 3, tile.width * 3);
+
+        job.connection->send("tile " + jobId + " " + std::to_string(tile.x) + " " + std::to_string(tile.y) + " " +
+                             std::to_string(tile.width) + " " + std::to_string(tile.height), data.data(), data.size());
+
+        return true;
+    });
+
+    if(!job.connection->isOpen() && job.output.empty())
+        return;
+
+    if(!job.output.empty())
+        image.writeRegion(job.output, job.region);
+
+    std::ostringstream seconds;
+    seconds << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    job.connection->send("done " + jobId + " " + seconds.str());
+}
@@ -0,0 +1,135 @@
+#include "../socket.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    sockaddr_un getAddress(const std::string & path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if(path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Error: The socket path is too long.");
+
+        strcpy(address.sun_path, path.c_str());
+
+        return address;
+    }
+}
+
+int listenUnixSocket(const std::string & path)
+{
+    sockaddr_un address = getAddress(path);
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0)
+        throw std::runtime_error("Error: The socket cannot be created.");
+
+    // a server that did not exit cleanly leaves its socket file behind
+    unlink(path.c_str());
+
+    if(bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 16) < 0)
+    {
+        close(listener);
+        throw std::runtime_error("Error: The socket " + path + " cannot be bound.");
+    }
+
+    return listener;
+}
+
+int connectUnixSocket(const std::string & path)
+{
+    sockaddr_un address = getAddress(path);
+
+    int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(connection < 0)
+        throw std::runtime_error("Error: The socket cannot be created.");
+
+    if(connect(connection, (sockaddr *) &address, sizeof(address)) < 0)
+    {
+        close(connection);
+        throw std::runtime_error("Error: No server is listening at " + path + ".");
+    }
+
+    return connection;
+}
+
+bool sendAll(int socket, const void * data, size_t size)
+{
+    const char * bytes = (const char *) data;
+
+    while(size > 0)
+    {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+
+        if(sent < 0 && errno == EINTR)
+            continue;
+
+        if(sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+bool SocketReader::fill()
+{
+    char chunk[4096];
+
+    while(true)
+    {
+        ssize_t received = recv(this->socket, chunk, sizeof(chunk), 0);
+
+        if(received < 0 && errno == EINTR)
+            continue;
+
+        if(received <= 0)
+            return false;
+
+        this->buffer.append(chunk, received);
+
+        return true;
+    }
+}
+
+bool SocketReader::readLine(std::string & line)
+{
+    size_t end;
+
+    while((end = this->buffer.find('\n')) == string::npos)
+    {
+        if(!this->fill())
+            return false;
+    }
+
+    line = this->buffer.substr(0, end);
+    this->buffer.erase(0, end + 1);
+
+    return true;
+}
+
+bool SocketReader::read(void * data, size_t size)
+{
+    while(this->buffer.size() < size)
+    {
+        if(!this->fill())
+            return false;
+    }
+
+    memcpy(data, this->buffer.data(), size);
+    this->buffer.erase(0, size);
+
+    return true;
+}
@@ -0,0 +1,244 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <cmath>
+#include <cstring>
+
+// small header-only SIMD layer for the vector math
+// Float4 is backed by SSE or NEON, Float8 by AVX; both fall back to plain
+// .. float loops when the instruction set is not enabled,
+// .. so the code using them stays the same on every target
+// only exact IEEE operations are used (no fused multiply-add, no reciprocal
+// .. estimates), results are the same as the scalar code they replace
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#define SIMD_FLOAT4_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_FLOAT4_NEON
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_FLOAT8_AVX
+#endif
+
+struct Float4
+{
+#if defined(SIMD_FLOAT4_SSE)
+    __m128 v;
+
+    Float4() {}
+    Float4(__m128 v) : v(v) {}
+    explicit Float4(float s) : v(_mm_set1_ps(s)) {}
+    Float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+    // p must be 16-byte aligned
+    static Float4 load(const float * p) { return Float4(_mm_load_ps(p)); }
+    static Float4 loadUnaligned(const float * p) { return Float4(_mm_loadu_ps(p)); }
+    void store(float * p) const { _mm_store_ps(p, v); }
+
+    // 4 unsigned bytes converted to float
+    static Float4 fromBytes(const unsigned char * p)
+    {
+        int bytes;
+        memcpy(&bytes, p, 4);
+
+        __m128i zero = _mm_setzero_si128();
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+
+        return Float4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)));
+    }
+
+    float operator[](int i) const { float r[4] __attribute__((aligned(16))); _mm_store_ps(r, v); return r[i]; }
+
+    Float4 operator+(const Float4 & rhs) const { return Float4(_mm_add_ps(v, rhs.v)); }
+    Float4 operator-(const Float4 & rhs) const { return Float4(_mm_sub_ps(v, rhs.v)); }
+    Float4 operator*(const Float4 & rhs) const { return Float4(_mm_mul_ps(v, rhs.v)); }
+    Float4 operator/(const Float4 & rhs) const { return Float4(_mm_div_ps(v, rhs.v)); }
+
+    Float4 operator<(const Float4 & rhs) const { return Float4(_mm_cmplt_ps(v, rhs.v)); }
+    Float4 operator<=(const Float4 & rhs) const { return Float4(_mm_cmple_ps(v, rhs.v)); }
+    Float4 operator>(const Float4 & rhs) const { return Float4(_mm_cmpgt_ps(v, rhs.v)); }
+    Float4 operator==(const Float4 & rhs) const { return Float4(_mm_cmpeq_ps(v, rhs.v)); }
+
+    // bit i is set if lane i of a mask is set
+    int mask() const { return _mm_movemask_ps(v); }
+
+    // (y, z, x, w) and (z, x, y, w), used for the cross product
+    Float4 yzx() const { return Float4(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1))); }
+    Float4 zxy() const { return Float4(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2))); }
+
+    friend Float4 min(const Float4 & a, const Float4 & b) { return Float4(_mm_min_ps(a.v, b.v)); }
+    friend Float4 max(const Float4 & a, const Float4 & b) { return Float4(_mm_max_ps(a.v, b.v)); }
+    friend Float4 sqrt(const Float4 & a) { return Float4(_mm_sqrt_ps(a.v)); }
+#elif defined(SIMD_FLOAT4_NEON)
+    float32x4_t v;
+
+    Float4() {}
+    Float4(float32x4_t v) : v(v) {}
+    explicit Float4(float s) : v(vdupq_n_f32(s)) {}
+    Float4(float a, float b, float c, float d) { float r[4] = { a, b, c, d }; v = vld1q_f32(r); }
+
+    static Float4 load(const float * p) { return Float4(vld1q_f32(p)); }
+    static Float4 loadUnaligned(const float * p) { return Float4(vld1q_f32(p)); }
+    void store(float * p) const { vst1q_f32(p, v); }
+
+    static Float4 fromBytes(const unsigned char * p) { return Float4(p[0], p[1], p[2], p[3]); }
+
+    float operator[](int i) const { float r[4]; vst1q_f32(r, v); return r[i]; }
+
+    Float4 operator+(const Float4 & rhs) const { return Float4(vaddq_f32(v, rhs.v)); }
+    Float4 operator-(const Float4 & rhs) const { return Float4(vsubq_f32(v, rhs.v)); }
+    Float4 operator*(const Float4 & rhs) const { return Float4(vmulq_f32(v, rhs.v)); }
+    Float4 operator/(const Float4 & rhs) const { return Float4(vdivq_f32(v, rhs.v)); }
+
+    Float4 operator<(const Float4 & rhs) const { return Float4(vreinterpretq_f32_u32(vcltq_f32(v, rhs.v))); }
+    Float4 operator<=(const Float4 & rhs) const { return Float4(vreinterpretq_f32_u32(vcleq_f32(v, rhs.v))); }
+    Float4 operator>(const Float4 & rhs) const { return Float4(vreinterpretq_f32_u32(vcgtq_f32(v, rhs.v))); }
+    Float4 operator==(const Float4 & rhs) const { return Float4(vreinterpretq_f32_u32(vceqq_f32(v, rhs.v))); }
+
+    int mask() const
+    {
+        uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(v), 31);
+        return vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1) |
+               (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3);
+    }
+
+    Float4 yzx() const { float r[4]; vst1q_f32(r, v); return Float4(r[1], r[2], r[0], r[3]); }
+    Float4 zxy() const { float r[4]; vst1q_f32(r, v); return Float4(r[2], r[0], r[1], r[3]); }
+
+    friend Float4 min(const Float4 & a, const Float4 & b) { return Float4(vminq_f32(a.v, b.v)); }
+    friend Float4 max(const Float4 & a, const Float4 & b) { return Float4(vmaxq_f32(a.v, b.v)); }
+    friend Float4 sqrt(const Float4 & a) { return Float4(vsqrtq_f32(a.v)); }
+#else
+    float v[4];
+
+    Float4() {}
+    explicit Float4(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+    Float4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+
+    static Float4 load(const float * p) { return Float4(p[0], p[1], p[2], p[3]); }
+    static Float4 loadUnaligned(const float * p) { return Float4(p[0], p[1], p[2], p[3]); }
+    void store(float * p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+
+    static Float4 fromBytes(const unsigned char * p) { return Float4(p[0], p[1], p[2], p[3]); }
+
+    float operator[](int i) const { return v[i]; }
+
+    Float4 operator+(const Float4 & rhs) const { return Float4(v[0] + rhs.v[0], v[1] + rhs.v[1], v[2] + rhs.v[2], v[3] + rhs.v[3]); }
+    Float4 operator-(const Float4 & rhs) const { return Float4(v[0] - rhs.v[0], v[1] - rhs.v[1], v[2] - rhs.v[2], v[3] - rhs.v[3]); }
+    Float4 operator*(const Float4 & rhs) const { return Float4(v[0] * rhs.v[0], v[1] * rhs.v[1], v[2] * rhs.v[2], v[3] * rhs.v[3]); }
+    Float4 operator/(const Float4 & rhs) const { return Float4(v[0] / rhs.v[0], v[1] / rhs.v[1], v[2] / rhs.v[2], v[3] / rhs.v[3]); }
+
+    // lane masks are stored as 1.0f / 0.0f in the fallback
+    Float4 operator<(const Float4 & rhs) const { return Float4(v[0] < rhs.v[0], v[1] < rhs.v[1], v[2] < rhs.v[2], v[3] < rhs.v[3]); }
+    Float4 operator<=(const Float4 & rhs) const { return Float4(v[0] <= rhs.v[0], v[1] <= rhs.v[1], v[2] <= rhs.v[2], v[3] <= rhs.v[3]); }
+    Float4 operator>(const Float4 & rhs) const { return Float4(v[0] > rhs.v[0], v[1] > rhs.v[1], v[2] > rhs.v[2], v[3] > rhs.v[3]); }
+    Float4 operator==(const Float4 & rhs) const { return Float4(v[0] == rhs.v[0], v[1] == rhs.v[1], v[2] == rhs.v[2], v[3] == rhs.v[3]); }
+
+    int mask() const { return (v[0] != 0.0f) | ((v[1] != 0.0f) << 1) | ((v[2] != 0.0f) << 2) | ((v[3] != 0.0f) << 3); }
+
+    Float4 yzx() const { return Float4(v[1], v[2], v[0], v[3]); }
+    Float4 zxy() const { return Float4(v[2], v[0], v[1], v[3]); }
+
+    friend Float4 min(const Float4 & a, const Float4 & b) { return Float4(a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1], a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3]); }
+    friend Float4 max(const Float4 & a, const Float4 & b) { return Float4(a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1], a.v[2] > b.v[2] ? a.v[2] : b.v[2], a.v[3] > b.v[3] ? a.v[3] : b.v[3]); }
+    friend Float4 sqrt(const Float4 & a) { return Float4(std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3])); }
+#endif
+
+    // x + y + z in this order, w is ignored
+    float sum3() const { return (*this)[0] + (*this)[1] + (*this)[2]; }
+};
+
+// 8 lanes, used for structure-of-arrays batches (8 lights, 8 triangles, ...)
+// comparisons return all-ones / all-zeros lane masks usable by select
+struct Float8
+{
+#if defined(SIMD_FLOAT8_AVX)
+    __m256 v;
+
+    Float8() {}
+    Float8(__m256 v) : v(v) {}
+    explicit Float8(float s) : v(_mm256_set1_ps(s)) {}
+
+    // p must be 32-byte aligned
+    static Float8 load(const float * p) { return Float8(_mm256_load_ps(p)); }
+    static Float8 loadUnaligned(const float * p) { return Float8(_mm256_loadu_ps(p)); }
+
+    // 8 unsigned bytes converted to float
+    static Float8 fromBytes(const unsigned char * p)
+    {
+        long long bytes;
+        memcpy(&bytes, p, 8);
+
+        __m128i packed = _mm_cvtsi64_si128(bytes);
+        __m128i low = _mm_cvtepu8_epi32(packed);
+        __m128i high = _mm_cvtepu8_epi32(_mm_srli_si128(packed, 4));
+
+        return Float8(_mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1)));
+    }
+    void store(float * p) const { _mm256_store_ps(p, v); }
+
+    Float8 operator+(const Float8 & rhs) const { return Float8(_mm256_add_ps(v, rhs.v)); }
+    Float8 operator-(const Float8 & rhs) const { return Float8(_mm256_sub_ps(v, rhs.v)); }
+    Float8 operator*(const Float8 & rhs) const { return Float8(_mm256_mul_ps(v, rhs.v)); }
+    Float8 operator/(const Float8 & rhs) const { return Float8(_mm256_div_ps(v, rhs.v)); }
+
+    Float8 operator<(const Float8 & rhs) const { return Float8(_mm256_cmp_ps(v, rhs.v, _CMP_LT_OQ)); }
+    Float8 operator<=(const Float8 & rhs) const { return Float8(_mm256_cmp_ps(v, rhs.v, _CMP_LE_OQ)); }
+    Float8 operator>(const Float8 & rhs) const { return Float8(_mm256_cmp_ps(v, rhs.v, _CMP_GT_OQ)); }
+    Float8 operator==(const Float8 & rhs) const { return Float8(_mm256_cmp_ps(v, rhs.v, _CMP_EQ_OQ)); }
+    Float8 operator&(const Float8 & rhs) const { return Float8(_mm256_and_ps(v, rhs.v)); }
+    Float8 operator|(const Float8 & rhs) const { return Float8(_mm256_or_ps(v, rhs.v)); }
+
+    // bit i is set if lane i of a mask is set
+    int mask() const { return _mm256_movemask_ps(v); }
+
+    friend Float8 min(const Float8 & a, const Float8 & b) { return Float8(_mm256_min_ps(a.v, b.v)); }
+    friend Float8 max(const Float8 & a, const Float8 & b) { return Float8(_mm256_max_ps(a.v, b.v)); }
+    friend Float8 sqrt(const Float8 & a) { return Float8(_mm256_sqrt_ps(a.v)); }
+
+    // mask ? a : b, lane by lane
+    friend Float8 select(const Float8 & mask, const Float8 & a, const Float8 & b) { return Float8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+#else
+    float v[8] __attribute__((aligned(32)));
+
+    Float8() {}
+    explicit Float8(float s) { for(int i = 0; i < 8; i++) v[i] = s; }
+
+    static Float8 load(const float * p) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+    static Float8 loadUnaligned(const float * p) { return load(p); }
+    static Float8 fromBytes(const unsigned char * p) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+    void store(float * p) const { for(int i = 0; i < 8; i++) p[i] = v[i]; }
+
+    Float8 operator+(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = v[i] + rhs.v[i]; return r; }
+    Float8 operator-(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = v[i] - rhs.v[i]; return r; }
+    Float8 operator*(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = v[i] * rhs.v[i]; return r; }
+    Float8 operator/(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = v[i] / rhs.v[i]; return r; }
+
+    Float8 operator<(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(v[i] < rhs.v[i]); return r; }
+    Float8 operator<=(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(v[i] <= rhs.v[i]); return r; }
+    Float8 operator>(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(v[i] > rhs.v[i]); return r; }
+    Float8 operator==(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(v[i] == rhs.v[i]); return r; }
+    Float8 operator&(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(isSet(v[i]) && isSet(rhs.v[i])); return r; }
+    Float8 operator|(const Float8 & rhs) const { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = fromBool(isSet(v[i]) || isSet(rhs.v[i])); return r; }
+
+    int mask() const { int m = 0; for(int i = 0; i < 8; i++) m |= isSet(v[i]) << i; return m; }
+
+    friend Float8 min(const Float8 & a, const Float8 & b) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+    friend Float8 max(const Float8 & a, const Float8 & b) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+    friend Float8 sqrt(const Float8 & a) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+
+    friend Float8 select(const Float8 & mask, const Float8 & a, const Float8 & b) { Float8 r; for(int i = 0; i < 8; i++) r.v[i] = isSet(mask.v[i]) ? a.v[i] : b.v[i]; return r; }
+
+    private:
+        // lane masks are stored as 1.0f / 0.0f in the fallback
+        static float fromBool(bool b) { return b ? 1.0f : 0.0f; }
+        static bool isSet(float f) { return f != 0.0f; }
+#endif
+};
+
+#endif
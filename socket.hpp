@@ -0,0 +1,38 @@
+#ifndef __SOCKET_H__
+#define __SOCKET_H__
+
+#include <cstddef>
+#include <string>
+
+// Unix domain stream sockets for the render server and its client
+
+// listens at path, replacing a socket file left behind by an earlier server;
+// .. throws if the socket cannot be created
+int listenUnixSocket(const std::string & path);
+
+// throws if nothing listens at path
+int connectUnixSocket(const std::string & path);
+
+// false once the peer has gone away, never raises SIGPIPE
+bool sendAll(int socket, const void * data, size_t size);
+
+// buffered reads of newline terminated lines and of raw bytes from one socket
+class SocketReader
+{
+    private:
+        int socket;
+        std::string buffer;
+
+        bool fill();
+
+    public:
+        SocketReader(int socket) : socket(socket) {}
+
+        // without the newline, false at the end of the stream
+        bool readLine(std::string & line);
+
+        // false if the stream ends before size bytes
+        bool read(void * data, size_t size);
+};
+
+#endif
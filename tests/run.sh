@@ -0,0 +1,29 @@
+#!/bin/sh
+# renders scene pairs that must come out the same and compares the images
+# .. usage: tests/run.sh [raytracer]
+
+raytracer=$(cd "$(dirname "${1:-./raytracer}")" && pwd)/$(basename "${1:-./raytracer}")
+tests=$(cd "$(dirname "$0")" && pwd)
+output=$(mktemp -d)
+failed=0
+
+trap 'rm -rf "$output"' EXIT
+
+# expect <name> <scene> <image> <scene> <image>
+expect()
+{
+    (cd "$output" && "$raytracer" "$tests/$2" > /dev/null && "$raytracer" "$tests/$4" > /dev/null) || { echo "FAIL $1: cannot render"; failed=1; return; }
+
+    if cmp -s "$output/$3" "$output/$5"
+    then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: $3 and $5 differ"
+        failed=1
+    fi
+}
+
+# a sphere keyed with its own transformations is where the loader puts it
+expect sphere_key sphere_static.xml sphere_static.ppm sphere_keyed.xml sphere_keyed_0000.ppm
+
+exit $failed
@@ -0,0 +1,220 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads taking tasks from one queue
+// a thread waiting for its tasks (TaskGroup::wait) runs queued tasks itself
+// .. meanwhile, so tasks may spawn and wait for other tasks without deadlocking
+class ThreadPool
+{
+    private:
+        std::vector<std::thread> workers;
+        std::deque< std::function<void()> > tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::condition_variable progress;   // a task was queued or a group finished, for TaskGroup::wait
+        bool stopping;
+
+        ThreadPool(const ThreadPool &);
+        ThreadPool & operator=(const ThreadPool &);
+
+        void workerLoop()
+        {
+            while(true)
+            {
+                std::function<void()> task;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    while(!stopping && tasks.empty())
+                        condition.wait(lock);
+
+                    if(stopping && tasks.empty())
+                        return;
+
+                    task = tasks.front();
+                    tasks.pop_front();
+                }
+
+                task();
+            }
+        }
+
+    public:
+        // threadCount counts the calling thread too, so threadCount - 1 workers
+        // .. are started; 0 means one thread per hardware thread
+        ThreadPool(int threadCount = 0)
+            : stopping(false)
+        {
+            if(threadCount <= 0)
+                threadCount = getHardwareThreadCount();
+
+            for(int i = 1; i < threadCount; i++)
+                workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            condition.notify_all();
+
+            for(size_t i = 0; i < workers.size(); i++)
+                workers[i].join();
+        }
+
+        static int getHardwareThreadCount()
+        {
+            int count = std::thread::hardware_concurrency();
+
+            return count > 0 ? count : 1;
+        }
+
+        // workers plus the calling thread
+        int getThreadCount() const
+        {
+            return workers.size() + 1;
+        }
+
+        void submit(const std::function<void()> & task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(task);
+            }
+
+            condition.notify_one();
+            progress.notify_all();
+        }
+
+        // counts a task of a group done; under the mutex, so that a waiter
+        // .. cannot miss the group finishing between its check and its wait
+        void finishTask(std::atomic<int> & pending)
+        {
+            bool finished;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = --pending == 0;
+            }
+
+            if(finished)
+                progress.notify_all();
+        }
+
+        // blocks until a task is queued or pending is 0
+        void waitForProgress(const std::atomic<int> & pending)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while(pending > 0 && tasks.empty())
+                progress.wait(lock);
+        }
+
+        // runs one queued task on the calling thread, false if there was none
+        bool runPendingTask()
+        {
+            std::function<void()> task;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if(tasks.empty())
+                    return false;
+
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            task();
+
+            return true;
+        }
+};
+
+// a set of tasks that can be waited for together
+class TaskGroup
+{
+    private:
+        ThreadPool & pool;
+        std::atomic<int> pending;
+
+        TaskGroup(const TaskGroup &);
+        TaskGroup & operator=(const TaskGroup &);
+
+    public:
+        TaskGroup(ThreadPool & pool)
+            : pool(pool), pending(0) {}
+
+        ~TaskGroup()
+        {
+            wait();
+        }
+
+        void run(const std::function<void()> & task)
+        {
+            pending++;
+
+            std::atomic<int> & counter = pending;
+            ThreadPool & taskPool = pool;
+
+            pool.submit([task, &counter, &taskPool]() {
+                task();
+                taskPool.finishTask(counter);
+            });
+        }
+
+        // helps with queued tasks (of any group) until all tasks of this
+        // .. group are done, sleeping while there are none to help with
+        void wait()
+        {
+            while(pending > 0)
+            {
+                if(!pool.runPendingTask())
+                    pool.waitForProgress(pending);
+            }
+        }
+};
+
+// calls body(chunkBegin, chunkEnd) on chunks of at most grainSize indices,
+// .. spread over the pool, returns when all chunks are done
+template<class Body>
+void parallelFor(ThreadPool & pool, int begin, int end, int grainSize, const Body & body)
+{
+    if(grainSize < 1)
+        grainSize = 1;
+
+    if(end - begin <= grainSize || pool.getThreadCount() == 1)
+    {
+        if(begin < end)
+            body(begin, end);
+
+        return;
+    }
+
+    TaskGroup group(pool);
+
+    for(int chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize)
+    {
+        int chunkEnd = chunkBegin + grainSize < end ? chunkBegin + grainSize : end;
+
+        group.run([&body, chunkBegin, chunkEnd]() {
+            body(chunkBegin, chunkEnd);
+        });
+    }
+
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __VISIBILITY_H__
+#define __VISIBILITY_H__
+
+#include "geometry.hpp"
+#include <vector>
+
+// the surface each pixel of a camera sees first, found by rasterizing the
+// .. triangles instead of tracing the primary rays (see
+// .. Scene::rasterizeVisibility); shading repeats the ray test of that
+// .. surface alone, so the hit is the one the tracer finds
+// the spheres go through the same depth test, each by the ray tests of the
+// .. pixels its screen bounds cover
+class VisibilityBuffer
+{
+    private:
+        int width, height;
+        int triangleCount;
+        std::vector<int> primitives;    // of pixel (x, y) at y * width + x: a triangle, triangleCount + a sphere, -1: none
+        std::vector<float> depths;      // of its hit along the gaze, infinite if there is none
+
+    public:
+        VisibilityBuffer(int width, int height, int triangleCount);
+
+        int getWidth() const
+        {
+            return this->width;
+        }
+
+        int getHeight() const
+        {
+            return this->height;
+        }
+
+        int getPrimitive(int x, int y) const
+        {
+            return this->primitives[y * this->width + x];
+        }
+
+        float getDepth(int x, int y) const
+        {
+            return this->depths[y * this->width + x];
+        }
+
+        // false if the pixel sees no surface
+        bool getSurface(int x, int y, SurfaceRef & surface) const
+        {
+            int primitive = this->getPrimitive(x, y);
+
+            surface.type = primitive < this->triangleCount ? triangle_surface : sphere_surface;
+            surface.index = primitive < this->triangleCount ? primitive : primitive - this->triangleCount;
+
+            return primitive >= 0;
+        }
+
+        void set(int x, int y, int primitive, float depth)
+        {
+            this->primitives[y * this->width + x] = primitive;
+            this->depths[y * this->width + x] = depth;
+        }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __WATCHER_H__
+#define __WATCHER_H__
+
+#include "scene.hpp"
+#include "threadpool.hpp"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+// raytracer <scene.xml> --watch renders the scene, then waits for the scene
+// .. file or one of its textures to be saved and renders it again
+// the scene file is compared section by section with what was loaded: edits
+// .. of the background, epsilon, recursion depth, cameras, lights or
+// .. materials are read into the loaded scene, anything else loads the file
+// .. again; a saved texture is decoded again by itself
+// every render first writes a preview, one ray for each 4 x 4 pixels of the
+// .. tiles the edit reached, then renders those tiles in full (see
+// .. Scene::renderIncremental)
+class SceneWatcher
+{
+    private:
+        std::string path;
+        const Scene & settings;     // accelerator choice, build options and threads of every load
+        std::unique_ptr<Scene> scene;
+        ThreadPool pool;
+
+        // the hash of each top level element of the scene file as loaded
+        std::map<std::string, unsigned long long> sections;
+
+        int inotify;
+        std::map<int, std::string> directories;     // watch descriptor to the directory watched
+
+        // loads the scene file into a new scene, the old one stays if it fails
+        bool load();
+
+        // reads what changed since the scene file was loaded, loading it
+        // .. again if that is more than reload can read; false if nothing
+        // .. changed or it cannot be read
+        bool reload();
+
+        // decodes the textures of the image file again, false if the scene has none of it
+        bool reloadTexture(const std::string & file);
+
+        void watchDirectories();
+
+        // the files saved since the last call, as absolute paths, waiting
+        // .. until there is one and then until saving has calmed down
+        std::set<std::string> waitForChanges();
+
+        // since: when the edit was noticed, the times printed are from then
+        void render(std::chrono::steady_clock::time_point since);
+
+    public:
+        SceneWatcher(const std::string & path, const Scene & settings);
+        ~SceneWatcher();
+
+        // renders, then renders again after every edit, until killed; throws
+        // .. if the first load fails
+        void run();
+};
+
+#endif